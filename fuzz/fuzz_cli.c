@@ -14,7 +14,7 @@
  *
  * The fuzzer input is treated as a sequence of null-delimited strings that
  * become argv entries. No file I/O occurs — parseArgs() only populates the
- * Context struct.
+ * Options struct.
  *
  * Build:  CC=clang cmake -B build_fuzz -DFUZZ=ON && cmake --build build_fuzz
  * Run:    ./build_fuzz/fuzz/fuzz_cli corpus_cli/ -max_len=4096 -timeout=5
@@ -128,19 +128,17 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
     }
 
     /* Call parseArgs() — exit() calls are caught by longjmp.
-     * fuzz_active is set BEFORE newContext() so that even an OOM inside
-     * newContext() is caught by longjmp rather than killing the process. */
-    /* volatile: ctx is modified between setjmp and longjmp.  Without
-     * volatile the compiler may keep it in a register that longjmp
-     * restores to its pre-setjmp value (NULL), skipping all cleanup. */
-    Context * volatile ctx = NULL;
+     * The options live on the stack, so an interrupted parse leaves
+     * nothing to clean up. */
+    Options opts;
+    memset(&opts, 0, sizeof(opts));
+    t2szInitOptions(&opts.t2sz);
     bool overwrite = false;
 
     fuzz_active = 1;
     int jumped = setjmp(fuzz_jmp);
     if (jumped == 0) {
-        ctx = newContext();
-        parseArgs(argc, argv, ctx, &overwrite);
+        parseArgs(argc, argv, &opts, &overwrite);
     }
     fuzz_active = 0;
 
@@ -158,8 +156,7 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
         close(saved_stderr);
     }
 
-    /* Cleanup — ctx may be NULL if newContext() triggered longjmp. */
-    free(ctx);
+    /* Cleanup. */
     free(argv);
     free(copy);
 
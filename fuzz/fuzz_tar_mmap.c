@@ -3,8 +3,8 @@
 /**
  * fuzz_tar_mmap — libFuzzer harness for the mmap tar-parsing code path.
  *
- * Exercises compressFile() in tar mode with a memory-mapped input buffer
- * pointing directly at the fuzzer's data. Output is discarded to /dev/null.
+ * Exercises t2szCompressBuffer() in tar mode with the input buffer pointing
+ * directly at the fuzzer's data. Output goes to a sink that discards it.
  *
  * A custom mutator recalculates tar header checksums after each mutation,
  * allowing the fuzzer to efficiently explore code paths past the checksum
@@ -14,50 +14,13 @@
  * Run:    ./build_fuzz/fuzz/fuzz_tar_mmap corpus_mmap/ -max_len=65536 -timeout=10
  */
 
-/* T2SZ_NO_MAIN and VERSION are provided via -D flags in CMakeLists.txt. */
-#include "../src/t2sz.c"
-
-#include <setjmp.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <stdio.h>
-#include <dlfcn.h>
+/* Including the library source keeps its static functions visible to the
+ * sanitizer/coverage instrumentation of this translation unit. */
+#include "../src/libt2sz.c"
 
 /* libFuzzer provides this symbol at link time; declare it for the compiler. */
 extern size_t LLVMFuzzerMutate(uint8_t *data, size_t size, size_t max_size);
 
-/* ── setjmp/longjmp trap for exit() ─────────────────────────────────────────
- *
- * compressFile() calls exit(EXIT_FAILURE) on parse errors and compression
- * failures. In a normal process this is fine, but inside a libFuzzer harness
- * it would kill the fuzzer. We override exit() to longjmp back to the
- * harness's recovery point, allowing cleanup and the next iteration.
- *
- * We resolve the real libc exit() via dlsym(RTLD_NEXT) so that when
- * fuzz_active is false (e.g. libFuzzer shutdown), atexit handlers and
- * stdio buffers are flushed properly — preserving the summary report.
- *
- * Leaks from interrupted code paths are expected and harmless — run with
- * -detect_leaks=0 to suppress LSAN noise.
- */
-static jmp_buf fuzz_jmp;
-static volatile int fuzz_active = 0;
-
-static void (*real_exit)(int);
-
-__attribute__((constructor))
-static void init_real_exit(void) {
-    real_exit = (void (*)(int))dlsym(RTLD_NEXT, "exit");
-}
-
-void exit(int status) {
-    if (fuzz_active)
-        longjmp(fuzz_jmp, status ? status : 1);
-    if (real_exit)
-        real_exit(status);
-    _exit(status);
-}
-
 /* ── Custom mutator: checksum-aware tar header repair ───────────────────────
  *
  * Without this, the probability of a random mutation producing a valid tar
@@ -100,78 +63,28 @@ size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size,
 
 /* ── Harness entry point ────────────────────────────────────────────────────*/
 
+static int discard(void *opaque, const void *buf, size_t len) {
+    (void)opaque; (void)buf; (void)len;
+    return 0;
+}
+
 int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
     /* A tar header is 512 bytes; anything smaller cannot reach the parser. */
     if (size < 512) return 0;
 
-    /* Suppress stderr noise from t2sz error messages. */
-    int saved_stderr = dup(STDERR_FILENO);
-    int devnull_err = open("/dev/null", O_WRONLY);
-    if (devnull_err >= 0) {
-        dup2(devnull_err, STDERR_FILENO);
-        close(devnull_err);
-    }
-
-    /* Redirect stdout to /dev/null so compressed output is discarded. */
-    int saved_stdout = dup(STDOUT_FILENO);
-    int devnull = open("/dev/null", O_WRONLY);
-    if (devnull >= 0) {
-        dup2(devnull, STDOUT_FILENO);
-        close(devnull);
-    }
-
-    /* Run the full mmap tar compression pipeline.
-     * fuzz_active is set BEFORE newContext() so that even an OOM inside
-     * newContext() is caught by longjmp rather than killing the process.
-     * compressFile() internally calls prepareOutput() and prepareCctx(),
-     * so we do NOT call them here (that would leak the first allocation). */
-    /* volatile: ctx is modified between setjmp and longjmp.  Without
-     * volatile the compiler may keep it in a register that longjmp
-     * restores to its pre-setjmp value (NULL), skipping all cleanup. */
-    Context * volatile ctx = NULL;
-
-    fuzz_active = 1;
-    int jumped = setjmp(fuzz_jmp);
-    if (jumped == 0) {
-        ctx = newContext();
-        ctx->rawMode    = false;
-        ctx->stdinMode  = false;
-        ctx->stdoutMode = true;   /* write compressed output to stdout */
-        ctx->level      = 1;      /* fastest compression level */
-        ctx->verbose    = false;
-
-        /* Point the input buffer directly at the fuzzer's data (read-only). */
-        ctx->inBuff     = (uint8_t *)data;
-        ctx->inBuffSize = size;
-
-        compressFile(ctx);
-    }
-    fuzz_active = 0;
-
-    /* Flush stdio buffers BEFORE restoring fds to the terminal so that
-     * any compressed bytes buffered by a longjmp-interrupted write go to
-     * /dev/null, not the user's console. */
-    fflush(stdout);
-    fflush(stderr);
-
-    if (saved_stdout >= 0) {
-        dup2(saved_stdout, STDOUT_FILENO);
-        close(saved_stdout);
-    }
-    if (saved_stderr >= 0) {
-        dup2(saved_stderr, STDERR_FILENO);
-        close(saved_stderr);
-    }
-
-    /* Cleanup — must handle partial state from interrupted exit().
-     * ctx may be NULL if newContext() triggered longjmp. */
-    if (ctx) {
-        if (ctx->cctx)    ZSTD_freeCCtx(ctx->cctx);
-        if (ctx->outBuff) free(ctx->outBuff);
-        if (ctx->seekTable) free(ctx->seekTable);
-        if (ctx->outFile && ctx->outFile != stdout) fclose(ctx->outFile);
-        free(ctx);
+    /* The library reports errors as return codes, so an invalid archive
+     * simply ends the iteration; nothing to trap or redirect. */
+    T2szContext *ctx = t2szCreate();
+    if (!ctx) return 0;
+
+    T2szOptions opts;
+    t2szInitOptions(&opts);
+    opts.level      = 1;      /* fastest compression level */
+    opts.buildIndex = true;   /* also parse GNU/PAX long names */
+    if (t2szSetOptions(ctx, &opts) == T2SZ_OK) {
+        t2szCompressBuffer(ctx, data, size, discard, NULL);
     }
 
+    t2szFree(ctx);
     return 0;
 }
@@ -3,8 +3,10 @@
 /**
  * fuzz_tar_stdin — libFuzzer harness for the stdin tar-parsing code path.
  *
- * Exercises compressStdinTar() by replacing stdin with a memory-backed FILE*
- * (fmemopen) pointing at the fuzzer's data. Output is discarded to /dev/null.
+ * Exercises compressStreamTar() through t2szCompressStream(), with a read
+ * callback serving the fuzzer's data in small, uneven chunks so that
+ * headers and payloads straddle reads. Output goes to a sink that
+ * discards it.
  *
  * A custom mutator recalculates tar header checksums after each mutation,
  * allowing the fuzzer to efficiently explore code paths past the checksum
@@ -14,42 +16,13 @@
  * Run:    ./build_fuzz/fuzz/fuzz_tar_stdin corpus_stdin/ -max_len=65536 -timeout=10
  */
 
-/* T2SZ_NO_MAIN and VERSION are provided via -D flags in CMakeLists.txt. */
-#include "../src/t2sz.c"
-
-#include <setjmp.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <stdio.h>
-#include <dlfcn.h>
+/* Including the library source keeps its static functions visible to the
+ * sanitizer/coverage instrumentation of this translation unit. */
+#include "../src/libt2sz.c"
 
 /* libFuzzer provides this symbol at link time; declare it for the compiler. */
 extern size_t LLVMFuzzerMutate(uint8_t *data, size_t size, size_t max_size);
 
-/* ── setjmp/longjmp trap for exit() ─────────────────────────────────────────
- *
- * We resolve the real libc exit() via dlsym(RTLD_NEXT) so that when
- * fuzz_active is false (e.g. libFuzzer shutdown), atexit handlers and
- * stdio buffers are flushed properly — preserving the summary report.
- */
-static jmp_buf fuzz_jmp;
-static volatile int fuzz_active = 0;
-
-static void (*real_exit)(int);
-
-__attribute__((constructor))
-static void init_real_exit(void) {
-    real_exit = (void (*)(int))dlsym(RTLD_NEXT, "exit");
-}
-
-void exit(int status) {
-    if (fuzz_active)
-        longjmp(fuzz_jmp, status ? status : 1);
-    if (real_exit)
-        real_exit(status);
-    _exit(status);
-}
-
 /* ── Custom mutator: checksum-aware tar header repair ───────────────────────*/
 static void fix_tar_checksum(uint8_t *data, size_t size) {
     if (size < 512) return;
@@ -81,90 +54,41 @@ size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size,
 
 /* ── Harness entry point ────────────────────────────────────────────────────*/
 
-int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
-    if (size == 0) return 0;
-
-    /* Replace stdin with a memory-backed FILE* containing the fuzz input.
-     * fmemopen() is POSIX.1-2008, available on Linux and macOS 10.13+. */
-    FILE *mem = fmemopen((void *)data, size, "rb");
-    if (!mem) return 0;
-    FILE *saved_stdin = stdin;
-    stdin = mem;
-
-    /* Suppress stderr noise. */
-    int saved_stderr = dup(STDERR_FILENO);
-    int devnull_err = open("/dev/null", O_WRONLY);
-    if (devnull_err >= 0) {
-        dup2(devnull_err, STDERR_FILENO);
-        close(devnull_err);
-    }
-
-    /* Redirect stdout to /dev/null. */
-    int saved_stdout = dup(STDOUT_FILENO);
-    int devnull = open("/dev/null", O_WRONLY);
-    if (devnull >= 0) {
-        dup2(devnull, STDOUT_FILENO);
-        close(devnull);
-    }
-
-    /* Build a Context for the stdin tar path.
-     * fuzz_active is set BEFORE newContext() so that even an OOM inside
-     * newContext() is caught by longjmp rather than killing the process. */
-    /* volatile: ctx is modified between setjmp and longjmp.  Without
-     * volatile the compiler may keep it in a register that longjmp
-     * restores to its pre-setjmp value (NULL), skipping all cleanup. */
-    Context * volatile ctx = NULL;
-
-    fuzz_active = 1;
-    int jumped = setjmp(fuzz_jmp);
-    if (jumped == 0) {
-        ctx = newContext();
-        ctx->rawMode    = false;
-        ctx->stdinMode  = true;
-        ctx->stdoutMode = true;
-        ctx->level      = 1;
-        ctx->verbose    = false;
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} FuzzSource;
+
+static ptrdiff_t fuzzRead(void *opaque, void *buf, size_t len) {
+    FuzzSource *src = opaque;
+    size_t n = src->size - src->pos;
+    if (n > len) n = len;
+    if (n > 1000) n = 1000;   /* force short reads */
+    memcpy(buf, src->data + src->pos, n);
+    src->pos += n;
+    return (ptrdiff_t)n;
+}
 
-        prepareOutput(ctx);
-        prepareCctx(ctx);
-        compressStdinTar(ctx);
-        /* Normal completion: write seek table and clean up. */
-        if (!ctx->skipSeekTable)
-            writeSeekTable(ctx);
-        if (ctx->cctx) ZSTD_freeCCtx(ctx->cctx);
-        ctx->cctx = NULL;
-        free(ctx->outBuff);
-        ctx->outBuff = NULL;
-    }
-    fuzz_active = 0;
+static int discard(void *opaque, const void *buf, size_t len) {
+    (void)opaque; (void)buf; (void)len;
+    return 0;
+}
 
-    /* Restore stdin, stdout, stderr.
-     * Flush stdio buffers BEFORE restoring the fd to the terminal so that
-     * any compressed bytes buffered by a longjmp-interrupted write go to
-     * /dev/null, not the user's console. */
-    stdin = saved_stdin;
-    fclose(mem);
-    fflush(stdout);
-    fflush(stderr);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size == 0) return 0;
 
-    if (saved_stdout >= 0) {
-        dup2(saved_stdout, STDOUT_FILENO);
-        close(saved_stdout);
-    }
-    if (saved_stderr >= 0) {
-        dup2(saved_stderr, STDERR_FILENO);
-        close(saved_stderr);
-    }
+    T2szContext *ctx = t2szCreate();
+    if (!ctx) return 0;
 
-    /* Cleanup — handle partial state from interrupted exit().
-     * ctx may be NULL if newContext() triggered longjmp. */
-    if (ctx) {
-        if (ctx->cctx)    ZSTD_freeCCtx(ctx->cctx);
-        if (ctx->outBuff) free(ctx->outBuff);
-        if (ctx->seekTable) free(ctx->seekTable);
-        if (ctx->outFile && ctx->outFile != stdout) fclose(ctx->outFile);
-        free(ctx);
+    T2szOptions opts;
+    t2szInitOptions(&opts);
+    opts.level = 1;
+    if (t2szSetOptions(ctx, &opts) == T2SZ_OK) {
+        FuzzSource src = { data, size, 0 };
+        t2szCompressStream(ctx, fuzzRead, &src, discard, NULL);
     }
 
+    t2szFree(ctx);
     return 0;
 }
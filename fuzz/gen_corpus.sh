@@ -142,6 +142,15 @@ if [ -n "$CLI_DIR" ]; then
 
     # 15. Large numeric value for strtol edge cases
     printf '%s\0%s\0%s\0' "-s" "999999999999999999" "file.tar" > "$CLI_DIR/cli_huge_num.bin"
+
+    # 16. Trained dictionary size
+    printf '%s\0%s\0%s\0' "-D" "112k" "file.tar" > "$CLI_DIR/cli_dict.bin"
+
+    # 17. Single member extraction
+    printf '%s\0%s\0%s\0%s\0%s\0' "-x" "dir/file.txt" "-o" "-" "file.tar.zst" > "$CLI_DIR/cli_extract.bin"
+
+    # 18. Member index
+    printf '%s\0%s\0' "-i" "file.tar" > "$CLI_DIR/cli_index.bin"
 fi
 
 echo "Seed corpus generated:"
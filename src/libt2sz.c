@@ -0,0 +1,5730 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* ******************************************************************
+ * t2sz
+ * Copyright (c) 2020, Martinelli Marco
+ *
+ * You can contact the author at :
+ * - Email: marco+t2sz@13byte.com
+ * - Source repository : https://github.com/martinellimarco/t2sz
+ *
+ * This source code is licensed under the GPLv3 (found in the LICENSE
+ * file in the root directory of this source tree).
+****************************************************************** */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <zstd.h>
+#include <zdict.h>
+#include "t2sz.h"
+
+typedef struct __attribute__((__packed__)) { /* byte offset */
+    char name[100];               /*   0 */
+    char mode[8];                 /* 100 */
+    char uid[8];                  /* 108 */
+    char gid[8];                  /* 116 */
+    char size[12];                /* 124 */
+    char mtime[12];               /* 136 */
+    char chksum[8];               /* 148 */
+    char typeflag;                /* 156 */
+    char linkname[100];           /* 157 */
+    char magic[6];                /* 257 */
+    char version[2];              /* 263 */
+    char uname[32];               /* 265 */
+    char gname[32];               /* 297 */
+    char devmajor[8];             /* 329 */
+    char devminor[8];             /* 337 */
+    char prefix[155];             /* 345 */
+    /* 500 */
+} TarHeader;
+
+/* ── Tar block kernels ─────────────────────────────────────────────────────
+ *
+ * Every 512-byte header is checksummed, and blocks that are not headers are
+ * tested for zeros, by the planner, the stream framing and the archive
+ * reader alike: with millions of tiny members this shows at fast levels.
+ * tarKernelsSelect() picks the widest implementation the CPU runs, once per
+ * process (t2szCreate()): AVX2 when the compiler can target it and cpuid
+ * reports it, else SSE2 on x86 builds that assume it, NEON on AArch64, and
+ * the byte loops everywhere else. Every kernel returns exactly what the
+ * scalar one does; tests/bench_tar_block.c checks and times them.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TAR_KERNELS_AVX2 1
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TAR_KERNELS_SSE2 1
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TAR_KERNELS_NEON 1
+#endif
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_KERNELS_MAX 3   //scalar, then at most two vector kernels
+
+typedef struct {
+    const char *name;
+    uint32_t (*sum)(const uint8_t *block);  //sum of the TAR_BLOCK_SIZE bytes
+    bool (*isZero)(const uint8_t *block);   //all TAR_BLOCK_SIZE bytes are 0
+} TarKernels;
+
+/* Reference kernels, one byte at a time. */
+static uint32_t tarSumScalar(const uint8_t *block){
+    uint32_t sum = 0;
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i++){
+        sum += block[i];
+    }
+    return sum;
+}
+
+static bool tarIsZeroScalar(const uint8_t *block){
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i++){
+        if(block[i] != 0) return false;
+    }
+    return true;
+}
+
+static const TarKernels tarKernelsScalar = { "scalar", tarSumScalar, tarIsZeroScalar };
+
+#ifdef TAR_KERNELS_SSE2
+/* _mm_sad_epu8() against zero adds up 8 bytes into each 64-bit lane. */
+static uint32_t tarSumSse2(const uint8_t *block){
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i += 16){
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(block + i)), zero));
+    }
+    return (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+}
+
+/* 64 bytes at a time, so that a header is rejected after its first line. */
+static bool tarIsZeroSse2(const uint8_t *block){
+    const __m128i zero = _mm_setzero_si128();
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i += 64){
+        const __m128i *p = (const __m128i*)(block + i);
+        const __m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                                       _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) return false;
+    }
+    return true;
+}
+
+static const TarKernels tarKernelsSse2 = { "sse2", tarSumSse2, tarIsZeroSse2 };
+#endif
+
+#ifdef TAR_KERNELS_AVX2
+__attribute__((target("avx2")))
+static uint32_t tarSumAvx2(const uint8_t *block){
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i += 32){
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(block + i)), zero));
+    }
+    const __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    return (uint32_t)_mm_cvtsi128_si32(half) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+}
+
+__attribute__((target("avx2")))
+static bool tarIsZeroAvx2(const uint8_t *block){
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i += 128){
+        const __m256i *p = (const __m256i*)(block + i);
+        const __m256i v = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+                                          _mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+        if(!_mm256_testz_si256(v, v)) return false;
+    }
+    return true;
+}
+
+static const TarKernels tarKernelsAvx2 = { "avx2", tarSumAvx2, tarIsZeroAvx2 };
+#endif
+
+#ifdef TAR_KERNELS_NEON
+/* Pairwise widening adds: each 16-bit lane takes at most 64 bytes, 16320. */
+static uint32_t tarSumNeon(const uint8_t *block){
+    uint16x8_t acc = vdupq_n_u16(0);
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i += 16){
+        acc = vpadalq_u8(acc, vld1q_u8(block + i));
+    }
+    return vaddlvq_u16(acc);
+}
+
+static bool tarIsZeroNeon(const uint8_t *block){
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i += 64){
+        const uint8x16_t v = vorrq_u8(vorrq_u8(vld1q_u8(block + i), vld1q_u8(block + i + 16)),
+                                      vorrq_u8(vld1q_u8(block + i + 32), vld1q_u8(block + i + 48)));
+        if(vmaxvq_u8(v) != 0) return false;
+    }
+    return true;
+}
+
+static const TarKernels tarKernelsNeon = { "neon", tarSumNeon, tarIsZeroNeon };
+#endif
+
+/**
+ * List the kernels this CPU can run.
+ *
+ * @param list  Filled with the kernels, scalar first, widest last.
+ * @return      Their number, at least 1.
+ */
+static size_t tarKernelsSupported(const TarKernels *list[TAR_KERNELS_MAX]){
+    size_t n = 0;
+    list[n++] = &tarKernelsScalar;
+#ifdef TAR_KERNELS_SSE2
+    list[n++] = &tarKernelsSse2;
+#endif
+#ifdef TAR_KERNELS_NEON
+    list[n++] = &tarKernelsNeon;
+#endif
+#ifdef TAR_KERNELS_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        list[n++] = &tarKernelsAvx2;
+    }
+#endif
+    return n;
+}
+
+static const TarKernels *tarKernels = &tarKernelsScalar;
+static pthread_once_t tarKernelsOnce = PTHREAD_ONCE_INIT;
+
+/** Point tarKernels at the widest kernel the CPU runs. */
+static void tarKernelsSelect(void){
+    const TarKernels *list[TAR_KERNELS_MAX];
+    tarKernels = list[tarKernelsSupported(list) - 1];
+}
+
+/**
+ * Compute the POSIX tar header checksum.
+ *
+ * Sums all 512 bytes of the header, treating the 8-byte chksum field
+ * (offset 148-155) as ASCII spaces (0x20) per the POSIX spec. The block
+ * is summed by the selected kernel, then the field is swapped for spaces.
+ *
+ * @param header  Pointer to a 512-byte tar header block.
+ * @return        The unsigned 32-bit checksum value.
+ */
+static uint32_t checksum(const TarHeader* header){
+    const uint8_t* ptr = (const uint8_t*)header;
+    uint32_t field = 0;
+    for(size_t i = 0; i < sizeof(header->chksum); i++){
+        field += (uint8_t)header->chksum[i];
+    }
+    return tarKernels->sum(ptr) - field + 8*0x20;//8 ASCII spaces
+}
+
+/**
+ * Read the checksum stored in a tar header.
+ *
+ * Extracts the 6-byte octal string from header->chksum and converts it
+ * with strtoul.
+ *
+ * @param header  Pointer to the tar header.
+ * @return        The stored checksum.
+ */
+static uint32_t storedChecksum(const TarHeader* header){
+    char buf[7];
+    memcpy(buf, header->chksum, 6);
+    buf[6] = 0;
+    return (uint32_t)strtoul(buf, NULL, 8);
+}
+
+/**
+ * Validate a tar header by comparing its stored checksum against the
+ * computed one.
+ *
+ * @param header  Pointer to the tar header to validate.
+ * @return        true if the checksum matches, false otherwise.
+ */
+static bool isTarHeader(const TarHeader* header){
+    return checksum(header) == storedChecksum(header);
+}
+
+/**
+ * Whether a tar header only carries metadata for the member after it: a
+ * PAX extended ('x') or global ('g') header, or a GNU long name ('L') or
+ * long link name ('K'). The framing keeps these in the frame of the next
+ * member instead of closing a frame after them.
+ *
+ * @param header  Pointer to a valid tar header.
+ * @return        true for an extension header.
+ */
+static bool isTarExtension(const TarHeader* header){
+    return header->typeflag == 'x' || header->typeflag == 'g' ||
+           header->typeflag == 'L' || header->typeflag == 'K';
+}
+
+/**
+ * Safely parse the size field from a tar header.
+ *
+ * The size field is a fixed 12-byte array that is not guaranteed to be
+ * NUL-terminated for malformed inputs. This function copies it into a
+ * local buffer and NUL-terminates before calling strtoull, matching the
+ * defensive pattern already used in isTarHeader() for the checksum field.
+ * Sizes of 8 GiB and more do not fit 11 octal digits: GNU tar and star
+ * store them in base-256, a big-endian binary number flagged by the high
+ * bit of the first byte.
+ *
+ * @param header  Pointer to the tar header.
+ * @return        Parsed file size in bytes, SIZE_MAX if it does not fit a
+ *                size_t or is negative.
+ */
+static size_t parseTarSize(const TarHeader *header){
+    const uint8_t *field = (const uint8_t*)header->size;
+    if(field[0] & 0x80){
+        if(field[0] & 0x40){ //negative
+            return SIZE_MAX;
+        }
+        uint64_t size = field[0] & 0x3F;
+        for(size_t i = 1; i < sizeof(header->size); i++){
+            if(size > (SIZE_MAX >> 8)){
+                return SIZE_MAX;
+            }
+            size = size << 8 | field[i];
+        }
+        return size > SIZE_MAX ? SIZE_MAX : (size_t)size;
+    }
+    char buf[13];
+    memcpy(buf, header->size, 12);
+    buf[12] = '\0';
+    const unsigned long long size = strtoull(buf, NULL, 8);
+    return size > SIZE_MAX ? SIZE_MAX : (size_t)size;
+}
+
+#define TAR_SPARSE_HEADER_EXTENDED  482     /* GNU 'S' header: isextended */
+#define TAR_SPARSE_BLOCK_EXTENDED   504     /* sparse map extension block: isextended */
+#define TAR_LONG_NAME_MAX   ((size_t)4 << 20)   /* 'L'/'x' payloads read for a name, larger ones are ignored */
+
+/**
+ * Whether a sparse map extension block follows @p block.
+ *
+ * Old GNU sparse members ('S') hold the first four entries of their
+ * sparse map in the header; longer maps continue in 512-byte extension
+ * blocks between the header and the data, each flagged by the one before
+ * it. The size field only counts the data, so the extension blocks must
+ * be walked to find where the data starts.
+ *
+ * @param block   The tar header, or a sparse map extension block.
+ * @param header  true when @p block is the tar header.
+ * @return        true if an extension block follows.
+ */
+static bool tarSparseContinues(const uint8_t *block, const bool header){
+    if(header){
+        return ((const TarHeader*)block)->typeflag == 'S' && block[TAR_SPARSE_HEADER_EXTENDED] != 0;
+    }
+    return block[TAR_SPARSE_BLOCK_EXTENDED] != 0;
+}
+
+/**
+ * Strip leading "./" and "/" components so that "./dir/f", "/dir/f" and
+ * "dir/f" name the same member.
+ *
+ * @param name  A member name.
+ * @return      Pointer inside @p name past the stripped prefix.
+ */
+static const char* normalizeMemberName(const char *name){
+    while(true){
+        if(name[0] == '.' && name[1] == '/'){
+            name += 2;
+        }else if(name[0] == '/'){
+            name++;
+        }else{
+            return name;
+        }
+    }
+}
+
+/**
+ * Compare two member names after normalizeMemberName(), ignoring a
+ * trailing '/' (tar stores directories as "dir/").
+ *
+ * @param a  A member name.
+ * @param b  Another member name.
+ * @return   true if both name the same member.
+ */
+static bool memberNameEquals(const char *a, const char *b){
+    a = normalizeMemberName(a);
+    b = normalizeMemberName(b);
+    size_t la = strlen(a);
+    size_t lb = strlen(b);
+    if(la && a[la - 1] == '/'){
+        la--;
+    }
+    if(lb && b[lb - 1] == '/'){
+        lb--;
+    }
+    return la == lb && memcmp(a, b, la) == 0;
+}
+
+typedef struct {
+    uint32_t compressedSize;
+    uint32_t decompressedSize;
+} SeekTableEntry;
+
+typedef T2szFrame FramePlanEntry;
+
+typedef struct {
+    uint64_t dataOffset;    //offset of the first payload byte in the tar stream
+    uint64_t size;          //member size
+    uint32_t nameOffset;    //into the index name buffer
+    uint16_t nameLength;
+    char typeflag;
+    uint32_t frame;         //seek table entry holding dataOffset, set by indexResolveFrames()
+    uint32_t frameOffset;   //dataOffset relative to the start of that frame
+} IndexEntry;
+
+struct FramePool;
+struct Verifier;
+
+#define WARNING_KINDS 4     //T2szWarning flags
+
+struct T2szContext {
+    //options, see T2szOptions
+    uint8_t level;
+    size_t minBlockSize;
+    size_t maxBlockSize;
+    bool verbose;
+    bool rawMode;     //non-tar mode
+    bool buildIndex;  //write the member-name index frame (-i)
+    bool noSeekTable; //-j, skipSeekTable is reset to it before every archive
+    bool compressAll; //--compress-all, disables the incompressible fast path
+    bool noDecompress;  //--no-decompress, zstd-compressed input is compressed as is
+    bool verify;        //--verify, check the output on a verifier thread while compressing
+    uint32_t workers;
+
+    //automatic block sizes (--auto-block), buffer input only; see autoBlockSizes()
+    size_t autoMaxRead;     //largest frame allowed, 0 for no bound
+    double autoRatioLoss;   //percent of the solid ratio that may be lost, 0 for the default
+    bool autoBlock;         //either is set: minBlockSize and maxBlockSize are chosen per call
+
+    //content-defined chunking (--cdc), raw mode only; see cdcSetup()
+    size_t cdcAverage;      //0 for fixed-size frames
+    size_t cdcMin;          //-s, or cdcAverage / 4
+    size_t cdcMax;          //-S, or cdcAverage * 4
+    uint64_t cdcMaskSmall;  //cut test below the average size
+    uint64_t cdcMaskLarge;  //cut test above it
+
+    //first failure of the current call, recorded by fail()
+    atomic_int error;
+    char errorMsg[512];
+
+    //T2szWarning flags of the current call, recorded by warn()
+    atomic_uint warnings;
+    char warningMsg[WARNING_KINDS][160];    //one per flag, by bit position
+
+    //input: a buffer (planned frames) or a read callback (streamed)
+    size_t inBuffSize;
+    const uint8_t* inBuff;
+    T2szReadFn readFn;
+    void* readOpaque;
+    uint8_t peek[4];        //first bytes of a callback input, see sniffZstdInput()
+    size_t peekLen;
+    size_t peekPos;         //readInput() serves peek[peekPos..peekLen) first
+
+    //output sink and staging buffer
+    T2szWriteFn writeFn;
+    void* writeOpaque;
+    size_t outBuffSize;
+    void* outBuff;
+
+    //compression context, kept across calls
+    ZSTD_CCtx* cctx;
+    ZSTD_CCtx* fastCctx;    //incompressible fast path, created on first use
+    atomic_uint_fast64_t fastFrames;    //frames that took the fast path
+
+    //dictionary (-D), trained from sampled frames of the plan
+    size_t dictCapacity;    //maximum dictionary size, 0 disables training
+    void* dictBuff;
+    size_t dictSize;
+    ZSTD_CDict* cdict;      //digested once, shared by every context
+
+    //frame plan, built by planFrames() for buffer inputs
+    FramePlanEntry* plan;
+    size_t planLen;
+    size_t planCap;
+    uint64_t planMembers;   //tar members seen by the planner
+
+    //member-name index (-i)
+    IndexEntry* index;
+    size_t indexLen;
+    size_t indexCap;
+    char* indexNames;
+    size_t indexNamesLen;
+    size_t indexNamesCap;
+    char* pendingName;      //GNU/PAX long name for the next member, NULL if none
+
+    //frame-parallel worker pool, NULL when frames are compressed serially
+    struct FramePool* pool;
+    uint64_t frameCount;    //frames closed by the producer so far
+
+    //output verification (--verify), NULL when off and between calls
+    struct Verifier* verifier;
+
+    //seek table
+    SeekTableEntry* seekTable;
+    size_t seekTableLen;
+    size_t seekTableCap;
+    bool skipSeekTable;
+
+    //append mode, set up by t2szAppendTo() for the next compression call
+    bool append;
+    bool appendIndexed;         //the archive has a member index, keep it up to date
+    uint64_t tarBase;           //tar offset of the new data (the old end of archive)
+    uint8_t* appendFrame;       //copy of the compressed frame holding the old end of archive
+    size_t appendFrameSize;
+    uint64_t appendTailSize;    //bytes of that frame before the end of archive
+
+    //checkpoints (--checkpoint), buffer inputs only
+    T2szCheckpointFn checkpointFn;  //NULL disables them
+    void* checkpointOpaque;
+    uint32_t checkpointInterval;    //minimum seconds between two checkpoints
+    struct timespec lastCheckpoint;
+    uint8_t* checkpointBuff;        //serialized state, reused
+    size_t checkpointCap;
+    uint64_t framesWritten;         //planned frames handed to the sink, resumed ones included
+    uint64_t outputBytes;           //bytes handed to the sink, resumed ones included
+    uint64_t planHash;              //of those frames, see checkpointHashFrame()
+    uint64_t sampleHash;
+
+    //input window (--input-window), buffer inputs only
+    size_t inputWindow;             //0 keeps the whole input
+    T2szReleaseFn releaseFn;
+    void* releaseOpaque;
+    uint64_t released;              //input released by the current pass
+
+    //statistics (--stats), reset by beginCall()
+    bool collectStats;
+    uint64_t statsStart;            //clock at the start of the call
+    uint64_t frameNs;               //libzstd time of the frame being written, see zstdStream()
+    T2szStats stats;
+    T2szFrameStats* frameStats;     //stats.frames
+    size_t frameStatsCap;
+    atomic_uint_fast64_t threadMemory;  //ZSTD_sizeof_CCtx() of the pool workers, and the decoder
+
+    //progress, read by t2szGetProgress() from any thread, reset by beginCall()
+    atomic_uint_fast64_t progressIn;    //input bytes compressed so far
+    atomic_uint_fast64_t progressOut;   //outputBytes
+    atomic_uint_fast64_t progressTotal; //input bytes of the call, 0 when unknown
+    atomic_uint_fast64_t progressResumed;   //input bytes already compressed (--resume)
+
+    //resuming (--resume), set up by t2szResume() for the next compression call
+    bool resume;
+    bool resumeSkipSeekTable;       //the interrupted call had given up its seek table
+    uint64_t resumeFrames;          //planned frames already in the output
+    uint64_t resumeOutputSize;      //bytes of output they take
+    uint64_t resumeInputSize;
+    uint64_t resumeOptionsHash;
+    uint64_t resumePlanHash;
+    uint64_t resumeSampleHash;
+};
+
+typedef struct T2szContext Context;
+
+/**
+ * Record a failure of the current call.
+ *
+ * Only the first failure is kept: the reader, the writer and the pool
+ * workers may all fail while the call unwinds, and the root cause is the
+ * one worth reporting. Every loop checks failed() and bails out, so once
+ * an error is set nothing more is written to the sink.
+ *
+ * @param ctx   The compression context.
+ * @param code  Error code returned by the public function.
+ * @param fmt   printf-style message, without the "ERROR: " prefix.
+ * @return      false, so that callers can `return fail(...)`.
+ */
+static bool fail(Context *ctx, const T2szError code, const char *fmt, ...){
+    int expected = T2SZ_OK;
+    if(atomic_compare_exchange_strong(&ctx->error, &expected, (int)code)){
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(ctx->errorMsg, sizeof(ctx->errorMsg), fmt, args);
+        va_end(args);
+    }
+    return false;
+}
+
+/**
+ * Record a condition the current call works around (T2szWarning).
+ *
+ * Nothing is printed: the caller reads the flags and messages back with
+ * t2szGetWarnings() and t2szWarningMessage(). Only the first message of
+ * each kind is kept.
+ *
+ * @param ctx      The compression context.
+ * @param warning  A single T2szWarning flag.
+ * @param fmt      printf-style message, without the "Warning: " prefix.
+ */
+static void warn(Context *ctx, const T2szWarning warning, const char *fmt, ...){
+    if(atomic_fetch_or(&ctx->warnings, (unsigned)warning) & (unsigned)warning){
+        return;
+    }
+    unsigned kind = 0;
+    while(!((unsigned)warning & (1u << kind))){
+        kind++;
+    }
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(ctx->warningMsg[kind], sizeof(ctx->warningMsg[kind]), fmt, args);
+    va_end(args);
+}
+
+/**
+ * Check whether the current call has failed.
+ *
+ * @param ctx  The compression context.
+ * @return     true once fail() has been called.
+ */
+static bool failed(Context *ctx){
+    return atomic_load(&ctx->error) != T2SZ_OK;
+}
+
+/**
+ * Report an invalid tar header, with the checksums that did not match.
+ *
+ * @param ctx     The compression context.
+ * @param header  The rejected header.
+ * @return        false.
+ */
+static bool failTarHeader(Context *ctx, const TarHeader *header){
+    return fail(ctx, T2SZ_ERROR_FORMAT,
+                "Invalid tar header (checksum 0x%08x, expected 0x%08x). "
+                "If this is not a tar archive use raw mode (-r)",
+                storedChecksum(header), checksum(header));
+}
+
+/**
+ * Extract the value of the "path" record from a PAX extended header.
+ *
+ * Records have the form "<len> <key>=<value>\n". The payload is not
+ * NUL-terminated: nothing is read past @p size.
+ *
+ * @param ctx   The context, for out of memory failures.
+ * @param data  The PAX header payload.
+ * @param size  Payload size.
+ * @return      A newly allocated copy of the path, or NULL if absent or
+ *              out of memory.
+ */
+static char* paxPath(Context *ctx, const char *data, const size_t size){
+    size_t off = 0;
+    while(off < size){
+        size_t len = 0, digits = 0;
+        while(digits < size - off && data[off + digits] >= '0' && data[off + digits] <= '9'){
+            if(len > (size - off) / 10){
+                return NULL;
+            }
+            len = len * 10 + (size_t)(data[off + digits] - '0');
+            digits++;
+        }
+        if(digits == 0 || digits == size - off || data[off + digits] != ' ' || len <= digits || len > size - off){
+            return NULL;
+        }
+        const char *key = data + off + digits + 1;
+        const char *recEnd = data + off + len;
+        if(recEnd - key > 5 && memcmp(key, "path=", 5) == 0){
+            const size_t valLen = (size_t)(recEnd - key - 5 - 1); //without the trailing '\n'
+            char *path = malloc(valLen + 1);
+            if(!path){
+                fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory reading a PAX header");
+                return NULL;
+            }
+            memcpy(path, key + 5, valLen);
+            path[valLen] = '\0';
+            return path;
+        }
+        off += len;
+    }
+    return NULL;
+}
+
+
+/* Compile-time endianness detection.  GCC/Clang define __BYTE_ORDER__
+ * and __ORDER_LITTLE_ENDIAN__; MSVC is always little-endian on supported
+ * architectures.  If none of the macros are available the runtime
+ * fallback is used (no volatile — the result is constant). */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
+#define IS_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#elif defined(_WIN32)
+#define IS_LITTLE_ENDIAN 1
+#else
+static inline bool isLittleEndian(void){
+    const int x = 1;
+    return *(const char*)(&x) == 1;
+}
+#define IS_LITTLE_ENDIAN isLittleEndian()
+#endif
+
+/**
+ * Write a 32-bit unsigned integer to memory in little-endian byte order.
+ *
+ * On little-endian hosts this is a straight memcpy; on big-endian hosts
+ * the bytes are swapped first.
+ *
+ * @param dst   Destination buffer (must hold at least 4 bytes).
+ * @param data  The value to store.
+ */
+static void writeLE32(void* dst, const uint32_t data){
+    if(IS_LITTLE_ENDIAN){
+        memcpy(dst, &data, sizeof(data));
+    }else{
+        const uint32_t swap = ((data & 0xFF000000) >> 24) |
+                        ((data & 0x00FF0000) >> 8)  |
+                        ((data & 0x0000FF00) << 8)  |
+                        ((data & 0x000000FF) << 24);
+        memcpy(dst, &swap, sizeof(swap));
+    }
+}
+
+/**
+ * Read a 32-bit unsigned integer stored in little-endian byte order.
+ *
+ * @param src  Source buffer (must hold at least 4 bytes).
+ * @return     The decoded value.
+ */
+static uint32_t readLE32(const void* src){
+    const uint8_t *b = src;
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+/* ── Statistics (--stats) ──────────────────────────────────────────────────
+ *
+ * With collectStats the call times what it waits on: the read callback,
+ * the tar headers, libzstd and the write callback, and records the sizes
+ * and compression time of every data frame as it reaches the seek table.
+ * Each total is only updated by one thread (the reader, the writer, or the
+ * writer on behalf of the pool workers), so no locking is needed. Without
+ * collectStats statsClock() returns 0 and nothing is measured.
+ */
+
+/**
+ * @param ctx  The compression context.
+ * @return     Monotonic clock in nanoseconds, or 0 when statistics are off.
+ */
+static uint64_t statsClock(const Context *ctx){
+    if(!ctx->collectStats){
+        return 0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Add the time elapsed since @p start to @p total.
+ *
+ * @param ctx    The compression context.
+ * @param total  The counter to update.
+ * @param start  A statsClock() reading, 0 when statistics are off.
+ */
+static void statsSince(const Context *ctx, uint64_t *total, const uint64_t start){
+    if(start){
+        *total += statsClock(ctx) - start;
+    }
+}
+
+/**
+ * Record a data frame, with the libzstd time gathered in ctx->frameNs.
+ *
+ * @param ctx               The compression context.
+ * @param compressedSize    Compressed size of the frame (bytes).
+ * @param decompressedSize  Decompressed size of the frame (bytes).
+ */
+static void statsFrame(Context *ctx, const uint64_t compressedSize, const uint64_t decompressedSize){
+    const uint64_t ns = ctx->frameNs;
+    ctx->frameNs = 0;
+    if(!ctx->collectStats){
+        return;
+    }
+    if(ctx->stats.nbFrames == ctx->frameStatsCap){
+        const size_t cap = ctx->frameStatsCap ? ctx->frameStatsCap * 2 : 1024;
+        T2szFrameStats *frames = realloc(ctx->frameStats, cap * sizeof(T2szFrameStats));
+        if(!frames){
+            fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory growing frame statistics");
+            return;
+        }
+        ctx->frameStats = frames;
+        ctx->frameStatsCap = cap;
+        ctx->stats.frames = frames;
+    }
+    ctx->frameStats[ctx->stats.nbFrames++] = (T2szFrameStats){ decompressedSize, compressedSize, ns };
+    ctx->stats.compressNs += ns;
+    ctx->stats.inputBytes += decompressedSize;
+}
+
+/**
+ * Count @p n more input bytes as compressed, for t2szGetProgress().
+ * Only the thread that writes the output calls it, so a relaxed store is
+ * enough: readers just need a value that is not torn.
+ */
+static void progressInput(Context *ctx, const uint64_t n){
+    const uint64_t in = atomic_load_explicit(&ctx->progressIn, memory_order_relaxed);
+    atomic_store_explicit(&ctx->progressIn, in + n, memory_order_relaxed);
+}
+
+/* ── Input window (--input-window) ─────────────────────────────────────────
+ *
+ * A buffer input is read in up to three passes: planning (and the trials
+ * of automatic block sizes), dictionary sampling, then compression. Each
+ * pass walks it forward, and with inputWindow and releaseFn set it hands
+ * the caller every inputWindow bytes it is done with, so that the pages
+ * of a mapped file behind the cursor can be dropped. Only frames handed
+ * to the sink are released: with -T the frames being compressed stay.
+ */
+
+/**
+ * Release the input below @p cursor if a window of it has built up.
+ *
+ * @param ctx     The compression context.
+ * @param cursor  Offset below which the current pass is done with the input.
+ */
+static void releaseInput(Context *ctx, const uint64_t cursor){
+    if(!ctx->releaseFn || !ctx->inputWindow || cursor < ctx->released + ctx->inputWindow){
+        return;
+    }
+    ctx->releaseFn(ctx->releaseOpaque, ctx->released, cursor - ctx->released);
+    ctx->released = cursor;
+}
+
+/**
+ * End a pass: release the rest of the input, the next pass starts over.
+ *
+ * @param ctx  The compression context.
+ */
+static void releaseInputPass(Context *ctx){
+    if(ctx->releaseFn && ctx->inputWindow && ctx->released < ctx->inBuffSize){
+        ctx->releaseFn(ctx->releaseOpaque, ctx->released, ctx->inBuffSize - ctx->released);
+    }
+    ctx->released = 0;
+}
+
+/* ── Verification (--verify) ───────────────────────────────────────────────
+ *
+ * With verify, a verifier thread decompresses the output while the next
+ * frames are being compressed and compares it with the input, instead of
+ * a second pass over the archive. The writing thread queues two streams:
+ * every byte handed to the sink (writeOutput()), and the input as libzstd
+ * consumes it (zstdStream(), or a pool job when its frame is written),
+ * always before the output that depends on it. Input inside ctx->inBuff is
+ * queued by reference, since it stays mapped for the whole call. Input from
+ * the read callback, the pool staging buffers or the tail frame of an
+ * append is copied and retained until it has been checked. Small writes
+ * are gathered into chunks of VERIFY_CHUNK_SIZE bytes.
+ *
+ * The DCtx checks the content checksum of every frame and skips the
+ * skippable ones (dictionary, index, seek table). The first mismatch fails
+ * the call with T2SZ_ERROR_VERIFY, and the writer stops at its next
+ * failed() check. When more than VERIFY_BACKLOG bytes are retained while
+ * output is waiting to be checked, the writer waits for the verifier to
+ * catch up, so memory stays bounded when verification is the slower side.
+ */
+
+#define VERIFY_CHUNK_SIZE   ((size_t)256 << 10)
+#define VERIFY_BACKLOG      ((size_t)64 << 20)
+
+typedef struct VerifyChunk {
+    struct VerifyChunk* next;
+    const uint8_t* data;    //copy, or a range of ctx->inBuff
+    size_t len;
+    size_t cap;             //bytes of copy, 0 for a reference
+    uint8_t copy[];
+} VerifyChunk;
+
+typedef struct {
+    VerifyChunk* head;      //oldest published chunk, consumed by the verifier
+    VerifyChunk* tail;
+    VerifyChunk* staging;   //copy being filled by the writer, not published yet
+} VerifyQueue;
+
+typedef struct Verifier {
+    Context* ctx;
+    VerifyQueue output;     //bytes handed to the sink
+    VerifyQueue input;      //input consumed by libzstd
+    size_t retained;        //bytes of published copies not checked yet
+    bool done;              //the writer has published everything
+    bool exited;            //the verifier thread has returned
+
+    //verifier thread only
+    ZSTD_DCtx* dctx;
+    size_t inputPos;        //bytes of input.head already compared
+    bool inFrame;           //a frame has started and not ended yet
+    uint64_t frameBytes;    //bytes it has decompressed to so far
+    uint64_t frame;         //seek table number of the frame being checked
+    uint64_t frameOffset;   //its output offset
+    uint64_t offset;        //output offset of the next byte to decompress
+    uint64_t dataFrames;    //zstd frames checked
+    uint64_t ns;            //--stats: time spent decompressing and comparing
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed; //a chunk was published or checked, or done or exited changed
+} Verifier;
+
+/**
+ * Hand a chunk to the verifier. Output is only published after the input
+ * staged before it, so that the verifier always finds the input a frame
+ * decompresses to.
+ *
+ * @param v      The verifier.
+ * @param q      v->output or v->input.
+ * @param chunk  The chunk, owned by the verifier from now on.
+ */
+static void verifyPublish(Verifier *v, VerifyQueue *q, VerifyChunk *chunk){
+    if(q == &v->output && v->input.staging){
+        VerifyChunk *staged = v->input.staging;
+        v->input.staging = NULL;
+        verifyPublish(v, &v->input, staged);
+    }
+    pthread_mutex_lock(&v->mutex);
+    if(q->tail){
+        q->tail->next = chunk;
+    }else{
+        q->head = chunk;
+    }
+    q->tail = chunk;
+    if(chunk->cap){
+        v->retained += chunk->len;
+    }
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->mutex);
+}
+
+/**
+ * Publish the staging chunk of @p q, if it holds anything.
+ *
+ * @param v  The verifier.
+ * @param q  v->output or v->input.
+ */
+static void verifyFlush(Verifier *v, VerifyQueue *q){
+    VerifyChunk *staged = q->staging;
+    if(staged){
+        q->staging = NULL;
+        verifyPublish(v, q, staged);
+    }
+}
+
+/**
+ * Queue @p len bytes for the verifier: by reference when they lie in the
+ * mapped input, else copied into the staging chunk of @p q.
+ *
+ * @param ctx  The compression context, with a verifier.
+ * @param q    Its output or input queue.
+ * @param src  The bytes.
+ * @param len  Their number.
+ */
+static void verifyQueue(Context *ctx, VerifyQueue *q, const uint8_t *src, size_t len){
+    Verifier *v = ctx->verifier;
+    const uintptr_t p = (uintptr_t)src;
+    const uintptr_t base = (uintptr_t)ctx->inBuff;
+    if(ctx->inBuff && p >= base && p - base <= ctx->inBuffSize && len <= ctx->inBuffSize - (p - base)){
+        VerifyChunk *chunk = malloc(sizeof(VerifyChunk));
+        if(!chunk){
+            fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory queuing data for verification");
+            return;
+        }
+        *chunk = (VerifyChunk){ NULL, src, len, 0 };
+        verifyFlush(v, q);
+        verifyPublish(v, q, chunk);
+        return;
+    }
+    while(len){
+        VerifyChunk *chunk = q->staging;
+        if(!chunk){
+            const size_t cap = len > VERIFY_CHUNK_SIZE ? len : VERIFY_CHUNK_SIZE;
+            chunk = malloc(sizeof(VerifyChunk) + cap);
+            if(!chunk){
+                fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory queuing data for verification");
+                return;
+            }
+            *chunk = (VerifyChunk){ NULL, NULL, 0, cap };
+            chunk->data = chunk->copy;
+            q->staging = chunk;
+        }
+        const size_t n = len < chunk->cap - chunk->len ? len : chunk->cap - chunk->len;
+        memcpy(chunk->copy + chunk->len, src, n);
+        chunk->len += n;
+        src += n;
+        len -= n;
+        if(chunk->len == chunk->cap){
+            verifyFlush(v, q);
+        }
+    }
+}
+
+/**
+ * Queue input consumed by libzstd, see verifyQueue(). No-op without
+ * --verify.
+ */
+static void verifyInput(Context *ctx, const uint8_t *src, const size_t len){
+    if(ctx->verifier && len && !failed(ctx)){
+        verifyQueue(ctx, &ctx->verifier->input, src, len);
+    }
+}
+
+/**
+ * Queue bytes handed to the sink, see verifyQueue(), then wait if the
+ * verifier has fallen VERIFY_BACKLOG bytes behind. No-op without --verify.
+ */
+static void verifyOutput(Context *ctx, const uint8_t *buf, const size_t len){
+    Verifier *v = ctx->verifier;
+    if(!v || failed(ctx)){
+        return;
+    }
+    verifyQueue(ctx, &v->output, buf, len);
+    pthread_mutex_lock(&v->mutex);
+    while(v->retained > VERIFY_BACKLOG && v->output.head && !v->exited){
+        pthread_cond_wait(&v->changed, &v->mutex);
+    }
+    pthread_mutex_unlock(&v->mutex);
+}
+
+/**
+ * Wait until the verifier has checked everything written so far, e.g.
+ * before a checkpoint records it as done. No-op without --verify.
+ *
+ * @param ctx  The compression context.
+ */
+static void verifySync(Context *ctx){
+    Verifier *v = ctx->verifier;
+    if(!v){
+        return;
+    }
+    verifyFlush(v, &v->output);
+    pthread_mutex_lock(&v->mutex);
+    while(v->output.head && !v->exited){
+        pthread_cond_wait(&v->changed, &v->mutex);
+    }
+    pthread_mutex_unlock(&v->mutex);
+}
+
+/**
+ * Remove the oldest chunk of @p q, once checked.
+ *
+ * @param v  The verifier.
+ * @param q  v->output or v->input.
+ */
+static void verifyRelease(Verifier *v, VerifyQueue *q){
+    pthread_mutex_lock(&v->mutex);
+    VerifyChunk *chunk = q->head;
+    q->head = chunk->next;
+    if(!q->head){
+        q->tail = NULL;
+    }
+    if(chunk->cap){
+        v->retained -= chunk->len;
+    }
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->mutex);
+    free(chunk);
+}
+
+/**
+ * Compare decompressed output with the next bytes of the input queue.
+ *
+ * @param v    The verifier.
+ * @param buf  Decompressed bytes.
+ * @param n    Their number.
+ * @return     false on a mismatch (the call is failed).
+ */
+static bool verifyCompare(Verifier *v, const uint8_t *buf, size_t n){
+    while(n){
+        pthread_mutex_lock(&v->mutex);
+        VerifyChunk *chunk = v->input.head;
+        pthread_mutex_unlock(&v->mutex);
+        if(!chunk){
+            return fail(v->ctx, T2SZ_ERROR_VERIFY, "Verification failed: frame %" PRIu64 " at offset %" PRIu64
+                        " decompresses to more data than its input", v->frame, v->frameOffset);
+        }
+        const size_t left = chunk->len - v->inputPos;
+        const size_t m = n < left ? n : left;
+        if(memcmp(chunk->data + v->inputPos, buf, m) != 0){
+            return fail(v->ctx, T2SZ_ERROR_VERIFY, "Verification failed: frame %" PRIu64 " at offset %" PRIu64
+                        " does not decompress to its input", v->frame, v->frameOffset);
+        }
+        v->inputPos += m;
+        buf += m;
+        n -= m;
+        if(v->inputPos == chunk->len){
+            verifyRelease(v, &v->input);
+            v->inputPos = 0;
+        }
+    }
+    return true;
+}
+
+/**
+ * Decompress one output chunk and compare it with the input.
+ *
+ * @param v      The verifier.
+ * @param chunk  The oldest chunk of v->output.
+ * @param buf    Output buffer of @p cap bytes.
+ * @param cap    ZSTD_DStreamOutSize().
+ */
+static void verifyChunk(Verifier *v, const VerifyChunk *chunk, uint8_t *buf, const size_t cap){
+    Context *ctx = v->ctx;
+    ZSTD_inBuffer in = { chunk->data, chunk->len, 0 };
+    while(!failed(ctx)){
+        ZSTD_outBuffer out = { buf, cap, 0 };
+        const size_t inPos = in.pos;
+        const size_t ret = ZSTD_decompressStream(v->dctx, &out, &in);
+        if(ZSTD_isError(ret)){
+            fail(ctx, T2SZ_ERROR_VERIFY, "Verification failed: frame %" PRIu64 " at offset %" PRIu64 ": %s",
+                 v->frame, v->frameOffset, ZSTD_getErrorName(ret));
+            return;
+        }
+        v->offset += in.pos - inPos;
+        if(in.pos != inPos || out.pos){
+            v->inFrame = true;
+        }
+        if(out.pos && !verifyCompare(v, buf, out.pos)){
+            return;
+        }
+        v->frameBytes += out.pos;
+        if(ret == 0 && v->inFrame){
+            v->dataFrames += v->frameBytes != 0;
+            v->frameBytes = 0;
+            v->inFrame = false;
+            v->frame++;
+            v->frameOffset = v->offset;
+        }
+        if(in.pos == in.size && out.pos < out.size){
+            return;
+        }
+    }
+}
+
+/**
+ * Verifier thread: check output chunks as they are published until the
+ * writer is done, then make sure that the output ends with a complete
+ * frame and that no input is left over.
+ *
+ * @param arg  The verifier.
+ * @return     NULL.
+ */
+static void* verifyThread(void *arg){
+    Verifier *v = arg;
+    Context *ctx = v->ctx;
+    const size_t cap = ZSTD_DStreamOutSize();
+    uint8_t *buf = malloc(cap);
+    if(!buf){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating the verification buffer");
+    }
+    while(buf && !failed(ctx)){
+        pthread_mutex_lock(&v->mutex);
+        while(!v->output.head && !v->done){
+            pthread_cond_wait(&v->changed, &v->mutex);
+        }
+        VerifyChunk *chunk = v->output.head;
+        pthread_mutex_unlock(&v->mutex);
+        if(!chunk){
+            if(v->inFrame){
+                fail(ctx, T2SZ_ERROR_VERIFY, "Verification failed: frame %" PRIu64 " at offset %" PRIu64
+                     " is truncated", v->frame, v->frameOffset);
+            }else if(v->input.head){
+                fail(ctx, T2SZ_ERROR_VERIFY, "Verification failed: the output ends before the input");
+            }
+            break;
+        }
+        const uint64_t start = statsClock(ctx);
+        verifyChunk(v, chunk, buf, cap);
+        statsSince(ctx, &v->ns, start);
+        verifyRelease(v, &v->output);
+    }
+    free(buf);
+
+    pthread_mutex_lock(&v->mutex);
+    v->exited = true;
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->mutex);
+    return NULL;
+}
+
+/**
+ * Start verifying the output of the current call, with --verify. Call
+ * once the dictionary, if any, is known and before the first frame.
+ *
+ * @param ctx  The compression context.
+ * @return     false on failure (the call is failed).
+ */
+static bool verifyStart(Context *ctx){
+    if(!ctx->verify){
+        return true;
+    }
+    Verifier *v = calloc(1, sizeof(Verifier));
+    if(!v){
+        return fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory starting the verifier");
+    }
+    v->ctx = ctx;
+    v->frame = ctx->seekTableLen;
+    v->frameOffset = v->offset = ctx->outputBytes;
+    v->dctx = ZSTD_createDCtx();
+    if(!v->dctx){
+        free(v);
+        return fail(ctx, T2SZ_ERROR_ZSTD, "Cannot create ZSTD DCtx");
+    }
+    if(ctx->dictBuff && ZSTD_isError(ZSTD_DCtx_loadDictionary(v->dctx, ctx->dictBuff, ctx->dictSize))){
+        ZSTD_freeDCtx(v->dctx);
+        free(v);
+        return fail(ctx, T2SZ_ERROR_ZSTD, "Cannot load the dictionary for verification");
+    }
+    pthread_mutex_init(&v->mutex, NULL);
+    pthread_cond_init(&v->changed, NULL);
+    if(pthread_create(&v->thread, NULL, verifyThread, v) != 0){
+        pthread_cond_destroy(&v->changed);
+        pthread_mutex_destroy(&v->mutex);
+        ZSTD_freeDCtx(v->dctx);
+        free(v);
+        return fail(ctx, T2SZ_ERROR_THREAD, "Cannot create verifier thread");
+    }
+    ctx->verifier = v;
+    return true;
+}
+
+/**
+ * Free every chunk of @p q, published or staged.
+ *
+ * @param q  A queue of a verifier whose thread has returned.
+ */
+static void verifyFreeQueue(VerifyQueue *q){
+    while(q->head){
+        VerifyChunk *next = q->head->next;
+        free(q->head);
+        q->head = next;
+    }
+    free(q->staging);
+}
+
+/**
+ * Hand the rest of the output to the verifier, wait for it and release
+ * it. Called once nothing more will be written, the seek table included.
+ * No-op without --verify.
+ *
+ * @param ctx  The compression context.
+ */
+static void verifyFinish(Context *ctx){
+    Verifier *v = ctx->verifier;
+    if(!v){
+        return;
+    }
+    if(!failed(ctx)){
+        verifyFlush(v, &v->input);
+        verifyFlush(v, &v->output);
+    }
+    pthread_mutex_lock(&v->mutex);
+    v->done = true;
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->mutex);
+    pthread_join(v->thread, NULL);
+
+    if(ctx->verbose && !failed(ctx)){
+        fprintf(stderr, "# %" PRIu64 " frames verified\n", v->dataFrames);
+    }
+    ctx->stats.verifyNs = v->ns;
+    atomic_fetch_add(&ctx->threadMemory, ZSTD_sizeof_DCtx(v->dctx));
+    ZSTD_freeDCtx(v->dctx);
+    verifyFreeQueue(&v->output);
+    verifyFreeQueue(&v->input);
+    pthread_cond_destroy(&v->changed);
+    pthread_mutex_destroy(&v->mutex);
+    free(v);
+    ctx->verifier = NULL;
+}
+
+/**
+ * ZSTD_compressStream2(), timed into ctx->frameNs, with the input it
+ * consumes counted as progress and queued for verification.
+ *
+ * @return  The result of ZSTD_compressStream2().
+ */
+static size_t zstdStream(Context *ctx, ZSTD_CCtx *cctx, ZSTD_outBuffer *output, ZSTD_inBuffer *input,
+                         const ZSTD_EndDirective mode){
+    const uint64_t start = statsClock(ctx);
+    const size_t pos = input->pos;
+    const size_t ret = ZSTD_compressStream2(cctx, output, input, mode);
+    statsSince(ctx, &ctx->frameNs, start);
+    progressInput(ctx, input->pos - pos);
+    verifyInput(ctx, (const uint8_t*)input->src + pos, input->pos - pos);
+    return ret;
+}
+
+/**
+ * Pass @p len bytes to the output sink.
+ *
+ * Once the call has failed nothing more reaches the sink, so a failed
+ * call never adds bytes after the point of failure.
+ *
+ * @param ctx  The compression context (reads writeFn, writeOpaque).
+ * @param buf  Source buffer.
+ * @param len  Number of bytes to write.
+ * @return     Number of bytes written: @p len on success, 0 on failure.
+ */
+static size_t writeOutput(Context *ctx, const void *buf, const size_t len){
+    if(len == 0 || failed(ctx)) return 0;
+    const uint64_t start = statsClock(ctx);
+    const int ret = ctx->writeFn(ctx->writeOpaque, buf, len);
+    statsSince(ctx, &ctx->stats.outputNs, start);
+    if(ret != 0){
+        fail(ctx, T2SZ_ERROR_WRITE, "Failed to write output");
+        return 0;
+    }
+    ctx->outputBytes += len;
+    atomic_store_explicit(&ctx->progressOut, ctx->outputBytes, memory_order_relaxed);
+    verifyOutput(ctx, buf, len);
+    return len;
+}
+
+/**
+ * Append the zstd seekable-format seek table to the output file.
+ *
+ * Writes a Skippable frame (magic 0x184D2A5E | 0xE) containing:
+ *   - one (compressedSize, decompressedSize) pair per frame,
+ *   - a footer with Number_Of_Frames, Seek_Table_Descriptor (0),
+ *     and Seekable_Magic_Number (0x8F92EAB1).
+ *
+ * All multi-byte fields are written in little-endian order.
+ * In verbose mode, the per-frame sizes are printed to stderr.
+ *
+ * @param ctx  The compression context (reads seekTable, seekTableLen,
+ *             verbose).
+ */
+static void writeSeekTable(Context *ctx){
+    uint8_t buf[4];
+    //Skippable_Magic_Number
+    writeLE32(buf, ZSTD_MAGIC_SKIPPABLE_START | 0xE);
+    writeOutput(ctx, buf, 4);
+
+    //Frame_Size
+    writeLE32(buf, (uint32_t)ctx->seekTableLen*8 + 9);
+    writeOutput(ctx, buf, 4);
+        
+    if(ctx->verbose){
+        fprintf(stderr, "\n---- seek table ----\n");
+        fprintf(stderr, "decompressed\tcompressed\n");
+    }
+
+    //Seek_Table_Entries
+    for(size_t i = 0; i < ctx->seekTableLen; i++){
+        const SeekTableEntry* e = &ctx->seekTable[i];
+
+        //Compressed_Size
+        writeLE32(buf, e->compressedSize);
+        writeOutput(ctx, buf, 4);
+
+        //Decompressed_Size
+        writeLE32(buf, e->decompressedSize);
+        writeOutput(ctx, buf, 4);
+
+        if(ctx->verbose){
+            fprintf(stderr, "%u\t%u\n", e->decompressedSize, e->compressedSize);
+        }
+    }
+
+    //Seek_Table_Footer
+    //Number_Of_Frames
+    writeLE32(buf, (uint32_t)ctx->seekTableLen);
+    writeOutput(ctx, buf, 4);
+
+    //Seek_Table_Descriptor
+    buf[0] = 0;
+    writeOutput(ctx, buf, 1);
+
+    //Seekable_Magic_Number
+    writeLE32(buf, 0x8F92EAB1);
+    writeOutput(ctx, buf, 4);
+}
+
+/**
+ * Ensure the seek table array has room for at least @p needed entries.
+ *
+ * Doubles the capacity (starting from 1024) until it meets the
+ * requirement, then reallocates.
+ *
+ * @param ctx     The compression context owning the seek table.
+ * @param needed  Minimum number of entries required.
+ * @return        false when out of memory.
+ */
+static bool seekTableEnsureCap(Context* ctx, const size_t needed) {
+    if(ctx->seekTableCap >= needed) {
+        return true;
+    }
+
+    size_t newCap = ctx->seekTableCap ? ctx->seekTableCap : 1024; // start cap
+    while(newCap < needed) {
+        newCap *= 2;
+    }
+
+    SeekTableEntry* p = realloc(ctx->seekTable, newCap * sizeof(SeekTableEntry));
+    if(!p){
+        return fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory while growing seek table");
+    }
+    ctx->seekTable = p;
+    ctx->seekTableCap = newCap;
+    return true;
+}
+
+/**
+ * Record a compressed frame in the seek table.
+ *
+ * Silently becomes a no-op if the seek table has been disabled (by -j
+ * or by overflow guards). The statistics of data frames are recorded
+ * either way. Disables the table and raises T2SZ_WARNING_SEEK_TABLE if
+ * the frame count or sizes exceed the seekable-format uint32 limits.
+ *
+ * @param ctx               The compression context.
+ * @param compressedSize    Compressed size of the frame (bytes).
+ * @param decompressedSize  Decompressed size of the frame (bytes).
+ */
+static void seekTableAdd(Context* ctx, const uint64_t compressedSize, const uint64_t decompressedSize){
+    if(decompressedSize){
+        statsFrame(ctx, compressedSize, decompressedSize);
+    }
+    if(ctx->skipSeekTable){
+        return;
+    }
+
+    // entry size uint32 + numFrames uint32
+    if(ctx->seekTableLen + 1 >= 0x8000000U){
+        ctx->skipSeekTable = true;
+        warn(ctx, T2SZ_WARNING_SEEK_TABLE, "Too many frames. Unable to generate the seek table.");
+        return;
+    }
+    if(decompressedSize >= 0x80000000U){
+        ctx->skipSeekTable = true;
+        warn(ctx, T2SZ_WARNING_SEEK_TABLE, "Input frame too big. Unable to generate the seek table.");
+        return;
+    }
+    if(compressedSize >= 0x100000000ULL){
+        ctx->skipSeekTable = true;
+        warn(ctx, T2SZ_WARNING_SEEK_TABLE, "Compressed frame too big. Unable to generate the seek table.");
+        return;
+    }
+
+    if(!seekTableEnsureCap(ctx, ctx->seekTableLen + 1)){
+        return;
+    }
+
+    ctx->seekTable[ctx->seekTableLen].compressedSize   = (uint32_t)compressedSize;
+    ctx->seekTable[ctx->seekTableLen].decompressedSize = (uint32_t)decompressedSize;
+    ctx->seekTableLen++;
+}
+
+/* ── Member-name index (-i) ────────────────────────────────────────────────
+ *
+ * While the tar headers are scanned for framing, every member is recorded
+ * with its name, size, type and payload offset. At the end the offsets are
+ * resolved to (seek table frame, offset inside the frame) and the entries
+ * are written, sorted by name, in a skippable frame placed right before the
+ * seek table:
+ *
+ *   Skippable_Magic_Number  u32  0x184D2A5C
+ *   Frame_Size              u32
+ *   Index_Magic             u32  INDEX_MAGIC ("T2SI")
+ *   Number_Of_Members       u32
+ *   Entries                 32 bytes each, sorted by name (bytewise):
+ *     Frame_Index   u32   seek table entry holding the first payload byte
+ *     Frame_Offset  u32   offset of that byte inside the frame
+ *     Data_Offset   u64   offset of that byte in the tar stream
+ *     Member_Size   u64
+ *     Name_Offset   u32   into Names
+ *     Name_Length   u16
+ *     Type_Flag     u8    tar typeflag
+ *     Reserved      u8    0
+ *   Names                   concatenated names, not NUL-terminated
+ *
+ * Names are normalized with normalizeMemberName() and lose any trailing
+ * '/'. The frame is recorded in the seek table with a decompressed size of
+ * 0, like the dictionary frame, so frame offsets stay exact.
+ */
+
+#define INDEX_MAGIC       0x49533254U  //"T2SI"
+#define INDEX_ENTRY_SIZE  32
+
+/**
+ * Write a 64-bit unsigned integer to memory in little-endian byte order.
+ *
+ * @param dst   Destination buffer (must hold at least 8 bytes).
+ * @param data  The value to store.
+ */
+static void writeLE64(void* dst, const uint64_t data){
+    writeLE32(dst, (uint32_t)data);
+    writeLE32((uint8_t*)dst + 4, (uint32_t)(data >> 32));
+}
+
+/**
+ * @return  Whether the members of the current call are indexed: with -i,
+ *          or when appending to an archive that has an index (whatever
+ *          -i says, so that the index keeps covering the whole archive).
+ */
+static bool indexing(const Context *ctx){
+    return ctx->append ? ctx->appendIndexed : ctx->buildIndex;
+}
+
+/**
+ * Remember the name carried by a GNU long name ('L') or PAX ('x') header,
+ * to be used by the next indexed member.
+ *
+ * @param ctx       The compression context.
+ * @param typeflag  'L' or 'x'.
+ * @param data      The header payload.
+ * @param size      Payload size (unpadded).
+ */
+static void indexLongName(Context *ctx, const char typeflag, const uint8_t *data, const size_t size){
+    free(ctx->pendingName);
+    ctx->pendingName = NULL;
+    if(size > TAR_LONG_NAME_MAX){
+        return;     //not a name: the member keeps the one in its header
+    }
+    if(typeflag == 'x'){
+        ctx->pendingName = paxPath(ctx, (const char*)data, size);
+        return;
+    }
+    const size_t len = strnlen((const char*)data, size);
+    ctx->pendingName = malloc(len + 1);
+    if(!ctx->pendingName){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory while growing member index");
+        return;
+    }
+    memcpy(ctx->pendingName, data, len);
+    ctx->pendingName[len] = '\0';
+}
+
+/**
+ * Record a tar member in the index.
+ *
+ * The name is the pending long name, if any, otherwise the ustar prefix
+ * and name fields. Members whose name does not fit the 16-bit length field
+ * are left out.
+ *
+ * @param ctx         The compression context.
+ * @param header      The member header.
+ * @param size        Member size.
+ * @param dataOffset  Offset of the first payload byte in the tar stream,
+ *                    before an appended archive (see tarBase).
+ */
+static void indexAdd(Context *ctx, const TarHeader *header, const uint64_t size, const uint64_t dataOffset){
+    char field[257];
+    const char *name = ctx->pendingName;
+    if(!name){
+        if(memcmp(header->magic, "ustar", 6) == 0 && header->prefix[0]){ //POSIX ustar, not GNU
+            snprintf(field, sizeof(field), "%.155s/%.100s", header->prefix, header->name);
+        }else{
+            snprintf(field, sizeof(field), "%.100s", header->name);
+        }
+        name = field;
+    }
+    name = normalizeMemberName(name);
+    size_t len = strlen(name);
+    if(len && name[len - 1] == '/'){
+        len--;
+    }
+
+    bool fits = len <= UINT16_MAX;
+    if(fits && ctx->indexLen == ctx->indexCap){
+        const size_t newCap = ctx->indexCap ? ctx->indexCap * 2 : 1024;
+        IndexEntry *p = realloc(ctx->index, newCap * sizeof(IndexEntry));
+        if(p){
+            ctx->index = p;
+            ctx->indexCap = newCap;
+        }else{
+            fits = fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory while growing member index");
+        }
+    }
+    if(fits && ctx->indexNamesLen + len > ctx->indexNamesCap){
+        size_t newCap = ctx->indexNamesCap ? ctx->indexNamesCap : 65536;
+        while(newCap < ctx->indexNamesLen + len){
+            newCap *= 2;
+        }
+        char *p = realloc(ctx->indexNames, newCap);
+        if(p){
+            ctx->indexNames = p;
+            ctx->indexNamesCap = newCap;
+        }else{
+            fits = fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory while growing member index");
+        }
+    }
+
+    if(fits){
+        IndexEntry *e = &ctx->index[ctx->indexLen++];
+        e->dataOffset = ctx->tarBase + dataOffset;
+        e->size = size;
+        e->nameOffset = (uint32_t)ctx->indexNamesLen;
+        e->nameLength = (uint16_t)len;
+        e->typeflag = header->typeflag;
+        memcpy(ctx->indexNames + ctx->indexNamesLen, name, len);
+        ctx->indexNamesLen += len;
+    }
+
+    free(ctx->pendingName);
+    ctx->pendingName = NULL;
+}
+
+/**
+ * Map the payload offset of every indexed member to its seek table frame.
+ *
+ * Both lists are in stream order, so a single merge walk is enough. A
+ * payload starting exactly at a frame boundary belongs to the next frame
+ * with data; zero-size entries (dictionary) are never chosen.
+ *
+ * @param ctx  The compression context (reads seekTable; writes the frame
+ *             fields of index).
+ */
+static void indexResolveFrames(Context *ctx){
+    if(ctx->seekTableLen == 0){
+        return;
+    }
+    size_t f = 0;
+    uint64_t frameStart = 0;
+    for(size_t i = 0; i < ctx->indexLen; i++){
+        IndexEntry *e = &ctx->index[i];
+        while(f + 1 < ctx->seekTableLen &&
+              (ctx->seekTable[f].decompressedSize == 0 ||
+               e->dataOffset >= frameStart + ctx->seekTable[f].decompressedSize)){
+            frameStart += ctx->seekTable[f].decompressedSize;
+            f++;
+        }
+        e->frame = (uint32_t)f;
+        e->frameOffset = (uint32_t)(e->dataOffset - frameStart);
+    }
+}
+
+/**
+ * Order index entries by name, bytewise, then by position in the archive.
+ *
+ * @param names  The name buffer of the context.
+ * @param x      An IndexEntry.
+ * @param y      Another IndexEntry.
+ * @return       <0, 0 or >0 as for memcmp().
+ */
+static int indexCompare(const char *names, const IndexEntry *x, const IndexEntry *y){
+    const size_t n = x->nameLength < y->nameLength ? x->nameLength : y->nameLength;
+    const int c = memcmp(names + x->nameOffset, names + y->nameOffset, n);
+    if(c){
+        return c;
+    }
+    if(x->nameLength != y->nameLength){
+        return x->nameLength < y->nameLength ? -1 : 1;
+    }
+    return x->dataOffset < y->dataOffset ? -1 : (x->dataOffset > y->dataOffset);
+}
+
+/**
+ * Sort the index with indexCompare(). A bottom-up merge sort rather than
+ * qsort(), whose comparator can't be given the name buffer of the context
+ * without a global shared by every context.
+ *
+ * @param ctx  The compression context (index, indexNames).
+ * @return     false on out of memory (ctx has failed).
+ */
+static bool indexSort(Context *ctx){
+    const size_t n = ctx->indexLen;
+    if(n < 2){
+        return true;
+    }
+    IndexEntry *tmp = malloc(n * sizeof(IndexEntry));
+    if(!tmp){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory sorting the member index");
+        return false;
+    }
+    IndexEntry *src = ctx->index, *dst = tmp;
+    for(size_t width = 1; width < n; width *= 2){
+        for(size_t lo = 0; lo < n; lo += 2 * width){
+            const size_t mid = lo + width < n ? lo + width : n;
+            const size_t hi = mid + width < n ? mid + width : n;
+            size_t i = lo, j = mid, k = lo;
+            while(i < mid && j < hi){
+                dst[k++] = indexCompare(ctx->indexNames, &src[j], &src[i]) < 0 ? src[j++] : src[i++];
+            }
+            while(i < mid){
+                dst[k++] = src[i++];
+            }
+            while(j < hi){
+                dst[k++] = src[j++];
+            }
+        }
+        IndexEntry *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if(src != ctx->index){
+        memcpy(ctx->index, src, n * sizeof(IndexEntry));
+    }
+    free(tmp);
+    return true;
+}
+
+/**
+ * Write the member-name index frame and record it in the seek table.
+ *
+ * Must be called after the last data frame and before writeSeekTable().
+ * Raises T2SZ_WARNING_INDEX and writes nothing if the index does not fit a
+ * skippable frame.
+ *
+ * @param ctx  The compression context (reads index, indexNames, seekTable).
+ */
+static void writeIndexFrame(Context *ctx){
+    const uint64_t frameSize = 8 + (uint64_t)ctx->indexLen * INDEX_ENTRY_SIZE + ctx->indexNamesLen;
+    if(frameSize > UINT32_MAX - 8){
+        warn(ctx, T2SZ_WARNING_INDEX, "Too many members. Unable to generate the member index.");
+        return;
+    }
+
+    indexResolveFrames(ctx);
+    if(!indexSort(ctx)){
+        return;
+    }
+
+    uint8_t buf[INDEX_ENTRY_SIZE];
+    //Skippable_Magic_Number
+    writeLE32(buf, ZSTD_MAGIC_SKIPPABLE_START | 0xC);
+    writeOutput(ctx, buf, 4);
+
+    //Frame_Size
+    writeLE32(buf, (uint32_t)frameSize);
+    writeOutput(ctx, buf, 4);
+
+    //Index_Magic, Number_Of_Members
+    writeLE32(buf, INDEX_MAGIC);
+    writeLE32(buf + 4, (uint32_t)ctx->indexLen);
+    writeOutput(ctx, buf, 8);
+
+    //Entries
+    for(size_t i = 0; i < ctx->indexLen; i++){
+        const IndexEntry *e = &ctx->index[i];
+        writeLE32(buf, e->frame);
+        writeLE32(buf + 4, e->frameOffset);
+        writeLE64(buf + 8, e->dataOffset);
+        writeLE64(buf + 16, e->size);
+        writeLE32(buf + 24, e->nameOffset);
+        buf[28] = (uint8_t)(e->nameLength & 0xFF);
+        buf[29] = (uint8_t)(e->nameLength >> 8);
+        buf[30] = (uint8_t)e->typeflag;
+        buf[31] = 0;
+        writeOutput(ctx, buf, INDEX_ENTRY_SIZE);
+    }
+
+    //Names
+    writeOutput(ctx, ctx->indexNames, ctx->indexNamesLen);
+
+    seekTableAdd(ctx, 8 + frameSize, 0);
+}
+
+/**
+ * Apply the per-frame compression parameters to a zstd context.
+ *
+ * Sets the compression level, enables content checksums and references
+ * the shared dictionary, if any. Shared by
+ * prepareCctx() and by the frame pool workers, so that every frame is
+ * encoded with the same parameters regardless of which context produced
+ * it.
+ *
+ * @param ctx   The compression context (reads level, cdict).
+ * @param cctx  The zstd context to configure.
+ * @return      false on error.
+ */
+static bool setCctxParams(Context *ctx, ZSTD_CCtx *cctx){
+    size_t err;
+    err = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, ctx->level);
+    if(ZSTD_isError(err)){
+        return fail(ctx, T2SZ_ERROR_ZSTD, "Cannot set compression level: %s", ZSTD_getErrorName(err));
+    }
+
+    err = ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+    if(ZSTD_isError(err)){
+        return fail(ctx, T2SZ_ERROR_ZSTD, "Cannot set checksum flag: %s", ZSTD_getErrorName(err));
+    }
+
+    if(ctx->cdict){
+        err = ZSTD_CCtx_refCDict(cctx, ctx->cdict);
+        if(ZSTD_isError(err)){
+            return fail(ctx, T2SZ_ERROR_ZSTD, "Cannot reference dictionary: %s", ZSTD_getErrorName(err));
+        }
+    }
+    return true;
+}
+
+/**
+ * Create or reset the zstd compression context, and allocate the output
+ * staging buffer.
+ *
+ * Both are kept by the context, so only the first archive pays for them.
+ * If a dictionary was trained, digests it once into a ZSTD_CDict that
+ * every frame, on every context, references instead of loading the raw
+ * dictionary again. Applies setCctxParams(). If workers is non-zero,
+ * attempts to enable multi-threaded compression; falls back to
+ * single-thread on failure (e.g. libzstd without ZSTD_MULTITHREAD) and
+ * raises T2SZ_WARNING_THREADS.
+ *
+ * @param ctx  The compression context (reads level, workers, dictBuff;
+ *             writes cctx, cdict, outBuff, outBuffSize).
+ * @return     false on error.
+ */
+static bool prepareCctx(Context *ctx){
+    if(ctx->cctx == NULL){
+        ctx->cctx = ZSTD_createCCtx();
+        if(ctx->cctx == NULL){
+            return fail(ctx, T2SZ_ERROR_ZSTD, "Cannot create ZSTD CCtx");
+        }
+    }else{
+        ZSTD_CCtx_reset(ctx->cctx, ZSTD_reset_session_and_parameters);
+    }
+
+    if(ctx->outBuff == NULL){
+        ctx->outBuffSize = ZSTD_CStreamOutSize();
+        ctx->outBuff = malloc(ctx->outBuffSize);
+        if(!ctx->outBuff){
+            return fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating output buffer");
+        }
+    }
+
+    if(ctx->dictBuff){
+        ctx->cdict = ZSTD_createCDict(ctx->dictBuff, ctx->dictSize, ctx->level);
+        if(ctx->cdict == NULL){
+            return fail(ctx, T2SZ_ERROR_ZSTD, "Cannot create ZSTD CDict");
+        }
+    }
+
+    if(!setCctxParams(ctx, ctx->cctx)){
+        return false;
+    }
+
+    if(ctx->workers){
+        const size_t err = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_nbWorkers, (int32_t)ctx->workers);
+        if(ZSTD_isError(err)){
+            warn(ctx, T2SZ_WARNING_THREADS, "Multi-thread is supported only with libzstd >= 1.5.0 or on older versions "
+                                             "compiled with ZSTD_MULTITHREAD. Reverting to single-thread.");
+            ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_nbWorkers, 0);
+        }
+    }
+    return true;
+}
+
+/**
+ * Reset the zstd session for a new independent frame.
+ *
+ * Keeps compression parameters but clears the internal state so the
+ * next compressed output starts a fresh frame.
+ *
+ * @param ctx   The compression context, receives the errors.
+ * @param cctx  ctx->cctx, or the fast path context.
+ */
+static void zstdResetFrame(Context *ctx, ZSTD_CCtx *cctx){
+    const size_t err = ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+    if(ZSTD_isError(err)){
+        fail(ctx, T2SZ_ERROR_ZSTD, "Can't reset ZSTD session: %s", ZSTD_getErrorName(err));
+    }
+}
+
+/**
+ * Set the pledged source size for the current frame.
+ *
+ * When @p known is true, tells zstd exactly how many bytes to expect,
+ * which enables single-pass optimizations. When false, sets
+ * ZSTD_CONTENTSIZE_UNKNOWN for streaming with unknown length.
+ *
+ * @param ctx    The compression context, receives the errors.
+ * @param cctx   ctx->cctx, or the fast path context.
+ * @param size   The pledged size in bytes (ignored if known is false).
+ * @param known  Whether the source size is known in advance.
+ */
+static void zstdSetPledged(Context *ctx, ZSTD_CCtx *cctx, const unsigned long long size, const bool known){
+    const size_t err = ZSTD_CCtx_setPledgedSrcSize(cctx, known ? size : ZSTD_CONTENTSIZE_UNKNOWN);
+    if(ZSTD_isError(err)){
+        fail(ctx, T2SZ_ERROR_ZSTD, "Can't set pledged size: %s", ZSTD_getErrorName(err));
+    }
+}
+
+/* Incompressible frame fast path.
+ *
+ * Frames of already compressed data (JPEG, video, archives) come out of
+ * zstd as raw blocks whatever the level, but the higher levels spend a
+ * long time searching for matches first: on random data level 19 is three
+ * orders of magnitude slower than level 1. A frame whose sampled order-0
+ * entropy is close to 8 bits per byte is therefore compressed at
+ * FAST_PATH_LEVEL on a separate context, without the dictionary. The frame
+ * is still a regular checksummed zstd frame recorded in the seek table. */
+
+/* Frames smaller than this are not probed: there is little time to save. */
+#define PROBE_MIN_FRAME    ((size_t)128 << 10)
+/* The probe reads PROBE_WINDOWS windows spread evenly over the frame. */
+#define PROBE_WINDOWS      16
+#define PROBE_WINDOW_SIZE  ((size_t)4096)
+/* Bits per byte above which a frame counts as incompressible. Compressed
+ * and encrypted data measure about 7.99, text and executables below 7. */
+#define PROBE_MAX_ENTROPY  7.95
+#define FAST_PATH_LEVEL    1
+
+/**
+ * Decide whether a frame should take the fast path.
+ *
+ * @param ctx   The compression context (reads level, compressAll).
+ * @param src   The frame content.
+ * @param size  Size of the frame.
+ * @return      true if the sampled entropy says the frame is incompressible.
+ */
+static bool looksIncompressible(const Context *ctx, const uint8_t *src, const size_t size){
+    if(ctx->compressAll || ctx->level <= FAST_PATH_LEVEL || size < PROBE_MIN_FRAME){
+        return false;
+    }
+    uint32_t hist[256] = {0};
+    const size_t stride = (size - PROBE_WINDOW_SIZE) / (PROBE_WINDOWS - 1);
+    for(size_t w = 0; w < PROBE_WINDOWS; w++){
+        const uint8_t *p = src + w * stride;
+        for(size_t i = 0; i < PROBE_WINDOW_SIZE; i++){
+            hist[p[i]]++;
+        }
+    }
+    const double n = (double)(PROBE_WINDOWS * PROBE_WINDOW_SIZE);
+    double sum = 0;
+    for(size_t i = 0; i < 256; i++){
+        if(hist[i]){
+            sum += hist[i] * log2(hist[i]);
+        }
+    }
+    return log2(n) - sum / n > PROBE_MAX_ENTROPY;
+}
+
+/**
+ * Return the fast path context in @p slot, creating it on first use.
+ *
+ * @param ctx   The compression context, receives the errors.
+ * @param slot  Where the context is kept (ctx->fastCctx, or a worker's).
+ * @return      The context, NULL on error.
+ */
+static ZSTD_CCtx* fastPathCctx(Context *ctx, ZSTD_CCtx **slot){
+    if(*slot){
+        return *slot;
+    }
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if(cctx == NULL){
+        fail(ctx, T2SZ_ERROR_ZSTD, "Cannot create ZSTD CCtx");
+        return NULL;
+    }
+    if(ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, FAST_PATH_LEVEL)) ||
+       ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1))){
+        ZSTD_freeCCtx(cctx);
+        fail(ctx, T2SZ_ERROR_ZSTD, "Cannot configure the fast path ZSTD CCtx");
+        return NULL;
+    }
+    return *slot = cctx;
+}
+
+/**
+ * Compress an entire memory buffer into a single zstd frame.
+ *
+ * Resets the session, pledges the exact source size, then feeds all
+ * bytes through ZSTD_compressStream2 with ZSTD_e_continue followed by
+ * ZSTD_e_end. Writes compressed output to the sink. Frames that look
+ * incompressible go through the fast path context.
+ *
+ * @param ctx      The compression context.
+ * @param src      Source data buffer.
+ * @param srcSize  Number of bytes to compress.
+ * @return         Total number of compressed bytes written.
+ */
+static uint64_t zstdCompressBufferToFrame(Context *ctx, const uint8_t *src, const size_t srcSize){
+    // Compress exactly one frame from a memory buffer, with known size.
+    ZSTD_CCtx *cctx = ctx->cctx;
+    if(looksIncompressible(ctx, src, srcSize)){
+        cctx = fastPathCctx(ctx, &ctx->fastCctx);
+        if(cctx == NULL){
+            return 0;
+        }
+        atomic_fetch_add(&ctx->fastFrames, 1);
+    }
+    zstdResetFrame(ctx, cctx);
+    zstdSetPledged(ctx, cctx, srcSize, true);
+    if(failed(ctx)){
+        return 0;
+    }
+
+    ZSTD_inBuffer input = { src, srcSize, 0 };
+    uint64_t compressedSize = 0;
+
+    while(true){
+        ZSTD_outBuffer output = { ctx->outBuff, ctx->outBuffSize, 0 };
+        const ZSTD_EndDirective mode = (input.pos < input.size) ? ZSTD_e_continue : ZSTD_e_end;
+
+        const size_t remaining = zstdStream(ctx, cctx, &output, &input, mode);
+        if(ZSTD_isError(remaining)){
+            fail(ctx, T2SZ_ERROR_ZSTD, "Can't compress stream: %s", ZSTD_getErrorName(remaining));
+            break;
+        }
+        compressedSize += writeOutput(ctx, ctx->outBuff, output.pos);
+
+        if(mode == ZSTD_e_end && remaining == 0){
+            break;
+        }
+    }
+
+    return compressedSize;
+}
+
+/**
+ * Finalize the current zstd frame without providing additional input.
+ *
+ * Flushes all pending data and writes the frame epilogue.
+ * Uses a non-NULL dummy buffer to satisfy libzstd implementations
+ * that reject NULL input pointers.
+ *
+ * @param ctx  The compression context.
+ * @return     Number of compressed bytes written during finalization.
+ */
+static uint64_t zstdEndFrame(Context *ctx){
+    uint64_t compressedSize = 0;
+
+    // Some libzstd builds don't like input == NULL, so use a non-NULL dummy.
+    uint8_t dummy = 0;
+    ZSTD_inBuffer empty = { &dummy, 0, 0 };
+
+    while(true){
+        ZSTD_outBuffer output = { ctx->outBuff, ctx->outBuffSize, 0 };
+        const size_t remaining = zstdStream(ctx, ctx->cctx, &output, &empty, ZSTD_e_end);
+        if(ZSTD_isError(remaining)){
+            fail(ctx, T2SZ_ERROR_ZSTD, "Can't end frame: %s", ZSTD_getErrorName(remaining));
+            break;
+        }
+        compressedSize += writeOutput(ctx, ctx->outBuff, output.pos);
+        if(remaining == 0) {
+            break;
+        }
+    }
+    return compressedSize;
+}
+
+/**
+ * Feed @p n bytes into the currently open zstd frame.
+ *
+ * Runs ZSTD_compressStream2 with ZSTD_e_continue until all input is
+ * consumed, writing compressed output to the sink. The frame must
+ * have been started with startFrameUnknown() (or an equivalent reset).
+ *
+ * @param ctx  The compression context.
+ * @param src  Source bytes.
+ * @param n    Number of bytes in @p src.
+ * @return     Number of compressed bytes written.
+ */
+static uint64_t zstdCompressChunk(Context *ctx, const uint8_t *src, const size_t n){
+    uint64_t compressedSize = 0;
+
+    ZSTD_inBuffer input = { src, n, 0 };
+    while(input.pos < input.size){
+        ZSTD_outBuffer output = { ctx->outBuff, ctx->outBuffSize, 0 };
+        const size_t remaining = zstdStream(ctx, ctx->cctx, &output, &input, ZSTD_e_continue);
+        if(ZSTD_isError(remaining)){
+            fail(ctx, T2SZ_ERROR_ZSTD, "Can't compress stream: %s", ZSTD_getErrorName(remaining));
+            break;
+        }
+        compressedSize += writeOutput(ctx, ctx->outBuff, output.pos);
+    }
+    return compressedSize;
+}
+
+/* Frames larger than this are not handed to the pool workers. The writer
+ * compresses them in order through ctx->cctx instead, where libzstd's own
+ * multi-threading parallelises inside the frame, so that the memory held
+ * by in-flight compressed frames stays bounded. On the stream path it is
+ * also the size of the chunks such frames are streamed in. */
+#define POOL_MAX_FRAME_SIZE ((size_t)32 << 20)
+
+typedef enum {
+    JOB_FREE = 0,   // slot available to the producer
+    JOB_QUEUED,     // waiting for a worker (or for the writer, if inline)
+    JOB_RUNNING,    // being compressed by a worker
+    JOB_DONE        // compressed frame ready in dst
+} FrameJobState;
+
+typedef struct {
+    const uint8_t* src;
+    size_t srcSize;
+    bool inlineFrame;   // too big for the pool, compressed by the writer
+    bool frameStart;    // inline only: first chunk of its frame
+    bool frameEnd;      // inline only: last chunk of its frame
+
+    uint8_t* in;        // stream path: slot-owned copy of the input
+    size_t inCap;
+
+    uint8_t* dst;
+    size_t dstCap;
+    size_t dstSize;
+    uint64_t compressNs;    // --stats: time the worker spent in ZSTD_compress2()
+
+    FrameJobState state;
+} FrameJob;
+
+/**
+ * Worker pool compressing whole independent frames concurrently.
+ *
+ * Jobs live in a ring of nbSlots entries and are identified by a
+ * monotonically increasing sequence number (slot = seq % nbSlots).
+ * Every worker owns a private ZSTD_CCtx and takes the oldest queued job;
+ * the writer emits finished frames strictly in sequence order and records
+ * them in the seek table, so the output is independent of scheduling.
+ *
+ * On the mmap path the producer is also the writer (producerWrites).
+ * On the stream path a reader thread produces and the main thread writes;
+ * frames that outgrow POOL_MAX_FRAME_SIZE are then streamed to the writer
+ * as a sequence of inline chunks.
+ */
+typedef struct FramePool {
+    Context* ctx;
+
+    pthread_t* threads;
+    uint32_t nbThreads;
+
+    FrameJob* jobs;
+    size_t nbSlots;
+
+    uint64_t nextSubmit; // next sequence number handed out by the producer
+    uint64_t nextRun;    // next sequence number a worker will look at
+    uint64_t nextWrite;  // next sequence number the writer will emit
+    bool producerWrites;
+    bool producerDone;
+    bool closing;
+
+    //producer side: frame being assembled (stream path)
+    FrameJob* building;
+    bool streaming;      // some chunks of the current frame were already queued
+
+    //writer side: inline frame being streamed
+    uint64_t streamIn;
+    uint64_t streamOut;
+
+    pthread_mutex_t lock;
+    pthread_cond_t workerCond; // a job was queued or the pool is closing
+    pthread_cond_t writerCond; // a job was queued or finished, or the producer is done
+    pthread_cond_t slotFree;   // the writer released a slot
+    bool syncReady;            // lock and conditions are initialized
+} FramePool;
+
+static void framePoolFinish(FramePool* pool);
+static void checkpointFrameWritten(Context *ctx);
+
+/**
+ * Pool worker thread: compress queued frames until the pool closes.
+ *
+ * Inline jobs are skipped, the writer takes care of them. Each frame is
+ * compressed in one shot with ZSTD_compress2(), which pledges the exact
+ * source size just like the serial path does. Frames that look
+ * incompressible use the worker's own fast path context.
+ *
+ * Once the call has failed, jobs are still taken but marked done without
+ * compressing them, so that the writer and the producer never wait on a
+ * frame that will not come.
+ *
+ * @param arg  The FramePool.
+ * @return     NULL.
+ */
+static void* framePoolWorker(void* arg){
+    FramePool* pool = arg;
+
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    ZSTD_CCtx* fastCctx = NULL;
+    if(cctx == NULL){
+        fail(pool->ctx, T2SZ_ERROR_ZSTD, "Cannot create ZSTD CCtx");
+    }else{
+        setCctxParams(pool->ctx, cctx);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while(true){
+        while(pool->nextRun < pool->nextSubmit && pool->jobs[pool->nextRun % pool->nbSlots].inlineFrame){
+            pool->nextRun++;
+        }
+        if(pool->nextRun == pool->nextSubmit){
+            if(pool->closing){
+                break;
+            }
+            pthread_cond_wait(&pool->workerCond, &pool->lock);
+            continue;
+        }
+
+        FrameJob* job = &pool->jobs[pool->nextRun % pool->nbSlots];
+        pool->nextRun++;
+        job->state = JOB_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+
+        size_t res = 0;
+        if(!failed(pool->ctx)){
+            ZSTD_CCtx* jobCctx = cctx;
+            if(looksIncompressible(pool->ctx, job->src, job->srcSize)){
+                jobCctx = fastPathCctx(pool->ctx, &fastCctx);
+                atomic_fetch_add(&pool->ctx->fastFrames, 1);
+            }
+            const uint64_t start = statsClock(pool->ctx);
+            res = jobCctx ? ZSTD_compress2(jobCctx, job->dst, job->dstCap, job->src, job->srcSize) : 0;
+            job->compressNs = 0;
+            statsSince(pool->ctx, &job->compressNs, start);
+            if(ZSTD_isError(res)){
+                fail(pool->ctx, T2SZ_ERROR_ZSTD, "Can't compress frame: %s", ZSTD_getErrorName(res));
+                res = 0;
+            }
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        job->dstSize = res;
+        job->state = JOB_DONE;
+        pthread_cond_signal(&pool->writerCond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    atomic_fetch_add(&pool->ctx->threadMemory, ZSTD_sizeof_CCtx(cctx) + ZSTD_sizeof_CCtx(fastCctx));
+    ZSTD_freeCCtx(fastCctx);
+    ZSTD_freeCCtx(cctx);
+    return NULL;
+}
+
+/**
+ * Create the frame pool and start its worker threads.
+ *
+ * The ring holds two jobs per worker, so workers stay busy while the
+ * writer is flushing. If some threads cannot be started the pool runs
+ * with those that did; with none it is released and NULL is returned.
+ *
+ * @param ctx             The compression context (reads level).
+ * @param nbThreads       Number of worker threads (>= 1).
+ * @param producerWrites  true if the thread submitting frames also writes
+ *                        them (mmap path), false if the writer runs
+ *                        framePoolDrain() on another thread (stream path).
+ * @return                A running FramePool; release it with
+ *                        framePoolFinish(). NULL on failure.
+ */
+static FramePool* framePoolCreate(Context *ctx, const uint32_t nbThreads, const bool producerWrites){
+    FramePool* pool = calloc(1, sizeof(FramePool));
+    if(!pool){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating frame pool");
+        return NULL;
+    }
+    pool->ctx = ctx;
+    pool->nbSlots = (size_t)nbThreads * 2;
+    pool->producerWrites = producerWrites;
+    pool->jobs = calloc(pool->nbSlots, sizeof(FrameJob));
+    pool->threads = calloc(nbThreads, sizeof(pthread_t));
+    if(!pool->jobs || !pool->threads){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating frame pool");
+        framePoolFinish(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workerCond, NULL);
+    pthread_cond_init(&pool->writerCond, NULL);
+    pthread_cond_init(&pool->slotFree, NULL);
+    pool->syncReady = true;
+
+    for(uint32_t i = 0; i < nbThreads; i++){
+        if(pthread_create(&pool->threads[i], NULL, framePoolWorker, pool) != 0){
+            break;
+        }
+        pool->nbThreads++;
+    }
+    if(pool->nbThreads == 0){
+        fail(ctx, T2SZ_ERROR_THREAD, "Cannot create compression thread");
+        framePoolFinish(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/**
+ * Emit the oldest submitted job, waiting for its worker if needed.
+ *
+ * Inline jobs are compressed here, through ctx->cctx, directly to the
+ * output file: a job that is a whole frame is compressed with its exact
+ * pledged size, chunks of a streamed frame are fed to a frame of unknown
+ * size that is closed by the chunk flagged frameEnd. Every frame is
+ * recorded in the seek table in submission order, a checkpoint is taken
+ * if one is due, then the slot is released to the producer.
+ *
+ * @param pool  The frame pool (must have at least one queued job).
+ */
+static void framePoolWriteNext(FramePool* pool){
+    Context* ctx = pool->ctx;
+    FrameJob* job = &pool->jobs[pool->nextWrite % pool->nbSlots];
+
+    if(job->inlineFrame && job->frameStart && job->frameEnd){
+        const uint64_t compressedSize = zstdCompressBufferToFrame(ctx, job->src, job->srcSize);
+        seekTableAdd(ctx, compressedSize, job->srcSize);
+    }else if(job->inlineFrame){
+        if(job->frameStart){
+            zstdResetFrame(ctx, ctx->cctx);
+            zstdSetPledged(ctx, ctx->cctx, 0, false);
+            pool->streamIn = 0;
+            pool->streamOut = 0;
+        }
+        pool->streamOut += zstdCompressChunk(ctx, job->src, job->srcSize);
+        pool->streamIn += job->srcSize;
+        if(job->frameEnd){
+            pool->streamOut += zstdEndFrame(ctx);
+            seekTableAdd(ctx, pool->streamOut, pool->streamIn);
+        }
+    }else{
+        pthread_mutex_lock(&pool->lock);
+        while(job->state != JOB_DONE){
+            pthread_cond_wait(&pool->writerCond, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        verifyInput(ctx, job->src, job->srcSize);
+        const uint64_t compressedSize = writeOutput(ctx, job->dst, job->dstSize);
+        progressInput(ctx, job->srcSize);
+        ctx->frameNs = job->compressNs;
+        seekTableAdd(ctx, compressedSize, job->srcSize);
+    }
+    if(!job->inlineFrame || job->frameEnd){
+        checkpointFrameWritten(ctx);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    job->state = JOB_FREE;
+    pool->nextWrite++;
+    pthread_cond_signal(&pool->slotFree);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Reserve the next slot of the ring for the producer.
+ *
+ * When every slot is in use, either writes out the oldest job (if the
+ * producer is also the writer) or waits for the writer to release one.
+ *
+ * @param pool  The frame pool.
+ * @return      The free job at sequence number nextSubmit.
+ */
+static FrameJob* framePoolAcquire(FramePool* pool){
+    if(pool->producerWrites){
+        while(pool->nextSubmit - pool->nextWrite == pool->nbSlots){
+            framePoolWriteNext(pool);
+        }
+    }else{
+        pthread_mutex_lock(&pool->lock);
+        while(pool->nextSubmit - pool->nextWrite == pool->nbSlots){
+            pthread_cond_wait(&pool->slotFree, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    FrameJob* job = &pool->jobs[pool->nextSubmit % pool->nbSlots];
+    job->src = NULL;
+    job->srcSize = 0;
+    job->dstSize = 0;
+    return job;
+}
+
+/**
+ * Publish a job filled after framePoolAcquire().
+ *
+ * Pooled jobs get an output buffer of ZSTD_compressBound() bytes, reused
+ * across the lifetime of the slot. Wakes one worker and the writer.
+ *
+ * @param pool  The frame pool.
+ * @param job   The job returned by framePoolAcquire().
+ */
+static void framePoolQueue(FramePool* pool, FrameJob* job){
+    if(!job->inlineFrame){
+        const size_t bound = ZSTD_compressBound(job->srcSize);
+        if(job->dstCap < bound){
+            uint8_t* p = realloc(job->dst, bound);
+            if(p){
+                job->dst = p;
+                job->dstCap = bound;
+            }else{
+                // Still queued: the worker skips it once the call has failed.
+                fail(pool->ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating %zu-byte frame buffer", bound);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    job->state = JOB_QUEUED;
+    pool->nextSubmit++;
+    pthread_cond_signal(&pool->workerCond);
+    pthread_cond_signal(&pool->writerCond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Queue one frame that already lives in memory (mmap path).
+ *
+ * @p src must stay valid until the frame has been written.
+ *
+ * @param pool     The frame pool.
+ * @param src      Frame input bytes.
+ * @param srcSize  Number of input bytes.
+ */
+static void framePoolSubmit(FramePool* pool, const uint8_t* src, const size_t srcSize){
+    FrameJob* job = framePoolAcquire(pool);
+    job->src = src;
+    job->srcSize = srcSize;
+    job->inlineFrame = srcSize > POOL_MAX_FRAME_SIZE;
+    job->frameStart = true;
+    job->frameEnd = true;
+    framePoolQueue(pool, job);
+}
+
+/**
+ * Queue the frame being assembled, or its last chunk.
+ *
+ * @param pool      The frame pool.
+ * @param frameEnd  Whether this closes the frame.
+ */
+static void framePoolQueueBuilding(FramePool* pool, const bool frameEnd){
+    FrameJob* job = pool->building;
+    job->src = job->in;
+    job->inlineFrame = pool->streaming || !frameEnd;
+    job->frameStart = !pool->streaming;
+    job->frameEnd = frameEnd;
+    framePoolQueue(pool, job);
+
+    pool->building = NULL;
+    pool->streaming = !frameEnd;
+}
+
+/**
+ * Append bytes to the frame being assembled by the producer (stream path).
+ *
+ * Bytes are copied into the input buffer of the current slot. When the
+ * frame outgrows POOL_MAX_FRAME_SIZE the buffer is queued as an inline
+ * chunk and the rest of the frame is streamed in further chunks.
+ *
+ * @param pool  The frame pool.
+ * @param src   Source bytes.
+ * @param n     Number of bytes in @p src.
+ */
+static void framePoolAppend(FramePool* pool, const uint8_t* src, size_t n){
+    while(n > 0){
+        if(!pool->building){
+            pool->building = framePoolAcquire(pool);
+        }
+        FrameJob* job = pool->building;
+
+        size_t take = POOL_MAX_FRAME_SIZE - job->srcSize;
+        if(take > n){
+            take = n;
+        }
+        if(job->inCap < job->srcSize + take){
+            size_t newCap = job->inCap ? job->inCap : ZSTD_CStreamInSize();
+            while(newCap < job->srcSize + take){
+                newCap *= 2;
+            }
+            if(newCap > POOL_MAX_FRAME_SIZE){
+                newCap = POOL_MAX_FRAME_SIZE;
+            }
+            uint8_t* p = realloc(job->in, newCap);
+            if(!p){
+                fail(pool->ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating %zu-byte frame buffer", newCap);
+                return;
+            }
+            job->in = p;
+            job->inCap = newCap;
+        }
+
+        memcpy(job->in + job->srcSize, src, take);
+        job->srcSize += take;
+        src += take;
+        n -= take;
+
+        if(job->srcSize == POOL_MAX_FRAME_SIZE){
+            framePoolQueueBuilding(pool, false);
+        }
+    }
+}
+
+/**
+ * Close the frame being assembled by the producer (stream path).
+ *
+ * A frame that fits in one slot is queued whole for the workers; the end
+ * of a streamed frame is queued as its final inline chunk (possibly empty).
+ *
+ * @param pool  The frame pool.
+ */
+static void framePoolEndFrame(FramePool* pool){
+    if(!pool->building){
+        pool->building = framePoolAcquire(pool);
+    }
+    framePoolQueueBuilding(pool, true);
+}
+
+/**
+ * Mark the end of the producer's input and wake the writer.
+ *
+ * @param pool  The frame pool.
+ */
+static void framePoolProducerDone(FramePool* pool){
+    pthread_mutex_lock(&pool->lock);
+    pool->producerDone = true;
+    pthread_cond_signal(&pool->writerCond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Writer loop for a pool fed by another thread (stream path).
+ *
+ * Emits jobs in order as they are queued, until the producer is done and
+ * every queued job has been written.
+ *
+ * @param pool  The frame pool.
+ */
+static void framePoolDrain(FramePool* pool){
+    while(true){
+        pthread_mutex_lock(&pool->lock);
+        while(pool->nextWrite == pool->nextSubmit && !pool->producerDone){
+            pthread_cond_wait(&pool->writerCond, &pool->lock);
+        }
+        const bool pending = pool->nextWrite < pool->nextSubmit;
+        pthread_mutex_unlock(&pool->lock);
+
+        if(!pending){
+            break;
+        }
+        framePoolWriteNext(pool);
+    }
+}
+
+/**
+ * Write every pending frame, stop the workers and free the pool.
+ *
+ * Also releases a pool that framePoolCreate() could only partly set up.
+ *
+ * @param pool  The frame pool to release.
+ */
+static void framePoolFinish(FramePool* pool){
+    if(pool->syncReady){
+        while(pool->nextWrite < pool->nextSubmit){
+            framePoolWriteNext(pool);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->closing = true;
+        pthread_cond_broadcast(&pool->workerCond);
+        pthread_mutex_unlock(&pool->lock);
+
+        for(uint32_t i = 0; i < pool->nbThreads; i++){
+            pthread_join(pool->threads[i], NULL);
+        }
+
+        pthread_cond_destroy(&pool->slotFree);
+        pthread_cond_destroy(&pool->writerCond);
+        pthread_cond_destroy(&pool->workerCond);
+        pthread_mutex_destroy(&pool->lock);
+    }
+
+    for(size_t i = 0; pool->jobs && i < pool->nbSlots; i++){
+        free(pool->jobs[i].in);
+        free(pool->jobs[i].dst);
+    }
+    free(pool->jobs);
+    free(pool->threads);
+    free(pool);
+}
+
+/* ── Content-defined chunking (--cdc) ──────────────────────────────────────
+ *
+ * In raw mode -s cuts frames at fixed offsets, so a single inserted byte
+ * shifts every later boundary and no frame of two versions of a disk image
+ * is ever identical. With --cdc the boundaries are chosen by the content
+ * instead, FastCDC style: a gear rolling hash over the last 64 bytes, and a
+ * cut where its top bits are all zero. Below the average size the test uses
+ * one more bit than log2(average), above it one less, which keeps the sizes
+ * close to the average; the minimum and maximum bound them. An edit then
+ * only changes the frames around it, and a deduplicating store keeps the
+ * others. The same cuts are found on mapped and streamed inputs.
+ */
+
+static uint64_t cdcGear[256];
+static pthread_once_t cdcGearOnce = PTHREAD_ONCE_INIT;
+
+/** Fill cdcGear with fixed pseudo-random values (splitmix64), the same on every run. */
+static void cdcGearInit(void){
+    uint64_t x = 0x7432737A43444321ull;
+    for(size_t i = 0; i < 256; i++){
+        uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        cdcGear[i] = z ^ (z >> 31);
+    }
+}
+
+/**
+ * Validate the chunking options and derive the chunking parameters.
+ *
+ * @param ctx   The compression context (writes cdcAverage, cdcMin,
+ *              cdcMax, cdcMaskSmall, cdcMaskLarge).
+ * @param opts  The options; cdcAverage 0 disables chunking.
+ * @return      false if the sizes are inconsistent.
+ */
+static bool cdcSetup(Context *ctx, const T2szOptions *opts){
+    const size_t avg = opts->cdcAverage;
+    if(avg == 0){
+        ctx->cdcAverage = 0;
+        return true;
+    }
+    const size_t min = opts->minBlockSize ? opts->minBlockSize : avg / 4;
+    const size_t max = opts->maxBlockSize ? opts->maxBlockSize : avg * 4;
+    if(avg < 256 || avg > ((size_t)1 << 30) || min > avg || max < avg){
+        return fail(ctx, T2SZ_ERROR_PARAMETER, "Content-defined chunking needs min (-s) <= average <= max (-S), with an average between 256 and 1G");
+    }
+    ctx->cdcAverage = avg;
+    ctx->cdcMin = min;
+    ctx->cdcMax = max;
+    unsigned bits = 0;
+    while(((size_t)2 << bits) <= avg){
+        bits++;
+    }
+    ctx->cdcMaskSmall = ~(~0ull >> (bits + 1));
+    ctx->cdcMaskLarge = ~(~0ull >> (bits - 1));
+    pthread_once(&cdcGearOnce, cdcGearInit);
+    return true;
+}
+
+/**
+ * Find the end of the next content-defined frame.
+ *
+ * The result only depends on the first cdcMax bytes of @p src, so a
+ * caller that holds at least cdcMax bytes (or all that is left of the
+ * input) gets the same cut wherever the data comes from.
+ *
+ * @param ctx  The compression context (reads the cdc parameters).
+ * @param src  Start of the frame.
+ * @param len  Bytes available.
+ * @return     Size of the frame, at most @p len.
+ */
+static size_t cdcCut(const Context *ctx, const uint8_t *src, const size_t len){
+    if(len <= ctx->cdcMin){
+        return len;
+    }
+    const size_t end = len < ctx->cdcMax ? len : ctx->cdcMax;
+    const size_t normal = end < ctx->cdcAverage ? end : ctx->cdcAverage;
+    uint64_t hash = 0;
+    size_t i = ctx->cdcMin;
+    for(; i < normal; i++){
+        hash = (hash << 1) + cdcGear[src[i]];
+        if(!(hash & ctx->cdcMaskSmall)){
+            return i + 1;
+        }
+    }
+    for(; i < end; i++){
+        hash = (hash << 1) + cdcGear[src[i]];
+        if(!(hash & ctx->cdcMaskLarge)){
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+/**
+ * Read up to @p n bytes from the input callback.
+ *
+ * Loops on short reads, so less than @p n bytes are returned only at the
+ * end of the input or on error. Bytes peeked by sniffZstdInput() come
+ * first.
+ *
+ * @param ctx  The compression context (reads peek, readFn, readOpaque).
+ * @param dst  Destination buffer (must hold at least @p n bytes).
+ * @param n    Number of bytes wanted.
+ * @return     Bytes read. On a read error the call is failed and the
+ *             bytes read so far are returned.
+ */
+static size_t readInput(Context *ctx, uint8_t *dst, const size_t n){
+    size_t got = 0;
+    if(ctx->peekPos < ctx->peekLen){
+        const size_t left = ctx->peekLen - ctx->peekPos;
+        got = n < left ? n : left;
+        memcpy(dst, ctx->peek + ctx->peekPos, got);
+        ctx->peekPos += got;
+    }
+    while(got < n){
+        const uint64_t start = statsClock(ctx);
+        const ptrdiff_t r = ctx->readFn(ctx->readOpaque, dst + got, n - got);
+        statsSince(ctx, &ctx->stats.inputNs, start);
+        if(r < 0 || (size_t)r > n - got){
+            fail(ctx, T2SZ_ERROR_READ, "Read error on input");
+            break;
+        }
+        if(r == 0){
+            break; // EOF
+        }
+        got += (size_t)r;
+    }
+    return got;
+}
+
+/**
+ * Compress raw data pulled from the input callback into content-defined
+ * frames.
+ *
+ * The buffer is refilled to cdcMax bytes before every cut, so the frames
+ * are exactly those planFrames() finds on the same data in memory.
+ *
+ * @param ctx  The compression context (cdcSetup() done, cctx and readFn
+ *             initialized).
+ */
+static void compressStreamCdc(Context *ctx){
+    uint8_t *buf = malloc(ctx->cdcMax);
+    if(!buf){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating %zu-byte frame buffer", ctx->cdcMax);
+        return;
+    }
+    size_t len = 0;
+    bool eof = false;
+    while(!failed(ctx)){
+        if(!eof){
+            const size_t got = readInput(ctx, buf + len, ctx->cdcMax - len);
+            eof = len + got < ctx->cdcMax;
+            len += got;
+        }
+        if(len == 0 || failed(ctx)){
+            break;
+        }
+
+        const size_t cut = cdcCut(ctx, buf, len);
+        if(ctx->pool){
+            framePoolAppend(ctx->pool, buf, cut);
+            framePoolEndFrame(ctx->pool);
+        }else{
+            const uint64_t compressedSize = zstdCompressBufferToFrame(ctx, buf, cut);
+            seekTableAdd(ctx, compressedSize, cut);
+        }
+        ctx->frameCount++;
+
+        memmove(buf, buf + cut, len - cut);
+        len -= cut;
+    }
+    free(buf);
+}
+
+/**
+ * Compress raw (non-tar) data pulled from the input callback.
+ *
+ * Three modes:
+ *   - cdcAverage > 0: content-defined frames, see compressStreamCdc().
+ *   - minBlockSize == 0: streams the whole input into a single frame with
+ *     unknown pledged size (matches the mmap "whole file" behaviour).
+ *   - minBlockSize > 0: buffers exactly minBlockSize bytes at a time,
+ *     compressing each chunk as an independent frame with known size.
+ *     The last frame may be smaller if EOF is reached mid-buffer.
+ *
+ * Each frame is recorded in the seek table via seekTableAdd(). When
+ * ctx->pool is set this runs on the reader thread and hands the bytes to
+ * the pool instead of compressing them.
+ *
+ * @param ctx  The compression context (must have cctx, outBuff, readFn
+ *             already initialized).
+ */
+static void compressStreamRaw(Context *ctx){
+    // Three behaviours:
+    // - With --cdc: keep up to cdcMax bytes buffered and cut them where cdcCut() says.
+    // - If -s is set (minBlockSize > 0): read exactly one frame worth of bytes into a frame buffer,
+    //   then compress it as an independent frame with correct pledged size.
+    // - If -s is not set: stream into a single frame (pledged unknown), matching original "whole file" raw behaviour.
+
+    if(ctx->cdcAverage){
+        compressStreamCdc(ctx);
+        return;
+    }
+
+    if(ctx->minBlockSize == 0){
+        // Single-frame streaming, pledged unknown
+        if(!ctx->pool){
+            zstdResetFrame(ctx, ctx->cctx);
+            zstdSetPledged(ctx, ctx->cctx, 0, false);
+        }
+
+        const size_t inChunk = ZSTD_CStreamInSize();
+        uint8_t *inBuf = malloc(inChunk);
+        if(!inBuf){
+            fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating input buffer");
+            return;
+        }
+
+        uint64_t decompressedSize = 0;
+        uint64_t compressedSize = 0;
+
+        while(!failed(ctx)){
+            const size_t n = readInput(ctx, inBuf, inChunk);
+            if(n > 0){
+                decompressedSize += n;
+
+                if(ctx->pool){
+                    framePoolAppend(ctx->pool, inBuf, n);
+                }else{
+                    compressedSize += zstdCompressChunk(ctx, inBuf, n);
+                }
+            }
+
+            if(n < inChunk){
+                break; // EOF
+            }
+        }
+
+        if(ctx->pool){
+            framePoolEndFrame(ctx->pool);
+        }else{
+            compressedSize += zstdEndFrame(ctx);
+            seekTableAdd(ctx, compressedSize, decompressedSize);
+        }
+        ctx->frameCount++;
+
+        free(inBuf);
+        return;
+    }
+
+    // Fixed-size frames: buffer exactly one frame at a time (bounded memory = minBlockSize)
+    const size_t frameSize = ctx->minBlockSize;
+    uint8_t *frameBuf = malloc(frameSize);
+    if(!frameBuf){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating %zu-byte frame buffer", frameSize);
+        return;
+    }
+
+    while(!failed(ctx)){
+        const size_t got = readInput(ctx, frameBuf, frameSize);
+        if(got == 0 || failed(ctx)){
+            break; // no more data
+        }
+
+        if(ctx->pool){
+            framePoolAppend(ctx->pool, frameBuf, got);
+            framePoolEndFrame(ctx->pool);
+        }else{
+            const uint64_t compressedSize = zstdCompressBufferToFrame(ctx, frameBuf, got);
+            seekTableAdd(ctx, compressedSize, got);
+        }
+        ctx->frameCount++;
+
+        if(got < frameSize) {
+            break; // last partial frame (EOF)
+        }
+    }
+
+    free(frameBuf);
+}
+
+/**
+ * Check whether a 512-byte block is entirely zero.
+ *
+ * Two consecutive zero blocks mark the end-of-archive in a tar stream.
+ *
+ * @param b  Pointer to a 512-byte block.
+ * @return   true if all 512 bytes are 0x00.
+ */
+static bool isZeroTarBlock(const uint8_t *b){
+    return tarKernels->isZero(b);
+}
+
+/**
+ * Read exactly @p n bytes from the input callback into @p dst.
+ *
+ * Fails the call on premature end of input or read error.
+ *
+ * @param ctx  The compression context.
+ * @param dst  Destination buffer (must hold at least @p n bytes).
+ * @param n    Number of bytes to read.
+ * @return     false on error.
+ */
+static bool readExact(Context *ctx, uint8_t *dst, const size_t n){
+    if(readInput(ctx, dst, n) != n){
+        return fail(ctx, T2SZ_ERROR_READ, "Unexpected end of input");
+    }
+    return !failed(ctx);
+}
+
+/**
+ * Begin a new zstd frame with unknown pledged size.
+ *
+ * Resets the session, sets pledged to unknown, and zeroes the
+ * running byte counters for the frame being built. With a frame pool
+ * the writer owns ctx->cctx, so only the counters are reset.
+ *
+ * @param ctx        The compression context.
+ * @param frameIn    [out] Reset to 0 (decompressed bytes in frame).
+ * @param frameOut   [out] Reset to 0 (compressed bytes in frame).
+ * @param frameOpen  [out] Set to true.
+ */
+static void startFrameUnknown(Context *ctx, uint64_t *frameIn, uint64_t *frameOut, bool *frameOpen){
+    if(!ctx->pool){
+        zstdResetFrame(ctx, ctx->cctx);
+        zstdSetPledged(ctx, ctx->cctx, 0, false); // unknown size
+    }
+    *frameIn = 0;
+    *frameOut = 0;
+    *frameOpen = true;
+}
+
+/**
+ * Finalize the current frame and record it in the seek table.
+ *
+ * Calls zstdEndFrame() to flush remaining output, adds the frame's
+ * totals to the seek table, and marks the frame as closed. With a frame
+ * pool the frame is handed to the writer, which records it instead.
+ * No-op if *frameOpen is already false.
+ *
+ * @param ctx        The compression context.
+ * @param frameIn    Decompressed bytes accumulated in this frame.
+ * @param frameOut   Compressed bytes accumulated so far (updated by zstdEndFrame).
+ * @param frameOpen  [in/out] Set to false on return.
+ */
+static void endFrameAndRecord(Context *ctx, const uint64_t frameIn, uint64_t frameOut, bool *frameOpen){
+    if(!*frameOpen){
+        return;
+    }
+
+    if(ctx->pool){
+        framePoolEndFrame(ctx->pool);
+    }else{
+        frameOut += zstdEndFrame(ctx);
+        seekTableAdd(ctx, frameOut, frameIn);
+    }
+    ctx->frameCount++;
+    *frameOpen = false;
+}
+
+/**
+ * Feed tar payload bytes into the current zstd frame, respecting
+ * maxBlockSize splitting.
+ *
+ * Opens a new frame if none is active. If maxBlockSize is set and the
+ * frame reaches the limit, closes it and opens the next one, possibly
+ * splitting the input across multiple frames. All compressed output
+ * is written to the sink, or the bytes are appended to the frame
+ * being assembled by the pool.
+ *
+ * @param ctx        The compression context.
+ * @param src        Source bytes to compress.
+ * @param n          Number of bytes in @p src.
+ * @param frameIn    [in/out] Running decompressed byte count for the current frame.
+ * @param frameOut   [in/out] Running compressed byte count for the current frame.
+ * @param frameOpen  [in/out] Whether a frame is currently open.
+ */
+static void pushBytesTar(Context *ctx, const uint8_t *src, const size_t n, uint64_t *frameIn, uint64_t *frameOut, bool *frameOpen){
+    size_t off = 0;
+    while(off < n){
+        if(!*frameOpen){
+            startFrameUnknown(ctx, frameIn, frameOut, frameOpen);
+        }
+
+        // If maxBlockSize is set, never exceed it.
+        size_t canWrite = n - off;
+        if(ctx->maxBlockSize){
+            if(*frameIn >= ctx->maxBlockSize){
+                // current frame full -> close and open next
+                endFrameAndRecord(ctx, *frameIn, *frameOut, frameOpen);
+                continue;
+            }
+            const size_t left = ctx->maxBlockSize - (size_t)(*frameIn);
+            if(canWrite > left) canWrite = left;
+        }
+
+        if(ctx->pool){
+            framePoolAppend(ctx->pool, src + off, canWrite);
+        }else{
+            *frameOut += zstdCompressChunk(ctx, src + off, canWrite);
+        }
+
+        *frameIn += canWrite;
+        off += canWrite;
+
+        // If we exactly filled maxBlockSize, close immediately (split).
+        if(ctx->maxBlockSize && *frameIn >= ctx->maxBlockSize){
+            endFrameAndRecord(ctx, *frameIn, *frameOut, frameOpen);
+        }
+    }
+}
+
+/**
+ * Compress a tar archive pulled from the input callback.
+ *
+ * Reads 512-byte blocks from the input, parsing tar headers to determine
+ * file boundaries. Implements the same framing logic as the mmap path:
+ *   - minBlockSize == 0: one file per frame.
+ *   - minBlockSize > 0: aggregate whole files until the frame reaches
+ *     the minimum, then close at the next file boundary.
+ *   - maxBlockSize > 0: split so no frame exceeds the maximum (may
+ *     split inside a file).
+ *
+ * Null blocks (end-of-archive markers) and payload padding are included
+ * in the compressed stream. Each completed frame is recorded in the
+ * seek table. When ctx->pool is set this runs on the reader thread and
+ * the frames are compressed by the pool.
+ *
+ * @param ctx  The compression context (must have cctx, outBuff, readFn
+ *             already initialized).
+ */
+static void compressStreamTar(Context *ctx){
+    // Default tar behaviour matches mmap-path:
+    // - if minBlockSize==0: "one file per frame"
+    // - if minBlockSize>0: aggregate whole files until >= min, then close at file boundary
+    // - if maxBlockSize>0: split so frames never exceed max (may split inside a file)
+
+    const size_t inChunk = ZSTD_CStreamInSize();
+    uint8_t *chunkBuf = malloc(inChunk);
+    if(!chunkBuf){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating tar input chunk buffer");
+        return;
+    }
+
+    uint8_t hdrBlock[512];
+
+    uint64_t frameIn = 0, frameOut = 0;
+    bool frameOpen = false;
+    uint64_t tarPos = 0;    //offset of hdrBlock in the tar stream, for the index
+
+    while(!failed(ctx)){
+        // Read next 512-byte tar header/block
+        const size_t r = readInput(ctx, hdrBlock, 512);
+        if(r == 0 || failed(ctx)){
+            // EOF
+            break;
+        }
+        if(r != 512){
+            // partial header => truncated stream
+            fail(ctx, T2SZ_ERROR_FORMAT, "Truncated tar header in input");
+            break;
+        }
+
+        // Null block (end-of-archive marker): push into stream and continue.
+        if(isZeroTarBlock(hdrBlock)){
+            pushBytesTar(ctx, hdrBlock, 512, &frameIn, &frameOut, &frameOpen);
+
+            if(ctx->verbose){
+                fprintf(stderr, "+ <null>\n");
+            }
+
+            // In "one file per frame" mode, also close after a null block (matches mmap behaviour when -s is 0)
+            if(ctx->minBlockSize == 0 && frameOpen){
+                endFrameAndRecord(ctx, frameIn, frameOut, &frameOpen);
+            }
+            tarPos += 512;
+            continue;
+        }
+
+        // Validate the tar header *before* pushing it into the compressor,
+        // consistent with the mmap path which validates before including.
+        const uint64_t headerStart = statsClock(ctx);
+        TarHeader *header = (TarHeader*)hdrBlock;
+        if(!isTarHeader(header)){
+            failTarHeader(ctx, header);
+            break;
+        }
+        statsSince(ctx, &ctx->stats.headerNs, headerStart);
+
+        // Header is valid — include the 512-byte block in the stream,
+        // then the sparse map extension blocks of a GNU sparse member.
+        pushBytesTar(ctx, hdrBlock, 512, &frameIn, &frameOut, &frameOpen);
+        uint64_t headerBlocks = 512;
+        bool sparse = tarSparseContinues(hdrBlock, true);
+        while(sparse && readExact(ctx, chunkBuf, 512)){
+            pushBytesTar(ctx, chunkBuf, 512, &frameIn, &frameOut, &frameOpen);
+            sparse = tarSparseContinues(chunkBuf, false);
+            headerBlocks += 512;
+        }
+        if(failed(ctx)){
+            break;
+        }
+
+        const size_t fileSize = parseTarSize(header);
+        if(fileSize > SIZE_MAX - 1024){
+            fail(ctx, T2SZ_ERROR_FORMAT, "Invalid tar entry size (too large)");
+            break;
+        }
+
+        // pad to 512
+        size_t padded = fileSize;
+        const size_t mod = padded % 512;
+        if(mod) padded = padded - mod + 512;
+
+        if(ctx->verbose){
+            fprintf(stderr, "+ %.100s (%zu)\n", header->name, padded);
+        }
+
+        // Long names for the index are in the payload of 'L'/'x' headers.
+        uint8_t *longName = NULL;
+        if(indexing(ctx)){
+            const uint64_t indexStart = statsClock(ctx);
+            if((header->typeflag == 'L' || header->typeflag == 'x') && fileSize <= TAR_LONG_NAME_MAX){
+                longName = malloc(fileSize ? fileSize : 1);
+                if(!longName){
+                    fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory while growing member index");
+                    break;
+                }
+            }else if(header->typeflag == 'L' || header->typeflag == 'x'){
+                indexLongName(ctx, header->typeflag, NULL, fileSize);   //too large, clears the pending name
+            }else if(header->typeflag != 'g' && header->typeflag != 'K'){
+                indexAdd(ctx, header, fileSize, tarPos + headerBlocks);
+            }
+            statsSince(ctx, &ctx->stats.headerNs, indexStart);
+        }
+
+        // Stream payload+pads: read exactly 'padded' bytes from the input, push through compressor,
+        // respecting maxBlockSize splitting.
+        size_t remaining = padded;
+        while(remaining > 0){
+            const size_t take = remaining > inChunk ? inChunk : remaining;
+            if(!readExact(ctx, chunkBuf, take)){
+                break;
+            }
+            if(longName){
+                const size_t done = padded - remaining;
+                if(done < fileSize){
+                    memcpy(longName + done, chunkBuf, fileSize - done < take ? fileSize - done : take);
+                }
+            }
+            pushBytesTar(ctx, chunkBuf, take, &frameIn, &frameOut, &frameOpen);
+            remaining -= take;
+        }
+        if(longName){
+            indexLongName(ctx, header->typeflag, longName, fileSize);
+            free(longName);
+        }
+        tarPos += headerBlocks + padded;
+
+        // End-of-file boundary: decide whether to close frame. Extension
+        // headers stay in the frame of the member they describe.
+        if(isTarExtension(header)){
+            continue;
+        }else if(ctx->minBlockSize == 0){
+            // one file per frame
+            if(frameOpen){
+                endFrameAndRecord(ctx, frameIn, frameOut, &frameOpen);
+            }
+        }else{
+            // aggregated blocks: close only at file boundary when >= minBlockSize
+            if(frameOpen && frameIn >= ctx->minBlockSize){
+                endFrameAndRecord(ctx, frameIn, frameOut, &frameOpen);
+            }
+        }
+    }
+
+    // If stream ended without the 2 zero blocks (truncated tar), still close whatever was open.
+    if(frameOpen){
+        endFrameAndRecord(ctx, frameIn, frameOut, &frameOpen);
+    }
+
+    if(ctx->frameCount == 0 && !failed(ctx)){
+        fail(ctx, T2SZ_ERROR_FORMAT, "No tar entries found in input. "
+             "If this is not a tar archive use raw mode (-r)");
+    }
+
+    free(chunkBuf);
+}
+
+/**
+ * Reader thread of the pipelined stream path.
+ *
+ * Runs the regular stream framing logic, which hands every frame to
+ * ctx->pool, then tells the writer that no more frames will come.
+ *
+ * @param arg  The compression context.
+ * @return     NULL.
+ */
+static void* streamReaderThread(void *arg){
+    Context *ctx = arg;
+    if(ctx->rawMode){
+        compressStreamRaw(ctx);
+    }else{
+        compressStreamTar(ctx);
+    }
+    framePoolProducerDone(ctx->pool);
+    return NULL;
+}
+
+/* ── Compressed input ──────────────────────────────────────────────────────
+ *
+ * Inputs that are already zstd-compressed, typically a plain .tar.zst, are
+ * recognized by their first magic number and decompressed in-process
+ * instead of through `zstd -d | t2sz -`. A decoder thread runs the
+ * ZSTD_DCtx into a ring of DECODER_CHUNKS chunks, ahead of the compressor,
+ * and decoderRead() replaces the read callback: the stream framing (tar or
+ * raw, serial or pooled) reads the decompressed bytes through readInput()
+ * as if they came from the caller. The dictionary frame at the head of a -D
+ * archive is loaded into the DCtx, so seekable archives can be reframed
+ * too; their seek table and index frames are skipped like any skippable
+ * frame.
+ */
+
+#define DECODER_CHUNKS      4
+#define DECODER_CHUNK_SIZE  ((size_t)1 << 20)
+
+typedef struct {
+    Context* ctx;
+
+    //compressed source: a buffer, or the caller's read callback
+    const uint8_t* src;
+    size_t srcSize;
+    size_t srcPos;
+    T2szReadFn readFn;
+    void* readOpaque;
+    uint8_t peek[sizeof(((Context*)0)->peek)];  //bytes read by sniffZstdInput() before the decoder took over
+    size_t peekLen;
+    size_t peekPos;
+
+    //ring of decompressed chunks; a chunk belongs to the decoder until it
+    //is published (filled++), then to the reader until taken++
+    uint8_t* chunks[DECODER_CHUNKS];
+    size_t chunkLen[DECODER_CHUNKS];
+    size_t filled;          //chunks published by the decoder
+    size_t taken;           //chunks consumed by the reader
+    size_t readPos;         //read position in the oldest published chunk
+    bool done;              //the decoder has published its last chunk
+    bool stop;              //the reader is gone, the decoder must quit
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed; //filled, taken, done or stop changed
+} Decoder;
+
+/**
+ * @return  true if @p p (at least 4 bytes) starts a zstd frame or a
+ *          skippable frame.
+ */
+static bool isZstdMagic(const uint8_t *p){
+    const uint32_t magic = readLE32(p);
+    return magic == ZSTD_MAGICNUMBER || (magic & 0xFFFFFFF0U) == ZSTD_MAGIC_SKIPPABLE_START;
+}
+
+/**
+ * Tell whether the input of the current call is zstd-compressed.
+ *
+ * Buffer inputs are checked in place. For callback inputs the first bytes
+ * are read into ctx->peek, from where readInput() (or the decoder) serves
+ * them again.
+ *
+ * @param ctx  The compression context (inBuff, or readFn and readOpaque).
+ * @return     true if the input must go through the decoder.
+ */
+static bool sniffZstdInput(Context *ctx){
+    if(ctx->noDecompress){
+        return false;
+    }
+    if(ctx->inBuff){
+        return ctx->inBuffSize >= sizeof(ctx->peek) && isZstdMagic(ctx->inBuff);
+    }
+    ctx->peekLen = readInput(ctx, ctx->peek, sizeof(ctx->peek));
+    ctx->peekPos = 0;
+    return ctx->peekLen == sizeof(ctx->peek) && isZstdMagic(ctx->peek);
+}
+
+/**
+ * Read compressed bytes for the decoder: the peeked bytes first, then the
+ * buffer or the caller's read callback. Loops on short reads, like
+ * readInput().
+ *
+ * @param d    The decoder.
+ * @param dst  Destination buffer.
+ * @param n    Capacity of @p dst.
+ * @return     Bytes stored, 0 at the end of the input or on a read error
+ *             (the call is failed).
+ */
+static size_t decoderFill(Decoder *d, uint8_t *dst, const size_t n){
+    size_t got = 0;
+    if(d->peekPos < d->peekLen){
+        got = n < d->peekLen - d->peekPos ? n : d->peekLen - d->peekPos;
+        memcpy(dst, d->peek + d->peekPos, got);
+        d->peekPos += got;
+    }
+    if(d->src){
+        const size_t left = d->srcSize - d->srcPos;
+        const size_t len = n - got < left ? n - got : left;
+        memcpy(dst + got, d->src + d->srcPos, len);
+        d->srcPos += len;
+        return got + len;
+    }
+    while(got < n){
+        const ptrdiff_t r = d->readFn(d->readOpaque, dst + got, n - got);
+        if(r < 0 || (size_t)r > n - got){
+            fail(d->ctx, T2SZ_ERROR_READ, "Read error on input");
+            return 0;
+        }
+        if(r == 0){
+            break;
+        }
+        got += (size_t)r;
+    }
+    return got;
+}
+
+/**
+ * Wait for a free chunk of the ring.
+ *
+ * @param d  The decoder.
+ * @return   The chunk, or NULL if the reader is gone.
+ */
+static uint8_t* decoderAcquire(Decoder *d){
+    pthread_mutex_lock(&d->mutex);
+    while(d->filled - d->taken == DECODER_CHUNKS && !d->stop){
+        pthread_cond_wait(&d->changed, &d->mutex);
+    }
+    uint8_t *chunk = d->stop ? NULL : d->chunks[d->filled % DECODER_CHUNKS];
+    pthread_mutex_unlock(&d->mutex);
+    return chunk;
+}
+
+/**
+ * Hand the chunk being filled to the reader.
+ *
+ * @param d    The decoder.
+ * @param len  Decompressed bytes in the chunk.
+ */
+static void decoderPublish(Decoder *d, const size_t len){
+    pthread_mutex_lock(&d->mutex);
+    d->chunkLen[d->filled % DECODER_CHUNKS] = len;
+    d->filled++;
+    pthread_cond_broadcast(&d->changed);
+    pthread_mutex_unlock(&d->mutex);
+}
+
+/**
+ * Load the dictionary frame that starts a -D archive, if any.
+ *
+ * @param d     The decoder.
+ * @param dctx  The decompression context.
+ * @param in    Input buffer of at least 8 bytes. When the input does not
+ *              start with a dictionary frame, its first bytes are left here.
+ * @return      Bytes left in @p in, for the first ZSTD_decompressStream().
+ */
+static size_t decoderLoadDictionary(Decoder *d, ZSTD_DCtx *dctx, uint8_t *in){
+    Context *ctx = d->ctx;
+    const size_t len = decoderFill(d, in, 8);
+    if(len < 8 || readLE32(in) != (ZSTD_MAGIC_SKIPPABLE_START | 0xD)){
+        return len;
+    }
+
+    const size_t dictSize = readLE32(in + 4);
+    uint8_t *dict = malloc(dictSize ? dictSize : 1);
+    if(!dict){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory loading a %zu-byte dictionary", dictSize);
+        return 0;
+    }
+    if(decoderFill(d, dict, dictSize) < dictSize){
+        fail(ctx, T2SZ_ERROR_FORMAT, "Truncated zstd input");
+    }else{
+        const size_t err = ZSTD_DCtx_loadDictionary(dctx, dict, dictSize);
+        if(ZSTD_isError(err)){
+            fail(ctx, T2SZ_ERROR_FORMAT, "Cannot load the input dictionary: %s", ZSTD_getErrorName(err));
+        }
+    }
+    free(dict);
+    return 0;
+}
+
+/**
+ * Decompress the whole input into the ring.
+ *
+ * @param d     The decoder.
+ * @param dctx  The decompression context.
+ * @param buf   Input buffer of @p cap bytes.
+ * @param cap   Capacity of @p buf.
+ */
+static void decoderRun(Decoder *d, ZSTD_DCtx *dctx, uint8_t *buf, const size_t cap){
+    Context *ctx = d->ctx;
+    ZSTD_inBuffer in = { buf, decoderLoadDictionary(d, dctx, buf), 0 };
+    ZSTD_outBuffer out = { decoderAcquire(d), DECODER_CHUNK_SIZE, 0 };
+    size_t hint = 0;        //0 at the end of a frame, as returned by ZSTD_decompressStream()
+    bool flushing = false;  //the last call filled the chunk, more may be pending in dctx
+    while(out.dst && !failed(ctx)){
+        if(in.pos == in.size && !flushing){
+            in.size = decoderFill(d, buf, cap);
+            in.pos = 0;
+            if(in.size == 0){
+                if(hint != 0 && !failed(ctx)){
+                    fail(ctx, T2SZ_ERROR_FORMAT, "Truncated zstd input");
+                }
+                break;
+            }
+        }
+        const size_t inPos = in.pos;
+        const size_t outPos = out.pos;
+        const size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+        if(ZSTD_isError(ret)){
+            fail(ctx, T2SZ_ERROR_FORMAT, "Corrupted zstd input: %s", ZSTD_getErrorName(ret));
+            break;
+        }
+        if(in.pos != inPos || out.pos != outPos){
+            hint = ret; //an idle call between two frames asks for the next header
+        }
+        flushing = out.pos == out.size;
+        if(flushing){
+            decoderPublish(d, out.pos);
+            out.dst = decoderAcquire(d);
+            out.pos = 0;
+        }
+    }
+    if(out.dst && out.pos && !failed(ctx)){
+        decoderPublish(d, out.pos);
+    }
+}
+
+/**
+ * Decoder thread: decompress the input, then mark the ring as done so that
+ * the reader sees the end of the input (or the failure).
+ *
+ * @param arg  The decoder.
+ * @return     NULL.
+ */
+static void* decoderThread(void *arg){
+    Decoder *d = arg;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    const size_t cap = ZSTD_DStreamInSize();
+    uint8_t *buf = malloc(cap);
+    if(!dctx){
+        fail(d->ctx, T2SZ_ERROR_ZSTD, "Cannot create ZSTD DCtx");
+    }else if(!buf){
+        fail(d->ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating the decoder input buffer");
+    }else{
+        decoderRun(d, dctx, buf, cap);
+    }
+    free(buf);
+    atomic_fetch_add(&d->ctx->threadMemory, ZSTD_sizeof_DCtx(dctx));
+    ZSTD_freeDCtx(dctx);
+
+    pthread_mutex_lock(&d->mutex);
+    d->done = true;
+    pthread_cond_broadcast(&d->changed);
+    pthread_mutex_unlock(&d->mutex);
+    return NULL;
+}
+
+/**
+ * Read callback serving the decompressed input, see T2szReadFn.
+ *
+ * @param opaque  The decoder.
+ * @return        Bytes stored in @p buf, 0 at the end of the input or once
+ *                the decoder has failed.
+ */
+static ptrdiff_t decoderRead(void *opaque, void *buf, size_t len){
+    Decoder *d = opaque;
+    pthread_mutex_lock(&d->mutex);
+    while(d->taken == d->filled && !d->done){
+        pthread_cond_wait(&d->changed, &d->mutex);
+    }
+    const bool empty = d->taken == d->filled;
+    pthread_mutex_unlock(&d->mutex);
+    if(empty){
+        return 0;
+    }
+
+    //the oldest published chunk is ours until taken++
+    const size_t i = d->taken % DECODER_CHUNKS;
+    const size_t left = d->chunkLen[i] - d->readPos;
+    const size_t n = len < left ? len : left;
+    memcpy(buf, d->chunks[i] + d->readPos, n);
+    d->readPos += n;
+    if(d->readPos == d->chunkLen[i]){
+        pthread_mutex_lock(&d->mutex);
+        d->taken++;
+        d->readPos = 0;
+        pthread_cond_broadcast(&d->changed);
+        pthread_mutex_unlock(&d->mutex);
+    }
+    return (ptrdiff_t)n;
+}
+
+/**
+ * Start decompressing the input of the current call and make the stream
+ * path read the decompressed bytes.
+ *
+ * Takes over the input (ctx->inBuff, or readFn with the peeked bytes) and
+ * points ctx->readFn at decoderRead().
+ *
+ * @param d    The decoder, initialized here.
+ * @param ctx  The compression context.
+ * @return     false on failure (the call is failed, nothing to release).
+ */
+static bool decoderStart(Decoder *d, Context *ctx){
+    memset(d, 0, sizeof(*d));
+    d->ctx = ctx;
+    for(size_t i = 0; i < DECODER_CHUNKS; i++){
+        d->chunks[i] = malloc(DECODER_CHUNK_SIZE);
+        if(!d->chunks[i]){
+            for(size_t j = 0; j < i; j++){
+                free(d->chunks[j]);
+            }
+            return fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating the decoder buffers");
+        }
+    }
+    if(ctx->inBuff){
+        d->src = ctx->inBuff;
+        d->srcSize = ctx->inBuffSize;
+    }else{
+        d->readFn = ctx->readFn;
+        d->readOpaque = ctx->readOpaque;
+        memcpy(d->peek, ctx->peek, ctx->peekLen);
+        d->peekLen = ctx->peekLen;
+    }
+    pthread_mutex_init(&d->mutex, NULL);
+    pthread_cond_init(&d->changed, NULL);
+    if(pthread_create(&d->thread, NULL, decoderThread, d) != 0){
+        pthread_cond_destroy(&d->changed);
+        pthread_mutex_destroy(&d->mutex);
+        for(size_t i = 0; i < DECODER_CHUNKS; i++){
+            free(d->chunks[i]);
+        }
+        return fail(ctx, T2SZ_ERROR_THREAD, "Cannot create decoder thread");
+    }
+
+    ctx->inBuff = NULL;
+    ctx->inBuffSize = 0;
+    ctx->peekLen = 0;
+    ctx->readFn = decoderRead;
+    ctx->readOpaque = d;
+    if(ctx->verbose){
+        fprintf(stderr, "# ZSTD INPUT (decompressing on a separate thread)\n\n");
+    }
+    return true;
+}
+
+/**
+ * Stop the decoder, which may still be running when the tar framing has
+ * found the end of the archive, and release it.
+ *
+ * @param d  The decoder.
+ */
+static void decoderStop(Decoder *d){
+    pthread_mutex_lock(&d->mutex);
+    d->stop = true;
+    pthread_cond_broadcast(&d->changed);
+    pthread_mutex_unlock(&d->mutex);
+    pthread_join(d->thread, NULL);
+
+    pthread_cond_destroy(&d->changed);
+    pthread_mutex_destroy(&d->mutex);
+    for(size_t i = 0; i < DECODER_CHUNKS; i++){
+        free(d->chunks[i]);
+    }
+}
+
+/* ── Frame planner ─────────────────────────────────────────────────────────
+ *
+ * For mapped inputs the frame boundaries are decided up front, from the tar
+ * headers alone (or from the input size in raw mode), and stored as an
+ * array of FramePlanEntry in the context. The compressor then only walks
+ * the plan, and --plan prints it without compressing anything. Planning
+ * touches one page per tar member, so it runs in seconds even on archives
+ * that take hours to compress.
+ */
+
+/**
+ * Append a frame descriptor to the plan, growing the array as needed.
+ *
+ * Doubles the capacity (starting from 1024), like seekTableEnsureCap().
+ *
+ * @param ctx          The compression context owning the plan.
+ * @param offset       Offset of the first input byte of the frame.
+ * @param size         Number of input bytes in the frame.
+ * @param firstMember  Index of the tar member the frame starts in.
+ * @param members      Number of tar headers inside the frame.
+ * @return             false when out of memory.
+ */
+static bool planAdd(Context *ctx, const uint64_t offset, const uint64_t size,
+                    const uint64_t firstMember, const uint32_t members){
+    if(ctx->planLen == ctx->planCap){
+        const size_t newCap = ctx->planCap ? ctx->planCap * 2 : 1024;
+        FramePlanEntry *p = realloc(ctx->plan, newCap * sizeof(FramePlanEntry));
+        if(!p){
+            return fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory while growing frame plan");
+        }
+        ctx->plan = p;
+        ctx->planCap = newCap;
+    }
+    FramePlanEntry *e = &ctx->plan[ctx->planLen++];
+    e->offset = offset;
+    e->size = size;
+    e->firstMember = firstMember;
+    e->members = members;
+    return true;
+}
+
+/**
+ * Split the mapped input into frames.
+ *
+ * In raw mode the input is cut into -s sized frames, or kept whole without
+ * -s, or cut by content with --cdc. In tar mode whole members (header + padded payload) are accumulated
+ * until the frame reaches minBlockSize, and members bigger than
+ * maxBlockSize are split into maxBlockSize chunks. PAX and GNU long-name
+ * headers never end a frame, so they share it with the member they
+ * describe. Trailing zero blocks are kept in the last frame so the output
+ * decompresses to the exact input.
+ *
+ * Fails on invalid or truncated tar headers, and on tar inputs without
+ * any member. With -v each member and each frame boundary is listed on
+ * stderr.
+ *
+ * @param ctx  The compression context (reads inBuff, inBuffSize, rawMode,
+ *             minBlockSize, maxBlockSize, verbose; writes plan, planLen,
+ *             planMembers).
+ * @return     false on error.
+ */
+static bool planFrames(Context *ctx){
+    ctx->planLen = 0;
+    ctx->planMembers = 0;
+
+    if(ctx->rawMode){
+        const size_t frameSize = ctx->minBlockSize ? ctx->minBlockSize : ctx->inBuffSize;
+        size_t offset = 0;
+        do{
+            const size_t remaining = ctx->inBuffSize - offset;
+            const size_t blockSize = ctx->cdcAverage ? cdcCut(ctx, ctx->inBuff + offset, remaining)
+                                                     : remaining < frameSize ? remaining : frameSize;
+            if(ctx->verbose){
+                fprintf(stderr, "# END OF BLOCK (%zu, %zu)\n\n", blockSize, offset + blockSize);
+            }
+            if(!planAdd(ctx, offset, blockSize, 0, 0)){
+                return false;
+            }
+            offset += blockSize;
+            releaseInput(ctx, offset);
+        }while(offset < ctx->inBuffSize);
+        return true;
+    }
+
+    size_t tarHeaderIdx = 0;
+    size_t frameStart = 0;
+    bool lastChunk = false;
+    size_t residual = 0;
+    while(!lastChunk){
+        size_t blockSize = 0;
+        // A frame that starts inside a split member belongs to that member.
+        const uint64_t firstMember = residual ? ctx->planMembers - 1 : ctx->planMembers;
+        uint32_t members = 0;
+        bool extension = false;     //last header describes the next member, keep going
+        do{
+            if(residual){
+                if(residual > ctx->maxBlockSize){
+                    blockSize = ctx->maxBlockSize;
+                    residual = residual - ctx->maxBlockSize;
+                }else{
+                    blockSize = residual;
+                    residual = 0;
+                }
+            }else if(tarHeaderIdx + 512 > ctx->inBuffSize){
+                // Not enough data for a full header — truncated archive.
+                lastChunk = true;
+                break;
+            }else if(!isZeroTarBlock(&ctx->inBuff[tarHeaderIdx])){//tar ends with null headers that we can skip
+                TarHeader *header = (TarHeader *)&ctx->inBuff[tarHeaderIdx];
+                if(isTarHeader(header)){
+                    const size_t memberSize = parseTarSize(header);
+                    size_t size = memberSize;
+                    if(size > SIZE_MAX - 1024){
+                        return fail(ctx, T2SZ_ERROR_FORMAT, "Invalid tar entry size (too large)");
+                    }
+
+                    const size_t mod = size%512;
+                    if(mod){
+                        size = size - mod + 512;
+                    }
+
+                    // Header, then the sparse map extension blocks of a
+                    // GNU sparse member.
+                    size_t headerBlocks = 512;
+                    bool sparse = tarSparseContinues(&ctx->inBuff[tarHeaderIdx], true);
+                    while(sparse){
+                        if(tarHeaderIdx + headerBlocks + 512 > ctx->inBuffSize){
+                            return fail(ctx, T2SZ_ERROR_FORMAT, "Truncated sparse map of tar entry \"%.*s\"",
+                                        (int)sizeof(header->name), header->name);
+                        }
+                        sparse = tarSparseContinues(&ctx->inBuff[tarHeaderIdx + headerBlocks], false);
+                        headerBlocks += 512;
+                    }
+
+                    // Check that the complete entry (header + padded
+                    // payload) fits within the mapped buffer.
+                    const size_t remainingInBuf = ctx->inBuffSize - tarHeaderIdx;
+                    if(size > remainingInBuf - headerBlocks){
+                        return fail(ctx, T2SZ_ERROR_FORMAT,
+                                    "Truncated tar entry \"%.*s\" "
+                                    "(expected %zu bytes, only %zu remain)",
+                                    (int)sizeof(header->name), header->name,
+                                    size + headerBlocks, remainingInBuf);
+                    }
+                    const size_t toNextHeader = size + headerBlocks;
+
+                    if(indexing(ctx)){
+                        if(header->typeflag == 'L' || header->typeflag == 'x'){
+                            indexLongName(ctx, header->typeflag, &ctx->inBuff[tarHeaderIdx + 512], memberSize);
+                        }else if(header->typeflag != 'g' && header->typeflag != 'K'){
+                            indexAdd(ctx, header, memberSize, tarHeaderIdx + headerBlocks);
+                        }
+                        if(failed(ctx)){
+                            return false;
+                        }
+                    }
+
+                    tarHeaderIdx += toNextHeader;
+                    blockSize += toNextHeader;
+                    members++;
+                    ctx->planMembers++;
+                    extension = isTarExtension(header);
+                    releaseInput(ctx, tarHeaderIdx);
+
+                    if(ctx->maxBlockSize && blockSize > ctx->maxBlockSize){
+                        residual = blockSize - ctx->maxBlockSize;
+                        blockSize = ctx->maxBlockSize;
+                    }
+
+                    if(ctx->verbose){
+                        fprintf(stderr, "+ %.100s (%zu)\n", header->name, size);
+                    }
+                }else{
+                    return failTarHeader(ctx, header);
+                }
+            }else{
+                if(ctx->verbose){
+                    fprintf(stderr, "+ <null>\n");
+                }
+                tarHeaderIdx+=512;
+                blockSize += 512;
+                extension = false;
+            }
+            lastChunk = tarHeaderIdx >= ctx->inBuffSize;
+        }while((blockSize < ctx->minBlockSize || (extension && !residual)) && !lastChunk);
+
+        // If no data was accumulated (e.g., the truncation guard fired
+        // on the first iteration with no prior headers), do not plan a
+        // spurious empty frame.
+        if(blockSize == 0){
+            break;
+        }
+
+        if(ctx->verbose){
+            fprintf(stderr, "# END OF BLOCK (%zu, %zu)\n\n", blockSize, tarHeaderIdx);
+        }
+
+        if(blockSize > ctx->inBuffSize - frameStart){
+            return fail(ctx, T2SZ_ERROR_FORMAT, "Malformed or truncated tar archive (block extends past end of input)");
+        }
+
+        if(!planAdd(ctx, frameStart, blockSize, firstMember, members)){
+            return false;
+        }
+        frameStart += blockSize;
+    }
+
+    if(ctx->planLen == 0){
+        return fail(ctx, T2SZ_ERROR_FORMAT, "No tar entries found in input. "
+                    "If this is not a tar archive use raw mode (-r)");
+    }
+    return true;
+}
+
+/* ── Automatic block sizes (--auto-block) ──────────────────────────────────
+ *
+ * Small frames make random reads cheap, big frames compress better; where
+ * the trade-off lands depends on the data. Instead of repeated full runs,
+ * a few windows spread over the input are trial-compressed, cut into
+ * frames of each candidate size: powers of 4 from 16 KiB up to the zstd
+ * window of the level, the last one standing for solid compression (a
+ * frame larger than the window hardly compresses better). The smallest
+ * candidate whose ratio is within autoRatioLoss percent of the solid ratio
+ * is chosen, among the candidates of at most autoMaxRead bytes (which is
+ * a candidate itself when below 16 KiB); if none is, the largest of those.
+ *
+ * Trials use fixed-size frames, in tar mode too, and the requested level
+ * capped at AUTO_TRIAL_MAX_LEVEL with the window of the requested level,
+ * so that tuning takes seconds even at -l 19. In tar mode the chosen size
+ * becomes -s and autoMaxRead (or 4 times -s) becomes -S, so that a large
+ * member does not make a frame that breaks the target.
+ */
+
+#define AUTO_MIN_FRAME        ((size_t)16 << 10)
+#define AUTO_MIN_WINDOW       ((size_t)1 << 20)
+#define AUTO_MAX_WINDOW       ((size_t)8 << 20)
+#define AUTO_WINDOWS          4
+#define AUTO_TRIAL_MAX_LEVEL  9
+#define AUTO_DEFAULT_LOSS     1.0   //percent, when only autoMaxRead is given
+
+/* windowLog of libzstd's default parameters for large inputs, per level
+ * (ZSTD_getCParams() is not part of the stable API). */
+static const uint8_t autoWindowLog[23] = {
+    0, 19, 20, 21, 21, 21, 21, 21, 22, 22, 22, 22, 22, 22, 22, 22, 22, 23, 23, 23, 25, 26, 27
+};
+
+/**
+ * Compressed size of the sample windows, each cut into frames of
+ * @p frameSize bytes.
+ *
+ * @param ctx        The compression context (reads inBuff).
+ * @param cctx       Trial context, parameters set.
+ * @param offsets    Offsets of the windows in the input.
+ * @param nbWindows  Number of windows.
+ * @param window     Size of every window.
+ * @param frameSize  Frame size to try.
+ * @param dst        Scratch buffer of ZSTD_compressBound(@p window) bytes.
+ * @return           The compressed size, 0 on error (the call is failed).
+ */
+static uint64_t autoTrial(Context *ctx, ZSTD_CCtx *cctx, const size_t *offsets, const size_t nbWindows,
+                          const size_t window, const size_t frameSize, void *dst){
+    uint64_t total = 0;
+    for(size_t w = 0; w < nbWindows; w++){
+        for(size_t pos = 0; pos < window; pos += frameSize){
+            const size_t n = window - pos < frameSize ? window - pos : frameSize;
+            const size_t res = ZSTD_compress2(cctx, dst, ZSTD_compressBound(window),
+                                              ctx->inBuff + offsets[w] + pos, n);
+            if(ZSTD_isError(res)){
+                fail(ctx, T2SZ_ERROR_ZSTD, "Trial compression failed: %s", ZSTD_getErrorName(res));
+                return 0;
+            }
+            total += res;
+        }
+    }
+    return total;
+}
+
+/**
+ * Choose minBlockSize and maxBlockSize for the buffer input by trial
+ * compression, see above. Records the choice in the statistics and, with
+ * -v, lists the trials on stderr.
+ *
+ * @param ctx  The compression context (reads inBuff, inBuffSize, level,
+ *             rawMode and the auto-block targets; writes minBlockSize,
+ *             maxBlockSize).
+ * @return     false on error.
+ */
+static bool autoBlockSizes(Context *ctx){
+    const uint64_t start = statsClock(ctx);
+    const int windowLog = autoWindowLog[ctx->level];
+    size_t window = (size_t)1 << windowLog;
+    window = window < AUTO_MIN_WINDOW ? AUTO_MIN_WINDOW : window > AUTO_MAX_WINDOW ? AUTO_MAX_WINDOW : window;
+    if(window > ctx->inBuffSize){
+        window = ctx->inBuffSize;
+    }
+    size_t nbWindows = ctx->inBuffSize / window < AUTO_WINDOWS ? ctx->inBuffSize / window : AUTO_WINDOWS;
+    size_t offsets[AUTO_WINDOWS];
+    for(size_t w = 0; w < nbWindows; w++){
+        offsets[w] = nbWindows > 1 ? (size_t)((uint64_t)(ctx->inBuffSize - window) * w / (nbWindows - 1)) : 0;
+    }
+
+    //candidates, ascending; the last one is the solid reference
+    size_t sizes[16];
+    size_t nbSizes = 0;
+    const size_t limit = ctx->autoMaxRead ? ctx->autoMaxRead : SIZE_MAX;
+    if(limit < AUTO_MIN_FRAME && limit < window){
+        sizes[nbSizes++] = limit;
+    }
+    for(size_t c = AUTO_MIN_FRAME; c < window; c *= 4){
+        sizes[nbSizes++] = c;
+    }
+    sizes[nbSizes++] = window;
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    void *dst = malloc(ZSTD_compressBound(window));
+    if(!cctx || !dst){
+        ZSTD_freeCCtx(cctx);
+        free(dst);
+        return fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory for trial compression");
+    }
+    const int level = ctx->level < AUTO_TRIAL_MAX_LEVEL ? ctx->level : AUTO_TRIAL_MAX_LEVEL;
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, windowLog);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+
+    uint64_t trials[16];
+    for(size_t i = 0; i < nbSizes && !failed(ctx); i++){
+        trials[i] = autoTrial(ctx, cctx, offsets, nbWindows, window, sizes[i], dst);
+    }
+    ZSTD_freeCCtx(cctx);
+    free(dst);
+    if(failed(ctx)){
+        return false;
+    }
+
+    //the smallest candidate within the loss, else the largest within the limit
+    const double loss = ctx->autoRatioLoss ? ctx->autoRatioLoss : AUTO_DEFAULT_LOSS;
+    const double bound = (double)trials[nbSizes - 1] / (1 - loss / 100);
+    size_t chosen = 0;
+    for(size_t i = 0; i < nbSizes && sizes[i] <= limit; i++){
+        chosen = i;
+        if((double)trials[i] <= bound){
+            break;
+        }
+    }
+    const uint64_t sample = (uint64_t)window * nbWindows;
+    if(ctx->verbose){
+        fprintf(stderr, "# auto-block: %zu windows of %zu bytes, level %d\n", nbWindows, window, level);
+        for(size_t i = 0; i < nbSizes; i++){
+            fprintf(stderr, "#   %10zu  ratio %.3f%s%s\n", sizes[i], (double)sample / (double)trials[i],
+                    i == nbSizes - 1 ? "  (solid)" : "", i == chosen ? "  <-" : "");
+        }
+    }
+
+    const size_t minSize = sizes[chosen];
+    ctx->minBlockSize = minSize;
+    ctx->maxBlockSize = ctx->rawMode ? 0 : ctx->autoMaxRead ? ctx->autoMaxRead : minSize * 4;
+    if(ctx->collectStats){
+        ctx->stats.autoSampleBytes = sample;
+        ctx->stats.autoRatio = (double)sample / (double)trials[chosen];
+        ctx->stats.autoSolidRatio = (double)sample / (double)trials[nbSizes - 1];
+    }
+    statsSince(ctx, &ctx->stats.autoNs, start);
+    return true;
+}
+
+/* ── Dictionary (-D) ───────────────────────────────────────────────────────
+ *
+ * Small members compressed one per frame start cold and compress poorly.
+ * With -D a dictionary is trained from a sample of the planned frames and
+ * every frame is compressed with it, which keeps per-member seekability at
+ * close to solid ratios. The dictionary is stored in a skippable frame
+ * (magic 0x184D2A5E | 0xD) at the head of the archive, recorded in the seek
+ * table with a decompressed size of 0 so that frame offsets stay exact.
+ */
+
+#define DICT_MAX_SAMPLE_SIZE      ((size_t)128 << 10)  //longer samples add nothing to training
+#define DICT_SAMPLE_BUDGET_FACTOR 100                  //sample bytes per dictionary byte
+
+/**
+ * Train a dictionary from the planned frames of a mapped input.
+ *
+ * Takes the first DICT_MAX_SAMPLE_SIZE bytes of each frame as a sample.
+ * When the samples exceed DICT_SAMPLE_BUDGET_FACTOR times the dictionary
+ * capacity, only every n-th frame is sampled, so the sample still spans
+ * the whole archive. If training fails (e.g. too few frames)
+ * T2SZ_WARNING_DICTIONARY is raised and compression continues without a
+ * dictionary.
+ *
+ * @param ctx  The compression context (reads plan, inBuff, dictCapacity,
+ *             verbose; writes dictBuff, dictSize).
+ */
+static void trainDictionary(Context *ctx){
+    uint64_t total = 0;
+    for(size_t i = 0; i < ctx->planLen; i++){
+        total += ctx->plan[i].size < DICT_MAX_SAMPLE_SIZE ? ctx->plan[i].size : DICT_MAX_SAMPLE_SIZE;
+    }
+    const uint64_t budget = (uint64_t)ctx->dictCapacity * DICT_SAMPLE_BUDGET_FACTOR;
+    const size_t stride = total > budget ? (size_t)((total + budget - 1) / budget) : 1;
+
+    size_t samplesCap = 0;
+    for(size_t i = 0; i < ctx->planLen; i += stride){
+        samplesCap += ctx->plan[i].size < DICT_MAX_SAMPLE_SIZE ? (size_t)ctx->plan[i].size : DICT_MAX_SAMPLE_SIZE;
+    }
+
+    const size_t maxSamples = (ctx->planLen + stride - 1) / stride;
+    size_t *sampleSizes = malloc((maxSamples ? maxSamples : 1) * sizeof(size_t));
+    uint8_t *samples = malloc(samplesCap ? samplesCap : 1);
+    void *dict = malloc(ctx->dictCapacity);
+    if(!sampleSizes || !samples || !dict){
+        free(sampleSizes);
+        free(samples);
+        free(dict);
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating dictionary samples");
+        return;
+    }
+
+    size_t nbSamples = 0;
+    size_t samplesLen = 0;
+    for(size_t i = 0; i < ctx->planLen; i += stride){
+        const size_t n = ctx->plan[i].size < DICT_MAX_SAMPLE_SIZE ? (size_t)ctx->plan[i].size : DICT_MAX_SAMPLE_SIZE;
+        memcpy(samples + samplesLen, ctx->inBuff + ctx->plan[i].offset, n);
+        samplesLen += n;
+        sampleSizes[nbSamples++] = n;
+    }
+
+    const size_t res = ZDICT_trainFromBuffer(dict, ctx->dictCapacity, samples, sampleSizes, (unsigned)nbSamples);
+    free(samples);
+    free(sampleSizes);
+    if(ZDICT_isError(res)){
+        warn(ctx, T2SZ_WARNING_DICTIONARY, "Unable to train a dictionary (%s). Compressing without it.", ZDICT_getErrorName(res));
+        free(dict);
+        return;
+    }
+
+    ctx->dictBuff = dict;
+    ctx->dictSize = res;
+    if(ctx->verbose){
+        fprintf(stderr, "# DICTIONARY (%zu bytes, %zu samples, %zu sample bytes)\n\n", res, nbSamples, samplesLen);
+    }
+}
+
+/**
+ * Write the trained dictionary as a skippable frame at the current output
+ * position and record it in the seek table with a decompressed size of 0.
+ *
+ * Layout: Skippable_Magic_Number (0x184D2A5E | 0xD), Frame_Size, followed
+ * by the dictionary exactly as produced by ZDICT (it starts with the
+ * dictionary magic and ID, so it can be passed to zstd -D as is).
+ *
+ * @param ctx  The compression context (reads dictBuff, dictSize).
+ */
+static void writeDictionaryFrame(Context *ctx){
+    uint8_t buf[4];
+    //Skippable_Magic_Number
+    writeLE32(buf, ZSTD_MAGIC_SKIPPABLE_START | 0xD);
+    writeOutput(ctx, buf, 4);
+
+    //Frame_Size
+    writeLE32(buf, (uint32_t)ctx->dictSize);
+    writeOutput(ctx, buf, 4);
+
+    //User_Data
+    writeOutput(ctx, ctx->dictBuff, ctx->dictSize);
+
+    seekTableAdd(ctx, 8 + ctx->dictSize, 0);
+}
+
+/**
+ * Finalize output after all frames have been compressed.
+ *
+ * Writes the member index (with -i) and the seek table (unless disabled)
+ * if the call has not failed, then releases the dictionary. The seek
+ * table, index and plan arrays, the zstd context and the output buffer
+ * stay allocated for the next archive.
+ *
+ * @param ctx  The compression context.
+ */
+static void finishCompression(Context *ctx){
+    const uint64_t fast = atomic_load(&ctx->fastFrames);
+    if(ctx->verbose && fast){
+        fprintf(stderr, "# %" PRIu64 " incompressible frames compressed at level %d\n", fast, FAST_PATH_LEVEL);
+    }
+    if(!failed(ctx) && indexing(ctx) && !ctx->skipSeekTable){
+        writeIndexFrame(ctx);
+    }
+    if(!failed(ctx) && !ctx->skipSeekTable){
+        writeSeekTable(ctx);
+    }
+    verifyFinish(ctx);
+    if(ctx->collectStats){
+        ctx->stats.outputBytes = ctx->outputBytes;
+        ctx->stats.minBlockSize = ctx->minBlockSize;
+        ctx->stats.maxBlockSize = ctx->maxBlockSize;
+        ctx->stats.zstdMemory = atomic_load(&ctx->threadMemory) + ZSTD_sizeof_CCtx(ctx->cctx) +
+                                ZSTD_sizeof_CCtx(ctx->fastCctx) + ZSTD_sizeof_CDict(ctx->cdict);
+        statsSince(ctx, &ctx->stats.wallNs, ctx->statsStart);
+    }
+    free(ctx->pendingName);    ctx->pendingName = NULL;
+    ZSTD_freeCDict(ctx->cdict); ctx->cdict = NULL;
+    free(ctx->dictBuff);       ctx->dictBuff = NULL;
+    ctx->dictSize = 0;
+}
+
+static bool appendStart(Context *ctx);
+static void appendWriteTail(Context *ctx);
+static bool resumeStart(Context *ctx);
+
+/**
+ * Compression driver for buffer inputs.
+ *
+ * planFrames() first splits the input buffer into independently
+ * compressed frames according to minBlockSize / maxBlockSize and tar
+ * header boundaries, then each planned frame is compressed in order.
+ * Planning comes first, so an invalid archive is rejected before
+ * anything reaches the sink. With -T >= 2 and more than one frame,
+ * frames are handed to a FramePool and compressed concurrently. When
+ * resuming, the frames already in the output are skipped.
+ *
+ * @param ctx  The compression context (reads inBuff, inBuffSize and the
+ *             options).
+ */
+static void compressPlanned(Context *ctx){
+    if(ctx->append && !appendStart(ctx)){
+        return;
+    }
+    if(ctx->append && ctx->checkpointFn){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Checkpoints can't be taken while appending");
+        return;
+    }
+    if(ctx->autoBlock && !autoBlockSizes(ctx)){
+        return;
+    }
+    const uint64_t planStart = statsClock(ctx);
+    const bool planned = planFrames(ctx);
+    releaseInputPass(ctx);
+    if(!planned){
+        return;
+    }
+    statsSince(ctx, &ctx->stats.headerNs, planStart);
+    if(ctx->resume && !resumeStart(ctx)){
+        return;
+    }
+    const size_t first = (size_t)ctx->framesWritten;
+    atomic_store(&ctx->progressTotal, ctx->inBuffSize + ctx->appendTailSize);
+    atomic_store(&ctx->progressResumed, first < ctx->planLen ? ctx->plan[first].offset : ctx->inBuffSize);
+    atomic_store(&ctx->progressIn, atomic_load(&ctx->progressResumed));
+    atomic_store(&ctx->progressOut, ctx->outputBytes);
+    if(ctx->dictCapacity && !ctx->append && !ctx->resume){
+        trainDictionary(ctx);
+        releaseInputPass(ctx);
+    }
+    if(failed(ctx) || !prepareCctx(ctx) || !verifyStart(ctx)){
+        finishCompression(ctx);
+        return;
+    }
+
+    if(ctx->append){
+        appendWriteTail(ctx);
+    }else if(ctx->dictBuff && !ctx->resume){
+        writeDictionaryFrame(ctx);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ctx->lastCheckpoint);
+
+    // The frame pool needs at least two threads to pay off and more than
+    // one frame: a single frame, like raw input without -s, is better
+    // served by libzstd's own multi-threading.
+    if(ctx->workers > 1 && ctx->planLen - first > 1){
+        ctx->pool = framePoolCreate(ctx, ctx->workers, true);
+    }
+
+    for(size_t i = first; i < ctx->planLen && !failed(ctx); i++){
+        const uint8_t *src = ctx->inBuff + ctx->plan[i].offset;
+        const size_t blockSize = (size_t)ctx->plan[i].size;
+
+        if(ctx->pool){
+            framePoolSubmit(ctx->pool, src, blockSize);
+        }else{
+            const uint64_t compressedSize = zstdCompressBufferToFrame(ctx, src, blockSize);
+            seekTableAdd(ctx, compressedSize, blockSize);
+            checkpointFrameWritten(ctx);
+        }
+        ctx->frameCount++;
+    }
+
+    if(ctx->pool){
+        framePoolFinish(ctx->pool);
+        ctx->pool = NULL;
+    }
+
+    finishCompression(ctx);
+    releaseInputPass(ctx);
+}
+
+/**
+ * Compression driver for callback inputs, and for zstd-compressed inputs
+ * of any kind.
+ *
+ * Dispatches to compressStreamRaw() or compressStreamTar(). With -T >= 2
+ * these run on a reader thread feeding a FramePool while the calling
+ * thread writes the compressed frames in order. A zstd-compressed input
+ * is decompressed by a decoder thread in front of them.
+ *
+ * @param ctx  The compression context (reads readFn and readOpaque, or a
+ *             zstd-compressed inBuff, and the options).
+ */
+static void compressStreamed(Context *ctx){
+    if(ctx->append && !appendStart(ctx)){
+        return;
+    }
+    const bool compressed = sniffZstdInput(ctx);
+    if(failed(ctx)){
+        finishCompression(ctx);
+        return;
+    }
+    if(ctx->dictCapacity && !ctx->append){
+        fail(ctx, T2SZ_ERROR_PARAMETER, compressed ? "-D can't be used on a zstd-compressed input"
+                                                   : "-D requires a seekable input file");
+        return;
+    }
+    if(ctx->checkpointFn || ctx->resume){
+        fail(ctx, T2SZ_ERROR_PARAMETER, compressed ? "Checkpoints can't be used on a zstd-compressed input"
+                                                   : "Checkpoints require a seekable input file");
+        return;
+    }
+    if(ctx->autoBlock){
+        fail(ctx, T2SZ_ERROR_PARAMETER, compressed ? "--auto-block can't be used on a zstd-compressed input"
+                                                   : "--auto-block requires a seekable input file");
+        return;
+    }
+    Decoder decoder;
+    if(compressed && !decoderStart(&decoder, ctx)){
+        finishCompression(ctx);
+        return;
+    }
+    if(!prepareCctx(ctx) || !verifyStart(ctx)){
+        if(compressed){
+            decoderStop(&decoder);
+        }
+        finishCompression(ctx);
+        return;
+    }
+    if(ctx->append){
+        appendWriteTail(ctx);
+    }
+
+    if(ctx->workers > 1){
+        // Pipelined: a reader thread frames the input into the pool while
+        // this thread writes the compressed frames in order.
+        ctx->pool = framePoolCreate(ctx, ctx->workers, false);
+        if(ctx->pool){
+            pthread_t reader;
+            if(pthread_create(&reader, NULL, streamReaderThread, ctx) != 0){
+                fail(ctx, T2SZ_ERROR_THREAD, "Cannot create reader thread");
+            }else{
+                framePoolDrain(ctx->pool);
+                pthread_join(reader, NULL);
+            }
+
+            framePoolFinish(ctx->pool);
+            ctx->pool = NULL;
+        }
+    }else if(ctx->rawMode){
+        compressStreamRaw(ctx);
+    }else{
+        compressStreamTar(ctx);
+    }
+
+    if(compressed){
+        decoderStop(&decoder);
+    }
+    finishCompression(ctx);
+}
+
+/* ── Archive reader ────────────────────────────────────────────────────────
+ *
+ * Random access to the decompressed content of a seekable archive, driven
+ * by the seek table written by writeSeekTable(). A read position maps to a
+ * single frame through the decompressed offsets; only that frame is
+ * decompressed, and only up to the bytes actually requested. Frames are
+ * never decompressed just to be skipped, so reaching any position costs at
+ * most one partial frame.
+ */
+
+typedef struct {
+    Context* ctx;           //receives the errors
+    const uint8_t* buff;    //mapped archive
+    size_t buffSize;
+
+    size_t frames;          //seek table entries
+    uint64_t* cOffsets;     //compressed start of each frame, frames + 1 entries
+    uint64_t* dOffsets;     //decompressed start of each frame, frames + 1 entries
+
+    ZSTD_DCtx* dctx;
+    ZSTD_DDict* ddict;      //dictionary stored by -D, NULL if none
+
+    const uint8_t* index;   //entries of the member index written by -i, NULL if none
+    size_t indexMembers;
+    const uint8_t* indexNames;
+    size_t indexNamesSize;
+
+    size_t frame;           //frame being decompressed, frames when none
+    uint64_t pos;           //decompressed position of the next byte
+    ZSTD_inBuffer in;       //remaining compressed bytes of the current frame
+    uint8_t* scratch;       //sink for bytes skipped inside a frame
+    size_t scratchSize;
+} ArchiveReader;
+
+/**
+ * Parse the seek table of a mapped archive and prepare for reading.
+ *
+ * Accepts seek tables with or without per-frame checksums (descriptor bit
+ * 7) and requires the compressed sizes to add up exactly to the start of
+ * the seek table. Loads the -D dictionary when the first frame is the
+ * dictionary skippable frame. Fails if the archive has no valid seek
+ * table (e.g. it was written with -j).
+ *
+ * @param r         Reader to initialize. Release it with archiveClose()
+ *                  even on failure.
+ * @param ctx       Context receiving the errors.
+ * @param buff      The mapped archive.
+ * @param buffSize  Size of the mapped archive.
+ * @return          false on error.
+ */
+static bool archiveOpen(ArchiveReader *r, Context *ctx, const uint8_t *buff, const size_t buffSize){
+    memset(r, 0, sizeof(*r));
+    r->ctx = ctx;
+    r->buff = buff;
+    r->buffSize = buffSize;
+
+    if(buffSize < 17 || readLE32(buff + buffSize - 4) != 0x8F92EAB1){
+        return fail(ctx, T2SZ_ERROR_FORMAT, "No seek table found. The archive was not created by t2sz, or was created with -j");
+    }
+    const uint8_t descriptor = buff[buffSize - 5];
+    const size_t entrySize = (descriptor & 0x80) ? 12 : 8;
+    const size_t frames = readLE32(buff + buffSize - 9);
+    if((uint64_t)frames * entrySize + 17 > buffSize){
+        return fail(ctx, T2SZ_ERROR_FORMAT, "Corrupted seek table (too many frames)");
+    }
+    const size_t tableStart = buffSize - 9 - frames * entrySize - 8;
+    if(readLE32(buff + tableStart) != (ZSTD_MAGIC_SKIPPABLE_START | 0xE) ||
+       readLE32(buff + tableStart + 4) != frames * entrySize + 9){
+        return fail(ctx, T2SZ_ERROR_FORMAT, "Corrupted seek table (bad skippable frame header)");
+    }
+
+    r->frames = frames;
+    r->cOffsets = malloc((frames + 1) * sizeof(uint64_t));
+    r->dOffsets = malloc((frames + 1) * sizeof(uint64_t));
+    r->scratchSize = ZSTD_DStreamOutSize();
+    r->scratch = malloc(r->scratchSize);
+    if(!r->cOffsets || !r->dOffsets || !r->scratch){
+        return fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory loading the seek table");
+    }
+
+    const uint8_t *e = buff + tableStart + 8;
+    r->cOffsets[0] = 0;
+    r->dOffsets[0] = 0;
+    for(size_t i = 0; i < frames; i++, e += entrySize){
+        r->cOffsets[i + 1] = r->cOffsets[i] + readLE32(e);
+        r->dOffsets[i + 1] = r->dOffsets[i] + readLE32(e + 4);
+    }
+    if(r->cOffsets[frames] != tableStart){
+        return fail(ctx, T2SZ_ERROR_FORMAT, "Corrupted seek table (frame sizes do not match the archive)");
+    }
+
+    r->dctx = ZSTD_createDCtx();
+    if(r->dctx == NULL){
+        return fail(ctx, T2SZ_ERROR_ZSTD, "Cannot create ZSTD DCtx");
+    }
+
+    if(frames && r->dOffsets[1] == 0 && r->cOffsets[1] > 8 &&
+       readLE32(buff) == (ZSTD_MAGIC_SKIPPABLE_START | 0xD)){
+        r->ddict = ZSTD_createDDict(buff + 8, (size_t)r->cOffsets[1] - 8);
+        if(r->ddict == NULL){
+            return fail(ctx, T2SZ_ERROR_FORMAT, "Cannot load the archive dictionary");
+        }
+        const size_t err = ZSTD_DCtx_refDDict(r->dctx, r->ddict);
+        if(ZSTD_isError(err)){
+            return fail(ctx, T2SZ_ERROR_ZSTD, "Cannot reference dictionary: %s", ZSTD_getErrorName(err));
+        }
+    }
+
+    // The member index, if any, is the last frame before the seek table.
+    if(frames && r->dOffsets[frames] == r->dOffsets[frames - 1] && r->cOffsets[frames] - r->cOffsets[frames - 1] >= 16){
+        const uint8_t *f = buff + r->cOffsets[frames - 1];
+        const uint64_t frameSize = r->cOffsets[frames] - r->cOffsets[frames - 1] - 8;
+        if(readLE32(f) == (ZSTD_MAGIC_SKIPPABLE_START | 0xC) && readLE32(f + 4) == frameSize &&
+           readLE32(f + 8) == INDEX_MAGIC){
+            const size_t members = readLE32(f + 12);
+            if((uint64_t)members * INDEX_ENTRY_SIZE > frameSize - 8){
+                return fail(ctx, T2SZ_ERROR_FORMAT, "Corrupted member index");
+            }
+            r->index = f + 16;
+            r->indexMembers = members;
+            r->indexNames = r->index + members * INDEX_ENTRY_SIZE;
+            r->indexNamesSize = (size_t)(frameSize - 8 - members * INDEX_ENTRY_SIZE);
+        }
+    }
+
+    r->frame = frames;
+    return true;
+}
+
+/**
+ * Look a member up in the index written by -i.
+ *
+ * Binary search on the sorted names; when a name appears more than once
+ * the first occurrence in the archive is returned, like the header walk
+ * of extractMember() does.
+ *
+ * @param r         Reader with an index (r->index != NULL).
+ * @param name      Member name, normalized by the caller.
+ * @param len       Length of @p name.
+ * @param dataPos   Set to the payload offset in the tar stream.
+ * @param dataSize  Set to the member size.
+ * @param typeflag  Set to the tar typeflag.
+ * @return          true if found. A corrupted index fails the call and
+ *                  returns false.
+ */
+static bool archiveIndexLookup(ArchiveReader *r, const char *name, const size_t len,
+                               uint64_t *dataPos, uint64_t *dataSize, char *typeflag){
+    size_t lo = 0, hi = r->indexMembers; //first entry with a name >= name
+    while(lo < hi){
+        const size_t mid = lo + (hi - lo) / 2;
+        const uint8_t *e = r->index + mid * INDEX_ENTRY_SIZE;
+        const size_t nameOffset = readLE32(e + 24);
+        const size_t nameLength = (size_t)e[28] | ((size_t)e[29] << 8);
+        if(nameOffset > r->indexNamesSize || nameLength > r->indexNamesSize - nameOffset){
+            return fail(r->ctx, T2SZ_ERROR_FORMAT, "Corrupted member index");
+        }
+        const size_t n = nameLength < len ? nameLength : len;
+        int c = memcmp(r->indexNames + nameOffset, name, n);
+        if(!c){
+            c = nameLength < len ? -1 : (nameLength > len);
+        }
+        if(c < 0){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    if(lo == r->indexMembers){
+        return false;
+    }
+    const uint8_t *e = r->index + lo * INDEX_ENTRY_SIZE;
+    const size_t nameLength = (size_t)e[28] | ((size_t)e[29] << 8);
+    if(nameLength != len || memcmp(r->indexNames + readLE32(e + 24), name, len) != 0){
+        return false;
+    }
+    *dataPos = (uint64_t)readLE32(e + 8) | ((uint64_t)readLE32(e + 12) << 32);
+    *dataSize = (uint64_t)readLE32(e + 16) | ((uint64_t)readLE32(e + 20) << 32);
+    *typeflag = (char)e[30];
+    return true;
+}
+
+/**
+ * Release everything owned by the reader (not the mapped archive).
+ *
+ * @param r  The reader.
+ */
+static void archiveClose(ArchiveReader *r){
+    ZSTD_freeDCtx(r->dctx);
+    ZSTD_freeDDict(r->ddict);
+    free(r->cOffsets);
+    free(r->dOffsets);
+    free(r->scratch);
+    memset(r, 0, sizeof(*r));
+}
+
+/**
+ * Total decompressed size of the archive, as recorded in the seek table.
+ *
+ * @param r  The reader.
+ * @return   Sum of all decompressed frame sizes.
+ */
+static uint64_t archiveSize(const ArchiveReader *r){
+    return r->dOffsets[r->frames];
+}
+
+/**
+ * Start decompressing frame @p f from its beginning.
+ *
+ * @param r  The reader.
+ * @param f  Frame index, < frames.
+ * @return   false on error.
+ */
+static bool archiveStartFrame(ArchiveReader *r, const size_t f){
+    const size_t err = ZSTD_DCtx_reset(r->dctx, ZSTD_reset_session_only);
+    if(ZSTD_isError(err)){
+        return fail(r->ctx, T2SZ_ERROR_ZSTD, "Can't reset ZSTD session: %s", ZSTD_getErrorName(err));
+    }
+    r->frame = f;
+    r->pos = r->dOffsets[f];
+    r->in.src = r->buff + r->cOffsets[f];
+    r->in.size = (size_t)(r->cOffsets[f + 1] - r->cOffsets[f]);
+    r->in.pos = 0;
+    return true;
+}
+
+/**
+ * Decompress the next @p n bytes of the current frame into @p dst.
+ *
+ * The caller guarantees that the frame holds at least @p n more bytes.
+ * Fails on corrupted or truncated frames.
+ *
+ * @param r    The reader.
+ * @param dst  Destination buffer.
+ * @param n    Number of bytes to produce.
+ * @return     false on error.
+ */
+static bool archiveDecompress(ArchiveReader *r, void *dst, const size_t n){
+    ZSTD_outBuffer out = {dst, n, 0};
+    while(out.pos < out.size){
+        const size_t inPos = r->in.pos;
+        const size_t outPos = out.pos;
+        const size_t ret = ZSTD_decompressStream(r->dctx, &out, &r->in);
+        if(ZSTD_isError(ret)){
+            return fail(r->ctx, T2SZ_ERROR_FORMAT, "Corrupted frame %zu: %s", r->frame, ZSTD_getErrorName(ret));
+        }
+        if(out.pos < out.size && (ret == 0 || (r->in.pos == inPos && out.pos == outPos))){
+            return fail(r->ctx, T2SZ_ERROR_FORMAT, "Frame %zu is shorter than recorded in the seek table", r->frame);
+        }
+    }
+    r->pos += n;
+    return true;
+}
+
+/**
+ * Move the read position to the decompressed offset @p pos.
+ *
+ * Forward moves inside the current frame decompress and discard the
+ * bytes in between; any other move restarts at the beginning of the frame
+ * that holds @p pos, found by binary search on the decompressed offsets.
+ *
+ * @param r    The reader.
+ * @param pos  Target position, <= archiveSize().
+ * @return     false on error.
+ */
+static bool archiveSeek(ArchiveReader *r, const uint64_t pos){
+    if(r->frame < r->frames && pos >= r->pos && pos < r->dOffsets[r->frame + 1]){
+        // already in the right frame
+    }else if(pos >= archiveSize(r)){
+        r->frame = r->frames;
+        r->pos = pos;
+        return true;
+    }else{
+        size_t lo = 0, hi = r->frames - 1;
+        while(lo < hi){ //last frame starting at or before pos with data past it
+            const size_t mid = lo + (hi - lo + 1) / 2;
+            if(r->dOffsets[mid] <= pos){
+                lo = mid;
+            }else{
+                hi = mid - 1;
+            }
+        }
+        if(!archiveStartFrame(r, lo)){
+            return false;
+        }
+    }
+
+    while(r->pos < pos){
+        const uint64_t left = pos - r->pos;
+        if(!archiveDecompress(r, r->scratch, left < r->scratchSize ? (size_t)left : r->scratchSize)){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Read up to @p n bytes at the current position, crossing frames as needed.
+ *
+ * @param r    The reader.
+ * @param dst  Destination buffer.
+ * @param n    Number of bytes wanted.
+ * @return     Bytes read; less than @p n only at the end of the archive
+ *             or on error.
+ */
+static size_t archiveRead(ArchiveReader *r, void *dst, const size_t n){
+    size_t done = 0;
+    while(done < n && r->pos < archiveSize(r)){
+        if(r->frame >= r->frames || r->pos >= r->dOffsets[r->frame + 1]){
+            if(!archiveSeek(r, r->pos)){
+                break;
+            }
+        }
+        const uint64_t left = r->dOffsets[r->frame + 1] - r->pos;
+        const size_t chunk = n - done < left ? n - done : (size_t)left;
+        if(!archiveDecompress(r, (uint8_t*)dst + done, chunk)){
+            break;
+        }
+        done += chunk;
+    }
+    return done;
+}
+
+/* ── Extraction (-x) ───────────────────────────────────────────────────────*/
+
+/**
+ * Read the payload of a name-carrying header (GNU 'L', PAX 'x') and
+ * return the member name it sets for the next header.
+ *
+ * @param r         Reader positioned at the payload.
+ * @param typeflag  'L' or 'x'.
+ * @param size      Payload size.
+ * @return          A newly allocated name, or NULL if the header sets none
+ *                  or on error (check failed()).
+ */
+static char* readLongName(ArchiveReader *r, const char typeflag, const size_t size){
+    char *data = malloc(size + 1);
+    if(!data){
+        fail(r->ctx, T2SZ_ERROR_MEMORY, "Out of memory reading a long name");
+        return NULL;
+    }
+    if(archiveRead(r, data, size) != size){
+        fail(r->ctx, T2SZ_ERROR_FORMAT, "Truncated tar archive");
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+    if(typeflag == 'x'){
+        char *path = paxPath(r->ctx, data, size);
+        free(data);
+        return path;
+    }
+    return data;
+}
+
+/**
+ * Skip the sparse map extension blocks that follow a GNU sparse header.
+ *
+ * @param r       Reader positioned right after @p header.
+ * @param header  A valid tar header.
+ * @param hdrPos  Position of @p header in the tar stream.
+ * @return        Position of the member payload, 0 on error.
+ */
+static uint64_t archiveDataPos(ArchiveReader *r, const uint8_t *header, const uint64_t hdrPos){
+    uint64_t pos = hdrPos + 512;
+    bool sparse = tarSparseContinues(header, true);
+    while(sparse){
+        uint8_t block[512];
+        if(archiveRead(r, block, sizeof(block)) != sizeof(block)){
+            fail(r->ctx, T2SZ_ERROR_FORMAT, "Truncated sparse map at offset %" PRIu64, pos);
+            return 0;
+        }
+        sparse = tarSparseContinues(block, false);
+        pos += 512;
+    }
+    return pos;
+}
+
+/**
+ * Locate a tar member in a seekable archive.
+ *
+ * With a member index (-i) the member is found by a binary search in the
+ * index frame. Otherwise the tar headers are walked through the archive
+ * reader: each header costs the decompression of at most the start of one
+ * frame, and member payloads are jumped over without being decompressed.
+ * The member name is taken from the GNU long name or PAX path header
+ * preceding it, or from the ustar prefix and name fields.
+ *
+ * @param r         Open reader.
+ * @param member    Member name as given by the user.
+ * @param dataPos   Set to the payload offset in the tar stream.
+ * @param dataSize  Set to the member size.
+ * @return          false if the member is missing, is not a regular file,
+ *                  or on error.
+ */
+static bool findMember(ArchiveReader *r, const char *member, uint64_t *dataPos, size_t *dataSize){
+    Context *ctx = r->ctx;
+    if(r->index){
+        // One binary search instead of the header walk.
+        const char *wanted = normalizeMemberName(member);
+        size_t len = strlen(wanted);
+        if(len && wanted[len - 1] == '/'){
+            len--;
+        }
+        uint64_t size = 0;
+        char typeflag = 0;
+        if(!archiveIndexLookup(r, wanted, len, dataPos, &size, &typeflag)){
+            return failed(ctx) ? false : fail(ctx, T2SZ_ERROR_NOT_FOUND, "'%s' not found in archive", member);
+        }
+        if(typeflag != '0' && typeflag != '\0' && typeflag != '7'){
+            return fail(ctx, T2SZ_ERROR_PARAMETER, "'%s' is not a regular file", member);
+        }
+        if(size > SIZE_MAX || *dataPos + size > archiveSize(r)){
+            return fail(ctx, T2SZ_ERROR_FORMAT, "Corrupted member index");
+        }
+        *dataSize = (size_t)size;
+        return true;
+    }
+
+    char *longName = NULL;
+    uint64_t hdrPos = 0;
+    bool found = false;
+    while(!found && !failed(ctx)){
+        uint8_t block[512];
+        if(!archiveSeek(r, hdrPos) || archiveRead(r, block, sizeof(block)) != sizeof(block) || isZeroTarBlock(block)){
+            break;
+        }
+        const TarHeader *header = (const TarHeader*)block;
+        if(!isTarHeader(header)){
+            fail(ctx, T2SZ_ERROR_FORMAT, "Invalid tar header at offset %" PRIu64, hdrPos);
+            break;
+        }
+        const size_t size = parseTarSize(header);
+        const uint64_t payloadPos = archiveDataPos(r, block, hdrPos);
+        if(!payloadPos){
+            break;
+        }
+        if(size > archiveSize(r) - payloadPos){
+            fail(ctx, T2SZ_ERROR_FORMAT, "Truncated tar entry at offset %" PRIu64, hdrPos);
+            break;
+        }
+        const uint64_t padded = ((uint64_t)size + 511) / 512 * 512;
+
+        if(header->typeflag == 'L' || header->typeflag == 'x'){
+            free(longName);
+            longName = size <= TAR_LONG_NAME_MAX ? readLongName(r, header->typeflag, size) : NULL;
+        }else if(header->typeflag != 'g' && header->typeflag != 'K'){
+            char name[257];
+            const char *memberName = longName;
+            if(!memberName){
+                if(memcmp(header->magic, "ustar", 6) == 0 && header->prefix[0]){ //POSIX ustar, not GNU
+                    snprintf(name, sizeof(name), "%.155s/%.100s", header->prefix, header->name);
+                }else{
+                    snprintf(name, sizeof(name), "%.100s", header->name);
+                }
+                memberName = name;
+            }
+
+            if(memberNameEquals(memberName, member)){
+                if(header->typeflag != '0' && header->typeflag != '\0' && header->typeflag != '7'){
+                    fail(ctx, T2SZ_ERROR_PARAMETER, "'%s' is not a regular file", member);
+                    break;
+                }
+                found = true;
+                *dataPos = payloadPos;
+                *dataSize = size;
+            }
+            free(longName);
+            longName = NULL;
+        }
+        hdrPos = payloadPos + padded;
+    }
+    free(longName);
+
+    if(!found && !failed(ctx)){
+        fail(ctx, T2SZ_ERROR_NOT_FOUND, "'%s' not found in archive", member);
+    }
+    return found;
+}
+
+/**
+ * Extract a single tar member from a seekable archive (-x).
+ *
+ * Once findMember() has located it, only the frames covering the payload
+ * are decompressed, straight into the sink. Nothing is written unless the
+ * member has been found.
+ *
+ * @param ctx     Context with the archive in inBuff and the sink set.
+ * @param member  Member name.
+ */
+static void extractMember(Context *ctx, const char *member){
+    ArchiveReader r;
+    uint64_t dataPos = 0;
+    size_t dataSize = 0;
+    if(!archiveOpen(&r, ctx, ctx->inBuff, ctx->inBuffSize) || !findMember(&r, member, &dataPos, &dataSize)){
+        archiveClose(&r);
+        return;
+    }
+    if(ctx->verbose){
+        fprintf(stderr, "+ %s (%zu bytes at offset %" PRIu64 ")\n", member, dataSize, dataPos);
+    }
+
+    if(ctx->outBuff == NULL){
+        ctx->outBuffSize = ZSTD_CStreamOutSize();
+        ctx->outBuff = malloc(ctx->outBuffSize);
+        if(!ctx->outBuff){
+            fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory allocating output buffer");
+            archiveClose(&r);
+            return;
+        }
+    }
+
+    size_t left = archiveSeek(&r, dataPos) ? dataSize : 0;
+    while(left && !failed(ctx)){
+        const size_t n = left < ctx->outBuffSize ? left : ctx->outBuffSize;
+        if(archiveRead(&r, ctx->outBuff, n) != n){
+            fail(ctx, T2SZ_ERROR_FORMAT, "Truncated tar archive");
+            break;
+        }
+        writeOutput(ctx, ctx->outBuff, n);
+        left -= n;
+    }
+    archiveClose(&r);
+}
+
+/* ── Integrity test (-t) ───────────────────────────────────────────────────
+ *
+ * Every frame listed in the seek table is checked on its own, so frames
+ * are handed out to -T threads through a shared counter, each thread with
+ * its own decompression context (the dictionary, if any, is shared). A
+ * frame passes when libzstd finds that it ends exactly where the seek
+ * table says, it decompresses without error to the recorded size and, for
+ * data frames, its content checksum matches (libzstd checks it at the end
+ * of the frame). Skippable frames (dictionary, index) only need to be
+ * well-formed.
+ */
+
+typedef struct {
+    ArchiveReader* r;
+    atomic_size_t next;         //next frame to check
+    atomic_uint_fast64_t dataFrames;
+    atomic_uint_fast64_t noChecksum;
+} ArchiveTest;
+
+/**
+ * Check frame @p f of the archive.
+ *
+ * @param t     The test.
+ * @param f     Frame index.
+ * @param dctx  Decompression context of the calling thread.
+ * @param buf   Scratch output of ZSTD_DStreamOutSize() bytes.
+ * @return      false if the frame is bad (the call is failed).
+ */
+static bool testFrame(ArchiveTest *t, const size_t f, ZSTD_DCtx *dctx, uint8_t *buf){
+    const ArchiveReader *r = t->r;
+    Context *ctx = r->ctx;
+    const uint8_t *src = r->buff + r->cOffsets[f];
+    const size_t cSize = (size_t)(r->cOffsets[f + 1] - r->cOffsets[f]);
+    const uint64_t dSize = r->dOffsets[f + 1] - r->dOffsets[f];
+
+    const size_t found = ZSTD_findFrameCompressedSize(src, cSize);
+    if(ZSTD_isError(found)){
+        return fail(ctx, T2SZ_ERROR_FORMAT, "Frame %zu at offset %" PRIu64 ": %s",
+                    f, r->cOffsets[f], ZSTD_getErrorName(found));
+    }
+    if(found != cSize){
+        return fail(ctx, T2SZ_ERROR_FORMAT, "Frame %zu at offset %" PRIu64 ": %zu bytes, the seek table says %zu",
+                    f, r->cOffsets[f], found, cSize);
+    }
+    if((readLE32(src) & ZSTD_MAGIC_SKIPPABLE_MASK) == ZSTD_MAGIC_SKIPPABLE_START){ //found >= 8
+        if(dSize){
+            return fail(ctx, T2SZ_ERROR_FORMAT, "Frame %zu at offset %" PRIu64 ": skippable frame with %" PRIu64
+                        " decompressed bytes in the seek table", f, r->cOffsets[f], dSize);
+        }
+        return true;
+    }
+    if(cSize < 5 || !(src[4] & 0x04)){ //Frame_Header_Descriptor, Content_Checksum_flag
+        atomic_fetch_add(&t->noChecksum, 1);
+    }
+
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    ZSTD_inBuffer in = { src, cSize, 0 };
+    uint64_t produced = 0;
+    size_t ret = 1;
+    while(ret != 0 && !failed(ctx)){
+        ZSTD_outBuffer out = { buf, ZSTD_DStreamOutSize(), 0 };
+        const size_t inPos = in.pos;
+        ret = ZSTD_decompressStream(dctx, &out, &in);
+        if(ZSTD_isError(ret)){
+            return fail(ctx, T2SZ_ERROR_FORMAT, "Frame %zu at offset %" PRIu64 ": %s",
+                        f, r->cOffsets[f], ZSTD_getErrorName(ret));
+        }
+        produced += out.pos;
+        if(ret != 0 && out.pos == 0 && in.pos == inPos){
+            return fail(ctx, T2SZ_ERROR_FORMAT, "Frame %zu at offset %" PRIu64 ": truncated", f, r->cOffsets[f]);
+        }
+    }
+    if(!failed(ctx) && produced != dSize){
+        return fail(ctx, T2SZ_ERROR_FORMAT, "Frame %zu at offset %" PRIu64 ": %" PRIu64
+                    " decompressed bytes, the seek table says %" PRIu64, f, r->cOffsets[f], produced, dSize);
+    }
+    atomic_fetch_add(&t->dataFrames, 1);
+    atomic_fetch_add_explicit(&ctx->progressIn, produced, memory_order_relaxed);
+    return true;
+}
+
+/**
+ * Thread body of the test: check frames until there are none left or the
+ * call has failed.
+ *
+ * @param arg  The ArchiveTest.
+ * @return     NULL.
+ */
+static void* testThread(void *arg){
+    ArchiveTest *t = arg;
+    Context *ctx = t->r->ctx;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    uint8_t *buf = malloc(ZSTD_DStreamOutSize());
+    if(!dctx || !buf){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory testing the archive");
+    }else if(t->r->ddict && ZSTD_isError(ZSTD_DCtx_refDDict(dctx, t->r->ddict))){
+        fail(ctx, T2SZ_ERROR_ZSTD, "Cannot reference dictionary");
+    }
+    while(!failed(ctx)){
+        const size_t f = atomic_fetch_add(&t->next, 1);
+        if(f >= t->r->frames || !testFrame(t, f, dctx, buf)){
+            break;
+        }
+    }
+    ZSTD_freeDCtx(dctx);
+    free(buf);
+    return NULL;
+}
+
+/**
+ * Test the archive in ctx->inBuff on ctx->workers threads.
+ *
+ * @param ctx     The context (reads inBuff, inBuffSize, workers).
+ * @param result  Receives the counts.
+ */
+static void testArchive(Context *ctx, T2szTestResult *result){
+    ArchiveReader r;
+    if(!archiveOpen(&r, ctx, ctx->inBuff, ctx->inBuffSize)){
+        archiveClose(&r);
+        return;
+    }
+    atomic_store(&ctx->progressTotal, archiveSize(&r));
+    ArchiveTest t = { .r = &r };
+    atomic_init(&t.next, 0);
+    atomic_init(&t.dataFrames, 0);
+    atomic_init(&t.noChecksum, 0);
+
+    size_t nbThreads = ctx->workers > 1 ? ctx->workers : 1;
+    if(nbThreads > r.frames){
+        nbThreads = r.frames ? r.frames : 1;
+    }
+    pthread_t *threads = nbThreads > 1 ? calloc(nbThreads - 1, sizeof(pthread_t)) : NULL;
+    size_t started = 0;
+    if(nbThreads > 1 && !threads){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory starting the test threads");
+    }
+    while(threads && started < nbThreads - 1 && !failed(ctx)){
+        if(pthread_create(&threads[started], NULL, testThread, &t) != 0){
+            fail(ctx, T2SZ_ERROR_THREAD, "Cannot start a test thread");
+            break;
+        }
+        started++;
+    }
+    testThread(&t); //the calling thread checks frames too
+    for(size_t i = 0; i < started; i++){
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    result->frames = r.frames;
+    result->dataFrames = atomic_load(&t.dataFrames);
+    result->noChecksumFrames = atomic_load(&t.noChecksum);
+    result->compressedBytes = ctx->inBuffSize;
+    result->decompressedBytes = archiveSize(&r);
+    if(ctx->verbose && !failed(ctx)){
+        fprintf(stderr, "# %zu frames tested on %zu threads\n", r.frames, nbThreads);
+    }
+    archiveClose(&r);
+}
+
+/* ── Append (-a) ───────────────────────────────────────────────────────────
+ *
+ * New members are added to a seekable tar archive without recompressing
+ * it. t2szAppendTo() finds the end-of-archive zero blocks and keeps every
+ * frame before the one that holds them; the caller cuts the archive there.
+ * That frame is copied, and the next compression call decompresses the
+ * member data it holds before the zero blocks and compresses it again as
+ * the first new frame. The new members follow, then a seek table covering
+ * the whole archive. The dictionary of a -D archive is reused for the new
+ * frames, and the member index of a -i archive is carried over and
+ * extended. With an index the end of the archive is found from the last
+ * indexed member; otherwise every tar header is walked, which decompresses
+ * the start of each frame (and whole frames holding several members).
+ */
+
+/**
+ * Find the end-of-archive position: the first zero block at a header
+ * position, or the end of the data if the archive has none.
+ *
+ * @param r    Open reader.
+ * @param end  Set to the position.
+ * @return     false on error.
+ */
+static bool findArchiveEnd(ArchiveReader *r, uint64_t *end){
+    uint64_t hdrPos = 0;
+    // Every indexed member ends at a header position: start after the last.
+    for(size_t i = 0; i < r->indexMembers; i++){
+        const uint8_t *e = r->index + i * INDEX_ENTRY_SIZE;
+        const uint64_t dataPos = (uint64_t)readLE32(e + 8) | ((uint64_t)readLE32(e + 12) << 32);
+        const uint64_t size = (uint64_t)readLE32(e + 16) | ((uint64_t)readLE32(e + 20) << 32);
+        if(dataPos > archiveSize(r) || size > archiveSize(r) - dataPos){
+            return fail(r->ctx, T2SZ_ERROR_FORMAT, "Corrupted member index");
+        }
+        const uint64_t next = dataPos + (size + 511) / 512 * 512;
+        if(next > hdrPos){
+            hdrPos = next;
+        }
+    }
+
+    while(!failed(r->ctx)){
+        uint8_t block[512];
+        if(hdrPos >= archiveSize(r)){
+            *end = archiveSize(r);
+            return true;
+        }
+        if(!archiveSeek(r, hdrPos) || archiveRead(r, block, sizeof(block)) != sizeof(block)){
+            return failed(r->ctx) ? false : fail(r->ctx, T2SZ_ERROR_FORMAT, "Truncated tar archive");
+        }
+        if(isZeroTarBlock(block)){
+            *end = hdrPos;
+            return true;
+        }
+        const TarHeader *header = (const TarHeader*)block;
+        if(!isTarHeader(header)){
+            return fail(r->ctx, T2SZ_ERROR_FORMAT, "Invalid tar header at offset %" PRIu64, hdrPos);
+        }
+        const uint64_t payloadPos = archiveDataPos(r, block, hdrPos);
+        if(!payloadPos){
+            return false;
+        }
+        const size_t size = parseTarSize(header);
+        hdrPos = size > archiveSize(r) - payloadPos ? archiveSize(r) : payloadPos + ((uint64_t)size + 511) / 512 * 512;
+    }
+    return false;
+}
+
+/**
+ * Load the member index of the archive into ctx->index, to be extended
+ * with the new members and written again.
+ *
+ * @param ctx  The compression context (writes index, indexNames).
+ * @param r    Reader with an index.
+ * @return     false on error.
+ */
+static bool appendLoadIndex(Context *ctx, const ArchiveReader *r){
+    if(r->indexMembers > ctx->indexCap){
+        IndexEntry *p = realloc(ctx->index, r->indexMembers * sizeof(IndexEntry));
+        if(!p){
+            return fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory loading the member index");
+        }
+        ctx->index = p;
+        ctx->indexCap = r->indexMembers;
+    }
+    if(r->indexNamesSize > ctx->indexNamesCap){
+        char *p = realloc(ctx->indexNames, r->indexNamesSize);
+        if(!p){
+            return fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory loading the member index");
+        }
+        ctx->indexNames = p;
+        ctx->indexNamesCap = r->indexNamesSize;
+    }
+    for(size_t i = 0; i < r->indexMembers; i++){
+        const uint8_t *e = r->index + i * INDEX_ENTRY_SIZE;
+        IndexEntry *x = &ctx->index[i];
+        x->dataOffset = (uint64_t)readLE32(e + 8) | ((uint64_t)readLE32(e + 12) << 32);
+        x->size = (uint64_t)readLE32(e + 16) | ((uint64_t)readLE32(e + 20) << 32);
+        x->nameOffset = readLE32(e + 24);
+        x->nameLength = (uint16_t)(e[28] | (e[29] << 8));
+        x->typeflag = (char)e[30];
+        if(x->nameOffset > r->indexNamesSize || x->nameLength > r->indexNamesSize - x->nameOffset){
+            return fail(ctx, T2SZ_ERROR_FORMAT, "Corrupted member index");
+        }
+    }
+    memcpy(ctx->indexNames, r->indexNames, r->indexNamesSize);
+    ctx->indexLen = r->indexMembers;
+    ctx->indexNamesLen = r->indexNamesSize;
+    return true;
+}
+
+/**
+ * Prepare the context to append to a seekable archive.
+ *
+ * Loads the seek table entries of the kept frames, the dictionary and the
+ * member index, and copies the frame holding the end of archive.
+ *
+ * @param ctx      The compression context.
+ * @param archive  The mapped archive.
+ * @param size     Size of the archive.
+ * @param keep     Set to the number of archive bytes that stay as they are.
+ */
+static void prepareAppend(Context *ctx, const uint8_t *archive, const size_t size, uint64_t *keep){
+    ArchiveReader r;
+    uint64_t end = 0;
+    if(!archiveOpen(&r, ctx, archive, size) || !findArchiveEnd(&r, &end)){
+        archiveClose(&r);
+        return;
+    }
+
+    // Frames to keep: up to the one holding the end of archive, or all the
+    // data frames when there are no zero blocks (the index frame goes).
+    size_t kept = r.frames;
+    if(end < archiveSize(&r)){
+        kept = 0;
+        while(r.dOffsets[kept + 1] <= end){
+            kept++;
+        }
+    }else if(r.index){
+        kept--;
+    }
+
+    for(size_t i = 0; i < kept && !failed(ctx); i++){
+        seekTableAdd(ctx, r.cOffsets[i + 1] - r.cOffsets[i], r.dOffsets[i + 1] - r.dOffsets[i]);
+    }
+    if(ctx->skipSeekTable){
+        fail(ctx, T2SZ_ERROR_FORMAT, "The seek table of the archive can't be extended");
+    }
+
+    if(!failed(ctx) && r.ddict){
+        ctx->dictSize = (size_t)r.cOffsets[1] - 8;
+        ctx->dictBuff = malloc(ctx->dictSize);
+        if(!ctx->dictBuff){
+            fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory loading the archive dictionary");
+        }else{
+            memcpy(ctx->dictBuff, archive + 8, ctx->dictSize);
+        }
+    }
+
+    if(!failed(ctx) && r.index){
+        appendLoadIndex(ctx, &r);
+    }
+
+    ctx->appendTailSize = kept < r.frames ? end - r.dOffsets[kept] : 0;
+    if(!failed(ctx) && ctx->appendTailSize){
+        ctx->appendFrameSize = (size_t)(r.cOffsets[kept + 1] - r.cOffsets[kept]);
+        ctx->appendFrame = malloc(ctx->appendFrameSize);
+        if(!ctx->appendFrame){
+            fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory copying the last frame of the archive");
+        }else{
+            memcpy(ctx->appendFrame, archive + r.cOffsets[kept], ctx->appendFrameSize);
+        }
+    }
+
+    if(!failed(ctx)){
+        ctx->append = true;
+        ctx->appendIndexed = r.index != NULL;
+        ctx->tarBase = end;
+        *keep = r.cOffsets[kept];
+        if(ctx->verbose){
+            fprintf(stderr, "# APPEND (keeping %zu of %zu frames, %" PRIu64 " bytes; end of archive at %" PRIu64 ")\n\n",
+                    kept, r.frames, *keep, end);
+        }
+    }
+    archiveClose(&r);
+}
+
+/**
+ * Check that the options of the compression call allow appending.
+ *
+ * @param ctx  The compression context, with append set.
+ * @return     false on error.
+ */
+static bool appendStart(Context *ctx){
+    if(ctx->rawMode){
+        return fail(ctx, T2SZ_ERROR_PARAMETER, "Appending requires tar mode");
+    }
+    if(ctx->noSeekTable){
+        return fail(ctx, T2SZ_ERROR_PARAMETER, "Appending requires a seek table (-j can't be used)");
+    }
+    return true;
+}
+
+/**
+ * Compress the data of the old last frame, up to the end of archive, as
+ * the first new frame.
+ *
+ * @param ctx  The compression context (prepareCctx() done).
+ */
+static void appendWriteTail(Context *ctx){
+    if(ctx->appendTailSize == 0){
+        return;
+    }
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    const size_t bufSize = ZSTD_DStreamOutSize();
+    uint8_t *buf = malloc(bufSize);
+    if(!dctx || !buf){
+        fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory decompressing the last frame of the archive");
+    }else if(ctx->dictBuff && ZSTD_isError(ZSTD_DCtx_loadDictionary(dctx, ctx->dictBuff, ctx->dictSize))){
+        fail(ctx, T2SZ_ERROR_FORMAT, "Cannot load the archive dictionary");
+    }
+
+    zstdResetFrame(ctx, ctx->cctx);
+    zstdSetPledged(ctx, ctx->cctx, ctx->appendTailSize, true);
+    uint64_t compressedSize = 0;
+    uint64_t left = ctx->appendTailSize;
+    ZSTD_inBuffer in = { ctx->appendFrame, ctx->appendFrameSize, 0 };
+    while(left && !failed(ctx)){
+        ZSTD_outBuffer out = { buf, left < bufSize ? (size_t)left : bufSize, 0 };
+        const size_t inPos = in.pos;
+        const size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+        if(ZSTD_isError(ret)){
+            fail(ctx, T2SZ_ERROR_FORMAT, "Corrupted last frame: %s", ZSTD_getErrorName(ret));
+        }else if(out.pos == 0 && in.pos == inPos){
+            fail(ctx, T2SZ_ERROR_FORMAT, "The last frame is shorter than recorded in the seek table");
+        }else{
+            compressedSize += zstdCompressChunk(ctx, buf, out.pos);
+            left -= out.pos;
+        }
+    }
+    if(!failed(ctx)){
+        compressedSize += zstdEndFrame(ctx);
+        seekTableAdd(ctx, compressedSize, ctx->appendTailSize);
+    }
+    ZSTD_freeDCtx(dctx);
+    free(buf);
+}
+
+/**
+ * Leave append mode at the end of the compression call, whatever its
+ * outcome.
+ *
+ * @param ctx  The compression context.
+ */
+static void appendEnd(Context *ctx){
+    if(!ctx->append){
+        return;
+    }
+    ctx->append = false;
+    ctx->appendIndexed = false;
+    ctx->tarBase = 0;
+    free(ctx->appendFrame);
+    ctx->appendFrame = NULL;
+    ctx->appendFrameSize = 0;
+    ctx->appendTailSize = 0;
+    ZSTD_freeCDict(ctx->cdict);
+    ctx->cdict = NULL;
+    free(ctx->dictBuff);
+    ctx->dictBuff = NULL;
+    ctx->dictSize = 0;
+}
+
+/* ── Checkpoints (--checkpoint, --resume) ──────────────────────────────────
+ *
+ * The seek table only exists in memory until the end of the call, so an
+ * interrupted run loses everything it has written. With a checkpoint
+ * callback, the state needed to continue is handed to the caller between
+ * frames, at most every checkpointInterval seconds: the seek table so far,
+ * the dictionary, the number of planned frames written and the output size.
+ * t2szResume() loads it back; the next t2szCompressBuffer() call plans the
+ * same input again, checks that it matches, and carries on after the last
+ * saved frame. The member index is rebuilt by the planner, as usual.
+ *
+ * State layout, all integers little-endian:
+ *
+ *   Checkpoint_Magic   u32  CHECKPOINT_MAGIC ("T2SC")
+ *   Version            u32  CHECKPOINT_VERSION
+ *   Options_Hash       u64  options that change the output, see checkpointOptionsHash()
+ *   Input_Size         u64
+ *   Frames             u64  planned frames in the output
+ *   Plan_Hash          u64  offsets and sizes of those frames
+ *   Sample_Hash        u64  first and last input bytes of each of those frames
+ *   Output_Size        u64  bytes of output they take
+ *   Flags              u32  bit 0: the seek table was given up
+ *   Dictionary_Size    u32
+ *   Seek_Table_Length  u32
+ *   Dictionary         Dictionary_Size bytes
+ *   Seek_Table         8 bytes per entry, as in the seek table frame
+ *   Checksum           u64  FNV-1a of everything before
+ */
+
+#define CHECKPOINT_MAGIC        0x43533254U  //"T2SC"
+#define CHECKPOINT_VERSION      1
+#define CHECKPOINT_HEADER_SIZE  68
+#define CHECKPOINT_SAMPLE_SIZE  ((size_t)512)
+
+#define FNV_OFFSET  0xCBF29CE484222325ULL
+#define FNV_PRIME   0x100000001B3ULL
+
+/**
+ * Continue a 64-bit FNV-1a hash.
+ *
+ * @param h     Hash so far, FNV_OFFSET to start.
+ * @param data  Bytes to add.
+ * @param len   Number of bytes.
+ * @return      The updated hash.
+ */
+static uint64_t fnv1a(uint64_t h, const void *data, const size_t len){
+    const uint8_t *p = data;
+    for(size_t i = 0; i < len; i++){
+        h = (h ^ p[i]) * FNV_PRIME;
+    }
+    return h;
+}
+
+static uint64_t fnv1a64(const uint64_t h, const uint64_t v){
+    uint8_t buf[8];
+    writeLE64(buf, v);
+    return fnv1a(h, buf, sizeof(buf));
+}
+
+static uint64_t readLE64(const void *src){
+    const uint8_t *p = src;
+    return (uint64_t)readLE32(p) | ((uint64_t)readLE32(p + 4) << 32);
+}
+
+/**
+ * Hash the options that change the frames or the output layout. The
+ * number of workers and -v do not, so they may differ when resuming.
+ *
+ * @param ctx  The compression context.
+ * @return     The hash.
+ */
+static uint64_t checkpointOptionsHash(const Context *ctx){
+    uint64_t h = FNV_OFFSET;
+    h = fnv1a64(h, ctx->level);
+    h = fnv1a64(h, ctx->minBlockSize);
+    h = fnv1a64(h, ctx->maxBlockSize);
+    h = fnv1a64(h, ctx->cdcAverage);
+    h = fnv1a64(h, ctx->dictCapacity);
+    h = fnv1a64(h, (uint64_t)ctx->rawMode | (uint64_t)ctx->noSeekTable << 1 |
+                   (uint64_t)ctx->buildIndex << 2 | (uint64_t)ctx->compressAll << 3);
+    return h;
+}
+
+/**
+ * Add planned frame @p i to the plan and sample hashes of the frames
+ * written so far. The sample is the first and last CHECKPOINT_SAMPLE_SIZE
+ * input bytes of the frame: one page per frame, like the planner, but
+ * enough to tell another input with the same layout (an edited member, a
+ * tar rebuilt with new dates) from the one being compressed.
+ *
+ * @param ctx  The compression context, with a plan.
+ * @param i    The frame, written right after the ones already hashed.
+ */
+static void checkpointHashFrame(Context *ctx, const size_t i){
+    const FramePlanEntry *e = &ctx->plan[i];
+    const size_t n = e->size < CHECKPOINT_SAMPLE_SIZE ? (size_t)e->size : CHECKPOINT_SAMPLE_SIZE;
+    ctx->planHash = fnv1a64(fnv1a64(ctx->planHash, e->offset), e->size);
+    ctx->sampleHash = fnv1a(ctx->sampleHash, ctx->inBuff + e->offset, n);
+    ctx->sampleHash = fnv1a(ctx->sampleHash, ctx->inBuff + e->offset + e->size - n, n);
+}
+
+/**
+ * Serialize the state and hand it to the checkpoint callback.
+ *
+ * @param ctx  The compression context, between two frames.
+ */
+static void writeCheckpoint(Context *ctx){
+    const size_t len = CHECKPOINT_HEADER_SIZE + ctx->dictSize + ctx->seekTableLen * 8 + 8;
+    if(len > ctx->checkpointCap){
+        uint8_t *p = realloc(ctx->checkpointBuff, len);
+        if(!p){
+            fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory writing a checkpoint");
+            return;
+        }
+        ctx->checkpointBuff = p;
+        ctx->checkpointCap = len;
+    }
+
+    uint8_t *b = ctx->checkpointBuff;
+    writeLE32(b, CHECKPOINT_MAGIC);
+    writeLE32(b + 4, CHECKPOINT_VERSION);
+    writeLE64(b + 8, checkpointOptionsHash(ctx));
+    writeLE64(b + 16, ctx->inBuffSize);
+    writeLE64(b + 24, ctx->framesWritten);
+    writeLE64(b + 32, ctx->planHash);
+    writeLE64(b + 40, ctx->sampleHash);
+    writeLE64(b + 48, ctx->outputBytes);
+    writeLE32(b + 56, ctx->skipSeekTable ? 1 : 0);
+    writeLE32(b + 60, (uint32_t)ctx->dictSize);
+    writeLE32(b + 64, (uint32_t)ctx->seekTableLen);
+    uint8_t *p = b + CHECKPOINT_HEADER_SIZE;
+    if(ctx->dictSize){
+        memcpy(p, ctx->dictBuff, ctx->dictSize);
+        p += ctx->dictSize;
+    }
+    for(size_t i = 0; i < ctx->seekTableLen; i++, p += 8){
+        writeLE32(p, ctx->seekTable[i].compressedSize);
+        writeLE32(p + 4, ctx->seekTable[i].decompressedSize);
+    }
+    writeLE64(p, fnv1a(FNV_OFFSET, b, (size_t)(p - b)));
+
+    if(ctx->checkpointFn(ctx->checkpointOpaque, b, len) != 0){
+        fail(ctx, T2SZ_ERROR_WRITE, "Failed to write a checkpoint");
+    }else if(ctx->verbose){
+        fprintf(stderr, "# CHECKPOINT (%" PRIu64 " of %zu frames, %" PRIu64 " bytes)\n",
+                ctx->framesWritten, ctx->planLen, ctx->outputBytes);
+    }
+}
+
+/**
+ * Count a planned frame as written, and take a checkpoint if one is due.
+ *
+ * @param ctx  The compression context.
+ */
+static void checkpointFrameWritten(Context *ctx){
+    if(ctx->inputWindow && ctx->framesWritten < ctx->planLen){
+        releaseInput(ctx, ctx->plan[ctx->framesWritten].offset + ctx->plan[ctx->framesWritten].size);
+    }
+    if(!ctx->checkpointFn || failed(ctx)){
+        ctx->framesWritten++;
+        return;
+    }
+    checkpointHashFrame(ctx, (size_t)ctx->framesWritten++);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(now.tv_sec - ctx->lastCheckpoint.tv_sec < (time_t)ctx->checkpointInterval){
+        return;
+    }
+    ctx->lastCheckpoint = now;
+    verifySync(ctx);
+    if(!failed(ctx)){
+        writeCheckpoint(ctx);
+    }
+}
+
+/**
+ * Load a checkpoint state for the next compression call.
+ *
+ * @param ctx    The compression context.
+ * @param state  The state, as handed to the checkpoint callback.
+ * @param len    Its size.
+ * @param keep   Set to the size of the output it describes.
+ */
+static void prepareResume(Context *ctx, const uint8_t *state, const size_t len, uint64_t *keep){
+    if(len < CHECKPOINT_HEADER_SIZE + 8 || readLE32(state) != CHECKPOINT_MAGIC){
+        fail(ctx, T2SZ_ERROR_FORMAT, "Not a t2sz checkpoint");
+        return;
+    }
+    if(readLE32(state + 4) != CHECKPOINT_VERSION){
+        fail(ctx, T2SZ_ERROR_FORMAT, "Unsupported checkpoint version %u", readLE32(state + 4));
+        return;
+    }
+    const size_t dictSize = readLE32(state + 60);
+    const size_t entries = readLE32(state + 64);
+    if(len != CHECKPOINT_HEADER_SIZE + dictSize + entries * 8 + 8 ||
+       readLE64(state + len - 8) != fnv1a(FNV_OFFSET, state, len - 8)){
+        fail(ctx, T2SZ_ERROR_FORMAT, "Corrupted checkpoint");
+        return;
+    }
+
+    if(!seekTableEnsureCap(ctx, entries)){
+        return;
+    }
+    const uint8_t *p = state + CHECKPOINT_HEADER_SIZE + dictSize;
+    for(size_t i = 0; i < entries; i++, p += 8){
+        ctx->seekTable[i].compressedSize = readLE32(p);
+        ctx->seekTable[i].decompressedSize = readLE32(p + 4);
+    }
+    ctx->seekTableLen = entries;
+
+    if(dictSize){
+        ctx->dictBuff = malloc(dictSize);
+        if(!ctx->dictBuff){
+            fail(ctx, T2SZ_ERROR_MEMORY, "Out of memory loading the checkpoint dictionary");
+            return;
+        }
+        memcpy(ctx->dictBuff, state + CHECKPOINT_HEADER_SIZE, dictSize);
+        ctx->dictSize = dictSize;
+    }
+
+    ctx->resume = true;
+    ctx->resumeOptionsHash = readLE64(state + 8);
+    ctx->resumeInputSize = readLE64(state + 16);
+    ctx->resumeFrames = readLE64(state + 24);
+    ctx->resumePlanHash = readLE64(state + 32);
+    ctx->resumeSampleHash = readLE64(state + 40);
+    ctx->resumeOutputSize = readLE64(state + 48);
+    ctx->resumeSkipSeekTable = readLE32(state + 56) & 1;
+    *keep = ctx->resumeOutputSize;
+}
+
+/**
+ * Check that the planned input is the one the checkpoint was taken on,
+ * with the same options, and skip the frames it has written.
+ *
+ * @param ctx  The compression context, with resume set and a plan.
+ * @return     false on error.
+ */
+static bool resumeStart(Context *ctx){
+    if(ctx->resumeOptionsHash != checkpointOptionsHash(ctx)){
+        return fail(ctx, T2SZ_ERROR_PARAMETER, "The checkpoint was taken with other options");
+    }
+    if(ctx->resumeInputSize != ctx->inBuffSize || ctx->resumeFrames > ctx->planLen){
+        return fail(ctx, T2SZ_ERROR_PARAMETER, "The checkpoint was taken on another input");
+    }
+    for(size_t i = 0; i < ctx->resumeFrames; i++){
+        checkpointHashFrame(ctx, i);
+    }
+    if(ctx->resumePlanHash != ctx->planHash || ctx->resumeSampleHash != ctx->sampleHash){
+        return fail(ctx, T2SZ_ERROR_PARAMETER, "The checkpoint was taken on another input");
+    }
+    ctx->framesWritten = ctx->resumeFrames;
+    ctx->frameCount = ctx->resumeFrames;
+    ctx->outputBytes = ctx->resumeOutputSize;
+    ctx->skipSeekTable = ctx->skipSeekTable || ctx->resumeSkipSeekTable;
+    if(ctx->verbose){
+        fprintf(stderr, "# RESUME (%" PRIu64 " of %zu frames done, %" PRIu64 " bytes)\n\n",
+                ctx->resumeFrames, ctx->planLen, ctx->resumeOutputSize);
+    }
+    return true;
+}
+
+/**
+ * Leave resume mode at the end of the compression call, whatever its
+ * outcome.
+ *
+ * @param ctx  The compression context.
+ */
+static void resumeEnd(Context *ctx){
+    if(!ctx->resume){
+        return;
+    }
+    ctx->resume = false;
+    ctx->resumeSkipSeekTable = false;
+    ctx->resumeFrames = 0;
+    ctx->resumeOutputSize = 0;
+    ZSTD_freeCDict(ctx->cdict);
+    ctx->cdict = NULL;
+    free(ctx->dictBuff);
+    ctx->dictBuff = NULL;
+    ctx->dictSize = 0;
+}
+
+/* ── Public API ────────────────────────────────────────────────────────────*/
+
+void t2szInitOptions(T2szOptions *opts){
+    memset(opts, 0, sizeof(*opts));
+    opts->level = 3;
+}
+
+T2szContext* t2szCreate(void){
+    pthread_once(&tarKernelsOnce, tarKernelsSelect);
+    Context *ctx = calloc(1, sizeof(Context));
+    if(!ctx){
+        return NULL;
+    }
+    atomic_init(&ctx->error, T2SZ_OK);
+    atomic_init(&ctx->fastFrames, 0);
+    atomic_init(&ctx->threadMemory, 0);
+    atomic_init(&ctx->progressIn, 0);
+    atomic_init(&ctx->progressOut, 0);
+    atomic_init(&ctx->progressTotal, 0);
+    atomic_init(&ctx->progressResumed, 0);
+    ctx->level = 3;
+    return ctx;
+}
+
+void t2szFree(T2szContext *ctx){
+    if(!ctx){
+        return;
+    }
+    ZSTD_freeCCtx(ctx->cctx);
+    ZSTD_freeCCtx(ctx->fastCctx);
+    ZSTD_freeCDict(ctx->cdict);
+    free(ctx->dictBuff);
+    free(ctx->outBuff);
+    free(ctx->plan);
+    free(ctx->index);
+    free(ctx->indexNames);
+    free(ctx->pendingName);
+    free(ctx->seekTable);
+    free(ctx->appendFrame);
+    free(ctx->checkpointBuff);
+    free(ctx->frameStats);
+    free(ctx);
+}
+
+/**
+ * Start a new call: clear the previous error and the per-archive state,
+ * keeping every allocation for reuse. The seek table and the index
+ * loaded by t2szAppendTo(), or the seek table loaded by t2szResume(), are
+ * kept for the compression call that uses them.
+ *
+ * @param ctx  The context.
+ */
+static void beginCall(Context *ctx){
+    atomic_store(&ctx->error, T2SZ_OK);
+    ctx->errorMsg[0] = '\0';
+    atomic_store(&ctx->warnings, 0);
+    for(size_t i = 0; i < WARNING_KINDS; i++){
+        ctx->warningMsg[i][0] = '\0';
+    }
+    ctx->inBuff = NULL;
+    ctx->inBuffSize = 0;
+    ctx->readFn = NULL;
+    ctx->readOpaque = NULL;
+    ctx->peekLen = 0;
+    ctx->peekPos = 0;
+    ctx->writeFn = NULL;
+    ctx->writeOpaque = NULL;
+    ctx->planLen = 0;
+    ctx->planMembers = 0;
+    ctx->released = 0;
+    if(!ctx->append){ //else t2szAppendTo() has loaded them from the archive
+        ctx->indexLen = 0;
+        ctx->indexNamesLen = 0;
+        if(!ctx->resume){
+            ctx->seekTableLen = 0;
+        }
+    }
+    free(ctx->pendingName);
+    ctx->pendingName = NULL;
+    ctx->frameCount = 0;
+    ctx->framesWritten = 0;
+    ctx->outputBytes = 0;
+    ctx->planHash = FNV_OFFSET;
+    ctx->sampleHash = FNV_OFFSET;
+    atomic_store(&ctx->fastFrames, 0);
+    ctx->skipSeekTable = ctx->noSeekTable;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->stats.frames = ctx->frameStats;
+    ctx->frameNs = 0;
+    atomic_store(&ctx->threadMemory, 0);
+    ctx->statsStart = statsClock(ctx);
+    atomic_store(&ctx->progressIn, 0);
+    atomic_store(&ctx->progressOut, 0);
+    atomic_store(&ctx->progressTotal, 0);
+    atomic_store(&ctx->progressResumed, 0);
+}
+
+/**
+ * @return  The error code of the call that just ended.
+ */
+static T2szError endCall(Context *ctx){
+    return (T2szError)atomic_load(&ctx->error);
+}
+
+T2szError t2szSetOptions(T2szContext *ctx, const T2szOptions *opts){
+    beginCall(ctx);
+    if(opts->level < 1 || opts->level > 22){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Invalid level %d, must be between 1 and 22", opts->level);
+    }else if(opts->maxBlockSize && opts->maxBlockSize < opts->minBlockSize){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Maximum block size must be >= minimum block size");
+    }else if(opts->dictCapacity && (opts->dictCapacity < 256 || opts->dictCapacity > 0x7FFFFFFF)){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Dictionary size must be between 256 bytes and 2 GiB");
+    }else if(opts->buildIndex && opts->rawMode){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "The member index (-i) requires tar mode");
+    }else if(opts->cdcAverage && !opts->rawMode){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Content-defined chunking (--cdc) requires raw mode");
+    }else if((opts->autoMaxRead || opts->autoRatioLoss) &&
+             (opts->minBlockSize || opts->maxBlockSize || opts->cdcAverage)){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Automatic block sizes can't be combined with -s, -S or --cdc");
+    }else if(!(opts->autoRatioLoss >= 0 && opts->autoRatioLoss <= 100)){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "The ratio loss must be between 0 and 100 percent");
+    }else if(cdcSetup(ctx, opts)){
+        ctx->level = (uint8_t)opts->level;
+        ctx->minBlockSize = opts->minBlockSize;
+        ctx->maxBlockSize = opts->maxBlockSize;
+        ctx->workers = opts->workers;
+        ctx->dictCapacity = opts->dictCapacity;
+        ctx->autoMaxRead = opts->autoMaxRead;
+        ctx->autoRatioLoss = opts->autoRatioLoss;
+        ctx->autoBlock = opts->autoMaxRead || opts->autoRatioLoss;
+        ctx->rawMode = opts->rawMode;
+        ctx->noSeekTable = opts->skipSeekTable;
+        ctx->buildIndex = opts->buildIndex;
+        ctx->compressAll = opts->compressAll;
+        ctx->collectStats = opts->collectStats;
+        ctx->noDecompress = opts->noDecompress;
+        ctx->verify = opts->verify;
+        ctx->verbose = opts->verbose;
+        ctx->checkpointFn = opts->checkpointFn;
+        ctx->checkpointOpaque = opts->checkpointOpaque;
+        ctx->checkpointInterval = opts->checkpointInterval;
+        ctx->inputWindow = opts->inputWindow;
+        ctx->releaseFn = opts->releaseFn;
+        ctx->releaseOpaque = opts->releaseOpaque;
+    }
+    return endCall(ctx);
+}
+
+T2szError t2szCompressBuffer(T2szContext *ctx, const void *src, size_t size,
+                             T2szWriteFn writeFn, void *writeOpaque){
+    beginCall(ctx);
+    if(!src || !size || !writeFn){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Empty input or missing sink");
+        appendEnd(ctx);
+        resumeEnd(ctx);
+        return endCall(ctx);
+    }
+    ctx->inBuff = src;
+    ctx->inBuffSize = size;
+    ctx->writeFn = writeFn;
+    ctx->writeOpaque = writeOpaque;
+    if(sniffZstdInput(ctx)){
+        compressStreamed(ctx);  //frames can only be planned on the decompressed data
+    }else{
+        compressPlanned(ctx);
+    }
+    appendEnd(ctx);
+    resumeEnd(ctx);
+    return endCall(ctx);
+}
+
+T2szError t2szCompressStream(T2szContext *ctx, T2szReadFn readFn, void *readOpaque,
+                             T2szWriteFn writeFn, void *writeOpaque){
+    beginCall(ctx);
+    if(!readFn || !writeFn){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Missing source or sink");
+        appendEnd(ctx);
+        resumeEnd(ctx);
+        return endCall(ctx);
+    }
+    ctx->readFn = readFn;
+    ctx->readOpaque = readOpaque;
+    ctx->writeFn = writeFn;
+    ctx->writeOpaque = writeOpaque;
+    compressStreamed(ctx);
+    appendEnd(ctx);
+    resumeEnd(ctx);
+    return endCall(ctx);
+}
+
+T2szError t2szAppendTo(T2szContext *ctx, const void *archive, size_t size, uint64_t *keep){
+    appendEnd(ctx);
+    resumeEnd(ctx);
+    beginCall(ctx);
+    if(!archive || !keep){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Missing archive");
+        return endCall(ctx);
+    }
+    prepareAppend(ctx, archive, size, keep);
+    if(failed(ctx)){
+        ctx->append = true; //release what was loaded
+        appendEnd(ctx);
+    }
+    return endCall(ctx);
+}
+
+T2szError t2szResume(T2szContext *ctx, const void *state, size_t len, uint64_t *keep){
+    appendEnd(ctx);
+    resumeEnd(ctx);
+    beginCall(ctx);
+    if(!state || !keep){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Missing checkpoint");
+        return endCall(ctx);
+    }
+    prepareResume(ctx, state, len, keep);
+    if(failed(ctx)){
+        ctx->resume = true; //release what was loaded
+        resumeEnd(ctx);
+        ctx->seekTableLen = 0;
+    }
+    return endCall(ctx);
+}
+
+T2szError t2szPlan(T2szContext *ctx, const void *src, size_t size,
+                   const T2szFrame **frames, size_t *nbFrames, uint64_t *nbMembers){
+    beginCall(ctx);
+    if(!src || !size){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Empty input");
+        return endCall(ctx);
+    }
+    ctx->inBuff = src;
+    ctx->inBuffSize = size;
+    if(sniffZstdInput(ctx)){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "The input is zstd-compressed, decompress it to plan its frames");
+    }else if((!ctx->autoBlock || autoBlockSizes(ctx)) && planFrames(ctx)){
+        *frames = ctx->plan;
+        *nbFrames = ctx->planLen;
+        *nbMembers = ctx->planMembers;
+    }
+    free(ctx->pendingName);
+    ctx->pendingName = NULL;
+    return endCall(ctx);
+}
+
+T2szError t2szExtract(T2szContext *ctx, const void *archive, size_t size, const char *member,
+                      T2szWriteFn writeFn, void *writeOpaque){
+    beginCall(ctx);
+    if(!archive || !member || !writeFn){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Missing archive, member name or sink");
+        return endCall(ctx);
+    }
+    ctx->inBuff = archive;
+    ctx->inBuffSize = size;
+    ctx->writeFn = writeFn;
+    ctx->writeOpaque = writeOpaque;
+    extractMember(ctx, member);
+    return endCall(ctx);
+}
+
+T2szError t2szTest(T2szContext *ctx, const void *archive, size_t size, T2szTestResult *result){
+    beginCall(ctx);
+    if(!archive || !result){
+        fail(ctx, T2SZ_ERROR_PARAMETER, "Missing archive or result");
+        return endCall(ctx);
+    }
+    memset(result, 0, sizeof(*result));
+    ctx->inBuff = archive;
+    ctx->inBuffSize = size;
+    testArchive(ctx, result);
+    return endCall(ctx);
+}
+
+const T2szStats* t2szGetStats(const T2szContext *ctx){
+    return &ctx->stats;
+}
+
+void t2szGetProgress(T2szContext *ctx, T2szProgress *progress){
+    progress->inputBytes = atomic_load_explicit(&ctx->progressIn, memory_order_relaxed);
+    progress->outputBytes = atomic_load_explicit(&ctx->progressOut, memory_order_relaxed);
+    progress->totalBytes = atomic_load_explicit(&ctx->progressTotal, memory_order_relaxed);
+    progress->resumedBytes = atomic_load_explicit(&ctx->progressResumed, memory_order_relaxed);
+}
+
+const char* t2szErrorMessage(const T2szContext *ctx){
+    return ctx->errorMsg;
+}
+
+unsigned t2szGetWarnings(const T2szContext *ctx){
+    return atomic_load(&((T2szContext*)ctx)->warnings);
+}
+
+const char* t2szWarningMessage(const T2szContext *ctx, const T2szWarning warning){
+    for(unsigned kind = 0; kind < WARNING_KINDS; kind++){
+        if((unsigned)warning == 1u << kind){
+            return ctx->warningMsg[kind];
+        }
+    }
+    return "";
+}
+
+const char* t2szErrorName(T2szError err){
+    switch(err){
+        case T2SZ_OK:               return "no error";
+        case T2SZ_ERROR_PARAMETER:  return "invalid parameter";
+        case T2SZ_ERROR_MEMORY:     return "out of memory";
+        case T2SZ_ERROR_READ:       return "read error";
+        case T2SZ_ERROR_WRITE:      return "write error";
+        case T2SZ_ERROR_FORMAT:     return "invalid or corrupted input";
+        case T2SZ_ERROR_NOT_FOUND:  return "member not found";
+        case T2SZ_ERROR_ZSTD:       return "zstd error";
+        case T2SZ_ERROR_THREAD:     return "cannot start thread";
+        case T2SZ_ERROR_VERIFY:     return "verification failed";
+    }
+    return "unknown error";
+}
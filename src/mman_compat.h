@@ -5,7 +5,7 @@
  *
  * Maps POSIX mmap(PROT_READ, MAP_PRIVATE) to the Windows
  * CreateFileMapping + MapViewOfFile API.  Only the subset used
- * by t2sz is implemented.
+ * by t2sz is implemented; madvise() is a no-op.
  */
 #ifndef MMAN_COMPAT_H
 #define MMAN_COMPAT_H
@@ -49,6 +49,18 @@ static inline int munmap(void *addr, size_t length){
     return UnmapViewOfFile(addr) ? 0 : -1;
 }
 
+/* Paging hints are only hints: none of them is needed for correctness. */
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
+
+static inline int madvise(void *addr, size_t length, int advice){
+    (void)addr;
+    (void)length;
+    (void)advice;
+    return 0;
+}
+
 #else /* POSIX */
 #include <sys/mman.h>
 #endif
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* ******************************************************************
+ * t2sz
+ * Copyright (c) 2020, Martinelli Marco
+ *
+ * You can contact the author at :
+ * - Email: marco+t2sz@13byte.com
+ * - Source repository : https://github.com/martinellimarco/t2sz
+ *
+ * This source code is licensed under the GPLv3 (found in the LICENSE
+ * file in the root directory of this source tree).
+****************************************************************** */
+
+#ifdef __linux__
+#define _GNU_SOURCE     //O_DIRECT
+#endif
+#include <errno.h>
+#include "pread_reader.h"
+
+#ifndef _WIN32
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/* The thread stays up to PREAD_BUFFERS chunks of PREAD_CHUNK bytes ahead
+ * of the consumer. Chunks, buffers and file offsets are PREAD_ALIGN
+ * aligned, which satisfies O_DIRECT on the usual 512-byte and 4K block
+ * devices. */
+#define PREAD_BUFFERS   8
+#define PREAD_CHUNK     ((size_t)2 << 20)
+#define PREAD_ALIGN     4096
+
+typedef struct {
+    uint8_t* data;          //PREAD_ALIGN-aligned, PREAD_CHUNK bytes
+    size_t len;             //bytes read into it
+    size_t pos;             //bytes handed to the consumer
+    bool filled;            //owned by the consumer until it is drained
+    bool last;              //the file ends with this chunk
+    int err;                //errno of a failed read, after the len bytes
+} PreadBuffer;
+
+struct PreadReader {
+    int fd;
+    bool direct;
+    bool dropCache;
+    PreadBuffer bufs[PREAD_BUFFERS];
+    size_t next;            //buffer the consumer reads from
+    bool stop;              //preadReaderClose(): the thread exits
+    bool threaded;          //the thread was started, the file is more than one chunk
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filledCond;  //a buffer was filled
+    pthread_cond_t freeCond;    //a buffer was drained, or stop was set
+};
+
+/**
+ * Fill one chunk from @p offset. Reads until the chunk is full, the file
+ * ends or a read fails; with O_DIRECT a read that stops off alignment is
+ * the end of the file.
+ *
+ * @param r       The reader.
+ * @param b       The buffer to fill.
+ * @param offset  File offset of the chunk.
+ */
+static void preadChunk(PreadReader *r, PreadBuffer *b, const uint64_t offset){
+    size_t len = 0;
+    int err = 0;
+    while(len < PREAD_CHUNK){
+        const ssize_t n = pread(r->fd, b->data + len, PREAD_CHUNK - len, (off_t)(offset + len));
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            err = errno;
+            break;
+        }
+        if(n == 0){
+            break;
+        }
+        len += (size_t)n;
+        if(r->direct && len % PREAD_ALIGN){
+            break;
+        }
+    }
+#ifdef POSIX_FADV_DONTNEED
+    if(r->dropCache && len){
+        posix_fadvise(r->fd, (off_t)offset, (off_t)len, POSIX_FADV_DONTNEED);
+    }
+#endif
+    b->len = len;
+    b->pos = 0;
+    b->err = err;
+    b->last = err || len < PREAD_CHUNK;
+}
+
+/**
+ * Readahead thread: fill the buffers in order, waiting for the consumer
+ * to drain one before reusing it, until the end of the file or an error.
+ *
+ * @param arg  The reader.
+ * @return     NULL.
+ */
+static void* preadThread(void *arg){
+    PreadReader *r = arg;
+    uint64_t offset = r->bufs[0].len;   //the first chunk was read by preadReaderOpen()
+    for(size_t i = 1; ; i++){
+        PreadBuffer *b = &r->bufs[i % PREAD_BUFFERS];
+        pthread_mutex_lock(&r->lock);
+        while(b->filled && !r->stop){
+            pthread_cond_wait(&r->freeCond, &r->lock);
+        }
+        const bool stop = r->stop;
+        pthread_mutex_unlock(&r->lock);
+        if(stop){
+            break;
+        }
+
+        preadChunk(r, b, offset);
+        offset += b->len;
+
+        pthread_mutex_lock(&r->lock);
+        b->filled = true;
+        pthread_cond_signal(&r->filledCond);
+        pthread_mutex_unlock(&r->lock);
+        if(b->last){
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Free what preadReaderOpen() set up so far and close the file, keeping
+ * errno.
+ *
+ * @param r  The reader, with its thread stopped or never started.
+ */
+static void preadRelease(PreadReader *r){
+    const int err = errno;
+    for(size_t i = 0; i < PREAD_BUFFERS; i++){
+        free(r->bufs[i].data);
+    }
+    close(r->fd);
+    free(r);
+    errno = err;
+}
+
+PreadReader* preadReaderOpen(const char *filename, bool direct, bool dropCache, uint64_t *size){
+    int flags = O_RDONLY;
+#ifdef O_DIRECT
+    if(direct){
+        flags |= O_DIRECT;
+    }
+#elif !defined(F_NOCACHE)
+    if(direct){
+        errno = EINVAL;
+        return NULL;
+    }
+#endif
+    // Checked before open(): opening a FIFO would block for a writer,
+    // and closing it again would lose what the writer sent.
+    struct stat st;
+    if(stat(filename, &st) == 0 && !S_ISREG(st.st_mode)){
+        errno = ESPIPE;
+        return NULL;
+    }
+    const int fd = open(filename, flags);
+    if(fd < 0){
+        return NULL;
+    }
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+        close(fd);
+        errno = ESPIPE;
+        return NULL;
+    }
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    if(direct && fcntl(fd, F_NOCACHE, 1) != 0){
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+#endif
+
+    PreadReader *r = calloc(1, sizeof(PreadReader));
+    if(!r){
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    r->fd = fd;
+    r->direct = direct;
+    r->dropCache = dropCache && !direct;
+    for(size_t i = 0; i < PREAD_BUFFERS; i++){
+        void *p = NULL;
+        if(posix_memalign(&p, PREAD_ALIGN, PREAD_CHUNK) != 0){
+            errno = ENOMEM;
+            preadRelease(r);
+            return NULL;
+        }
+        r->bufs[i].data = p;
+    }
+
+    // Some filesystems accept O_DIRECT at open() and only fail the reads:
+    // try the first chunk here so that the caller can fall back.
+    preadChunk(r, &r->bufs[0], 0);
+    if(r->bufs[0].err){
+        errno = r->bufs[0].err;
+        preadRelease(r);
+        return NULL;
+    }
+    r->bufs[0].filled = true;
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->filledCond, NULL);
+    pthread_cond_init(&r->freeCond, NULL);
+    if(!r->bufs[0].last){
+        if(pthread_create(&r->thread, NULL, preadThread, r) != 0){
+            pthread_mutex_destroy(&r->lock);
+            pthread_cond_destroy(&r->filledCond);
+            pthread_cond_destroy(&r->freeCond);
+            errno = EAGAIN;
+            preadRelease(r);
+            return NULL;
+        }
+        r->threaded = true;
+    }
+    *size = (uint64_t)st.st_size;
+    return r;
+}
+
+ptrdiff_t preadReaderRead(void *reader, void *buf, size_t len){
+    PreadReader *r = reader;
+    size_t done = 0;
+    while(done < len){
+        PreadBuffer *b = &r->bufs[r->next % PREAD_BUFFERS];
+        pthread_mutex_lock(&r->lock);
+        while(!b->filled){
+            pthread_cond_wait(&r->filledCond, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        const size_t n = len - done < b->len - b->pos ? len - done : b->len - b->pos;
+        memcpy((uint8_t*)buf + done, b->data + b->pos, n);
+        b->pos += n;
+        done += n;
+        if(b->pos < b->len){
+            continue;
+        }
+        if(b->last){
+            // Stays filled: the following calls return 0, or the error.
+            if(b->err && !done){
+                errno = b->err;
+                return -1;
+            }
+            break;
+        }
+        pthread_mutex_lock(&r->lock);
+        b->filled = false;
+        r->next++;
+        pthread_cond_signal(&r->freeCond);
+        pthread_mutex_unlock(&r->lock);
+    }
+    return (ptrdiff_t)done;
+}
+
+void preadReaderClose(PreadReader *r){
+    if(!r){
+        return;
+    }
+    if(r->threaded){
+        pthread_mutex_lock(&r->lock);
+        r->stop = true;
+        pthread_cond_signal(&r->freeCond);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->thread, NULL);
+    }
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->filledCond);
+    pthread_cond_destroy(&r->freeCond);
+    preadRelease(r);
+}
+
+#else /* _WIN32 */
+
+PreadReader* preadReaderOpen(const char *filename, bool direct, bool dropCache, uint64_t *size){
+    (void)filename; (void)direct; (void)dropCache; (void)size;
+    errno = ENOSYS;
+    return NULL;
+}
+
+ptrdiff_t preadReaderRead(void *reader, void *buf, size_t len){
+    (void)reader; (void)buf; (void)len;
+    errno = ENOSYS;
+    return -1;
+}
+
+void preadReaderClose(PreadReader *r){
+    (void)r;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/**
+ * Input file reader with a readahead thread.
+ *
+ * A dedicated thread reads the file in large aligned chunks with pread()
+ * into a pool of buffers, up to PREAD_BUFFERS chunks ahead of the
+ * consumer, which copies them out through preadReaderRead(). On network
+ * filesystems this keeps large requests in flight while the compressor
+ * works, instead of stalling on one page fault at a time in a mapped
+ * file. With direct I/O the page cache is bypassed (O_DIRECT on Linux,
+ * F_NOCACHE on macOS).
+ *
+ * Not available on Windows: preadReaderOpen() returns NULL with errno set
+ * to ENOSYS and the caller maps the file instead.
+ */
+#ifndef PREAD_READER_H
+#define PREAD_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct PreadReader PreadReader;
+
+/**
+ * Open @p filename and start reading it ahead.
+ *
+ * @param filename   A regular file.
+ * @param direct     Bypass the page cache.
+ * @param dropCache  Drop every chunk from the page cache once it is read
+ *                   (see --input-window), when not @p direct.
+ * @param size       Set to the size of the file.
+ * @return           The reader, or NULL with errno set: ESPIPE if the file
+ *                   is not a regular file, EINVAL if its filesystem does
+ *                   not support direct I/O.
+ */
+PreadReader* preadReaderOpen(const char *filename, bool direct, bool dropCache, uint64_t *size);
+
+/**
+ * Copy the next bytes of the file, waiting for the readahead thread if
+ * needed. Has the signature of a T2szReadFn.
+ *
+ * @param reader  The PreadReader.
+ * @return        Bytes stored in @p buf, 0 at the end of the file, or -1
+ *                on error with errno set.
+ */
+ptrdiff_t preadReaderRead(void *reader, void *buf, size_t len);
+
+/** Stop the readahead thread, close the file and free the reader. Accepts NULL. */
+void preadReaderClose(PreadReader *r);
+
+#endif /* PREAD_READER_H */
@@ -11,388 +11,471 @@
  * file in the root directory of this source tree).
 ****************************************************************** */
 
+
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
-#include <math.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
 
 #ifdef _WIN32
 #include <io.h>
 #else
 #include <unistd.h>
+#include <sys/resource.h>
 #endif
 #include "mman_compat.h"
-#include <zstd.h>
-
-typedef struct __attribute__((__packed__)) { /* byte offset */
-    char name[100];               /*   0 */
-    char mode[8];                 /* 100 */
-    char uid[8];                  /* 108 */
-    char gid[8];                  /* 116 */
-    char size[12];                /* 124 */
-    char mtime[12];               /* 136 */
-    char chksum[8];               /* 148 */
-    char typeflag;                /* 156 */
-    char linkname[100];           /* 157 */
-    char magic[6];                /* 257 */
-    char version[2];              /* 263 */
-    char uname[32];               /* 265 */
-    char gname[32];               /* 297 */
-    char devmajor[8];             /* 329 */
-    char devminor[8];             /* 337 */
-    char prefix[155];             /* 345 */
-    /* 500 */
-} TarHeader;
+#include "t2sz.h"
+#include "uring_writer.h"
+#include "pread_reader.h"
 
-/**
- * Compute the POSIX tar header checksum.
- *
- * Sums all 512 bytes of the header, treating the 8-byte chksum field
- * (offset 148-155) as ASCII spaces (0x20) per the POSIX spec.
- *
- * @param header  Pointer to a 512-byte tar header block.
- * @return        The unsigned 32-bit checksum value.
- */
-uint32_t checksum(const TarHeader* header){
-    const uint8_t* ptr = (const uint8_t*)header;
-    uint32_t ac = 0;
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
-    while(ptr < (const uint8_t*)&header->chksum) {
-        ac += *ptr++;
-    }
+/* The command line tool is a client of libt2sz (t2sz.h): it maps or
+ * streams the input, hands it to the library with a FILE-backed sink and
+ * turns the returned error codes into messages and an exit status. */
 
-    ac += 8*0x20;//8 ASCII spaces
-    ptr+= 8;
+/* How an input file is read (--input-engine). */
+typedef enum {
+    INPUT_ENGINE_MMAP,          //mapped, frames planned up front (default)
+    INPUT_ENGINE_PREAD,         //pread() on a readahead thread, streamed like stdin
+    INPUT_ENGINE_PREAD_DIRECT   //the same, bypassing the page cache
+} InputEngine;
 
-    while(ptr < (const uint8_t*)header+512) {
-        ac += *ptr++;
-    }
+static const char* const inputEngineNames[] = {"mmap", "pread", "pread-direct"};
 
-    return ac;
-}
+typedef struct {
+    const char* inFilename;
+    char *outFilename;
+    bool stdinMode;   //input is "-" (stdin)
+    bool stdoutMode;  //output is "-" (stdout)
+    bool planOnly;    //print the frame plan and exit (--plan)
+    bool noIoUring;   //write the output file with stdio only (--no-io-uring)
+    const char* extractName;    //tar member to extract (-x), NULL when compressing
+    bool testMode;    //check the integrity of an archive (-t)
+    const char* appendTo;       //archive the input members are appended to (-a), NULL otherwise
+    bool checkpoint;  //save checkpoints to OUTPUT.ckpt (--checkpoint)
+    bool resume;      //continue from OUTPUT.ckpt if there is one (--resume)
+    const char* statsFile;      //JSON statistics written there (--stats), NULL otherwise
+    bool progress;    //report progress on stderr from a timer (--progress)
+    size_t inputWindow;         //input bytes kept in memory (--input-window), 0 for the whole input
+    int inputFd;      //input file kept open by mapInput() for --input-window, -1 otherwise
+    InputEngine inputEngine;    //--input-engine, the one in use once the input is open
+    T2szOptions t2sz; //compression options handed to the library
+} Options;
+
+/* Seconds between two checkpoints with --resume and no --checkpoint. */
+#define CHECKPOINT_DEFAULT_INTERVAL 60
 
 /**
- * Validate a tar header by comparing its stored checksum against the
- * computed one.
- *
- * Extracts the 6-byte octal string from header->chksum, converts it
- * with strtoul, and compares to checksum(). Prints a diagnostic on
- * mismatch.
- *
- * @param header  Pointer to the tar header to validate.
- * @return        true if the checksum matches, false otherwise.
+ * Output sink backed by a FILE, or by an io_uring writer.
+ *
+ * The file is opened on the first write, so an input rejected by the
+ * library (invalid archive, missing member) leaves no empty output file
+ * behind. With -a (and --resume) the existing file is written from the
+ * offset given by t2szAppendTo() (t2szResume()) on, and cut where the new
+ * data ends. Output files go through a UringWriter when the kernel
+ * supports it: the compressor then only copies into a pool buffer while
+ * earlier buffers are being written. Stdout, and any file io_uring can't
+ * handle, use stdio.
  */
-bool isTarHeader(const TarHeader* header){
-    const uint32_t chksum = checksum(header);
-
-    char buf[7];
-    memcpy(buf, header->chksum, 6);
-    buf[6] = 0;
-    const uint32_t hdrChksum = strtoul(buf, NULL, 8);
+typedef struct {
+    const char* filename;   //NULL for stdout
+    bool useUring;          //try io_uring for the output file
+    bool verbose;
+    bool append;            //write into the existing file from offset on, and cut it at the end (-a, --resume)
+    uint64_t offset;
+    uint64_t written;       //bytes accepted so far
+    FILE* file;
+    UringWriter* uring;     //non-NULL when io_uring is in use, file is NULL then
+    int fd;                 //descriptor behind uring
+    bool openFailed;        //fopen() failed
+    int err;                //errno of the failed fopen()/fwrite(), 0 if none
+} FileSink;
 
-    if(chksum != hdrChksum){
-        fprintf(stderr, "ERROR: Mismatching checksum. Expected 0x%08x but found 0x%08x.\n", chksum, hdrChksum);
+/**
+ * Open the output of a FileSink on first use.
+ *
+ * @param sink  The sink.
+ * @return      false if the output file could not be opened.
+ */
+static bool openSink(FileSink *sink){
+    if(sink->filename == NULL){
+        sink->file = stdout;
+        return true;
+    }
+    if(sink->append){
+        const int fd = open(sink->filename, O_WRONLY | O_BINARY);
+        if(fd < 0 || lseek(fd, (off_t)sink->offset, SEEK_SET) < 0){
+            sink->openFailed = true;
+            sink->err = errno;
+            if(fd >= 0){
+                close(fd);
+            }
+            return false;
+        }
+        sink->fd = fd;
+        sink->uring = sink->useUring ? uringWriterOpen(fd) : NULL;
+        if(sink->uring == NULL && (sink->file = fdopen(fd, "wb")) == NULL){
+            sink->openFailed = true;
+            sink->err = errno;
+            close(fd);
+            return false;
+        }
+        if(sink->uring && sink->verbose){
+            fprintf(stderr, "Output: io_uring\n");
+        }
+        return true;
+    }
+#ifdef HAVE_IO_URING
+    if(sink->useUring){
+        const int fd = open(sink->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(fd < 0){
+            sink->openFailed = true;
+            sink->err = errno;
+            return false;
+        }
+        sink->uring = uringWriterOpen(fd);
+        if(sink->uring){
+            sink->fd = fd;
+            if(sink->verbose){
+                fprintf(stderr, "Output: io_uring\n");
+            }
+            return true;
+        }
+        sink->file = fdopen(fd, "wb");
+        if(sink->file == NULL){
+            sink->openFailed = true;
+            sink->err = errno;
+            close(fd);
+            return false;
+        }
+        return true;
+    }
+#endif
+    if((sink->file = fopen(sink->filename, "wb")) == NULL){
+        sink->openFailed = true;
+        sink->err = errno;
         return false;
     }
-
     return true;
 }
 
 /**
- * Safely parse the octal size field from a tar header.
+ * T2szWriteFn writing to a FileSink.
  *
- * The size field is a fixed 12-byte array that is not guaranteed to be
- * NUL-terminated for malformed inputs. This function copies it into a
- * local buffer and NUL-terminates before calling strtoul, matching the
- * defensive pattern already used in isTarHeader() for the checksum field.
+ * Every byte is checked: a short write (e.g. disk full, broken pipe) must
+ * fail the call rather than silently produce a corrupt output file.
  *
- * @param header  Pointer to the tar header.
- * @return        Parsed file size in bytes.
+ * @param opaque  The FileSink.
+ * @param buf     Bytes to write.
+ * @param len     Number of bytes.
+ * @return        0 on success, -1 on error (errno saved in the sink).
  */
-static size_t parseTarSize(const TarHeader *header){
-    char buf[13];
-    memcpy(buf, header->size, 12);
-    buf[12] = '\0';
-    return (size_t)strtoul(buf, NULL, 8);
+static int writeFile(void *opaque, const void *buf, size_t len){
+    FileSink *sink = opaque;
+    if(sink->file == NULL && sink->uring == NULL && !openSink(sink)){
+        return -1;
+    }
+    if(sink->uring){
+        if(uringWriterWrite(sink->uring, buf, len) != 0){
+            sink->err = errno;
+            return -1;
+        }
+        sink->written += len;
+        return 0;
+    }
+    if(len && fwrite(buf, 1, len, sink->file) != len){
+        sink->err = errno;
+        return -1;
+    }
+    sink->written += len;
+    return 0;
 }
 
-typedef struct {
-    uint32_t compressedSize;
-    uint32_t decompressedSize;
-} SeekTableEntry;
-
-typedef struct {
-    //input parameters
-    const char* inFilename;
-    char *outFilename;
-    uint8_t level;
-    size_t minBlockSize;
-    size_t maxBlockSize;
-    bool verbose;
-    bool rawMode;     //non-tar mode
-    bool stdinMode;   //input is "-" (stdin)
-    bool stdoutMode;  //output is "-" (stdout)
-    uint32_t workers;
-
-    //input buffer
-    size_t inBuffSize;
-    uint8_t* inBuff;
-
-    //output buffer
-    FILE* outFile;
-    size_t outBuffSize;
-    void* outBuff;
-
-    //compression context
-    ZSTD_CCtx* cctx;
-
-    //seek table
-    SeekTableEntry* seekTable;
-    size_t seekTableLen;
-    size_t seekTableCap;
-    bool skipSeekTable;
-} Context;
-
-/* Compile-time endianness detection.  GCC/Clang define __BYTE_ORDER__
- * and __ORDER_LITTLE_ENDIAN__; MSVC is always little-endian on supported
- * architectures.  If none of the macros are available the runtime
- * fallback is used (no volatile — the result is constant). */
-#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
-#define IS_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
-#elif defined(_WIN32)
-#define IS_LITTLE_ENDIAN 1
+/**
+ * Cut the file behind @p fd to @p size bytes.
+ *
+ * @return  0 on success, -1 on error with errno set.
+ */
+static int truncateFd(const int fd, const uint64_t size){
+#ifdef _WIN32
+    errno = _chsize_s(fd, (__int64)size);
+    return errno ? -1 : 0;
 #else
-static inline bool isLittleEndian(void){
-    const int x = 1;
-    return *(const char*)(&x) == 1;
-}
-#define IS_LITTLE_ENDIAN isLittleEndian()
+    return ftruncate(fd, (off_t)size);
 #endif
+}
 
 /**
- * Write a 32-bit unsigned integer to memory in little-endian byte order.
+ * Flush the file descriptor @p fd to the storage device.
  *
- * On little-endian hosts this is a straight memcpy; on big-endian hosts
- * the bytes are swapped first.
- *
- * @param dst   Destination buffer (must hold at least 4 bytes).
- * @param data  The value to store.
+ * @return  0 on success, -1 on error with errno set.
  */
-void writeLE32(void* dst, const uint32_t data){
-    if(IS_LITTLE_ENDIAN){
-        memcpy(dst, &data, sizeof(data));
-    }else{
-        const uint32_t swap = ((data & 0xFF000000) >> 24) |
-                        ((data & 0x00FF0000) >> 8)  |
-                        ((data & 0x0000FF00) << 8)  |
-                        ((data & 0x000000FF) << 24);
-        memcpy(dst, &swap, sizeof(swap));
-    }
+static int syncFd(const int fd){
+#ifdef _WIN32
+    return _commit(fd);
+#else
+    return fsync(fd);
+#endif
 }
 
 /**
- * Write @p len bytes to @p f, aborting on short writes.
- *
- * Wraps fwrite() with an error check so that I/O failures (disk full,
- * broken pipe, etc.) are caught immediately instead of silently
- * producing a corrupt output file.
+ * Make every byte written to the sink so far durable, before a checkpoint
+ * records it.
  *
- * @param buf  Source buffer.
- * @param len  Number of bytes to write.
- * @param f    Destination file stream.
- * @return     Number of bytes written (always @p len on success).
+ * @param sink  The sink.
+ * @return      0 on success, -1 on error (errno saved in the sink).
  */
-static size_t checkedFwrite(const void *buf, const size_t len, FILE *f){
-    if(len == 0) return 0;
-    const size_t written = fwrite(buf, 1, len, f);
-    if(written != len){
-        fprintf(stderr, "ERROR: Failed to write output: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+static int syncSink(FileSink *sink){
+    int ret = 0;
+    if(sink->uring){
+        ret = uringWriterFlush(sink->uring) == 0 ? syncFd(sink->fd) : -1;
+    }else if(sink->file){
+        ret = fflush(sink->file) == 0 ? syncFd(fileno(sink->file)) : -1;
+    }
+    if(ret != 0){
+        sink->err = errno;
     }
-    return written;
+    return ret;
 }
 
 /**
- * Append the zstd seekable-format seek table to the output file.
+ * Flush and close the sink.
  *
- * Writes a Skippable frame (magic 0x184D2A5E | 0xE) containing:
- *   - one (compressedSize, decompressedSize) pair per frame,
- *   - a footer with Number_Of_Frames, Seek_Table_Descriptor (0),
- *     and Seekable_Magic_Number (0x8F92EAB1).
+ * After a successful call the output must exist even if nothing was
+ * written to it (e.g. empty raw input with -j), so the file is created
+ * here when needed. An archive appended to is cut after the new data,
+ * dropping what is left of its old seek table.
  *
- * All multi-byte fields are written in little-endian order.
- * In verbose mode, the per-frame sizes are printed to stderr.
- *
- * @param ctx  The compression context (reads seekTable, seekTableLen,
- *             outFile, verbose).
+ * @param sink     The sink.
+ * @param success  Whether the library call succeeded.
+ * @return         false if the output could not be created or flushed.
  */
-void writeSeekTable(const Context *ctx){
-    uint8_t buf[4];
-    //Skippable_Magic_Number
-    writeLE32(buf, ZSTD_MAGIC_SKIPPABLE_START | 0xE);
-    checkedFwrite(buf, 4, ctx->outFile);
-
-    //Frame_Size
-    writeLE32(buf, (uint32_t)ctx->seekTableLen*8 + 9);
-    checkedFwrite(buf, 4, ctx->outFile);
-        
-    if(ctx->verbose){
-        fprintf(stderr, "\n---- seek table ----\n");
-        fprintf(stderr, "decompressed\tcompressed\n");
-    }
-
-    //Seek_Table_Entries
-    for(size_t i = 0; i < ctx->seekTableLen; i++){
-        const SeekTableEntry* e = &ctx->seekTable[i];
-
-        //Compressed_Size
-        writeLE32(buf, e->compressedSize);
-        checkedFwrite(buf, 4, ctx->outFile);
-
-        //Decompressed_Size
-        writeLE32(buf, e->decompressedSize);
-        checkedFwrite(buf, 4, ctx->outFile);
-
-        if(ctx->verbose){
-            fprintf(stderr, "%u\t%u\n", e->decompressedSize, e->compressedSize);
+static bool closeSink(FileSink *sink, const bool success){
+    if(sink->file == NULL && sink->uring == NULL && success && writeFile(sink, NULL, 0) != 0){
+        return false;
+    }
+    if(sink->uring){
+        int ret = uringWriterClose(sink->uring);
+        if(ret != 0 && !sink->err){
+            sink->err = errno;
+        }
+        if(ret == 0 && success && sink->append && truncateFd(sink->fd, sink->offset + sink->written) != 0){
+            sink->err = errno;
+            ret = -1;
         }
+        if(close(sink->fd) != 0 && ret == 0){
+            sink->err = errno;
+            ret = -1;
+        }
+        sink->uring = NULL;
+        return ret == 0;
+    }
+    if(sink->file == NULL){
+        return true;
     }
+    if(success && sink->append && (fflush(sink->file) != 0 || truncateFd(fileno(sink->file), sink->offset + sink->written) != 0)){
+        sink->err = errno;
+        fclose(sink->file);
+        sink->file = NULL;
+        return false;
+    }
+    const int ret = sink->filename ? fclose(sink->file) : fflush(sink->file);
+    if(ret != 0 && !sink->err){
+        sink->err = errno;
+    }
+    sink->file = NULL;
+    return ret == 0;
+}
 
-    //Seek_Table_Footer
-    //Number_Of_Frames
-    writeLE32(buf, (uint32_t)ctx->seekTableLen);
-    checkedFwrite(buf, 4, ctx->outFile);
+/**
+ * T2szReadFn reading from a FILE (stdin).
+ *
+ * @param opaque  The FILE.
+ * @param buf     Destination buffer.
+ * @param len     Buffer size.
+ * @return        Bytes read, 0 at EOF, -1 on error.
+ */
+static ptrdiff_t readFile(void *opaque, void *buf, size_t len){
+    FILE *f = opaque;
+    const size_t n = fread(buf, 1, len, f);
+    if(n == 0 && ferror(f)){
+        return -1;
+    }
+    return (ptrdiff_t)n;
+}
 
-    //Seek_Table_Descriptor
-    buf[0] = 0;
-    checkedFwrite(buf, 1, ctx->outFile);
+/* Release granularity of --input-window, a multiple of every page size. */
+#define INPUT_WINDOW_ALIGN ((uint64_t)64 << 10)
 
-    //Seekable_Magic_Number
-    writeLE32(buf, 0x8F92EAB1);
-    checkedFwrite(buf, 4, ctx->outFile);
-}
+/**
+ * Input pages dropped behind the compressor (--input-window).
+ *
+ * On the mmap path the library hands back the ranges it is done with
+ * every half window: they are unmapped from the process (MADV_DONTNEED)
+ * and dropped from the page cache (POSIX_FADV_DONTNEED), and the next
+ * half window is prefetched, so about one window of the input stays in
+ * memory. On the stdin path, when stdin is a regular file, what has been
+ * read is dropped from the page cache every window.
+ */
+typedef struct {
+    uint8_t *map;           //mapped input, NULL on the stdin path
+    size_t size;            //its size
+    int fd;                 //input file, -1 if not a regular file
+    size_t window;          //--input-window
+    FILE *stream;           //stdin path: the input
+    uint64_t readBytes;     //stdin path: offset reached in the file
+    uint64_t dropped;       //stdin path: offset dropped from the page cache so far
+} InputWindow;
 
 /**
- * Ensure the seek table array has room for at least @p needed entries.
+ * Drop a range of the input file from the page cache, where supported.
  *
- * Doubles the capacity (starting from 1024) until it meets the
- * requirement, then reallocates. Aborts on OOM.
- *
- * @param ctx     The compression context owning the seek table.
- * @param needed  Minimum number of entries required.
+ * @param fd      The input file, -1 for none.
+ * @param offset  First byte.
+ * @param size    Bytes to drop.
  */
-static void seekTableEnsureCap(Context* ctx, const size_t needed) {
-    if(ctx->seekTableCap >= needed) {
-        return;
+static void dropFileCache(const int fd, const uint64_t offset, const uint64_t size){
+#ifdef POSIX_FADV_DONTNEED
+    if(fd >= 0 && size){
+        posix_fadvise(fd, (off_t)offset, (off_t)size, POSIX_FADV_DONTNEED);
     }
+#else
+    (void)fd;
+    (void)offset;
+    (void)size;
+#endif
+}
 
-    size_t newCap = ctx->seekTableCap ? ctx->seekTableCap : 1024; // start cap
-    while(newCap < needed) {
-        newCap *= 2;
+/**
+ * T2szReleaseFn of the mmap path: unmap and drop a range the library is
+ * done with, and prefetch the half window after it. Pages are only
+ * dropped from the process: the mapping stays valid and a later pass
+ * faults them in again.
+ *
+ * @param opaque  The InputWindow.
+ * @param offset  First released byte.
+ * @param size    Released bytes.
+ */
+static void releaseMapped(void *opaque, uint64_t offset, uint64_t size){
+    InputWindow *w = opaque;
+    const uint64_t start = offset / INPUT_WINDOW_ALIGN * INPUT_WINDOW_ALIGN;
+    const uint64_t end = offset + size;
+    madvise(w->map + start, (size_t)(end - start), MADV_DONTNEED);
+    dropFileCache(w->fd, start, end - start);
+    if(end < w->size){
+        const uint64_t ahead = end / INPUT_WINDOW_ALIGN * INPUT_WINDOW_ALIGN;
+        const uint64_t len = w->size - ahead < w->window / 2 ? w->size - ahead : w->window / 2;
+        madvise(w->map + ahead, (size_t)len, MADV_WILLNEED);
     }
+}
 
-    SeekTableEntry* p = realloc(ctx->seekTable, newCap * sizeof(SeekTableEntry));
-    if(!p){
-        fprintf(stderr, "ERROR: Out of memory while growing seek table\n");
-        exit(EXIT_FAILURE);
+/**
+ * T2szReadFn of the stdin path with --input-window: readFile(), then drop
+ * what has been read from the page cache every window.
+ *
+ * @param opaque  The InputWindow.
+ * @param buf     Destination buffer.
+ * @param len     Buffer size.
+ * @return        Bytes read, 0 at EOF, -1 on error.
+ */
+static ptrdiff_t readFileWindowed(void *opaque, void *buf, size_t len){
+    InputWindow *w = opaque;
+    const ptrdiff_t n = readFile(w->stream, buf, len);
+    if(n > 0){
+        w->readBytes += (uint64_t)n;
+        if(w->readBytes - w->dropped >= w->window){
+            const uint64_t start = w->dropped / INPUT_WINDOW_ALIGN * INPUT_WINDOW_ALIGN;
+            dropFileCache(w->fd, start, w->readBytes - start);
+            w->dropped = w->readBytes;
+        }
     }
-    ctx->seekTable = p;
-    ctx->seekTableCap = newCap;
+    return n;
 }
 
 /**
- * Record a compressed frame in the seek table.
+ * Print the error of a failed library call and exit.
  *
- * Silently becomes a no-op if the seek table has been disabled (by -j
- * or by overflow guards). Disables the table and prints a warning if
- * the frame count or sizes exceed the seekable-format uint32 limits.
+ * Write errors are described from the sink, which knows whether the file
+ * could not be opened or a write failed, and why.
  *
- * @param ctx               The compression context.
- * @param compressedSize    Compressed size of the frame (bytes).
- * @param decompressedSize  Decompressed size of the frame (bytes).
+ * @param ctx   The library context.
+ * @param err   The error returned by the library.
+ * @param sink  The output sink, NULL if none.
  */
-void seekTableAdd(Context* ctx, const uint64_t compressedSize, const uint64_t decompressedSize){
-    if(ctx->skipSeekTable){
-        return;
-    }
-
-    // entry size uint32 + numFrames uint32
-    if(ctx->seekTableLen + 1 >= 0x8000000U){
-        ctx->skipSeekTable = true;
-        fprintf(stderr, "Warning: Too many frames. Unable to generate the seek table.\n");
-        return;
-    }
-    if(decompressedSize >= 0x80000000U){
-        ctx->skipSeekTable = true;
-        fprintf(stderr, "Warning: Input frame too big. Unable to generate the seek table.\n");
-        return;
-    }
-    if(compressedSize >= 0x100000000ULL){
-        ctx->skipSeekTable = true;
-        fprintf(stderr, "Warning: Compressed frame too big. Unable to generate the seek table.\n");
-        return;
+static void fatal(const T2szContext *ctx, const T2szError err, const FileSink *sink){
+    if(err == T2SZ_ERROR_WRITE && sink && sink->openFailed){
+        fprintf(stderr, "ERROR: Cannot open output file for writing\n");
+    }else if(err == T2SZ_ERROR_WRITE && sink && sink->err){
+        fprintf(stderr, "ERROR: Failed to write output: %s\n", strerror(sink->err));
+    }else{
+        fprintf(stderr, "ERROR: %s\n", t2szErrorMessage(ctx));
     }
-
-    seekTableEnsureCap(ctx, ctx->seekTableLen + 1);
-
-    ctx->seekTable[ctx->seekTableLen].compressedSize   = (uint32_t)compressedSize;
-    ctx->seekTable[ctx->seekTableLen].decompressedSize = (uint32_t)decompressedSize;
-    ctx->seekTableLen++;
+    exit(EXIT_FAILURE);
 }
 
 /**
- * Allocate and zero-initialize a new compression Context.
+ * Print the warnings of the last library call, if any.
  *
- * Sets the default compression level to 3. All other fields are zero
- * (false / NULL / 0). Aborts on OOM.
- *
- * @return  A heap-allocated Context; caller must free().
+ * @param ctx  The library context.
  */
-Context* newContext(){
-    Context* ctx = malloc(sizeof(Context));
-    if(!ctx){
-        fprintf(stderr, "ERROR: Out of memory allocating new context\n");
-        exit(EXIT_FAILURE);
+static void printWarnings(const T2szContext *ctx){
+    const unsigned warnings = t2szGetWarnings(ctx);
+    for(unsigned w = 1; w && w <= warnings; w <<= 1){
+        if(warnings & w){
+            fprintf(stderr, "Warning: %s\n", t2szWarningMessage(ctx, (T2szWarning)w));
+        }
     }
-    memset(ctx, 0, sizeof(Context));
-    ctx->level = 3;
-    return ctx;
 }
 
 /**
- * Memory-map the input file for the mmap compression path.
+ * Memory-map the input file.
+ *
+ * Opens the file read-only, determines its size via lseek, and maps it.
+ * Aborts on any I/O error or if the file is empty.
  *
- * Opens the file read-only, determines its size via lseek, and maps it
- * into ctx->inBuff. Aborts on any I/O error or if the file is empty.
- * No-op when ctx->stdinMode is true (stdin is handled separately).
+ * In stdin mode, a non-empty regular file redirected to stdin and not read
+ * from yet (t2sz - < archive.tar) is mapped the same way and stdinMode is
+ * cleared, so that it takes the mmap path. Any other stdin returns NULL
+ * without mapping.
  *
  * If the input is not seekable (pipe, FIFO, or process substitution such
  * as bash's <(...)), redirects the fd to stdin via dup2() and sets
- * ctx->stdinMode = true so the caller falls through to the streaming path.
- *
- * @param ctx  The compression context (reads inFilename, stdinMode;
- *             writes inBuff, inBuffSize, stdinMode).
+ * opts->stdinMode = true so the caller falls through to the streaming path.
+ * With --input-window the file stays open for releaseMapped(), in
+ * opts->inputFd.
+ *
+ * @param opts  Parsed options (reads inFilename and inputWindow, may set
+ *              or clear stdinMode, sets inputFd).
+ * @param size  Set to the size of the mapping.
+ * @return      The mapping, or NULL in stdin mode.
  */
-void prepareInput(Context *ctx){
-    if(ctx->stdinMode){
-        // The stdin path is handled by compressStdinRaw()/compressStdinTar().
-        return;
-    }
-
-    // If the input buffer is already populated (e.g., by a fuzz harness
-    // that injects data directly), skip file I/O entirely.
-    if(ctx->inBuff){
-        return;
+static uint8_t* mapInput(Options *opts, size_t *size){
+    *size = 0;
+    opts->inputFd = -1;
+    if(opts->stdinMode){
+        // Only from offset 0: the mapping must start where stdin is, and
+        // anything already consumed by the caller is not part of the input.
+        struct stat st;
+        if(fstat(STDIN_FILENO, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+           (unsigned long long)st.st_size > SIZE_MAX || lseek(STDIN_FILENO, 0, SEEK_CUR) != 0){
+            return NULL;
+        }
     }
 
-    const int fd = open(ctx->inFilename, O_RDONLY, 0);
+    const int fd = opts->stdinMode ? STDIN_FILENO : open(opts->inFilename, O_RDONLY, 0);
     if(fd < 0){
-        fprintf(stderr, "ERROR: Unable to open '%s'\n", ctx->inFilename);
+        fprintf(stderr, "ERROR: Unable to open '%s'\n", opts->inFilename);
         exit(EXIT_FAILURE);
     }
 
@@ -403,825 +486,543 @@ void prepareInput(Context *ctx){
         if(fd != STDIN_FILENO){
             if(dup2(fd, STDIN_FILENO) < 0){
                 fprintf(stderr, "ERROR: Unable to redirect '%s' to stdin\n",
-                        ctx->inFilename);
+                        opts->inFilename);
                 close(fd);
                 exit(EXIT_FAILURE);
             }
             close(fd);
         }
-        ctx->stdinMode = true;
-        return;
+        opts->stdinMode = true;
+        return NULL;
     }
     if(end == 0){
-        fprintf(stderr, "ERROR: Empty input file '%s'\n", ctx->inFilename);
+        fprintf(stderr, "ERROR: Empty input file '%s'\n", opts->inFilename);
         close(fd);
         exit(EXIT_FAILURE);
     }
     if((unsigned long long)end > SIZE_MAX){
         fprintf(stderr, "ERROR: Input file '%s' is too large to map into memory\n",
-                ctx->inFilename);
+                opts->inFilename);
         close(fd);
         exit(EXIT_FAILURE);
     }
-    ctx->inBuffSize = (size_t)end;
 
-    ctx->inBuff = (uint8_t*)mmap(NULL, ctx->inBuffSize, PROT_READ, MAP_PRIVATE, fd, 0);
-    if(ctx->inBuff == MAP_FAILED){
-        fprintf(stderr, "ERROR: Unable to mmap '%s'\n", ctx->inFilename);
+    uint8_t *buff = (uint8_t*)mmap(NULL, (size_t)end, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(buff == MAP_FAILED){
+        fprintf(stderr, "ERROR: Unable to mmap '%s'\n", opts->inFilename);
         close(fd);
         exit(EXIT_FAILURE);
     }
-    close(fd);
-}
-
-/**
- * Open the output destination and allocate the output buffer.
- *
- * If stdoutMode is true, uses stdout directly; otherwise opens
- * ctx->outFilename for writing. Allocates an output buffer sized
- * by ZSTD_CStreamOutSize(). Aborts on fopen or OOM failure.
- *
- * @param ctx  The compression context (reads outFilename, stdoutMode;
- *             writes outFile, outBuff, outBuffSize).
- */
-void prepareOutput(Context *ctx){
-    if(ctx->stdoutMode){
-        ctx->outFile = stdout;
-    }else{
-        ctx->outFile = fopen(ctx->outFilename, "wb");
-        if(!ctx->outFile){
-            fprintf(stderr, "ERROR: Cannot open output file for writing\n");
-            exit(EXIT_FAILURE);
-        }
-    }
-    ctx->outBuffSize = ZSTD_CStreamOutSize();
-    ctx->outBuff = malloc(ctx->outBuffSize);
-    if(!ctx->outBuff){
-        fprintf(stderr, "ERROR: Out of memory allocating output buffer\n");
-        exit(EXIT_FAILURE);
+    if(opts->inputWindow){
+        // Read ahead aggressively, pages behind are released as compression goes.
+        madvise(buff, (size_t)end, MADV_SEQUENTIAL);
+        opts->inputFd = fd;
+    }else if(fd != STDIN_FILENO){
+        close(fd);
     }
+    opts->stdinMode = false;
+    *size = (size_t)end;
+    return buff;
 }
 
 /**
- * Create and configure the zstd compression context.
+ * Map the archive given to -a.
  *
- * Sets the compression level and enables content checksums. If workers
- * is non-zero, attempts to enable multi-threaded compression; falls
- * back to single-thread on failure (e.g. libzstd without ZSTD_MULTITHREAD).
- * Aborts on fatal errors.
+ * Aborts if it can't be opened or mapped.
  *
- * @param ctx  The compression context (reads level, workers;
- *             writes cctx).
+ * @param filename  The archive.
+ * @param size      Set to the size of the mapping.
+ * @return          The mapping.
  */
-void prepareCctx(Context *ctx){
-    ctx->cctx = ZSTD_createCCtx();
-    if(ctx->cctx == NULL){
-        fprintf(stderr, "ERROR: Cannot create ZSTD CCtx\n");
+static uint8_t* mapArchive(const char *filename, size_t *size){
+    const int fd = open(filename, O_RDONLY | O_BINARY, 0);
+    if(fd < 0){
+        fprintf(stderr, "ERROR: Unable to open '%s'\n", filename);
         exit(EXIT_FAILURE);
     }
-
-    size_t err;
-    err = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_compressionLevel, ctx->level);
-    if(ZSTD_isError(err)){
-        fprintf(stderr, "ERROR: Cannot set compression level: %s\n", ZSTD_getErrorName(err));
+    const off_t end = lseek(fd, 0, SEEK_END);
+    if(end <= 0 || (unsigned long long)end > SIZE_MAX){
+        fprintf(stderr, "ERROR: '%s' is not a seekable archive\n", filename);
+        close(fd);
         exit(EXIT_FAILURE);
     }
-
-    err = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_checksumFlag, 1);
-    if(ZSTD_isError(err)){
-        fprintf(stderr, "ERROR: Cannot set checksum flag: %s\n", ZSTD_getErrorName(err));
+    uint8_t *buff = (uint8_t*)mmap(NULL, (size_t)end, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(buff == MAP_FAILED){
+        fprintf(stderr, "ERROR: Unable to mmap '%s'\n", filename);
+        close(fd);
         exit(EXIT_FAILURE);
     }
+    close(fd);
+    *size = (size_t)end;
+    return buff;
+}
 
-    if(ctx->workers){
-        err = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_nbWorkers, (int32_t)ctx->workers);
-        if(ZSTD_isError(err)){
-            fprintf(stderr, "ERROR: Multi-thread is supported only with libzstd >= 1.5.0 or on older versions compiled with ZSTD_MULTITHREAD. Reverting to single-thread.\n");
-            ctx->workers = 0;
-            ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_nbWorkers, (int32_t)ctx->workers);
+/**
+ * Put back the end of an archive after a failed append, so that it is
+ * left as it was.
+ *
+ * @param filename  The archive.
+ * @param offset    Where the append started writing.
+ * @param tail      The original bytes from @p offset to the end.
+ * @param len       Number of bytes in @p tail.
+ * @return          false if the archive could not be restored.
+ */
+static bool restoreArchive(const char *filename, const uint64_t offset, const uint8_t *tail, const size_t len){
+    const int fd = open(filename, O_WRONLY | O_BINARY);
+    if(fd < 0){
+        return false;
+    }
+    bool ok = lseek(fd, (off_t)offset, SEEK_SET) >= 0;
+    size_t done = 0;
+    while(ok && done < len){
+        const ssize_t n = write(fd, tail + done, len - done);
+        if(n < 0 && errno == EINTR){
+            continue;
         }
+        ok = n > 0;
+        done += ok ? (size_t)n : 0;
     }
+    ok = ok && truncateFd(fd, offset + len) == 0;
+    return close(fd) == 0 && ok;
 }
 
 /**
- * Reset the zstd session for a new independent frame.
+ * Checkpoint file of an output (--checkpoint, --resume).
  *
- * Keeps compression parameters but clears the internal state so the
- * next compressed output starts a fresh frame. Aborts on error.
+ * The state is written to a temporary file that is then renamed over the
+ * previous checkpoint, so a crash while saving leaves the previous one.
+ */
+typedef struct {
+    FileSink* sink;     //the output the checkpoints describe
+    char* path;         //OUTPUT.ckpt
+    char* tmpPath;      //OUTPUT.ckpt.tmp
+} Checkpointer;
+
+/**
+ * Build "<name><suffix>" in a new buffer. Aborts when out of memory.
  *
- * @param ctx  The compression context (reads cctx).
+ * @param name    The base name.
+ * @param suffix  The suffix.
+ * @return        The new string, to be freed by the caller.
  */
-static void zstdResetFrame(const Context *ctx){
-    const size_t err = ZSTD_CCtx_reset(ctx->cctx, ZSTD_reset_session_only);
-    if(ZSTD_isError(err)){
-        fprintf(stderr, "ERROR: Can't reset ZSTD session: %s\n", ZSTD_getErrorName(err));
+static char* withSuffix(const char *name, const char *suffix){
+    const size_t len = strlen(name) + strlen(suffix) + 1;
+    char *buff = malloc(len);
+    if(!buff){
+        fprintf(stderr, "ERROR: Out of memory allocating a filename\n");
         exit(EXIT_FAILURE);
     }
+    snprintf(buff, len, "%s%s", name, suffix);
+    return buff;
 }
 
 /**
- * Set the pledged source size for the current frame.
+ * T2szCheckpointFn saving the state next to the output file.
  *
- * When @p known is true, tells zstd exactly how many bytes to expect,
- * which enables single-pass optimizations. When false, sets
- * ZSTD_CONTENTSIZE_UNKNOWN for streaming with unknown length.
- * Aborts on error.
+ * The output is synced first: the state must never describe frames that
+ * could still be lost.
  *
- * @param ctx    The compression context (reads cctx).
- * @param size   The pledged size in bytes (ignored if known is false).
- * @param known  Whether the source size is known in advance.
+ * @param opaque  The Checkpointer.
+ * @param state   The state to save.
+ * @param len     Its size.
+ * @return        0 on success, -1 on error.
  */
-static void zstdSetPledged(const Context *ctx, const unsigned long long size, const bool known){
-    const size_t err = ZSTD_CCtx_setPledgedSrcSize(ctx->cctx, known ? size : ZSTD_CONTENTSIZE_UNKNOWN);
-    if(ZSTD_isError(err)){
-        fprintf(stderr, "ERROR: Can't set pledged size: %s\n", ZSTD_getErrorName(err));
-        exit(EXIT_FAILURE);
+static int saveCheckpoint(void *opaque, const void *state, size_t len){
+    Checkpointer *c = opaque;
+    if(syncSink(c->sink) != 0){
+        return -1;
     }
+    FILE *f = fopen(c->tmpPath, "wb");
+    if(f == NULL){
+        return -1;
+    }
+    bool ok = fwrite(state, 1, len, f) == len && fflush(f) == 0 && syncFd(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+    if(ok){
+        remove(c->path); //rename() does not replace files on Windows
+    }
+#endif
+    return ok && rename(c->tmpPath, c->path) == 0 ? 0 : -1;
 }
 
 /**
- * Compress an entire memory buffer into a single zstd frame.
+ * Read the checkpoint file of the output (--resume).
  *
- * Resets the session, pledges the exact source size, then feeds all
- * bytes through ZSTD_compressStream2 with ZSTD_e_continue followed by
- * ZSTD_e_end. Writes compressed output to ctx->outFile.
+ * Aborts if it exists but can't be read.
  *
- * @param ctx      The compression context.
- * @param src      Source data buffer.
- * @param srcSize  Number of bytes to compress.
- * @return         Total number of compressed bytes written.
+ * @param path  The checkpoint file.
+ * @param len   Set to its size.
+ * @return      Its content, or NULL if there is no checkpoint.
  */
-static uint64_t zstdCompressBufferToFrame(const Context *ctx, const uint8_t *src, const size_t srcSize){
-    // Compress exactly one frame from a memory buffer, with known size.
-    zstdResetFrame(ctx);
-    zstdSetPledged(ctx, srcSize, true);
-
-    ZSTD_inBuffer input = { src, srcSize, 0 };
-    uint64_t compressedSize = 0;
-
-    while(true){
-        ZSTD_outBuffer output = { ctx->outBuff, ctx->outBuffSize, 0 };
-        const ZSTD_EndDirective mode = (input.pos < input.size) ? ZSTD_e_continue : ZSTD_e_end;
-
-        const size_t remaining = ZSTD_compressStream2(ctx->cctx, &output, &input, mode);
-        if(ZSTD_isError(remaining)){
-            fprintf(stderr, "ERROR: Can't compress stream: %s\n", ZSTD_getErrorName(remaining));
-            exit(EXIT_FAILURE);
+static uint8_t* readCheckpoint(const char *path, size_t *len){
+    FILE *f = fopen(path, "rb");
+    if(f == NULL){
+        if(errno == ENOENT){
+            return NULL;
         }
-        compressedSize += checkedFwrite(ctx->outBuff, output.pos, ctx->outFile);
-
-        if(mode == ZSTD_e_end && remaining == 0){
+        fprintf(stderr, "ERROR: Unable to open '%s'\n", path);
+        exit(EXIT_FAILURE);
+    }
+    size_t cap = 4096;
+    *len = 0;
+    uint8_t *buff = malloc(cap);
+    while(buff){
+        *len += fread(buff + *len, 1, cap - *len, f);
+        if(*len < cap){
             break;
         }
+        uint8_t *p = realloc(buff, cap * 2);
+        if(!p){
+            free(buff);
+        }
+        buff = p;
+        cap *= 2;
     }
-
-    return compressedSize;
+    if(!buff || ferror(f)){
+        fprintf(stderr, "ERROR: Unable to read '%s'\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    return buff;
 }
 
 /**
- * Finalize the current zstd frame without providing additional input.
+ * Print the frame plan of a file without compressing it (--plan).
  *
- * Flushes all pending data and writes the frame epilogue.
- * Uses a non-NULL dummy buffer to satisfy libzstd implementations
- * that reject NULL input pointers.
+ * Writes one tab-separated line per frame to stdout: frame index, input
+ * offset, input size, the tar member the frame starts in and the number
+ * of tar headers in the frame. A trailing comment line summarizes the
+ * totals.
  *
- * @param ctx  The compression context.
- * @return     Number of compressed bytes written during finalization.
+ * @param ctx   Configured library context.
+ * @param in    The mapped input.
+ * @param size  Size of the input.
  */
-static uint64_t zstdEndFrame(const Context *ctx){
-    uint64_t compressedSize = 0;
-
-    // Some libzstd builds don't like input == NULL, so use a non-NULL dummy.
-    uint8_t dummy = 0;
-    ZSTD_inBuffer empty = { &dummy, 0, 0 };
-
-    while(true){
-        ZSTD_outBuffer output = { ctx->outBuff, ctx->outBuffSize, 0 };
-        const size_t remaining = ZSTD_compressStream2(ctx->cctx, &output, &empty, ZSTD_e_end);
-        if(ZSTD_isError(remaining)){
-            fprintf(stderr, "ERROR: Can't end frame: %s\n", ZSTD_getErrorName(remaining));
-            exit(EXIT_FAILURE);
-        }
-        compressedSize += checkedFwrite(ctx->outBuff, output.pos, ctx->outFile);
-        if(remaining == 0) {
-            break;
-        }
-    }
-    return compressedSize;
+static void printPlan(T2szContext *ctx, const uint8_t *in, const size_t size){
+    const T2szFrame *frames = NULL;
+    size_t nbFrames = 0;
+    uint64_t nbMembers = 0;
+    const T2szError err = t2szPlan(ctx, in, size, &frames, &nbFrames, &nbMembers);
+    if(err != T2SZ_OK){
+        fatal(ctx, err, NULL);
+    }
+
+    printf("# frame\toffset\tsize\tfirst_member\tmembers\n");
+    for(size_t i = 0; i < nbFrames; i++){
+        const T2szFrame *e = &frames[i];
+        printf("%zu\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu32 "\n",
+               i, e->offset, e->size, e->firstMember, e->members);
+    }
+    printf("# %zu frames, %" PRIu64 " members, %zu bytes\n", nbFrames, nbMembers, size);
 }
 
 /**
- * Compress raw (non-tar) data read from standard input.
- *
- * Two modes based on ctx->minBlockSize:
- *   - minBlockSize == 0: streams all of stdin into a single frame with
- *     unknown pledged size (matches the mmap "whole file" behaviour).
- *   - minBlockSize > 0: buffers exactly minBlockSize bytes at a time,
- *     compressing each chunk as an independent frame with known size.
- *     The last frame may be smaller if EOF is reached mid-buffer.
- *
- * Each frame is recorded in the seek table via seekTableAdd().
+ * Write @p str as a JSON string literal.
  *
- * @param ctx  The compression context (must have cctx, outFile, outBuff
- *             already initialized).
+ * @param f    Destination.
+ * @param str  NUL-terminated string, NULL for a JSON null.
  */
-static void compressStdinRaw(Context *ctx){
-    // Two behaviours:
-    // - If -s is set (minBlockSize > 0): read exactly one frame worth of bytes into a frame buffer,
-    //   then compress it as an independent frame with correct pledged size.
-    // - If -s is not set: stream into a single frame (pledged unknown), matching original "whole file" raw behaviour.
-
-    if(ctx->minBlockSize == 0){
-        // Single-frame streaming, pledged unknown
-        zstdResetFrame(ctx);
-        zstdSetPledged(ctx, 0, false);
-
-        const size_t inChunk = ZSTD_CStreamInSize();
-        uint8_t *inBuf = malloc(inChunk);
-        if(!inBuf){
-            fprintf(stderr, "ERROR: Out of memory allocating stdin buffer\n");
-            exit(EXIT_FAILURE);
-        }
-
-        uint64_t decompressedSize = 0;
-        uint64_t compressedSize = 0;
-
-        while(true){
-            const size_t n = fread(inBuf, 1, inChunk, stdin);
-            if(n > 0){
-                decompressedSize += n;
-
-                ZSTD_inBuffer input = { inBuf, n, 0 };
-                while(input.pos < input.size){
-                    ZSTD_outBuffer output = { ctx->outBuff, ctx->outBuffSize, 0 };
-                    const size_t remaining = ZSTD_compressStream2(ctx->cctx, &output, &input, ZSTD_e_continue);
-                    if(ZSTD_isError(remaining)){
-                        fprintf(stderr, "ERROR: Can't compress stream: %s\n", ZSTD_getErrorName(remaining));
-                        free(inBuf);
-                        exit(EXIT_FAILURE);
-                    }
-                    compressedSize += checkedFwrite(ctx->outBuff, output.pos, ctx->outFile);
-                }
-            }
-
-            if(n == 0){
-                if(ferror(stdin)){
-                    fprintf(stderr, "ERROR: Read error on stdin\n");
-                    free(inBuf);
-                    exit(EXIT_FAILURE);
-                }
-                // EOF
-                break;
-            }
-        }
-
-        compressedSize += zstdEndFrame(ctx);
-
-        seekTableAdd(ctx, compressedSize, decompressedSize);
-
-        free(inBuf);
+static void jsonString(FILE *f, const char *str){
+    if(!str){
+        fputs("null", f);
         return;
     }
+    fputc('"', f);
+    for(const unsigned char *c = (const unsigned char*)str; *c; c++){
+        if(*c == '"' || *c == '\\'){
+            fprintf(f, "\\%c", *c);
+        }else if(*c < 0x20){
+            fprintf(f, "\\u%04x", *c);
+        }else{
+            fputc(*c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/* Upper bounds of the compression ratio buckets of --stats, the last one is open. */
+static const double statsRatioBuckets[] = { 1, 1.5, 2, 3, 4, 6, 8, 16 };
+#define STATS_RATIO_BUCKETS (sizeof(statsRatioBuckets) / sizeof(statsRatioBuckets[0]) + 1)
 
-    // Fixed-size frames: buffer exactly one frame at a time (bounded memory = minBlockSize)
-    const size_t frameSize = ctx->minBlockSize;
-    uint8_t *frameBuf = malloc(frameSize);
-    if(!frameBuf){
-        fprintf(stderr, "ERROR: Out of memory allocating %zu-byte frame buffer\n", frameSize);
+/**
+ * Write the statistics of a successful compression as JSON (--stats).
+ *
+ * Adds what only the process knows to the library statistics: the time
+ * to close the output (waiting for io_uring writes) counts as output time,
+ * and CPU time, major page faults and peak RSS come from getrusage() (not
+ * available on Windows, written as null). Times are in seconds.
+ *
+ * @param opts     Parsed options (statsFile, input and output names).
+ * @param ctx      The context of the compression call.
+ * @param closeNs  Nanoseconds spent closing the output.
+ */
+static void writeStats(const Options *opts, const T2szContext *ctx, const uint64_t closeNs){
+    const T2szStats *st = t2szGetStats(ctx);
+    FILE *f = fopen(opts->statsFile, "w");
+    if(!f){
+        fprintf(stderr, "ERROR: Unable to write statistics to '%s': %s\n", opts->statsFile, strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    while(true){
-        size_t got = 0;
-        while(got < frameSize){
-            const size_t n = fread(frameBuf + got, 1, frameSize - got, stdin);
-            if(n > 0){
-                got += n;
-                continue;
-            }
-            if(ferror(stdin)){
-                fprintf(stderr, "ERROR: Read error on stdin\n");
-                free(frameBuf);
-                exit(EXIT_FAILURE);
-            }
-            // EOF
-            break;
+    uint64_t histFrames[STATS_RATIO_BUCKETS] = {0};
+    uint64_t histBytes[STATS_RATIO_BUCKETS] = {0};
+    for(size_t i = 0; i < st->nbFrames; i++){
+        const T2szFrameStats *fr = &st->frames[i];
+        const double ratio = fr->outputSize ? (double)fr->inputSize / (double)fr->outputSize : 0;
+        size_t b = 0;
+        while(b < STATS_RATIO_BUCKETS - 1 && ratio >= statsRatioBuckets[b]){
+            b++;
         }
+        histFrames[b]++;
+        histBytes[b] += fr->inputSize;
+    }
+
+    fprintf(f, "{\n  \"version\": ");
+    jsonString(f, VERSION);
+    fprintf(f, ",\n  \"input\": ");
+    jsonString(f, opts->stdinMode ? "-" : opts->inFilename);
+    fprintf(f, ",\n  \"output\": ");
+    jsonString(f, opts->stdoutMode ? "-" : opts->outFilename);
+    fprintf(f, ",\n  \"source\": \"%s\",\n  \"mode\": \"%s\",\n  \"level\": %d,\n  \"threads\": %" PRIu32 ",\n",
+            opts->stdinMode ? "stdin" : inputEngineNames[opts->inputEngine], opts->t2sz.rawMode ? "raw" : "tar", opts->t2sz.level,
+            opts->t2sz.workers ? opts->t2sz.workers : 1);
+    fprintf(f, "  \"input_bytes\": %" PRIu64 ",\n  \"output_bytes\": %" PRIu64 ",\n  \"ratio\": %.4f,\n",
+            st->inputBytes, st->outputBytes, st->outputBytes ? (double)st->inputBytes / (double)st->outputBytes : 0);
+    fprintf(f, "  \"block_size\": {\"min\": %" PRIu64 ", \"max\": %" PRIu64 ", \"auto\": ",
+            st->minBlockSize, st->maxBlockSize);
+    if(opts->t2sz.autoMaxRead || opts->t2sz.autoRatioLoss){
+        fprintf(f, "{\"sample_bytes\": %" PRIu64 ", \"ratio\": %.4f, \"solid_ratio\": %.4f, \"seconds\": %.6f}},\n",
+                st->autoSampleBytes, st->autoRatio, st->autoSolidRatio, (double)st->autoNs / 1e9);
+    }else{
+        fprintf(f, "null},\n");
+    }
+    fprintf(f, "  \"time\": {\"wall\": %.6f, \"input\": %.6f, \"headers\": %.6f, \"compression\": %.6f, \"output\": %.6f, "
+               "\"verify\": %.6f},\n",
+            (double)(st->wallNs + closeNs) / 1e9, (double)st->inputNs / 1e9, (double)st->headerNs / 1e9,
+            (double)st->compressNs / 1e9, (double)(st->outputNs + closeNs) / 1e9, (double)st->verifyNs / 1e9);
+#ifdef _WIN32
+    fprintf(f, "  \"cpu\": null,\n");
+    fprintf(f, "  \"memory\": {\"peak_rss_bytes\": null, \"zstd_bytes\": %" PRIu64 "},\n", st->zstdMemory);
+#else
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    const uint64_t peakRss = (uint64_t)ru.ru_maxrss;            //bytes
+#else
+    const uint64_t peakRss = (uint64_t)ru.ru_maxrss * 1024;     //KiB
+#endif
+    fprintf(f, "  \"cpu\": {\"user\": %.6f, \"system\": %.6f, \"major_faults\": %ld},\n",
+            (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1e6,
+            (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec / 1e6, (long)ru.ru_majflt);
+    fprintf(f, "  \"memory\": {\"peak_rss_bytes\": %" PRIu64 ", \"zstd_bytes\": %" PRIu64 "},\n",
+            peakRss, st->zstdMemory);
+#endif
 
-        if(got == 0){
-            break; // no more data
+    const unsigned warnings = t2szGetWarnings(ctx);
+    fprintf(f, "  \"warnings\": [");
+    for(unsigned w = 1, n = 0; w && w <= warnings; w <<= 1){
+        if(warnings & w){
+            if(n++){
+                fputs(", ", f);
+            }
+            jsonString(f, t2szWarningMessage(ctx, (T2szWarning)w));
         }
+    }
+    fprintf(f, "],\n");
 
-        const uint64_t compressedSize = zstdCompressBufferToFrame(ctx, frameBuf, got);
-        seekTableAdd(ctx, compressedSize, got);
-
-        if(got < frameSize) {
-            break; // last partial frame (EOF)
+    fprintf(f, "  \"ratio_histogram\": [\n");
+    for(size_t b = 0; b < STATS_RATIO_BUCKETS; b++){
+        fprintf(f, "    {\"min\": %g, \"max\": ", b ? statsRatioBuckets[b - 1] : 0.0);
+        if(b < STATS_RATIO_BUCKETS - 1){
+            fprintf(f, "%g", statsRatioBuckets[b]);
+        }else{
+            fprintf(f, "null");
         }
+        fprintf(f, ", \"frames\": %" PRIu64 ", \"input_bytes\": %" PRIu64 "}%s\n",
+                histFrames[b], histBytes[b], b < STATS_RATIO_BUCKETS - 1 ? "," : "");
     }
+    fprintf(f, "  ],\n  \"frames\": [\n");
+    for(size_t i = 0; i < st->nbFrames; i++){
+        const T2szFrameStats *fr = &st->frames[i];
+        fprintf(f, "    {\"input_bytes\": %" PRIu64 ", \"output_bytes\": %" PRIu64 ", \"compress_seconds\": %.6f}%s\n",
+                fr->inputSize, fr->outputSize, (double)fr->compressNs / 1e9, i + 1 < st->nbFrames ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
 
-    free(frameBuf);
-}
-
-/**
- * Check whether a 512-byte block is entirely zero.
- *
- * Two consecutive zero blocks mark the end-of-archive in a tar stream.
- *
- * @param b  Pointer to a 512-byte block.
- * @return   true if all 512 bytes are 0x00.
- */
-static bool isZeroTarBlock(const uint8_t *b){
-    for(size_t i = 0; i < 512; i++){
-        if(b[i] != 0) return false;
+    if(ferror(f) | (fclose(f) != 0)){
+        fprintf(stderr, "ERROR: Unable to write statistics to '%s'\n", opts->statsFile);
+        exit(EXIT_FAILURE);
     }
-    return true;
 }
 
+/* Seconds between two --progress reports: on a terminal the line is
+ * redrawn, otherwise (a log file) every report is a new line. */
+#define PROGRESS_INTERVAL_TTY 1
+#define PROGRESS_INTERVAL_LOG 10
+
 /**
- * Read exactly @p n bytes from stdin into @p dst.
- *
- * Loops on partial reads (fread may return less than requested).
- * Aborts with an error message on premature EOF or read error.
+ * Progress reporter (--progress).
  *
- * @param dst  Destination buffer (must hold at least @p n bytes).
- * @param n    Number of bytes to read.
+ * A thread wakes up every few seconds, reads the counters of the running
+ * call with t2szGetProgress() and prints bytes in and out, the ratio, the
+ * throughput since the previous report and, when the input size is known
+ * (an input file), the percentage and the time left at the average
+ * throughput so far. The compression loop itself does no extra work.
  */
-static void readExactStdin(uint8_t *dst, const size_t n){
-    size_t got = 0;
-    while(got < n){
-        const size_t r = fread(dst + got, 1, n - got, stdin);
-        if(r == 0){
-            if(feof(stdin)){
-                fprintf(stderr, "ERROR: Unexpected EOF on stdin\n");
-            }else{
-                fprintf(stderr, "ERROR: Read error on stdin\n");
-            }
-            exit(EXIT_FAILURE);
-        }
-        got += r;
-    }
-}
+typedef struct {
+    T2szContext* ctx;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    //signalled when the compression call is over
+    bool done;
+    bool tty;               //stderr is a terminal
+    int interval;           //seconds between two reports
+    int lineLen;            //length of the line on screen, to blank it when redrawing
+    struct timespec start;
+    uint64_t lastIn;
+    double lastSec;
+} ProgressReporter;
 
 /**
- * Begin a new zstd frame with unknown pledged size.
- *
- * Resets the session, sets pledged to unknown, and zeroes the
- * running byte counters for the frame being built.
- *
- * @param ctx        The compression context.
- * @param frameIn    [out] Reset to 0 (decompressed bytes in frame).
- * @param frameOut   [out] Reset to 0 (compressed bytes in frame).
- * @param frameOpen  [out] Set to true.
+ * @param ts  A point in time.
+ * @return    Seconds from @p from to @p ts.
  */
-static void startFrameUnknown(const Context *ctx, uint64_t *frameIn, uint64_t *frameOut, bool *frameOpen){
-    zstdResetFrame(ctx);
-    zstdSetPledged(ctx, 0, false); // unknown size
-    *frameIn = 0;
-    *frameOut = 0;
-    *frameOpen = true;
+static double secondsSince(const struct timespec *from, const struct timespec *ts){
+    return (double)(ts->tv_sec - from->tv_sec) + (double)(ts->tv_nsec - from->tv_nsec) / 1e9;
 }
 
 /**
- * Finalize the current frame and record it in the seek table.
+ * Format @p bytes as a short human-readable size ("12.3 GiB").
  *
- * Calls zstdEndFrame() to flush remaining output, adds the frame's
- * totals to the seek table, and marks the frame as closed.
- * No-op if *frameOpen is already false.
- *
- * @param ctx        The compression context.
- * @param frameIn    Decompressed bytes accumulated in this frame.
- * @param frameOut   Compressed bytes accumulated so far (updated by zstdEndFrame).
- * @param frameOpen  [in/out] Set to false on return.
+ * @param buf    Destination, at least 16 bytes.
+ * @param bytes  The size.
+ * @return       @p buf.
  */
-static void endFrameAndRecord(Context *ctx, const uint64_t frameIn, uint64_t frameOut, bool *frameOpen){
-    if(!*frameOpen){
-        return;
-    }
-
-    frameOut += zstdEndFrame(ctx);
-
-    seekTableAdd(ctx, frameOut, frameIn);
-    *frameOpen = false;
+static const char* formatBytes(char *buf, const uint64_t bytes){
+    static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB" };
+    double v = (double)bytes;
+    size_t u = 0;
+    while(v >= 1024 && u < sizeof(units) / sizeof(units[0]) - 1){
+        v /= 1024;
+        u++;
+    }
+    snprintf(buf, 16, u ? "%.1f %s" : "%.0f %s", v, units[u]);
+    return buf;
 }
 
 /**
- * Feed tar payload bytes into the current zstd frame, respecting
- * maxBlockSize splitting.
- *
- * Opens a new frame if none is active. If maxBlockSize is set and the
- * frame reaches the limit, closes it and opens the next one, possibly
- * splitting the input across multiple frames. All compressed output
- * is written to ctx->outFile.
+ * Print one progress report.
  *
- * @param ctx        The compression context.
- * @param src        Source bytes to compress.
- * @param n          Number of bytes in @p src.
- * @param frameIn    [in/out] Running decompressed byte count for the current frame.
- * @param frameOut   [in/out] Running compressed byte count for the current frame.
- * @param frameOpen  [in/out] Whether a frame is currently open.
+ * @param p      The reporter.
+ * @param final  The call is over: report the average throughput and end
+ *               the line.
  */
-static void pushBytesTar(Context *ctx, const uint8_t *src, const size_t n, uint64_t *frameIn, uint64_t *frameOut, bool *frameOpen){
-    size_t off = 0;
-    while(off < n){
-        if(!*frameOpen){
-            startFrameUnknown(ctx, frameIn, frameOut, frameOpen);
-        }
-
-        // If maxBlockSize is set, never exceed it.
-        size_t canWrite = n - off;
-        if(ctx->maxBlockSize){
-            if(*frameIn >= ctx->maxBlockSize){
-                // current frame full -> close and open next
-                endFrameAndRecord(ctx, *frameIn, *frameOut, frameOpen);
-                continue;
-            }
-            const size_t left = ctx->maxBlockSize - (size_t)(*frameIn);
-            if(canWrite > left) canWrite = left;
-        }
-
-        ZSTD_inBuffer in = { src + off, canWrite, 0 };
-        while(in.pos < in.size){
-            ZSTD_outBuffer out = { ctx->outBuff, ctx->outBuffSize, 0 };
-            const size_t rem = ZSTD_compressStream2(ctx->cctx, &out, &in, ZSTD_e_continue);
-            if(ZSTD_isError(rem)){
-                fprintf(stderr, "ERROR: Can't compress stream: %s\n", ZSTD_getErrorName(rem));
-                exit(EXIT_FAILURE);
-            }
-            *frameOut += checkedFwrite(ctx->outBuff, out.pos, ctx->outFile);
-        }
-
-        *frameIn += canWrite;
-        off += canWrite;
-
-        // If we exactly filled maxBlockSize, close immediately (split).
-        if(ctx->maxBlockSize && *frameIn >= ctx->maxBlockSize){
-            endFrameAndRecord(ctx, *frameIn, *frameOut, frameOpen);
+static void progressReport(ProgressReporter *p, const bool final){
+    T2szProgress pr;
+    t2szGetProgress(p->ctx, &pr);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double sec = secondsSince(&p->start, &now);
+    const uint64_t last = p->lastIn > pr.resumedBytes ? p->lastIn : pr.resumedBytes;
+    const double avg = sec > 0 ? (double)(pr.inputBytes - pr.resumedBytes) / sec : 0;
+    const double cur = final ? avg : (sec > p->lastSec ? (double)(pr.inputBytes - last) / (sec - p->lastSec) : 0);
+    p->lastIn = pr.inputBytes;
+    p->lastSec = sec;
+
+    char in[16], out[16], line[160];
+    int len = snprintf(line, sizeof(line), "%s", formatBytes(in, pr.inputBytes));
+    if(pr.outputBytes){ //none with -t
+        len += snprintf(line + len, sizeof(line) - (size_t)len, " -> %s, ratio %.2f", formatBytes(out, pr.outputBytes),
+                        (double)pr.inputBytes / (double)pr.outputBytes);
+    }
+    len += snprintf(line + len, sizeof(line) - (size_t)len, ", %.1f MB/s", cur / 1e6);
+    if(final){
+        len += snprintf(line + len, sizeof(line) - (size_t)len, ", %.1f s", sec);
+    }else if(pr.totalBytes){
+        len += snprintf(line + len, sizeof(line) - (size_t)len, ", %.1f%%", 100.0 * (double)pr.inputBytes / (double)pr.totalBytes);
+        if(avg > 0 && pr.inputBytes < pr.totalBytes){
+            const uint64_t eta = (uint64_t)((double)(pr.totalBytes - pr.inputBytes) / avg);
+            len += snprintf(line + len, sizeof(line) - (size_t)len, ", ETA %" PRIu64 ":%02u:%02u",
+                            eta / 3600, (unsigned)(eta / 60 % 60), (unsigned)(eta % 60));
         }
     }
+    if(p->tty){
+        fprintf(stderr, "\r%s%*s%s", line, p->lineLen > len ? p->lineLen - len : 0, "", final ? "\n" : "");
+        p->lineLen = len;
+    }else{
+        fprintf(stderr, "%s\n", line);
+    }
+    fflush(stderr);
 }
 
 /**
- * Compress a tar archive read from standard input.
- *
- * Reads 512-byte blocks from stdin, parsing tar headers to determine
- * file boundaries. Implements the same framing logic as the mmap path:
- *   - minBlockSize == 0: one file per frame.
- *   - minBlockSize > 0: aggregate whole files until the frame reaches
- *     the minimum, then close at the next file boundary.
- *   - maxBlockSize > 0: split so no frame exceeds the maximum (may
- *     split inside a file).
+ * Body of the progress thread: report every p->interval seconds until
+ * progressStop().
  *
- * Null blocks (end-of-archive markers) and payload padding are included
- * in the compressed stream. Each completed frame is recorded in the
- * seek table.
- *
- * @param ctx  The compression context (must have cctx, outFile, outBuff
- *             already initialized).
+ * @param arg  The ProgressReporter.
+ * @return     NULL.
  */
-static void compressStdinTar(Context *ctx){
-    // Default tar behaviour matches mmap-path:
-    // - if minBlockSize==0: "one file per frame"
-    // - if minBlockSize>0: aggregate whole files until >= min, then close at file boundary
-    // - if maxBlockSize>0: split so frames never exceed max (may split inside a file)
-
-    const size_t inChunk = ZSTD_CStreamInSize();
-    uint8_t *chunkBuf = malloc(inChunk);
-    if(!chunkBuf){
-        fprintf(stderr, "ERROR: Out of memory allocating tar stdin chunk buffer\n");
-        exit(EXIT_FAILURE);
-    }
-
-    uint8_t hdrBlock[512];
-
-    uint64_t frameIn = 0, frameOut = 0;
-    bool frameOpen = false;
-
-    while(true){
-        // Read next 512-byte tar header/block
-        const size_t r = fread(hdrBlock, 1, 512, stdin);
-        if(r == 0){
-            if(ferror(stdin)){
-                fprintf(stderr, "ERROR: Read error on stdin\n");
-                free(chunkBuf);
-                exit(EXIT_FAILURE);
-            }
-            // EOF
-            break;
-        }
-        if(r != 512){
-            // partial header => truncated stream
-            fprintf(stderr, "ERROR: Truncated tar header on stdin\n");
-            free(chunkBuf);
-            exit(EXIT_FAILURE);
-        }
-
-        // Null block (end-of-archive marker): push into stream and continue.
-        if(isZeroTarBlock(hdrBlock)){
-            pushBytesTar(ctx, hdrBlock, 512, &frameIn, &frameOut, &frameOpen);
-
-            if(ctx->verbose){
-                fprintf(stderr, "+ <null>\n");
-            }
-
-            // In "one file per frame" mode, also close after a null block (matches mmap behaviour when -s is 0)
-            if(ctx->minBlockSize == 0 && frameOpen){
-                endFrameAndRecord(ctx, frameIn, frameOut, &frameOpen);
-            }
-            continue;
+static void* progressThread(void *arg){
+    ProgressReporter *p = arg;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    pthread_mutex_lock(&p->lock);
+    while(!p->done){
+        deadline.tv_sec += p->interval;
+        while(!p->done && pthread_cond_timedwait(&p->wake, &p->lock, &deadline) == 0){
         }
-
-        // Validate the tar header *before* pushing it into the compressor,
-        // consistent with the mmap path which validates before including.
-        TarHeader *header = (TarHeader*)hdrBlock;
-        if(!isTarHeader(header)){
-            fprintf(stderr, "ERROR: Invalid tar header. If this is not a tar archive use raw mode (-r)\n");
-            free(chunkBuf);
-            exit(EXIT_FAILURE);
-        }
-
-        // Header is valid — include the 512-byte block in the stream.
-        pushBytesTar(ctx, hdrBlock, 512, &frameIn, &frameOut, &frameOpen);
-
-        const size_t fileSize = parseTarSize(header);
-        if(fileSize > SIZE_MAX - 1024){
-            fprintf(stderr, "ERROR: Invalid tar entry size (too large)\n");
-            free(chunkBuf);
-            exit(EXIT_FAILURE);
-        }
-
-        // pad to 512
-        size_t padded = fileSize;
-        const size_t mod = padded % 512;
-        if(mod) padded = padded - mod + 512;
-
-        if(ctx->verbose){
-            fprintf(stderr, "+ %.100s (%zu)\n", header->name, padded);
-        }
-
-        // Stream payload+pads: read exactly 'padded' bytes from stdin, push through compressor,
-        // respecting maxBlockSize splitting.
-        size_t remaining = padded;
-        while(remaining > 0){
-            const size_t take = remaining > inChunk ? inChunk : remaining;
-            readExactStdin(chunkBuf, take);
-            pushBytesTar(ctx, chunkBuf, take, &frameIn, &frameOut, &frameOpen);
-            remaining -= take;
-        }
-
-        // End-of-file boundary: decide whether to close frame
-        if(ctx->minBlockSize == 0){
-            // one file per frame
-            if(frameOpen){
-                endFrameAndRecord(ctx, frameIn, frameOut, &frameOpen);
-            }
-        }else{
-            // aggregated blocks: close only at file boundary when >= minBlockSize
-            if(frameOpen && frameIn >= ctx->minBlockSize){
-                endFrameAndRecord(ctx, frameIn, frameOut, &frameOpen);
-            }
+        if(!p->done){
+            progressReport(p, false);
         }
     }
-
-    // If stream ended without the 2 zero blocks (truncated tar), still close whatever was open.
-    if(frameOpen){
-        endFrameAndRecord(ctx, frameIn, frameOut, &frameOpen);
-    }
-
-    if(ctx->seekTableLen == 0){
-        fprintf(stderr, "ERROR: No tar entries found on stdin. "
-                "If this is not a tar archive use raw mode (-r)\n");
-        free(chunkBuf);
-        exit(EXIT_FAILURE);
-    }
-
-    free(chunkBuf);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
 }
 
 /**
- * Finalize output after all frames have been compressed.
- *
- * Writes the seek table (unless disabled), frees the seek table array
- * and the zstd context, closes or flushes the output file, and frees
- * the output buffer.
+ * Start reporting the progress of the next compression call on @p ctx.
+ * Without a thread there is simply no progress report.
  *
- * @param ctx  The compression context.
+ * @param p    The reporter to initialize.
+ * @param ctx  The context the call runs on.
  */
-static void cleanupCompression(Context *ctx){
-    if(!ctx->skipSeekTable){
-        writeSeekTable(ctx);
-    }
-    free(ctx->seekTable);      ctx->seekTable = NULL;
-    ZSTD_freeCCtx(ctx->cctx);  ctx->cctx = NULL;
-    if(!ctx->stdoutMode){
-        fclose(ctx->outFile);
-    }else{
-        fflush(ctx->outFile);
+static void progressStart(ProgressReporter *p, T2szContext *ctx){
+    memset(p, 0, sizeof(*p));
+    p->ctx = ctx;
+    p->tty = isatty(fileno(stderr));
+    p->interval = p->tty ? PROGRESS_INTERVAL_TTY : PROGRESS_INTERVAL_LOG;
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    if(pthread_create(&p->thread, NULL, progressThread, p) != 0){
+        p->ctx = NULL;
     }
-    ctx->outFile = NULL;
-    free(ctx->outBuff);        ctx->outBuff = NULL;
 }
 
 /**
- * Top-level compression driver.
- *
- * Prepares output and the zstd context, then dispatches to one of four
- * code paths depending on input source and mode:
- *
- *   | Input  | Mode | Handler             |
- *   |--------|------|---------------------|
- *   | stdin  | raw  | compressStdinRaw()  |
- *   | stdin  | tar  | compressStdinTar()  |
- *   | file   | raw  | inline mmap loop    |
- *   | file   | tar  | inline mmap loop    |
- *
- * For the mmap path, iterates over the input buffer, splitting it into
- * independently compressed frames according to minBlockSize / maxBlockSize
- * and tar header boundaries.
+ * Stop the progress thread once the compression call has returned, and
+ * print the final report if the call succeeded.
  *
- * On completion, calls cleanupCompression() to flush and release resources.
- *
- * @param ctx  Fully configured compression context (inFilename or stdinMode,
- *             outFilename or stdoutMode, level, rawMode, block sizes, etc.).
+ * @param p        The reporter.
+ * @param success  Whether the call succeeded.
  */
-void compressFile(Context *ctx){
-    // For file inputs, prepareInput() may detect a non-seekable source
-    // (pipe, FIFO, process substitution) and switch to stdinMode.
-    if(!ctx->stdinMode){
-        prepareInput(ctx);
-    }
-
-#ifdef _WIN32
-    if(ctx->stdinMode){
-        if(_setmode(_fileno(stdin), _O_BINARY) == -1){
-            fprintf(stderr, "t2sz: failed to set stdin to binary mode\n");
-            exit(EXIT_FAILURE);
-        }
-    }
-    if(ctx->stdoutMode){
-        if(_setmode(_fileno(stdout), _O_BINARY) == -1){
-            fprintf(stderr, "t2sz: failed to set stdout to binary mode\n");
-            exit(EXIT_FAILURE);
-        }
-    }
-#endif
-
-    prepareOutput(ctx);
-
-    prepareCctx(ctx);
-
-    if(ctx->stdinMode){
-        if(ctx->rawMode){
-            compressStdinRaw(ctx);
-        }else{
-            compressStdinTar(ctx);
-        }
-
-        cleanupCompression(ctx);
-    }else{
-
-        size_t tarHeaderIdx = 0;
-        uint8_t* readBuff = ctx->inBuff;
-
-        bool lastChunk = false;
-        size_t residual = 0;
-        while(!lastChunk) {
-            size_t blockSize = 0;
-            if(ctx->rawMode){
-                if(ctx->minBlockSize){
-                    const size_t remaining =
-                        (size_t)((ctx->inBuff + ctx->inBuffSize) - readBuff);
-                    if(remaining == 0){
-                        break;
-                    }
-                    blockSize = ctx->minBlockSize;
-                    if(blockSize > remaining){
-                        blockSize = remaining;
-                        lastChunk = true;
-                    }
-                }else{
-                    blockSize = ctx->inBuffSize;
-                    lastChunk = true;
-                }
-            }else{
-                do{
-                    if(residual){
-                        if(residual > ctx->maxBlockSize){
-                            blockSize = ctx->maxBlockSize;
-                            residual = residual - ctx->maxBlockSize;
-                        }else{
-                            blockSize = residual;
-                            residual = 0;
-                        }
-                    }else if(tarHeaderIdx + 512 > ctx->inBuffSize){
-                        // Not enough data for a full header — truncated archive.
-                        lastChunk = true;
-                        break;
-                    }else if(!isZeroTarBlock(&ctx->inBuff[tarHeaderIdx])){//tar ends with null headers that we can skip
-                        TarHeader *header = (TarHeader *)&ctx->inBuff[tarHeaderIdx];
-                        if(isTarHeader(header)){
-                            size_t size = parseTarSize(header);
-                            if(size > SIZE_MAX - 1024){
-                                fprintf(stderr, "ERROR: Invalid tar entry size (too large)\n");
-                                exit(EXIT_FAILURE);
-                            }
-
-                            const size_t mod = size%512;
-                            if(mod){
-                                size = size - mod + 512;
-                            }
-                            const size_t toNextHeader  = size + 512;
-
-                            // Check that the complete entry (header + padded
-                            // payload) fits within the mapped buffer.
-                            const size_t remainingInBuf = ctx->inBuffSize - tarHeaderIdx;
-                            if(toNextHeader > remainingInBuf){
-                                fprintf(stderr,
-                                        "ERROR: Truncated tar entry \"%.*s\" "
-                                        "(expected %zu bytes, only %zu remain)\n",
-                                        (int)sizeof(header->name), header->name,
-                                        toNextHeader, remainingInBuf);
-                                exit(EXIT_FAILURE);
-                            }
-
-                            tarHeaderIdx += toNextHeader;
-                            blockSize += toNextHeader;
-
-                            if(ctx->maxBlockSize && blockSize > ctx->maxBlockSize){
-                                residual = blockSize - ctx->maxBlockSize;
-                                blockSize = ctx->maxBlockSize;
-                            }
-
-                            if(ctx->verbose){
-                                fprintf(stderr, "+ %.100s (%zu)\n", header->name, size);
-                            }
-                        }else{
-                            fprintf(stderr, "ERROR: Invalid tar header. If this is not a tar archive use raw mode (-r)\n");
-                            exit(EXIT_FAILURE);
-                        }
-                    }else{
-                        if(ctx->verbose){
-                            fprintf(stderr, "+ <null>\n");
-                        }
-                        tarHeaderIdx+=512;
-                        blockSize += 512;
-                    }
-                    lastChunk = tarHeaderIdx >= ctx->inBuffSize;
-                }while(blockSize < ctx->minBlockSize && !lastChunk);
-
-                // If no data was accumulated (e.g., the truncation guard fired
-                // on the first iteration with no prior headers), skip the
-                // compression step to avoid emitting a spurious empty frame.
-                if(blockSize == 0){
-                    break;
-                }
-            }
-
-            zstdResetFrame(ctx);
-            zstdSetPledged(ctx, blockSize, true);
-            if(ctx->verbose){
-                fprintf(stderr, "# END OF BLOCK (%zu, %zu)\n\n", blockSize, tarHeaderIdx);
-            }
-
-            if(readBuff+blockSize > ctx->inBuff+ctx->inBuffSize){
-                fprintf(stderr, "ERROR: Malformed or truncated tar archive (block extends past end of input)\n");
-                exit(EXIT_FAILURE);
-            }
-
-            ZSTD_inBuffer input = {readBuff, blockSize, 0 };
-            size_t remaining;
-            ZSTD_EndDirective mode;
-            uint64_t compressedSize = 0;
-            do{
-                ZSTD_outBuffer output = {ctx->outBuff, ctx->outBuffSize, 0 };
-                mode = input.pos < input.size ? ZSTD_e_continue : ZSTD_e_end;
-                remaining = ZSTD_compressStream2(ctx->cctx, &output , &input, mode);
-                if(ZSTD_isError(remaining)){
-                    fprintf(stderr, "ERROR: Can't compress stream: %s\n", ZSTD_getErrorName(remaining));
-                    exit(EXIT_FAILURE);
-                }
-                compressedSize += checkedFwrite(ctx->outBuff, output.pos, ctx->outFile);
-            }while(mode==ZSTD_e_continue || remaining>0);
-
-            seekTableAdd(ctx, compressedSize, blockSize);
-
-            readBuff += blockSize;
-        }
-
-        if(!ctx->rawMode && ctx->seekTableLen == 0){
-            fprintf(stderr, "ERROR: No tar entries found in input. "
-                    "If this is not a tar archive use raw mode (-r)\n");
-            if(ctx->inFilename){
-                munmap(ctx->inBuff, ctx->inBuffSize);
-            }
-            exit(EXIT_FAILURE);
-        }
-
-        cleanupCompression(ctx);
-        if(ctx->inFilename){
-            munmap(ctx->inBuff, ctx->inBuffSize);
-        }
+static void progressStop(ProgressReporter *p, const bool success){
+    if(p->ctx == NULL){
+        return;
     }
+    pthread_mutex_lock(&p->lock);
+    p->done = true;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    if(success){
+        progressReport(p, true);
+    }else if(p->tty && p->lineLen){
+        fputc('\n', stderr); //keep the last report above the error message
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
 }
 
 /**
@@ -1302,12 +1103,17 @@ void usage(const char *name, const char *str){
             "\t%1$s -r -o out.zst -                        Compress stdin (raw mode) to out.zst\n"
             "\t%1$s -o out.tar.zst -                       Compress tar from stdin to out.tar.zst\n"
             "\t%1$s -r -o - -                              Compress stdin to stdout (raw mode)\n"
+            "\t%1$s --plan -s 1M -S 16M archive.tar        Show the frames -s/-S would produce, without compressing\n"
+            "\t%1$s -x dir/file.txt archive.tar.zst        Extract dir/file.txt from archive.tar.zst to standard output\n"
+            "\t%1$s -a archive.tar.zst new.tar             Append the members of new.tar to archive.tar.zst\n"
+            "\t%1$s -s 4M -o out.tar.zst in.tar.zst        Make the plain in.tar.zst seekable, without a temporary file\n"
             "\n"
             "Options:\n"
             "\t-l [1..22]         Set compression level, from 1 (lower) to 22 (highest). Default is 3.\n"
             "\t-o FILENAME        Output file name. Use '-' to write to standard output.\n"
             "\t                   When reading from stdin ('-') and -o is omitted, output defaults to stdout.\n"
             "\t-s SIZE            In raw mode: the exact size of each input block, except the last one.\n"
+            "\t                                With --cdc, the minimum size of a block.\n"
             "\t                   In tar mode: the minimum size of an input block, in bytes.\n"
             "\t                                A block is composed by one or more whole files.\n"
             "\t                                A file is never split unless -S is used.\n"
@@ -1322,24 +1128,89 @@ void usage(const char *name, const char *str){
             "\t                       kB/KB = 1000\n"
             "\t                       MB = 1000^2\n"
             "\t                       GB = 1000^3\n"
-            "\t-S SIZE            In raw mode: it is ignored.\n"
+            "\t-S SIZE            In raw mode: it is ignored, except with --cdc where it is the maximum size of a block.\n"
             "\t                   In tar mode: the maximum size of an input block, in bytes.\n"
             "\t                   Unlike -s this option may split big files in smaller chunks.\n"
             "\t                   Remember that each block is compressed independently and a small value here will result in a bigger archive.\n"
             "\t                   -S can be used together with -s but MUST be greater or equal to its value.\n"
             "\t                   If -S and -s are equal the input block will be of exactly that size, if there is enough input data.\n"
             "\t                   Like -s SIZE may be followed by one of the multiplicative suffixes described above.\n"
+            "\t-D SIZE            Train a dictionary of at most SIZE bytes (e.g. 112k) from a sample of the frames and\n"
+            "\t                   compress every frame with it. Greatly improves the ratio of archives with many small files.\n"
+            "\t                   The dictionary is stored in a skippable frame at the head of the archive; to decompress\n"
+            "\t                   with zstd, extract it first (see README). Requires a seekable input file.\n"
             "\t-T [1..N]          Number of thread to spawn. It improves compression speed but cost more memory. Default is single thread.\n"
-            "\t                   It requires libzstd >= 1.5.0 or an older version compiler with ZSTD_MULTITHREAD.\n"
-            "\t                   If `-s` or `-S` are too small it is possible that a lower number of threads will be used.\n"
+            "\t                   Frames up to 32M are compressed in parallel, one per thread.\n"
+            "\t                   When reading from stdin, reading also overlaps with compression.\n"
+            "\t                   Bigger frames, and raw mode without -s, use the multi-threading of libzstd inside the frame.\n"
+            "\t                   The latter requires libzstd >= 1.5.0 or an older version compiler with ZSTD_MULTITHREAD.\n"
+            "\t-x MEMBER          Extract mode. Write the tar member MEMBER of the compressed archive given as input\n"
+            "\t                   to standard output, or to the file given with -o. Only the frames holding the member\n"
+            "\t                   and the tar headers before it are decompressed, using the seek table.\n"
+            "\t                   If the archive was created with -i, the member is found through the index instead.\n"
+            "\t-t, --test         Test mode. Check the seekable archive given as input: every frame of the seek table\n"
+            "\t                   must decompress, with a matching content checksum, to the sizes the table records.\n"
+            "\t                   Frames are checked in parallel with -T. Nothing is written.\n"
+            "\t-a ARCHIVE         Append mode. Add the members of the tar archive given as input to ARCHIVE, a seekable\n"
+            "\t                   archive created by t2sz in tar mode. Only the new members and the last frame of ARCHIVE\n"
+            "\t                   are compressed. The dictionary (-D) and the member index (-i) of ARCHIVE are reused.\n"
+            "\t                   ARCHIVE is left unchanged if anything fails. Can't be used with -o, -r, -j, -D or -i.\n"
+            "\t-i                 Write a member index: name, size, type and position of every tar member, sorted by name,\n"
+            "\t                   in a skippable frame before the seek table. Readers can then find a member with a single\n"
+            "\t                   small read instead of scanning every tar header. Tar mode only.\n"
             "\t-r                 Raw mode or non-tar mode. Treat tar archives as regular files, without any special handling.\n"
             "\t-j                 Do not generate a seek table.\n"
             "\t-v                 Verbose. List the elements in the tar archive and their size.\n"
             "\t-f                 Overwrite output without prompting.\n"
+            "\t--plan             Print the frame plan (offset, size and tar members of each frame) and exit\n"
+            "\t                   without compressing. Only the tar headers are read, so it is fast even on huge archives.\n"
+            "\t--no-io-uring      Write the output file with stdio instead of asynchronous io_uring writes (Linux).\n"
+            "\t--cdc SIZE         Raw mode only. Cut blocks where the content says so instead of every -s bytes, with an\n"
+            "\t                   average size of SIZE (at least 256), between -s and -S (default SIZE/4 and SIZE*4).\n"
+            "\t                   An insertion or deletion only changes the blocks around it, so the compressed frames\n"
+            "\t                   of two versions of a file are mostly identical and deduplicate well.\n"
+            "\t--checkpoint SEC   Every SEC seconds (0: after every frame), save what is needed to resume an interrupted\n"
+            "\t                   run to OUTPUT.ckpt, once the output written so far is on disk. The file is removed\n"
+            "\t                   when compression succeeds. Requires an input file and an output file.\n"
+            "\t--resume           Continue an interrupted run from OUTPUT.ckpt: the output is cut after its last saved\n"
+            "\t                   frame and compression goes on from the matching input offset. Use the same input and\n"
+            "\t                   options. Starts from the beginning if there is no checkpoint. Keeps saving\n"
+            "\t                   checkpoints, every %2$d seconds unless --checkpoint is given.\n"
+            "\t--no-decompress    Compress zstd-compressed input as it is. By default an input that starts with a zstd\n"
+            "\t                   frame (e.g. a .tar.zst, or another seekable archive) is decompressed on a separate\n"
+            "\t                   thread and its content is framed anew, in tar mode for .tar.zst and .tzst files.\n"
+            "\t                   -D, --plan, --checkpoint and --resume need an uncompressed input.\n"
+            "\t--stats FILE       Write statistics of the run to FILE as JSON: time spent reading input, parsing tar\n"
+            "\t                   headers, compressing and writing output, CPU time, peak memory (RSS and libzstd\n"
+            "\t                   contexts), input and output size and compression time of every frame, and a\n"
+            "\t                   histogram of frame compression ratios.\n"
+            "\t--progress         Report progress on stderr every second (every 10 seconds when stderr is not a\n"
+            "\t                   terminal): bytes in and out, ratio, throughput and, for an input file, the\n"
+            "\t                   percentage done and the time left.\n"
+            "\t--auto-block GOAL  Choose -s and -S by trial-compressing samples of the input with candidate frame\n"
+            "\t                   sizes. GOAL is read=SIZE, the most bytes a random read may decompress (frames\n"
+            "\t                   of at most SIZE), ratio=PCT, the smallest frames compressing within PCT percent\n"
+            "\t                   of solid compression, or both separated by a comma (ratio defaults to 1).\n"
+            "\t                   Requires a seekable input file; the choice is shown with -v and in --stats.\n"
+            "\t--verify           Decompress every frame on a separate thread as soon as it is written and compare it\n"
+            "\t                   with the input, while the next frames are compressed. Fails at the first mismatch.\n"
+            "\t--input-window SIZE\n"
+            "\t                   Keep about SIZE of the input in memory: pages the compressor is done with are\n"
+            "\t                   released from the process and dropped from the page cache, so that archiving a\n"
+            "\t                   huge file does not evict the working set of other processes. The frames being\n"
+            "\t                   compressed stay in memory whatever SIZE.\n"
+            "\t--input-engine ENGINE\n"
+            "\t                   How an input file is read. mmap (default) maps it and plans the frames up front.\n"
+            "\t                   pread reads it in large chunks on a readahead thread and frames it like stdin,\n"
+            "\t                   which keeps network filesystems busy; pread-direct does the same bypassing the\n"
+            "\t                   page cache (falls back to pread where unsupported). Only mmap supports -D,\n"
+            "\t                   --checkpoint, --resume and --auto-block.\n"
+            "\t--compress-all     Compress every frame at the requested level. By default frames of 128K or more that\n"
+            "\t                   look incompressible (already compressed or encrypted data) are compressed at level 1.\n"
             "\t-h                 Print this help.\n"
             "\t-V                 Print the version.\n"
             "\n",
-            name);
+            name, CHECKPOINT_DEFAULT_INTERVAL);
     version();
     exit(!str ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -1396,9 +1267,89 @@ size_t decodeMultiplier(const char *suffix){
 }
 
 /**
- * Parse command-line options and populate the Context.
+ * Parse a SIZE argument (-s, -S, -D): a positive integer optionally followed
+ * by one of the suffixes known to decodeMultiplier().
+ *
+ * On invalid input calls usage() with @p err, which exits.
+ *
+ * @param executable  argv[0], forwarded to usage().
+ * @param arg         The option argument.
+ * @param err         Error message for usage().
+ * @return            The size in bytes.
+ */
+static size_t parseSize(const char *executable, const char *arg, const char *err){
+    char *endptr;
+    errno = 0;
+    const long val = strtol(arg, &endptr, 10);
+    if(endptr == arg || errno == ERANGE || val < 1){
+        usage(executable, err);
+    }
+    const size_t multiplier = decodeMultiplier(endptr);
+    if(*endptr != '\0' && multiplier == 1){
+        usage(executable, err);
+    }
+    if((size_t)val > SIZE_MAX / multiplier){
+        usage(executable, err);
+    }
+    return (size_t)val * multiplier;
+}
+
+/* Values for long options without a short equivalent, outside the char range. */
+enum {
+    OPT_PLAN = 256,
+    OPT_NO_IO_URING,
+    OPT_COMPRESS_ALL,
+    OPT_CDC,
+    OPT_CHECKPOINT,
+    OPT_RESUME,
+    OPT_NO_DECOMPRESS,
+    OPT_STATS,
+    OPT_PROGRESS,
+    OPT_AUTO_BLOCK,
+    OPT_VERIFY,
+    OPT_INPUT_WINDOW,
+    OPT_INPUT_ENGINE
+};
+
+/**
+ * Parse the targets of --auto-block: "read=SIZE", "ratio=PCT", or both
+ * separated by a comma. Calls usage() on invalid input.
+ *
+ * @param executable  argv[0], for usage().
+ * @param arg         The option argument.
+ * @param opts        Receives autoMaxRead and autoRatioLoss.
+ */
+static void parseAutoBlock(const char *executable, const char *arg, T2szOptions *opts){
+    char buf[128];
+    if(strlen(arg) >= sizeof(buf)){
+        usage(executable, "ERROR: Invalid --auto-block target");
+    }
+    strcpy(buf, arg);
+    for(char *t = strtok(buf, ","); t; t = strtok(NULL, ",")){
+        if(strncmp(t, "read=", 5) == 0){
+            opts->autoMaxRead = parseSize(executable, t + 5, "ERROR: Invalid --auto-block read size");
+        }else if(strncmp(t, "ratio=", 6) == 0){
+            char *endptr;
+            errno = 0;
+            const double val = strtod(t + 6, &endptr);
+            if(endptr == t + 6 || (*endptr != '\0' && strcmp(endptr, "%") != 0) || errno == ERANGE ||
+               !(val > 0 && val <= 100)){
+                usage(executable, "ERROR: Invalid --auto-block ratio. Must be a percentage between 0 and 100.");
+            }
+            opts->autoRatioLoss = val;
+        }else{
+            usage(executable, "ERROR: Invalid --auto-block target, use read=SIZE and/or ratio=PCT");
+        }
+    }
+    if(!opts->autoMaxRead && !opts->autoRatioLoss){
+        usage(executable, "ERROR: Invalid --auto-block target, use read=SIZE and/or ratio=PCT");
+    }
+}
+
+/**
+ * Parse command-line options and populate the Options.
  *
- * Processes all getopt flags, validates argument counts and mutual
+ * Processes all getopt_long flags, validates argument counts and mutual
  * constraints (e.g. maxBlockSize >= minBlockSize), sets the input
  * filename, and auto-detects stdin/raw mode.
  *
@@ -1407,14 +1358,32 @@ size_t decodeMultiplier(const char *suffix){
  *
  * @param argc      Argument count.
  * @param argv      Argument vector.
- * @param ctx       Context to populate.
+ * @param opts      Options to populate.
  * @param overwrite Pointer set to true if -f is given.
  */
-static void parseArgs(int argc, char **argv, Context *ctx, bool *overwrite){
+static void parseArgs(int argc, char **argv, Options *opts, bool *overwrite){
     const char* executable = argv[0];
 
+    static const struct option longOpts[] = {
+        {"plan",        no_argument, NULL, OPT_PLAN},
+        {"no-io-uring", no_argument, NULL, OPT_NO_IO_URING},
+        {"compress-all", no_argument, NULL, OPT_COMPRESS_ALL},
+        {"cdc",         required_argument, NULL, OPT_CDC},
+        {"checkpoint",  required_argument, NULL, OPT_CHECKPOINT},
+        {"resume",      no_argument, NULL, OPT_RESUME},
+        {"no-decompress", no_argument, NULL, OPT_NO_DECOMPRESS},
+        {"stats",       required_argument, NULL, OPT_STATS},
+        {"progress",    no_argument, NULL, OPT_PROGRESS},
+        {"auto-block",  required_argument, NULL, OPT_AUTO_BLOCK},
+        {"verify",      no_argument, NULL, OPT_VERIFY},
+        {"input-window", required_argument, NULL, OPT_INPUT_WINDOW},
+        {"input-engine", required_argument, NULL, OPT_INPUT_ENGINE},
+        {"test",        no_argument, NULL, 't'},
+        {NULL,   0,           NULL, 0}
+    };
+
     int ch;
-    while((ch = getopt(argc, argv, "l:o:s:S:T:rjVfvh")) != -1){
+    while((ch = getopt_long(argc, argv, "l:o:s:S:D:T:x:a:tirjVfvh", longOpts, NULL)) != -1){
         switch(ch){
             case 'l': {
                 char *endptr;
@@ -1423,46 +1392,24 @@ static void parseArgs(int argc, char **argv, Context *ctx, bool *overwrite){
                 if(endptr == optarg || *endptr != '\0' || errno == ERANGE || val < 1 || val > 22){
                     usage(executable, "ERROR: Invalid level. Must be between 1 and 22.");
                 }
-                ctx->level = (int32_t)val;
+                opts->t2sz.level = (int32_t)val;
                 break;
             }
             case 'o':
-                ctx->outFilename = optarg;
+                opts->outFilename = optarg;
                 break;
-            case 's': {
-                char *endptr;
-                errno = 0;
-                const long val = strtol(optarg, &endptr, 10);
-                if(endptr == optarg || errno == ERANGE || val < 1){
-                    usage(executable, "ERROR: Invalid block size");
-                }
-                const size_t multiplier = decodeMultiplier(endptr);
-                if(*endptr != '\0' && multiplier == 1){
-                    usage(executable, "ERROR: Invalid block size");
-                }
-                if((size_t)val > SIZE_MAX / multiplier){
-                    usage(executable, "ERROR: Invalid block size");
-                }
-                ctx->minBlockSize = (size_t)val * multiplier;
+            case 's':
+                opts->t2sz.minBlockSize = parseSize(executable, optarg, "ERROR: Invalid block size");
                 break;
-            }
-            case 'S': {
-                char *endptr;
-                errno = 0;
-                const long val = strtol(optarg, &endptr, 10);
-                if(endptr == optarg || errno == ERANGE || val < 1){
-                    usage(executable, "ERROR: Invalid block size");
-                }
-                const size_t multiplier = decodeMultiplier(endptr);
-                if(*endptr != '\0' && multiplier == 1){
-                    usage(executable, "ERROR: Invalid block size");
-                }
-                if((size_t)val > SIZE_MAX / multiplier){
-                    usage(executable, "ERROR: Invalid block size");
+            case 'S':
+                opts->t2sz.maxBlockSize = parseSize(executable, optarg, "ERROR: Invalid block size");
+                break;
+            case 'D':
+                opts->t2sz.dictCapacity = parseSize(executable, optarg, "ERROR: Invalid dictionary size");
+                if(opts->t2sz.dictCapacity < 256 || opts->t2sz.dictCapacity > 0x7FFFFFFF){
+                    usage(executable, "ERROR: Invalid dictionary size. Must be between 256 and 2G.");
                 }
-                ctx->maxBlockSize = (size_t)val * multiplier;
                 break;
-            }
             case 'T': {
                 char *endptr;
                 errno = 0;
@@ -1470,21 +1417,89 @@ static void parseArgs(int argc, char **argv, Context *ctx, bool *overwrite){
                 if(endptr == optarg || *endptr != '\0' || errno == ERANGE || val < 1 || val > UINT32_MAX){
                     usage(executable, "ERROR: Invalid number of threads. Must be greater than 0.");
                 }
-                ctx->workers = (uint32_t)val;
+                opts->t2sz.workers = (uint32_t)val;
                 break;
             }
+            case 'x':
+                opts->extractName = optarg;
+                break;
+            case 'a':
+                opts->appendTo = optarg;
+                break;
+            case 't':
+                opts->testMode = true;
+                break;
+            case 'i':
+                opts->t2sz.buildIndex = true;
+                break;
             case 'r':
-                ctx->rawMode = true;
+                opts->t2sz.rawMode = true;
                 break;
             case 'j':
-                ctx->skipSeekTable = true;
+                opts->t2sz.skipSeekTable = true;
                 break;
             case 'v':
-                ctx->verbose = true;
+                opts->t2sz.verbose = true;
                 break;
             case 'f':
                 *overwrite = true;
                 break;
+            case OPT_PLAN:
+                opts->planOnly = true;
+                break;
+            case OPT_NO_IO_URING:
+                opts->noIoUring = true;
+                break;
+            case OPT_COMPRESS_ALL:
+                opts->t2sz.compressAll = true;
+                break;
+            case OPT_CDC:
+                opts->t2sz.cdcAverage = parseSize(executable, optarg, "ERROR: Invalid average block size");
+                break;
+            case OPT_CHECKPOINT: {
+                char *endptr;
+                errno = 0;
+                const long val = strtol(optarg, &endptr, 10);
+                if(endptr == optarg || *endptr != '\0' || errno == ERANGE || val < 0 || val > UINT32_MAX){
+                    usage(executable, "ERROR: Invalid checkpoint interval. Must be a number of seconds.");
+                }
+                opts->checkpoint = true;
+                opts->t2sz.checkpointInterval = (uint32_t)val;
+                break;
+            }
+            case OPT_RESUME:
+                opts->resume = true;
+                break;
+            case OPT_NO_DECOMPRESS:
+                opts->t2sz.noDecompress = true;
+                break;
+            case OPT_STATS:
+                opts->statsFile = optarg;
+                opts->t2sz.collectStats = true;
+                break;
+            case OPT_PROGRESS:
+                opts->progress = true;
+                break;
+            case OPT_AUTO_BLOCK:
+                parseAutoBlock(executable, optarg, &opts->t2sz);
+                break;
+            case OPT_VERIFY:
+                opts->t2sz.verify = true;
+                break;
+            case OPT_INPUT_WINDOW:
+                opts->inputWindow = parseSize(executable, optarg, "ERROR: Invalid input window size");
+                break;
+            case OPT_INPUT_ENGINE: {
+                size_t e = 0;
+                while(e < sizeof(inputEngineNames) / sizeof(inputEngineNames[0]) && strcmp(optarg, inputEngineNames[e]) != 0){
+                    e++;
+                }
+                if(e == sizeof(inputEngineNames) / sizeof(inputEngineNames[0])){
+                    usage(executable, "ERROR: Invalid input engine. Must be mmap, pread or pread-direct.");
+                }
+                opts->inputEngine = (InputEngine)e;
+                break;
+            }
             case 'V':
                 version();
                 exit(EXIT_SUCCESS);
@@ -1492,7 +1507,7 @@ static void parseArgs(int argc, char **argv, Context *ctx, bool *overwrite){
                 usage(executable, NULL);
                 break;
             case '?': {
-                const char *opts = "l:o:s:S:T:rjVfvh";
+                const char *opts = "l:o:s:S:D:T:x:a:tirjVfvh";
                 const char *p = optopt ? strchr(opts, optopt) : NULL;
                 if(p && p[1] == ':'){
                     char msg[64];
@@ -1518,31 +1533,100 @@ static void parseArgs(int argc, char **argv, Context *ctx, bool *overwrite){
         usage(executable, "Too many arguments");
     }
 
-    if(ctx->maxBlockSize && ctx->maxBlockSize < ctx->minBlockSize){
+    if(opts->t2sz.maxBlockSize && opts->t2sz.maxBlockSize < opts->t2sz.minBlockSize){
         usage(executable, "The maximum block size can't be smaller than the minimum one");
     }
+    if((opts->t2sz.autoMaxRead || opts->t2sz.autoRatioLoss) &&
+       (opts->t2sz.minBlockSize || opts->t2sz.maxBlockSize || opts->t2sz.cdcAverage)){
+        usage(executable, "ERROR: --auto-block chooses -s and -S, it can't be used with them or with --cdc");
+    }
 
-    ctx->inFilename = argv[0];
+    opts->inFilename = argv[0];
 
     // Stdin mode: "-" as the input filename reads from standard input.
-    if(strcmp(ctx->inFilename, "-") == 0){
-        ctx->stdinMode = true;
+    if(strcmp(opts->inFilename, "-") == 0){
+        opts->stdinMode = true;
+    }
+
+    if(opts->appendTo){
+        if(opts->outFilename){
+            usage(executable, "ERROR: -a and -o can't be used together");
+        }else if(opts->extractName){
+            usage(executable, "ERROR: -a and -x can't be used together");
+        }else if(opts->t2sz.rawMode){
+            usage(executable, "ERROR: Appending (-a) requires a tar input");
+        }else if(opts->t2sz.skipSeekTable){
+            usage(executable, "ERROR: Appending (-a) requires a seek table, -j can't be used");
+        }else if(opts->t2sz.dictCapacity || opts->t2sz.buildIndex){
+            usage(executable, "ERROR: -D and -i can't be used with -a, the archive keeps its own");
+        }
+    }
+
+    if(opts->testMode && (opts->extractName || opts->appendTo || opts->planOnly || opts->outFilename ||
+                          opts->statsFile || opts->checkpoint || opts->resume)){
+        usage(executable, "ERROR: -t can't be used with -x, -a, -o, --plan, --stats, --checkpoint or --resume");
+    }
+    if(opts->statsFile && (opts->extractName || opts->planOnly)){
+        usage(executable, "ERROR: --stats can't be used with -x or --plan");
+    }
+    if(opts->progress && (opts->extractName || opts->planOnly)){
+        usage(executable, "ERROR: --progress can't be used with -x or --plan");
+    }
+    if(opts->t2sz.verify && (opts->extractName || opts->testMode || opts->planOnly)){
+        usage(executable, "ERROR: --verify can't be used with -x, -t or --plan");
+    }
+    if(opts->inputWindow && (opts->extractName || opts->testMode || opts->planOnly)){
+        usage(executable, "ERROR: --input-window can't be used with -x, -t or --plan");
+    }
+    if(opts->inputEngine != INPUT_ENGINE_MMAP){
+        if(opts->extractName || opts->testMode || opts->planOnly){
+            usage(executable, "ERROR: --input-engine can't be used with -x, -t or --plan");
+        }else if(opts->t2sz.dictCapacity || opts->checkpoint || opts->resume ||
+                 opts->t2sz.autoMaxRead || opts->t2sz.autoRatioLoss){
+            usage(executable, "ERROR: -D, --checkpoint, --resume and --auto-block require the mmap input engine");
+        }
+    }
+
+    if(opts->checkpoint || opts->resume){
+        if(opts->extractName || opts->appendTo || opts->planOnly){
+            usage(executable, "ERROR: --checkpoint and --resume can't be used with -x, -a or --plan");
+        }else if(opts->stdinMode){
+            usage(executable, "ERROR: --checkpoint and --resume require a seekable input file");
+        }else if(opts->outFilename && strcmp(opts->outFilename, "-") == 0){
+            usage(executable, "ERROR: --checkpoint and --resume require an output file");
+        }
+        if(!opts->checkpoint){
+            opts->t2sz.checkpointInterval = CHECKPOINT_DEFAULT_INTERVAL;
+        }
     }
 
     // Auto-detect raw mode from filename suffix only for real files.
     // When reading from stdin there is no filename to inspect; the user must
     // pass -r explicitly if raw mode is desired (default: tar mode).
-    if(!ctx->rawMode && !ctx->stdinMode){
-        ctx->rawMode = !strEndsWith(ctx->inFilename, ".tar");
+    // Appended inputs are tar archives, whatever their name. A compressed
+    // tar (.tar.zst, .tzst) is decompressed by the library and stays in tar
+    // mode, unless --no-decompress wraps it as is.
+    if(!opts->t2sz.rawMode && !opts->stdinMode && !opts->appendTo){
+        const bool compressedTar = !opts->t2sz.noDecompress &&
+                                   (strEndsWith(opts->inFilename, ".tar.zst") || strEndsWith(opts->inFilename, ".tzst"));
+        opts->t2sz.rawMode = !strEndsWith(opts->inFilename, ".tar") && !compressedTar;
+    }
+
+    if(opts->t2sz.buildIndex && opts->t2sz.rawMode && !opts->extractName && !opts->testMode){
+        usage(executable, "ERROR: The member index (-i) requires tar mode");
+    }
+    if(opts->t2sz.cdcAverage && !opts->t2sz.rawMode && !opts->extractName && !opts->testMode){
+        usage(executable, "ERROR: Content-defined chunking (--cdc) requires raw mode");
     }
 }
 
 /**
- * Entry point — parse CLI options, configure the context, and compress.
+ * Entry point — parse CLI options, configure the library, and compress.
  *
  * Handles option parsing (via parseArgs), input/output filename resolution,
- * overwrite prompting, and calls compressFile(). On success returns
- * EXIT_SUCCESS.
+ * overwrite prompting, and runs the library call matching the input:
+ * t2szCompressBuffer() on a mapped file, t2szCompressStream() on stdin,
+ * t2szExtract() for -x, t2szTest() for -t. On success returns EXIT_SUCCESS.
  *
  * @param argc  Argument count.
  * @param argv  Argument vector.
@@ -1550,56 +1634,308 @@ static void parseArgs(int argc, char **argv, Context *ctx, bool *overwrite){
  */
 #ifndef T2SZ_NO_MAIN
 int main(int argc, char **argv){
-    Context *ctx = newContext();
+    Options opts;
+    memset(&opts, 0, sizeof(opts));
+    t2szInitOptions(&opts.t2sz);
     bool overwrite = false;
 
-    parseArgs(argc, argv, ctx, &overwrite);
+    parseArgs(argc, argv, &opts, &overwrite);
+
+    // Filled in once the output is known; the library only calls it while compressing.
+    Checkpointer ckpt = {0};
+    if(opts.checkpoint || opts.resume){
+        opts.t2sz.checkpointFn = saveCheckpoint;
+        opts.t2sz.checkpointOpaque = &ckpt;
+    }
 
     // File existence check — not applicable for stdin.
-    if(!ctx->stdinMode && access(ctx->inFilename, F_OK) != 0){
-        fprintf(stderr, "%s: File not found\n", ctx->inFilename);
-        free(ctx);
+    if(!opts.stdinMode && access(opts.inFilename, F_OK) != 0){
+        fprintf(stderr, "%s: File not found\n", opts.inFilename);
         return EXIT_FAILURE;
     }
 
+    // --input-window: the mmap path releases every half window through
+    // releaseMapped(), filled in once the input is mapped.
+    InputWindow window = {.fd = -1, .window = opts.inputWindow, .stream = stdin};
+    if(opts.inputWindow){
+        opts.t2sz.inputWindow = opts.inputWindow / 2 ? opts.inputWindow / 2 : 1;
+        opts.t2sz.releaseFn = releaseMapped;
+        opts.t2sz.releaseOpaque = &window;
+    }
+
+    // -x and -t read an existing archive; the compression-only flags do not apply.
+    if(opts.extractName || opts.testMode){
+        opts.t2sz.buildIndex = false;
+        opts.t2sz.cdcAverage = 0;
+        opts.t2sz.autoMaxRead = 0;
+        opts.t2sz.autoRatioLoss = 0;
+    }
+
+    T2szContext *ctx = t2szCreate();
+    if(!ctx){
+        fprintf(stderr, "ERROR: Out of memory allocating new context\n");
+        return EXIT_FAILURE;
+    }
+    T2szError err = t2szSetOptions(ctx, &opts.t2sz);
+    if(err != T2SZ_OK){
+        fatal(ctx, err, NULL);
+    }
+
+    // --plan only reads the input: no output file, no overwrite prompt.
+    if(opts.planOnly){
+        size_t inSize;
+        uint8_t *in = mapInput(&opts, &inSize);
+        if(opts.stdinMode){
+            fprintf(stderr, "ERROR: --plan requires a seekable input file\n");
+            return EXIT_FAILURE;
+        }
+        printPlan(ctx, in, inSize);
+        munmap(in, inSize);
+        t2szFree(ctx);
+        return EXIT_SUCCESS;
+    }
+
+    // -t only reads the archive too.
+    if(opts.testMode){
+        size_t inSize;
+        uint8_t *in = mapInput(&opts, &inSize);
+        if(opts.stdinMode){
+            fprintf(stderr, "ERROR: -t requires a seekable archive file\n");
+            return EXIT_FAILURE;
+        }
+        ProgressReporter progress = {0};
+        if(opts.progress){
+            progressStart(&progress, ctx);
+        }
+        T2szTestResult res;
+        err = t2szTest(ctx, in, inSize, &res);
+        progressStop(&progress, err == T2SZ_OK);
+        if(err != T2SZ_OK){
+            fprintf(stderr, "ERROR: %s: %s\n", opts.inFilename, t2szErrorMessage(ctx));
+            return EXIT_FAILURE;
+        }
+        printf("%s: OK, %" PRIu64 " frames, %" PRIu64 " -> %" PRIu64 " bytes\n",
+               opts.inFilename, res.frames, res.compressedBytes, res.decompressedBytes);
+        if(res.noChecksumFrames){
+            fprintf(stderr, "Warning: %" PRIu64 " frames have no content checksum, only their sizes were checked\n",
+                    res.noChecksumFrames);
+        }
+        munmap(in, inSize);
+        t2szFree(ctx);
+        return EXIT_SUCCESS;
+    }
+
     // Determine the output destination.
     char *outFilenameToFree = NULL;
-    if(ctx->outFilename == NULL){
-        if(ctx->stdinMode){
-            // stdin input with no explicit -o: write to stdout.
-            ctx->stdoutMode = true;
+    if(opts.appendTo){
+        // The archive is updated in place: nothing to prompt for.
+        opts.outFilename = (char*)opts.appendTo;
+        overwrite = true;
+    }else if(opts.outFilename == NULL){
+        if(opts.stdinMode || opts.extractName){
+            // stdin input or extraction with no explicit -o: write to stdout.
+            opts.stdoutMode = true;
         }else{
-            outFilenameToFree = ctx->outFilename = getOutFilename(ctx->inFilename);
+            outFilenameToFree = opts.outFilename = getOutFilename(opts.inFilename);
         }
-    }else if(strcmp(ctx->outFilename, "-") == 0){
+    }else if(strcmp(opts.outFilename, "-") == 0){
         // -o - explicitly requested: write to stdout.
-        ctx->stdoutMode = true;
+        opts.stdoutMode = true;
+    }
+
+    // --resume: pick up the checkpoint of the output, if any. The output
+    // is then continued, not overwritten.
+    uint64_t keep = 0;
+    bool resuming = false;
+    if(opts.checkpoint || opts.resume){
+        ckpt.path = withSuffix(opts.outFilename, ".ckpt");
+        ckpt.tmpPath = withSuffix(opts.outFilename, ".ckpt.tmp");
+        size_t stateLen = 0;
+        uint8_t *state = opts.resume ? readCheckpoint(ckpt.path, &stateLen) : NULL;
+        if(state){
+            err = t2szResume(ctx, state, stateLen, &keep);
+            free(state);
+            if(err != T2SZ_OK){
+                fprintf(stderr, "ERROR: %s: %s\n", ckpt.path, t2szErrorMessage(ctx));
+                return EXIT_FAILURE;
+            }
+            struct stat st;
+            if(stat(opts.outFilename, &st) != 0 || (uint64_t)st.st_size < keep){
+                fprintf(stderr, "ERROR: '%s' is shorter than its checkpoint, run again without --resume\n", opts.outFilename);
+                return EXIT_FAILURE;
+            }
+            resuming = true;
+            overwrite = true;
+        }else if(opts.resume && opts.t2sz.verbose){
+            fprintf(stderr, "No checkpoint found, starting from the beginning\n");
+        }
     }
 
     // Overwrite prompt — skipped when writing to stdout (nothing to overwrite).
     // In stdinMode an interactive prompt would consume bytes from the input
     // stream and corrupt the compressed output, so we require -f instead.
-    if(!ctx->stdoutMode && !overwrite && access(ctx->outFilename, F_OK) == 0){
-        if(ctx->stdinMode){
-            fprintf(stderr, "ERROR: %s already exists. Use -f to overwrite.\n", ctx->outFilename);
+    if(!opts.stdoutMode && !overwrite && access(opts.outFilename, F_OK) == 0){
+        if(opts.stdinMode){
+            fprintf(stderr, "ERROR: %s already exists. Use -f to overwrite.\n", opts.outFilename);
             free(outFilenameToFree);
-            free(ctx);
+            t2szFree(ctx);
             return EXIT_FAILURE;
         }
         char ans;
-        fprintf(stderr, "%s already exists. Overwrite? [y/N]: ", ctx->outFilename);
+        fprintf(stderr, "%s already exists. Overwrite? [y/N]: ", opts.outFilename);
         const int res = scanf(" %c", &ans);
         if(res != 1 || ans != 'y'){
             free(outFilenameToFree);
-            free(ctx);
+            t2szFree(ctx);
             return EXIT_SUCCESS;
         }
     }
 
-    compressFile(ctx);
+    // --input-engine pread reads a regular file on a readahead thread and
+    // streams it like stdin; anything else (FIFO, ENOSYS) is mapped below.
+    PreadReader *reader = NULL;
+    if(opts.inputEngine != INPUT_ENGINE_MMAP && !opts.stdinMode){
+        uint64_t readerSize = 0;
+        const bool direct = opts.inputEngine == INPUT_ENGINE_PREAD_DIRECT;
+        reader = preadReaderOpen(opts.inFilename, direct, opts.inputWindow != 0, &readerSize);
+        if(!reader && direct && errno == EINVAL){
+            fprintf(stderr, "Warning: '%s' does not support direct I/O, reading it through the page cache\n", opts.inFilename);
+            opts.inputEngine = INPUT_ENGINE_PREAD;
+            reader = preadReaderOpen(opts.inFilename, false, opts.inputWindow != 0, &readerSize);
+        }
+        if(!reader && errno != ESPIPE && errno != ENOSYS){
+            fprintf(stderr, "ERROR: Unable to open '%s'\n", opts.inFilename);
+            exit(EXIT_FAILURE);
+        }
+        if(reader && readerSize == 0){
+            fprintf(stderr, "ERROR: Empty input file '%s'\n", opts.inFilename);
+            exit(EXIT_FAILURE);
+        }
+        if(!reader){
+            opts.inputEngine = INPUT_ENGINE_MMAP;
+        }
+    }
+
+    // For file inputs, mapInput() may detect a non-seekable source
+    // (pipe, FIFO, process substitution) and switch to stdinMode; a regular
+    // file redirected to stdin is mapped and leaves it.
+    size_t inSize = 0;
+    uint8_t *in = reader ? NULL : mapInput(&opts, &inSize);
+    if(opts.extractName && opts.stdinMode){
+        fprintf(stderr, "ERROR: -x requires a seekable archive file\n");
+        exit(EXIT_FAILURE);
+    }
+    if((opts.checkpoint || opts.resume) && opts.stdinMode){
+        fprintf(stderr, "ERROR: --checkpoint and --resume require a seekable input file\n");
+        exit(EXIT_FAILURE);
+    }
+    if(ckpt.path && !resuming){
+        remove(ckpt.path); //left by an earlier run, it would not match this output
+    }
+
+#ifdef _WIN32
+    if(opts.stdinMode){
+        if(_setmode(_fileno(stdin), _O_BINARY) == -1){
+            fprintf(stderr, "t2sz: failed to set stdin to binary mode\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(opts.stdoutMode){
+        if(_setmode(_fileno(stdout), _O_BINARY) == -1){
+            fprintf(stderr, "t2sz: failed to set stdout to binary mode\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+
+    // -a: find where the new frames go and keep a copy of what they
+    // overwrite, to put the archive back as it was if anything fails.
+    uint8_t *restore = NULL;
+    size_t restoreLen = 0;
+    if(opts.appendTo){
+        size_t archiveSize;
+        uint8_t *archive = mapArchive(opts.appendTo, &archiveSize);
+        err = t2szAppendTo(ctx, archive, archiveSize, &keep);
+        if(err != T2SZ_OK){
+            fatal(ctx, err, NULL);
+        }
+        restoreLen = archiveSize - (size_t)keep;
+        restore = malloc(restoreLen ? restoreLen : 1);
+        if(!restore){
+            fprintf(stderr, "ERROR: Out of memory saving the end of '%s'\n", opts.appendTo);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(restore, archive + keep, restoreLen);
+        munmap(archive, archiveSize);
+    }
+
+    FileSink sink = {
+        .filename = opts.stdoutMode ? NULL : opts.outFilename,
+        .useUring = !opts.noIoUring,
+        .verbose = opts.t2sz.verbose,
+        .append = opts.appendTo != NULL || resuming,
+        .offset = keep,
+    };
+    ckpt.sink = &sink;
+    window.map = in;
+    window.size = inSize;
+    window.fd = opts.inputFd;
+    struct stat inStat;
+    if(opts.inputWindow && opts.stdinMode && fstat(fileno(stdin), &inStat) == 0 && S_ISREG(inStat.st_mode)){
+        window.fd = fileno(stdin);
+        const off_t pos = lseek(window.fd, 0, SEEK_CUR);
+        window.readBytes = window.dropped = pos > 0 ? (uint64_t)pos : 0;
+    }
+
+    ProgressReporter progress = {0};
+    if(opts.progress){
+        progressStart(&progress, ctx);
+    }
+    if(opts.extractName){
+        err = t2szExtract(ctx, in, inSize, opts.extractName, writeFile, &sink);
+    }else if(reader){
+        err = t2szCompressStream(ctx, preadReaderRead, reader, writeFile, &sink);
+    }else if(opts.stdinMode && window.fd >= 0){
+        err = t2szCompressStream(ctx, readFileWindowed, &window, writeFile, &sink);
+    }else if(opts.stdinMode){
+        err = t2szCompressStream(ctx, readFile, stdin, writeFile, &sink);
+    }else{
+        err = t2szCompressBuffer(ctx, in, inSize, writeFile, &sink);
+    }
+    progressStop(&progress, err == T2SZ_OK);
+    printWarnings(ctx);
+    struct timespec closeStart, closeEnd;
+    clock_gettime(CLOCK_MONOTONIC, &closeStart);
+    if(!closeSink(&sink, err == T2SZ_OK) && err == T2SZ_OK){
+        err = T2SZ_ERROR_WRITE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &closeEnd);
+    if(err != T2SZ_OK){
+        if(opts.appendTo && !restoreArchive(opts.appendTo, keep, restore, restoreLen)){
+            fprintf(stderr, "ERROR: Unable to restore '%s' after the failed append\n", opts.appendTo);
+        }
+        fatal(ctx, err, &sink);
+    }
 
+    if(opts.statsFile){
+        writeStats(&opts, ctx, (uint64_t)(closeEnd.tv_sec - closeStart.tv_sec) * 1000000000u +
+                               (uint64_t)closeEnd.tv_nsec - (uint64_t)closeStart.tv_nsec);
+    }
+    if(ckpt.path){
+        remove(ckpt.path);
+    }
+    free(ckpt.path);
+    free(ckpt.tmpPath);
+    free(restore);
+    if(in){
+        munmap(in, inSize);
+    }
+    preadReaderClose(reader);
+    if(opts.inputFd >= 0){
+        close(opts.inputFd);
+    }
     free(outFilenameToFree);
-    free(ctx);
+    t2szFree(ctx);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* ******************************************************************
+ * t2sz
+ * Copyright (c) 2020, Martinelli Marco
+ *
+ * You can contact the author at :
+ * - Email: marco+t2sz@13byte.com
+ * - Source repository : https://github.com/martinellimarco/t2sz
+ *
+ * This source code is licensed under the GPLv3 (found in the LICENSE
+ * file in the root directory of this source tree).
+****************************************************************** */
+
+/* libt2sz: the t2sz compressor as a library.
+ *
+ * Input is either a memory buffer (a mapped file, frames planned up front)
+ * or a read callback (streamed, like stdin). Output goes to a write
+ * callback, so archives can be produced in-process without temporary
+ * files. No function exits the process: failures are reported as a
+ * T2szError, with a message available from t2szErrorMessage(). Nothing
+ * is printed either, except the -v diagnostics: conditions a call works
+ * around are reported by t2szGetWarnings().
+ *
+ * A T2szContext keeps its zstd context and internal buffers between
+ * calls; reusing one for many archives avoids most per-archive
+ * allocations. A context must not be used by two threads at once, but
+ * distinct contexts are independent.
+ */
+
+#ifndef T2SZ_H
+#define T2SZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    T2SZ_OK = 0,
+    T2SZ_ERROR_PARAMETER,   //invalid option or argument
+    T2SZ_ERROR_MEMORY,      //out of memory
+    T2SZ_ERROR_READ,        //the read callback failed or the input ended early
+    T2SZ_ERROR_WRITE,       //the write callback failed
+    T2SZ_ERROR_FORMAT,      //invalid tar archive, or corrupted seekable archive
+    T2SZ_ERROR_NOT_FOUND,   //t2szExtract(): no such member
+    T2SZ_ERROR_ZSTD,        //libzstd reported an error
+    T2SZ_ERROR_THREAD,      //a thread could not be started
+    T2SZ_ERROR_VERIFY       //--verify: the output does not decompress to the input
+} T2szError;
+
+/** Conditions a call worked around, at some cost to the archive; see t2szGetWarnings(). */
+typedef enum {
+    T2SZ_WARNING_SEEK_TABLE = 1 << 0,   //too many frames, or frames too large: no seek table written
+    T2SZ_WARNING_INDEX      = 1 << 1,   //too many members: no member index written
+    T2SZ_WARNING_DICTIONARY = 1 << 2,   //dictionary training failed: compressed without a dictionary
+    T2SZ_WARNING_THREADS    = 1 << 3    //libzstd without multi-threading: large frames on one thread
+} T2szWarning;
+
+/**
+ * Output sink. Must consume all @p len bytes.
+ *
+ * @return  0 on success, any other value aborts the call with
+ *          T2SZ_ERROR_WRITE.
+ */
+typedef int (*T2szWriteFn)(void *opaque, const void *buf, size_t len);
+
+/**
+ * Input source for t2szCompressStream(). Short reads are fine.
+ *
+ * @return  Bytes stored in @p buf, 0 at the end of the input, or a
+ *          negative value on error (T2SZ_ERROR_READ).
+ */
+typedef ptrdiff_t (*T2szReadFn)(void *opaque, void *buf, size_t len);
+
+/**
+ * Checkpoint sink, see T2szOptions.checkpointFn. Called between two frames
+ * of t2szCompressBuffer(), once every byte of the frames so far has been
+ * handed to the write callback. To be usable after a crash, the state must
+ * only be stored once that output is on disk.
+ *
+ * @return  0 on success, any other value aborts the call with
+ *          T2SZ_ERROR_WRITE.
+ */
+typedef int (*T2szCheckpointFn)(void *opaque, const void *state, size_t len);
+
+/**
+ * Input release hook, see T2szOptions.releaseFn. Called by
+ * t2szCompressBuffer() with a range of the input it is done with until
+ * its next pass over the input (planning, dictionary sampling and
+ * compression each make one), so that a caller that mapped a file can
+ * drop those pages. The buffer must stay valid and readable: a range may
+ * be read again by a later pass.
+ */
+typedef void (*T2szReleaseFn)(void *opaque, uint64_t offset, uint64_t size);
+
+typedef struct {
+    int level;              //1..22, default 3
+    size_t minBlockSize;    //-s, 0 for one tar member (or the whole raw input) per frame; the minimum with --cdc
+    size_t maxBlockSize;    //-S, 0 for no limit; tar mode, or the maximum with --cdc
+    uint32_t workers;       //-T, 0 or 1 for single thread
+    size_t cdcAverage;      //--cdc, average content-defined frame size in raw mode, 0 for fixed -s frames
+    size_t autoMaxRead;     //--auto-block read=SIZE, choose -s/-S by trial compression, frames of at most SIZE bytes
+    double autoRatioLoss;   //--auto-block ratio=PCT, the smallest frames within PCT% of solid compression (default 1)
+    size_t dictCapacity;    //-D, 0 disables the dictionary; buffer input only
+    bool rawMode;           //-r, the input is not a tar archive
+    bool skipSeekTable;     //-j
+    bool buildIndex;        //-i, tar mode only
+    bool compressAll;       //--compress-all, no fast path for incompressible frames
+    bool noDecompress;      //--no-decompress, compress zstd-compressed input as is instead of reframing it
+    bool verify;            //--verify, decompress the output on a separate thread and compare it with the input
+    bool verbose;           //-v, progress on stderr
+    bool collectStats;      //--stats, time and size every frame, see t2szGetStats()
+    T2szCheckpointFn checkpointFn;  //--checkpoint, NULL for none; buffer input only
+    void *checkpointOpaque;
+    uint32_t checkpointInterval;    //minimum seconds between two checkpoints, 0 after every frame
+    size_t inputWindow;     //--input-window, release the input every inputWindow bytes, 0 keeps it all; buffer input only
+    T2szReleaseFn releaseFn;        //called with the released ranges, NULL for none
+    void *releaseOpaque;
+} T2szOptions;
+
+/** One frame of the plan built by t2szPlan(). */
+typedef struct {
+    uint64_t offset;        //first input byte of the frame
+    uint64_t size;          //input bytes in the frame
+    uint64_t firstMember;   //tar member the frame starts in
+    uint32_t members;       //tar headers in the frame, 0 in raw mode and for split tails
+} T2szFrame;
+
+/** One compressed frame, see T2szStats. */
+typedef struct {
+    uint64_t inputSize;     //bytes of input in the frame
+    uint64_t outputSize;    //bytes of the compressed frame
+    uint64_t compressNs;    //time spent in libzstd on the frame
+} T2szFrameStats;
+
+/**
+ * Statistics of the last compression call, collected when
+ * T2szOptions.collectStats is set. Times are wall-clock nanoseconds;
+ * compressNs adds up the time of every thread, so with -T it can exceed
+ * wallNs. Memory-mapped input is read through page faults, which count as
+ * compression time: inputNs only covers the read callback.
+ */
+typedef struct {
+    uint64_t wallNs;        //the whole call
+    uint64_t inputNs;       //waiting for the read callback (or the zstd input decoder)
+    uint64_t headerNs;      //parsing tar headers and planning frames
+    uint64_t compressNs;    //in libzstd, summed over threads
+    uint64_t outputNs;      //in the write callback
+    uint64_t verifyNs;      //decompressing and comparing the output (verify), on the verifier thread
+    uint64_t inputBytes;    //input compressed by this call, in data frames
+    uint64_t outputBytes;   //bytes handed to the write callback
+    uint64_t zstdMemory;    //ZSTD_sizeof_CCtx() of every compression context, plus the dictionary and decoder
+    uint64_t minBlockSize;  //-s and -S of the call, as chosen with autoMaxRead or autoRatioLoss
+    uint64_t maxBlockSize;
+    uint64_t autoNs;        //trial compressions choosing them, 0 without automatic block sizes
+    uint64_t autoSampleBytes;   //input sampled by the trials
+    double autoRatio;       //ratio of the sample in frames of the chosen size
+    double autoSolidRatio;  //ratio of the sample compressed solid
+    const T2szFrameStats *frames;   //data frames in output order, without dictionary and index frames
+    size_t nbFrames;
+} T2szStats;
+
+/**
+ * Progress of a compression call, see t2szGetProgress(). inputBytes
+ * counts input as libzstd consumes it, so it runs up to totalBytes.
+ */
+typedef struct {
+    uint64_t inputBytes;    //input compressed so far, resumed frames included
+    uint64_t outputBytes;   //bytes handed to the write callback so far
+    uint64_t totalBytes;    //input size of t2szCompressBuffer(), 0 when unknown (streamed or zstd-compressed input)
+    uint64_t resumedBytes;  //input of the frames already in the output when resuming, included in inputBytes
+} T2szProgress;
+
+typedef struct T2szContext T2szContext;
+
+/** Fill @p opts with the defaults of the command line tool. */
+void t2szInitOptions(T2szOptions *opts);
+
+/** @return  A new context with default options, or NULL when out of memory. */
+T2szContext* t2szCreate(void);
+
+/** Release a context and everything it owns. Accepts NULL. */
+void t2szFree(T2szContext *ctx);
+
+/** Validate and apply options for the following calls. */
+T2szError t2szSetOptions(T2szContext *ctx, const T2szOptions *opts);
+
+/**
+ * Compress an in-memory tar archive (or raw data) to @p writeFn.
+ *
+ * Like t2szCompressStream(), an input that is itself zstd-compressed (a
+ * .tar.zst, or another seekable archive) is decompressed on a separate
+ * thread and its content reframed, unless T2szOptions.noDecompress is set.
+ * Such an input is streamed: -D and checkpoints are not available.
+ */
+T2szError t2szCompressBuffer(T2szContext *ctx, const void *src, size_t size,
+                             T2szWriteFn writeFn, void *writeOpaque);
+
+/** Compress data pulled from @p readFn as it arrives, to @p writeFn. */
+T2szError t2szCompressStream(T2szContext *ctx, T2szReadFn readFn, void *readOpaque,
+                             T2szWriteFn writeFn, void *writeOpaque);
+
+/**
+ * Split an in-memory input into frames as t2szCompressBuffer() would,
+ * without compressing. @p frames stays valid until the next call on @p ctx.
+ */
+T2szError t2szPlan(T2szContext *ctx, const void *src, size_t size,
+                   const T2szFrame **frames, size_t *nbFrames, uint64_t *nbMembers);
+
+/**
+ * Make the next t2szCompressBuffer() or t2szCompressStream() call on @p ctx
+ * append the members of its tar input to the seekable tar archive
+ * @p archive, instead of starting a new archive.
+ *
+ * The first @p *keep bytes of the archive stay as they are: the caller
+ * cuts the archive there and has the write callback of that call continue
+ * from this offset. The call then writes the member data of the old last
+ * frame again (without the end-of-archive blocks), the new members and a
+ * seek table for the whole archive. The dictionary (-D) and member index
+ * (-i) of the archive are reused and extended; the -D and -i options do
+ * not apply. Requires tar mode and a seek table. @p archive is only read
+ * during this call.
+ */
+T2szError t2szAppendTo(T2szContext *ctx, const void *archive, size_t size, uint64_t *keep);
+
+/**
+ * Make the next t2szCompressBuffer() call on @p ctx continue an output
+ * that was interrupted, from a state saved by its checkpoint callback.
+ *
+ * The first @p *keep bytes of that output are complete frames: the caller
+ * cuts it there and has the write callback continue from this offset. The
+ * call then fails with T2SZ_ERROR_PARAMETER unless the input and the
+ * options are the ones the state was saved with, and otherwise compresses
+ * the remaining frames and writes the seek table. Call it after
+ * t2szSetOptions().
+ */
+T2szError t2szResume(T2szContext *ctx, const void *state, size_t len, uint64_t *keep);
+
+/** Write the content of tar member @p member of a seekable archive to @p writeFn. */
+T2szError t2szExtract(T2szContext *ctx, const void *archive, size_t size, const char *member,
+                      T2szWriteFn writeFn, void *writeOpaque);
+
+/** Result of t2szTest(). */
+typedef struct {
+    uint64_t frames;            //seek table entries, skippable frames included
+    uint64_t dataFrames;        //zstd frames decompressed and checked
+    uint64_t noChecksumFrames;  //of those, frames without a content checksum (sizes checked only)
+    uint64_t compressedBytes;   //archive size
+    uint64_t decompressedBytes;
+} T2szTestResult;
+
+/**
+ * Check a seekable archive: every frame of the seek table must end where
+ * the table says and decompress, with a matching content checksum, to the
+ * size it records. Frames are checked in parallel on T2szOptions.workers
+ * threads. The first bad frame fails the call with T2SZ_ERROR_FORMAT and a
+ * message giving its index and offset.
+ */
+T2szError t2szTest(T2szContext *ctx, const void *archive, size_t size, T2szTestResult *result);
+
+/**
+ * @return  The statistics of the last t2szCompressBuffer() or
+ *          t2szCompressStream() call on @p ctx, valid until the next call.
+ *          All zero unless T2szOptions.collectStats was set.
+ */
+const T2szStats* t2szGetStats(const T2szContext *ctx);
+
+/**
+ * Progress of the compression call running on @p ctx, or of the last one.
+ * Unlike every other function, it can be called from another thread while
+ * the call runs, e.g. from a timer: the counters are updated as atomics,
+ * without locks or system calls.
+ */
+void t2szGetProgress(T2szContext *ctx, T2szProgress *progress);
+
+/** @return  The message of the last failure on @p ctx, "" if none. */
+const char* t2szErrorMessage(const T2szContext *ctx);
+
+/** @return  A static description of @p err. */
+const char* t2szErrorName(T2szError err);
+
+/**
+ * @return  The T2szWarning flags raised by the last call on @p ctx, 0 if
+ *          none. A call can succeed with warnings.
+ */
+unsigned t2szGetWarnings(const T2szContext *ctx);
+
+/** @return  The message of @p warning for the last call on @p ctx, "" if it was not raised. */
+const char* t2szWarningMessage(const T2szContext *ctx, T2szWarning warning);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* T2SZ_H */
@@ -0,0 +1,387 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* ******************************************************************
+ * t2sz
+ * Copyright (c) 2020, Martinelli Marco
+ *
+ * You can contact the author at :
+ * - Email: marco+t2sz@13byte.com
+ * - Source repository : https://github.com/martinellimarco/t2sz
+ *
+ * This source code is licensed under the GPLv3 (found in the LICENSE
+ * file in the root directory of this source tree).
+****************************************************************** */
+
+#include <errno.h>
+#include "uring_writer.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* The pool holds URING_BUFFERS buffers of URING_BUFFER_SIZE bytes: one is
+ * being filled while the others are in flight. liburing is not required,
+ * the two system calls are issued directly. */
+#define URING_BUFFERS     8
+#define URING_BUFFER_SIZE ((size_t)1 << 20)
+#define URING_ALIGN       4096
+
+typedef struct {
+    uint8_t* data;          //URING_ALIGN-aligned
+    size_t len;             //bytes filled
+    uint64_t offset;        //file offset, set on submission
+    bool busy;              //submitted and not completed yet
+} UringBuffer;
+
+struct UringWriter {
+    int fd;
+    int ringFd;
+
+    //rings shared with the kernel
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;           //== sqRing with IORING_FEAT_SINGLE_MMAP
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    UringBuffer bufs[URING_BUFFERS];
+    size_t current;         //buffer being filled
+    uint64_t offset;        //file offset of the current buffer
+    int err;                //errno of the first failed write, 0 if none
+};
+
+static int uringSetup(const unsigned entries, struct io_uring_params *p){
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(const int ringFd, const unsigned toSubmit, const unsigned minComplete, const unsigned flags){
+    int ret;
+    do{
+        ret = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+    }while(ret < 0 && errno == EINTR);
+    return ret;
+}
+
+/**
+ * Release the rings and the buffers.
+ *
+ * @param w  Writer, possibly partially initialized (zeroed fields).
+ */
+static void uringRelease(UringWriter *w){
+    for(size_t i = 0; i < URING_BUFFERS; i++){
+        free(w->bufs[i].data);
+    }
+    if(w->sqes){
+        munmap(w->sqes, w->sqesSize);
+    }
+    if(w->cqRing && w->cqRing != w->sqRing){
+        munmap(w->cqRing, w->cqRingSize);
+    }
+    if(w->sqRing){
+        munmap(w->sqRing, w->sqRingSize);
+    }
+    if(w->ringFd >= 0){
+        close(w->ringFd);
+    }
+    free(w);
+}
+
+UringWriter* uringWriterOpen(int fd){
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+        return NULL;
+    }
+    // With O_APPEND every write goes to the end of the file whatever its
+    // offset, so out-of-order completions would shuffle the output.
+    const int flags = fcntl(fd, F_GETFL);
+    if(flags < 0 || (flags & O_APPEND)){
+        return NULL;
+    }
+    const off_t start = lseek(fd, 0, SEEK_CUR);
+    if(start < 0){
+        return NULL;
+    }
+
+    UringWriter *w = calloc(1, sizeof(UringWriter));
+    if(!w){
+        return NULL;
+    }
+    w->fd = fd;
+    w->offset = (uint64_t)start;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    w->ringFd = uringSetup(URING_BUFFERS, &p);
+    // IORING_OP_WRITE and IORING_FEAT_RW_CUR_POS both appeared in 5.6.
+    if(w->ringFd < 0 || !(p.features & IORING_FEAT_RW_CUR_POS)){
+        uringRelease(w);
+        return NULL;
+    }
+
+    w->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    w->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(w->cqRingSize > w->sqRingSize){
+            w->sqRingSize = w->cqRingSize;
+        }
+        w->cqRingSize = w->sqRingSize;
+    }
+    w->sqRing = mmap(NULL, w->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ringFd, IORING_OFF_SQ_RING);
+    if(w->sqRing == MAP_FAILED){
+        w->sqRing = NULL;
+        uringRelease(w);
+        return NULL;
+    }
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        w->cqRing = w->sqRing;
+    }else{
+        w->cqRing = mmap(NULL, w->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ringFd, IORING_OFF_CQ_RING);
+        if(w->cqRing == MAP_FAILED){
+            w->cqRing = NULL;
+            uringRelease(w);
+            return NULL;
+        }
+    }
+    w->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    w->sqes = mmap(NULL, w->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ringFd, IORING_OFF_SQES);
+    if(w->sqes == MAP_FAILED){
+        w->sqes = NULL;
+        uringRelease(w);
+        return NULL;
+    }
+
+    uint8_t *sq = w->sqRing;
+    uint8_t *cq = w->cqRing;
+    w->sqTail = (unsigned*)(sq + p.sq_off.tail);
+    w->sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    w->sqArray = (unsigned*)(sq + p.sq_off.array);
+    w->cqHead = (unsigned*)(cq + p.cq_off.head);
+    w->cqTail = (unsigned*)(cq + p.cq_off.tail);
+    w->cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    w->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    for(size_t i = 0; i < URING_BUFFERS; i++){
+        if(posix_memalign((void**)&w->bufs[i].data, URING_ALIGN, URING_BUFFER_SIZE) != 0){
+            w->bufs[i].data = NULL;
+            uringRelease(w);
+            return NULL;
+        }
+    }
+    return w;
+}
+
+/**
+ * Finish a short write synchronously. Rare on regular files (disk full,
+ * signal), so there is no point in resubmitting.
+ *
+ * @param w     The writer.
+ * @param b     The buffer.
+ * @param done  Bytes already written by the asynchronous write.
+ */
+static void uringFinishShort(UringWriter *w, const UringBuffer *b, size_t done){
+    while(done < b->len){
+        const ssize_t n = pwrite(w->fd, b->data + done, b->len - done, (off_t)(b->offset + done));
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            if(!w->err){
+                w->err = n < 0 ? errno : ENOSPC;
+            }
+            return;
+        }
+        done += (size_t)n;
+    }
+}
+
+/**
+ * Process completions, waiting for at least one if @p wait is set.
+ *
+ * @param w     The writer.
+ * @param wait  Block until a completion is available.
+ * @return      false if waiting failed.
+ */
+static bool uringReap(UringWriter *w, const bool wait){
+    unsigned head = *w->cqHead;
+    unsigned tail = __atomic_load_n(w->cqTail, __ATOMIC_ACQUIRE);
+    if(head == tail && wait){
+        if(uringEnter(w->ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0){
+            if(!w->err){
+                w->err = errno;
+            }
+            return false;
+        }
+        tail = __atomic_load_n(w->cqTail, __ATOMIC_ACQUIRE);
+    }
+    while(head != tail){
+        const struct io_uring_cqe *cqe = &w->cqes[head & *w->cqMask];
+        UringBuffer *b = &w->bufs[cqe->user_data];
+        if(cqe->res < 0){
+            if(!w->err){
+                w->err = -cqe->res;
+            }
+        }else if((size_t)cqe->res < b->len){
+            uringFinishShort(w, b, (size_t)cqe->res);
+        }
+        b->busy = false;
+        head++;
+    }
+    __atomic_store_n(w->cqHead, head, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Submit the current buffer at the current file offset and move on to the
+ * next buffer of the pool, waiting for it to be written if needed.
+ *
+ * @param w  The writer.
+ * @return   false on error.
+ */
+static bool uringSubmitCurrent(UringWriter *w){
+    UringBuffer *b = &w->bufs[w->current];
+    b->offset = w->offset;
+    b->busy = true;
+    w->offset += b->len;
+
+    // Single producer: the tail is only written here. The SQ has as many
+    // entries as there are buffers, so it can never be full.
+    const unsigned tail = *w->sqTail;
+    const unsigned index = tail & *w->sqMask;
+    struct io_uring_sqe *sqe = &w->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = w->fd;
+    sqe->addr = (uint64_t)(uintptr_t)b->data;
+    sqe->len = (uint32_t)b->len;
+    sqe->off = b->offset;
+    sqe->user_data = w->current;
+    w->sqArray[index] = index;
+    __atomic_store_n(w->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    if(uringEnter(w->ringFd, 1, 0, 0) < 0){
+        if(!w->err){
+            w->err = errno;
+        }
+        b->busy = false;
+        return false;
+    }
+
+    w->current = (w->current + 1) % URING_BUFFERS;
+    while(w->bufs[w->current].busy){
+        if(!uringReap(w, true)){
+            return false;
+        }
+    }
+    w->bufs[w->current].len = 0;
+    uringReap(w, false);
+    return w->err == 0;
+}
+
+int uringWriterWrite(UringWriter *w, const void *buf, size_t len){
+    const uint8_t *src = buf;
+    while(len && !w->err){
+        UringBuffer *b = &w->bufs[w->current];
+        const size_t n = len < URING_BUFFER_SIZE - b->len ? len : URING_BUFFER_SIZE - b->len;
+        memcpy(b->data + b->len, src, n);
+        b->len += n;
+        src += n;
+        len -= n;
+        if(b->len == URING_BUFFER_SIZE){
+            uringSubmitCurrent(w);
+        }
+    }
+    if(w->err){
+        errno = w->err;
+        return -1;
+    }
+    return 0;
+}
+
+int uringWriterFlush(UringWriter *w){
+    if(!w->err && w->bufs[w->current].len){
+        uringSubmitCurrent(w);
+    }
+    for(size_t i = 0; i < URING_BUFFERS && !w->err; i++){
+        while(w->bufs[i].busy){
+            if(!uringReap(w, true)){
+                break;
+            }
+        }
+    }
+    if(w->err){
+        errno = w->err;
+        return -1;
+    }
+    return 0;
+}
+
+int uringWriterClose(UringWriter *w){
+    if(!w->err && w->bufs[w->current].len){
+        uringSubmitCurrent(w);
+    }
+    for(size_t i = 0; i < URING_BUFFERS; i++){
+        while(w->bufs[i].busy){
+            if(!uringReap(w, true)){
+                // Waiting failed: the buffers may still be in use by the
+                // kernel, leak them rather than free them under it.
+                const int err = w->err;
+                close(w->ringFd);
+                errno = err;
+                return -1;
+            }
+        }
+    }
+    // Writes were positioned: leave the file offset where stdio would have.
+    lseek(w->fd, (off_t)w->offset, SEEK_SET);
+
+    const int err = w->err;
+    uringRelease(w);
+    if(err){
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+#else /* !HAVE_IO_URING */
+
+UringWriter* uringWriterOpen(int fd){
+    (void)fd;
+    return NULL;
+}
+
+int uringWriterWrite(UringWriter *w, const void *buf, size_t len){
+    (void)w; (void)buf; (void)len;
+    errno = ENOSYS;
+    return -1;
+}
+
+int uringWriterFlush(UringWriter *w){
+    (void)w;
+    errno = ENOSYS;
+    return -1;
+}
+
+int uringWriterClose(UringWriter *w){
+    (void)w;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* HAVE_IO_URING */
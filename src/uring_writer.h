@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/**
+ * Asynchronous file writer on Linux io_uring.
+ *
+ * Output is gathered into a pool of large, page-aligned buffers; each full
+ * buffer is submitted as a write at its file offset and the caller goes
+ * on filling the next one while the kernel writes. Only regular files are
+ * supported: writes are positioned, so they can complete in any order.
+ *
+ * Built when HAVE_IO_URING is defined (Linux, see CMakeLists.txt). Without
+ * it, or when the kernel refuses io_uring (old kernel, seccomp filter),
+ * uringWriterOpen() returns NULL and the caller keeps using stdio.
+ */
+#ifndef URING_WRITER_H
+#define URING_WRITER_H
+
+#include <stddef.h>
+
+typedef struct UringWriter UringWriter;
+
+/**
+ * Start writing to @p fd at its current offset.
+ *
+ * @param fd  File descriptor of a regular file opened for writing, without
+ *            O_APPEND. Stays owned by the caller.
+ * @return    The writer, or NULL if io_uring is unavailable or @p fd is
+ *            not suitable.
+ */
+UringWriter* uringWriterOpen(int fd);
+
+/**
+ * Queue @p len bytes for writing.
+ *
+ * @return  0 on success, -1 on error with errno set (a failed earlier
+ *          asynchronous write is reported here too).
+ */
+int uringWriterWrite(UringWriter *w, const void *buf, size_t len);
+
+/**
+ * Write what is queued and wait for every write to complete, so that the
+ * file holds all the bytes passed so far (e.g. before an fsync()).
+ *
+ * @return  0 on success, -1 on error with errno set.
+ */
+int uringWriterFlush(UringWriter *w);
+
+/**
+ * Write what is left, wait for every write to complete and free the
+ * writer. The file descriptor is left open.
+ *
+ * @return  0 on success, -1 on error with errno set.
+ */
+int uringWriterClose(UringWriter *w);
+
+#endif /* URING_WRITER_H */
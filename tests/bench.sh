@@ -0,0 +1,207 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: GPL-3.0-or-later
+# bench.sh — End-to-end throughput benchmark for t2sz
+#
+# Run by the t2sz_bench target of tests/CMakeLists.txt, not by CTest: the
+# numbers depend on the machine, so nothing here passes or fails except a
+# t2sz run that exits with an error.
+#
+# Usage:
+#   bench.sh T2SZ GEN_BLOB WORK_DIR [RESULTS_FILE]
+#
+# Arguments:
+#   T2SZ          path to the t2sz binary under test (build it in Release)
+#   GEN_BLOB      path to the gen_blob binary
+#   WORK_DIR      directory for the corpora (kept between runs) and outputs
+#   RESULTS_FILE  where to write the results too, default WORK_DIR/results.jsonl
+#
+# Builds synthetic corpora with gen_blob, then compresses every corpus
+# through the mmap path (input file) and the stdin path, for every level,
+# block size option and thread count. Each configuration prints one JSON
+# object per line on stdout, e.g.
+#
+#   {"version":"1.2.5","corpus":"tar_tiny_text","path":"mmap","level":3,
+#    "blocks":"-s 1M","threads":4,"input_bytes":48168960,"output_bytes":...,
+#    "frames":46,"seconds":0.212,"mb_per_s":227.2,"frames_per_s":217.0,
+#    "ratio":3.41}
+#
+# MB/s is input megabytes (10^6 bytes) per second of wall time, seconds is
+# the best of BENCH_REPEAT runs, ratio is input bytes / output bytes.
+#
+# Environment:
+#   BENCH_SCALE    corpus size in MiB, default 32
+#   BENCH_REPEAT   runs per configuration, default 3
+#   BENCH_CORPORA  default "tar_tiny_text tar_huge_text tar_huge_random raw_text raw_random"
+#   BENCH_PATHS    default "mmap stdin"
+#   BENCH_LEVELS   default "1 3 9"
+#   BENCH_BLOCKS   block size options separated by commas, "none" for none,
+#                  default "none,-s 1M,-s 4M -S 16M" (-S only applies to tars)
+#   BENCH_THREADS  default "1 N" with N the number of CPUs
+
+set -eo pipefail
+
+# ── Bootstrap ────────────────────────────────────────────────────────────────
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+. "$SCRIPT_DIR/helpers.sh"
+
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 T2SZ GEN_BLOB WORK_DIR [RESULTS_FILE]" >&2
+    exit 1
+fi
+
+T2SZ="$1"
+GEN_BLOB="$2"
+WORK_DIR="$3"
+RESULTS="${4:-$WORK_DIR/results.jsonl}"
+
+die()  { printf "[ERROR] %s\n" "$*" >&2; exit 1; }
+
+CPUS=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+SCALE="${BENCH_SCALE:-32}"
+REPEAT="${BENCH_REPEAT:-3}"
+CORPORA="${BENCH_CORPORA:-tar_tiny_text tar_huge_text tar_huge_random raw_text raw_random}"
+PATHS="${BENCH_PATHS:-mmap stdin}"
+LEVELS="${BENCH_LEVELS:-1 3 9}"
+BLOCKS="${BENCH_BLOCKS:-none,-s 1M,-s 4M -S 16M}"
+if [ "$CPUS" -gt 1 ]; then
+    THREADS="${BENCH_THREADS:-1 $CPUS}"
+else
+    THREADS="${BENCH_THREADS:-1}"
+fi
+VERSION=$("$T2SZ" -V 2>&1 | awk 'NR == 1 { print $3 }')
+
+CORPUS_DIR="$WORK_DIR/corpora_${SCALE}M"
+OUT="$WORK_DIR/out.zst"
+mkdir -p "$CORPUS_DIR"
+: > "$RESULTS"
+
+# ── Corpora ──────────────────────────────────────────────────────────────────
+# Generated once per BENCH_SCALE and kept in WORK_DIR:
+#   tar_tiny_text    text split into 2500-byte files (13k members at 32 MiB)
+#   tar_huge_text    two text files of SCALE/2 MiB each
+#   tar_huge_random  two random files of SCALE/2 MiB each
+#   raw_text         SCALE MiB of text, compressed in raw mode
+#   raw_random       SCALE MiB of random data, compressed in raw mode
+
+# make_corpus NAME — prints the path of the corpus, generating it if needed.
+make_corpus() {
+    local name="$1"
+    local bytes=$(( SCALE * 1024 * 1024 ))
+    local half=$(( bytes / 2 ))
+    local dir="$CORPUS_DIR/$name.d"
+    local file
+    case "$name" in
+        tar_*) file="$CORPUS_DIR/$name.tar" ;;
+        raw_*) file="$CORPUS_DIR/$name.bin" ;;
+        *)     die "unknown corpus '$name'" ;;
+    esac
+    if [ ! -f "$file" ]; then
+        log_step "Generating $name ($SCALE MiB)" >&2
+        rm -rf "$dir"
+        mkdir -p "$dir"
+        case "$name" in
+            tar_tiny_text)
+                "$GEN_BLOB" 1 "$bytes" "$dir/all" text
+                (cd "$dir" && split -b 2500 -a 6 all f && rm all)
+                ;;
+            tar_huge_text)
+                "$GEN_BLOB" 2 "$half" "$dir/a" text
+                "$GEN_BLOB" 3 "$half" "$dir/b" text
+                ;;
+            tar_huge_random)
+                "$GEN_BLOB" 4 "$half" "$dir/a"
+                "$GEN_BLOB" 5 "$half" "$dir/b"
+                ;;
+            raw_text)
+                "$GEN_BLOB" 6 "$bytes" "$file.tmp" text
+                ;;
+            raw_random)
+                "$GEN_BLOB" 7 "$bytes" "$file.tmp"
+                ;;
+        esac
+        case "$name" in
+            tar_*) tar cf "$file.tmp" -C "$dir" . ;;
+        esac
+        rm -rf "$dir"
+        mv "$file.tmp" "$file"
+    fi
+    echo "$file"
+}
+
+# ── Timing ───────────────────────────────────────────────────────────────────
+# now — wall clock in seconds with a fractional part.
+now() {
+    if [ -n "${EPOCHREALTIME:-}" ]; then
+        echo "${EPOCHREALTIME/,/.}"
+    else
+        date +%s.%N
+    fi
+}
+
+# run_once CORPUS_FILE PATH FLAGS... — compress once, print the elapsed seconds.
+run_once() {
+    local input="$1" path="$2"
+    shift 2
+    local start end
+    start=$(now)
+    if [ "$path" = "stdin" ]; then
+        # Through a pipe: a regular file redirected to stdin takes the mmap path.
+        cat "$input" | "$T2SZ" "$@" -f -o "$OUT" - || die "t2sz $* - failed"
+    else
+        "$T2SZ" "$@" -f -o "$OUT" "$input" || die "t2sz $* $input failed"
+    fi
+    end=$(now)
+    awk -v s="$start" -v e="$end" 'BEGIN { printf "%.6f\n", e - s }'
+}
+
+# ── Sweep ────────────────────────────────────────────────────────────────────
+log_info "t2sz $VERSION, $CPUS CPUs, corpora of $SCALE MiB, best of $REPEAT runs" >&2
+
+IFS=',' read -r -a BLOCK_LIST <<< "$BLOCKS"
+
+for corpus in $CORPORA; do
+    input=$(make_corpus "$corpus")
+    input_bytes=$(wc -c < "$input")
+    input_bytes=$((input_bytes + 0))
+    mode_flags=()
+    case "$corpus" in
+        raw_*) mode_flags=(-r) ;;
+    esac
+
+    for path in $PATHS; do
+        for level in $LEVELS; do
+            for blocks in "${BLOCK_LIST[@]}"; do
+                block_flags=()
+                if [ "$blocks" != "none" ]; then
+                    read -r -a block_flags <<< "$blocks"
+                fi
+                for threads in $THREADS; do
+                    flags=("${mode_flags[@]}" -l "$level" "${block_flags[@]}" -T "$threads")
+                    best=""
+                    for _ in $(seq 1 "$REPEAT"); do
+                        t=$(run_once "$input" "$path" "${flags[@]}")
+                        best=$(awk -v a="$best" -v b="$t" 'BEGIN { print (a == "" || b < a) ? b : a }')
+                    done
+
+                    output_bytes=$(wc -c < "$OUT")
+                    output_bytes=$((output_bytes + 0))
+                    frames=$(read_le32 "$OUT" $(( output_bytes - 9 )))
+
+                    line=$(awk -v v="$VERSION" -v c="$corpus" -v p="$path" -v l="$level" \
+                               -v b="$blocks" -v th="$threads" -v ib="$input_bytes" \
+                               -v ob="$output_bytes" -v f="$frames" -v s="$best" 'BEGIN {
+                        if (s <= 0) s = 0.000001
+                        printf "{\"version\":\"%s\",\"corpus\":\"%s\",\"path\":\"%s\",\"level\":%d,", v, c, p, l
+                        printf "\"blocks\":\"%s\",\"threads\":%d,\"input_bytes\":%.0f,\"output_bytes\":%.0f,", b, th, ib, ob
+                        printf "\"frames\":%d,\"seconds\":%.6f,\"mb_per_s\":%.1f,\"frames_per_s\":%.1f,\"ratio\":%.3f}\n",
+                               f, s, ib / s / 1e6, f / s, ib / ob
+                    }')
+                    echo "$line" | tee -a "$RESULTS"
+                done
+            done
+        done
+    done
+done
+
+rm -f "$OUT"
+log_info "Results written to $RESULTS" >&2
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * bench_tar_block.c — Microbenchmark of the tar block kernels of libt2sz
+ *
+ * Usage: bench_tar_block [--check] [MIB]
+ *
+ * Includes the library source, like the fuzz harnesses, to reach the
+ * kernels behind checksum() and isZeroTarBlock(). Every kernel the CPU
+ * runs is first checked against the scalar one on edge cases and random
+ * blocks; with --check that is all (the tar_block_kernels test). Then each
+ * kernel is timed over MIB MiB (default 256) of tar headers for the
+ * checksum, and of zero blocks for the zero test, which reads them whole.
+ * One JSON object per line on stdout, e.g.
+ *
+ *   {"kernel":"avx2","op":"checksum","blocks":524288,"seconds":0.021,
+ *    "gb_per_s":12.8,"speedup":6.1}
+ *
+ * speedup is relative to the scalar kernel. Build in Release for numbers
+ * worth comparing. The kernel t2szCreate() selects is printed on stderr.
+ *
+ * Exit 0 on success, 1 if a kernel disagrees with the scalar one.
+ */
+
+#include "../src/libt2sz.c"
+
+#define BENCH_BUFFER_BLOCKS 2048    /* 1 MiB, stays in cache */
+
+static uint64_t rngState = 0x2545F4914F6CDD1Dull;
+
+static uint8_t nextByte(void) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return (uint8_t)rngState;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Compare one kernel with the scalar one on @p block; print the first difference. */
+static bool agrees(const TarKernels *k, const uint8_t *block, const char *what) {
+    const uint32_t sum = k->sum(block), want = tarKernelsScalar.sum(block);
+    const bool zero = k->isZero(block), wantZero = tarKernelsScalar.isZero(block);
+    if (sum != want || zero != wantZero) {
+        fprintf(stderr, "bench_tar_block: %s disagrees on %s: sum %u (want %u), zero %d (want %d)\n",
+                k->name, what, sum, want, zero, wantZero);
+        return false;
+    }
+    return true;
+}
+
+/* Edge cases (all zero, all 0xFF, one byte set at every position), then random blocks. */
+static bool check(const TarKernels *k) {
+    uint8_t block[TAR_BLOCK_SIZE];
+    bool ok = true;
+    memset(block, 0, sizeof(block));
+    ok &= agrees(k, block, "a zero block");
+    memset(block, 0xFF, sizeof(block));
+    ok &= agrees(k, block, "a 0xFF block");
+    for (size_t i = 0; i < TAR_BLOCK_SIZE && ok; i++) {
+        memset(block, 0, sizeof(block));
+        block[i] = (uint8_t)(1 + i % 255);
+        ok &= agrees(k, block, "a block with one byte set");
+    }
+    for (int n = 0; n < 10000 && ok; n++) {
+        for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) block[i] = nextByte();
+        ok &= agrees(k, block, "a random block");
+    }
+    return ok;
+}
+
+/* A plausible ustar header with a valid checksum: name, octal fields, padding. */
+static void makeHeader(uint8_t *h, const unsigned i) {
+    memset(h, 0, TAR_BLOCK_SIZE);
+    snprintf((char *)h, 100, "dir/sub/file%08u.json", i);
+    snprintf((char *)h + 100, 8, "0000644");
+    snprintf((char *)h + 108, 8, "0001750");
+    snprintf((char *)h + 116, 8, "0001750");
+    snprintf((char *)h + 124, 12, "%011o", 2500 + i % 1000);
+    snprintf((char *)h + 136, 12, "%011o", 1700000000u + i);
+    memset(h + 148, ' ', 8);
+    h[156] = '0';
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    snprintf((char *)h + 148, 8, "%06o", tarKernelsScalar.sum(h));
+}
+
+/* Time @p op of kernel @p k over @p blocks blocks of @p buf; print a JSON line. */
+static double timeKernel(const TarKernels *k, const char *op, const uint8_t *buf, const uint64_t blocks,
+                         const double scalarSeconds) {
+    const bool sum = strcmp(op, "checksum") == 0;
+    volatile uint32_t sink = 0;
+    const double start = now();
+    for (uint64_t b = 0; b < blocks; b++) {
+        const uint8_t *block = buf + (b % BENCH_BUFFER_BLOCKS) * TAR_BLOCK_SIZE;
+        sink += sum ? k->sum(block) : (uint32_t)k->isZero(block);
+    }
+    double seconds = now() - start;
+    if (seconds <= 0) seconds = 1e-9;
+    (void)sink;
+    printf("{\"kernel\":\"%s\",\"op\":\"%s\",\"blocks\":%" PRIu64 ",\"seconds\":%.6f,"
+           "\"gb_per_s\":%.2f,\"speedup\":%.2f}\n",
+           k->name, op, blocks, seconds, (double)blocks * TAR_BLOCK_SIZE / seconds / 1e9,
+           scalarSeconds > 0 ? scalarSeconds / seconds : 1.0);
+    return seconds;
+}
+
+int main(int argc, char **argv) {
+    bool checkOnly = false;
+    uint64_t mib = 256;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--check") == 0) {
+            checkOnly = true;
+        } else {
+            mib = strtoull(argv[i], NULL, 10);
+            if (mib == 0) {
+                fprintf(stderr, "Usage: %s [--check] [MIB]\n", argv[0]);
+                return 1;
+            }
+        }
+    }
+
+    pthread_once(&tarKernelsOnce, tarKernelsSelect);
+    fprintf(stderr, "bench_tar_block: selected kernel %s\n", tarKernels->name);
+
+    const TarKernels *list[TAR_KERNELS_MAX];
+    const size_t n = tarKernelsSupported(list);
+    for (size_t i = 1; i < n; i++) {
+        if (!check(list[i])) return 1;
+    }
+    if (checkOnly) {
+        printf("bench_tar_block: OK, %zu kernels checked\n", n - 1);
+        return 0;
+    }
+
+    uint8_t *headers = malloc(BENCH_BUFFER_BLOCKS * TAR_BLOCK_SIZE);
+    uint8_t *zeros = calloc(BENCH_BUFFER_BLOCKS, TAR_BLOCK_SIZE);
+    if (!headers || !zeros) {
+        fprintf(stderr, "bench_tar_block: out of memory\n");
+        return 1;
+    }
+    for (unsigned i = 0; i < BENCH_BUFFER_BLOCKS; i++) makeHeader(headers + (size_t)i * TAR_BLOCK_SIZE, i);
+
+    const uint64_t blocks = mib * 1024 * 1024 / TAR_BLOCK_SIZE;
+    double scalarSum = 0, scalarZero = 0;
+    for (size_t i = 0; i < n; i++) {
+        const double s = timeKernel(list[i], "checksum", headers, blocks, scalarSum);
+        const double z = timeKernel(list[i], "zero_block", zeros, blocks, scalarZero);
+        if (i == 0) {
+            scalarSum = s;
+            scalarZero = z;
+        }
+    }
+    free(headers);
+    free(zeros);
+    return 0;
+}
@@ -3,12 +3,16 @@
 /*
  * gen_blob.c — Deterministic binary blob generator
  *
- * Usage: gen_blob <seed> <size_bytes> <output_file>
+ * Usage: gen_blob <seed> <size_bytes> <output_file> [text]
  *
  * Given the same seed and size, always produces identical output.
  * Uses xorshift64, a fast PRNG with good statistical distribution.
  * seed=0 is remapped to 1 (xorshift64 must not start at zero).
  *
+ * By default the output is random and incompressible. With "text" it is
+ * lines of words drawn from a small vocabulary, which zstd compresses
+ * roughly 3:1, like logs or source code (used by bench.sh).
+ *
  * Exit 0 on success, 1 on error.
  */
 
@@ -27,15 +31,48 @@ static uint64_t xorshift64(uint64_t *state) {
     return (*state = x);
 }
 
+static const char *const words[] = {
+    "the", "of", "and", "to", "in", "is", "for", "on", "with", "as", "by", "at",
+    "from", "that", "this", "be", "are", "was", "or", "an", "not", "it", "if", "no",
+    "error", "warning", "info", "debug", "request", "response", "status", "user",
+    "file", "path", "size", "offset", "frame", "block", "member", "archive",
+    "read", "write", "open", "close", "start", "stop", "done", "failed",
+    "return", "while", "const", "static", "struct", "uint64_t", "size_t", "NULL",
+    "0", "1", "42", "1024", "4096", "65536", "0xFF", "-1"
+};
+
+/* Fill buf with words and spaces, ending lines every 4 to 19 words. */
+static void fillText(uint64_t *state, char *buf, const size_t len, unsigned *left) {
+    size_t pos = 0;
+    while (pos < len) {
+        const uint64_t r = xorshift64(state);
+        const char *w = words[r % (sizeof(words) / sizeof(words[0]))];
+        char sep = ' ';
+        if (*left == 0) {
+            *left = 4 + (unsigned)((r >> 32) % 16);
+        }
+        if (--*left == 0) {
+            sep = '\n';
+        }
+        for (; *w && pos < len; w++) {
+            buf[pos++] = *w;
+        }
+        if (pos < len) {
+            buf[pos++] = sep;
+        }
+    }
+}
+
 int main(const int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <seed> <size_bytes> <output_file>\n", argv[0]);
+    if (argc != 4 && !(argc == 5 && strcmp(argv[4], "text") == 0)) {
+        fprintf(stderr, "Usage: %s <seed> <size_bytes> <output_file> [text]\n", argv[0]);
         return 1;
     }
 
     uint64_t seed  = strtoull(argv[1], NULL, 10);
     const uint64_t total = strtoull(argv[2], NULL, 10);
     const char *path  = argv[3];
+    const int text = argc == 5;
 
     if (seed == 0) {
         seed = 1; /* xorshift64 state must not be 0 */
@@ -50,6 +87,21 @@ int main(const int argc, char *argv[]) {
     uint64_t state   = seed;
     uint64_t written = 0;
 
+    if (text) {
+        char buf[65536];
+        unsigned left = 0;
+        while (written < total) {
+            const size_t n = total - written < sizeof(buf) ? (size_t)(total - written) : sizeof(buf);
+            fillText(&state, buf, n, &left);
+            if (fwrite(buf, 1, n, f) != n) {
+                fprintf(stderr, "gen_blob: write error: %s\n", strerror(errno));
+                fclose(f);
+                return 1;
+            }
+            written += n;
+        }
+    }
+
     /* Write full 8-byte words */
     while (written + 8 <= total) {
         uint64_t val = xorshift64(&state);
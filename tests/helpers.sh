@@ -277,3 +277,58 @@ verify_no_seek_table() {
 
     return 0
 }
+
+# ── seek_table_dsizes <file> ────────────────────────────────────────────────
+# Prints the Decompressed_Size of every seek table entry, one per line, in
+# frame order. The file must end with a valid seek table.
+seek_table_dsizes() {
+    local file="$1"
+    local file_size num_frames entries_offset i
+
+    file_size=$(wc -c < "$file")
+    file_size=$((file_size + 0))
+    num_frames=$(read_le32 "$file" $(( file_size - 9 )))
+    entries_offset=$(( file_size - num_frames * 8 - 9 ))
+
+    od -A n -t u1 -v -j "$entries_offset" -N $(( num_frames * 8 )) "$file" \
+        | tr -s ' ' '\n' | sed '/^$/d' \
+        | awk '{ b[(NR - 1) % 8] = $1 }
+               NR % 8 == 0 { print b[4] + b[5]*256 + b[6]*65536 + b[7]*16777216 }'
+}
+
+# ── extract_dict <file> <dict_out> ──────────────────────────────────────────
+# Copies the dictionary stored by -D (skippable frame 0x184D2A5D at offset 0)
+# to <dict_out>, ready for zstd -D. Returns 1 if the archive has no
+# dictionary frame.
+extract_dict() {
+    local file="$1" out="$2"
+    local magic size
+
+    magic=$(read_le32 "$file" 0)
+    if [ "$magic" -ne 407710301 ]; then
+        return 1
+    fi
+    size=$(read_le32 "$file" 4)
+    tail -c +9 "$file" | head -c "$size" > "$out"
+}
+
+# ── index_members <file> ────────────────────────────────────────────────────
+# Prints Number_Of_Members of the member index written by -i (the skippable
+# frame 0x184D2A5C right before the seek table). Returns 1 if there is none.
+index_members() {
+    local file="$1"
+    local file_size num_frames table_start last_csize index_start
+
+    file_size=$(wc -c < "$file")
+    file_size=$((file_size + 0))
+    num_frames=$(read_le32 "$file" $(( file_size - 9 )))
+    table_start=$(( file_size - num_frames * 8 - 17 ))
+    last_csize=$(read_le32 "$file" $(( table_start + 8 + (num_frames - 1) * 8 )))
+    index_start=$(( table_start - last_csize ))
+
+    if [ "$(read_le32 "$file" "$index_start")" -ne 407710300 ] ||
+       [ "$(read_le32 "$file" $(( index_start + 8 )))" -ne 1230189140 ]; then
+        return 1
+    fi
+    read_le32 "$file" $(( index_start + 12 ))
+}
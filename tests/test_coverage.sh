@@ -19,7 +19,7 @@ set -eo pipefail
 
 SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 BUILD_DIR="${1:?Usage: $0 <build_dir>}"
-SRC_FILE="$SCRIPT_DIR/../src/t2sz.c"
+SRC_FILES=("$SCRIPT_DIR/../src/t2sz.c" "$SCRIPT_DIR/../src/libt2sz.c")
 T2SZ_BIN="$BUILD_DIR/t2sz"
 PROFDATA="$BUILD_DIR/coverage.profdata"
 HTML_DIR="$SCRIPT_DIR/coverage/html"
@@ -70,7 +70,9 @@ LLVM_COV="$(find_tool llvm-cov)"
 
 # ── Sanity checks ─────────────────────────────────────────────────────────────
 [ -f "$T2SZ_BIN" ]  || { echo "Error: $T2SZ_BIN not found — did you build with -DCOVERAGE=ON?"; exit 1; }
-[ -f "$SRC_FILE" ]  || { echo "Error: $SRC_FILE not found"; exit 1; }
+for SRC_FILE in "${SRC_FILES[@]}"; do
+    [ -f "$SRC_FILE" ]  || { echo "Error: $SRC_FILE not found"; exit 1; }
+done
 
 PROFRAW_COUNT=$(find "$BUILD_DIR" -name "cov_*.profraw" 2>/dev/null | wc -l | tr -d ' ')
 if [ "$PROFRAW_COUNT" -eq 0 ]; then
@@ -91,7 +93,7 @@ mkdir -p "$HTML_DIR"
     -instr-profile="$PROFDATA" \
     --format=html \
     -output-dir="$HTML_DIR" \
-    "$SRC_FILE"
+    "${SRC_FILES[@]}"
 
 # ── Print summary to stdout ───────────────────────────────────────────────────
 echo ""
@@ -99,7 +101,7 @@ echo "Coverage summary:"
 echo "─────────────────────────────────────────────────────────────────"
 "$LLVM_COV" report "$T2SZ_BIN" \
     -instr-profile="$PROFDATA" \
-    "$SRC_FILE"
+    "${SRC_FILES[@]}"
 echo "─────────────────────────────────────────────────────────────────"
 echo ""
 echo "Full report: $HTML_DIR/index.html"
@@ -295,7 +295,7 @@ stdin_default_stdout)
     # With "-" as input and no -o, output must go to stdout by default.
     # Verify the captured stdout is a valid zstd stream.
     make_small_dat "$WORK/input.dat"
-    "$T2SZ" -r - < "$WORK/input.dat" > "$WORK/out.zst" 2>/dev/null || {
+    "$T2SZ" -r - < <(cat "$WORK/input.dat") > "$WORK/out.zst" 2>/dev/null || {
         log_fail "$TEST_NAME — t2sz exited non-zero"
         exit 1
     }
@@ -327,7 +327,7 @@ stdin_corrupt_tar)
     make_small_tar "$WORK/corrupt.tar"
     printf '\xff\xff\xff\xff\xff\xff\xff\xff' \
         | dd of="$WORK/corrupt.tar" bs=1 seek=148 count=8 conv=notrunc 2>/dev/null
-    assert_nonzero "$T2SZ" -o "$WORK/out.zst" -f - < "$WORK/corrupt.tar"
+    assert_nonzero "$T2SZ" -o "$WORK/out.zst" -f - < <(cat "$WORK/corrupt.tar")
     log_pass "$TEST_NAME"
     ;;
 
@@ -340,7 +340,7 @@ stdin_empty_tar)
         exit 1
     }
     RC=0
-    "$T2SZ" -o "$WORK/out.zst" -f - < "$WORK/empty.tar" 2>/dev/null || RC=$?
+    "$T2SZ" -o "$WORK/out.zst" -f - < <(cat "$WORK/empty.tar") 2>/dev/null || RC=$?
     if [ "$RC" -gt 128 ]; then
         log_fail "$TEST_NAME — killed by signal $(( RC - 128 ))"
         exit 1
@@ -352,7 +352,7 @@ stdin_truncated_tar)
     # Partial 512-byte header on stdin → "Truncated tar header" error.
     # Send exactly 256 zero bytes: fread returns 256, r != 512 triggers the error.
     dd if=/dev/zero of="$WORK/partial.bin" bs=1 count=256 2>/dev/null
-    assert_nonzero "$T2SZ" -o "$WORK/out.zst" -f - < "$WORK/partial.bin"
+    assert_nonzero "$T2SZ" -o "$WORK/out.zst" -f - < <(cat "$WORK/partial.bin")
     log_pass "$TEST_NAME"
     ;;
 
@@ -362,7 +362,7 @@ stdin_truncated_payload)
     # good.tar ≈ 2048B: 512B header + 512B data block + 1024B end blocks.
     # Truncate to 768B: header complete, only 256 of 512 data bytes remain.
     dd if="$WORK/good.tar" of="$WORK/trunc.tar" bs=1 count=768 2>/dev/null
-    assert_nonzero "$T2SZ" -o "$WORK/out.zst" -f - < "$WORK/trunc.tar"
+    assert_nonzero "$T2SZ" -o "$WORK/out.zst" -f - < <(cat "$WORK/trunc.tar")
     log_pass "$TEST_NAME"
     ;;
 
@@ -429,7 +429,7 @@ stdin_raw_nonmultiple_s)
     # Same as raw_nonmultiple_s but via stdin, exercising compressStdinRaw() Path B.
     head -c 1000001 /dev/urandom > "$WORK/input.bin"
     sha_before=$(sha256_file "$WORK/input.bin")
-    assert_exit 0  "$T2SZ" -r -s 256k -o "$WORK/out.zst" -f - < "$WORK/input.bin"
+    assert_exit 0  "$T2SZ" -r -s 256k -o "$WORK/out.zst" -f - < <(cat "$WORK/input.bin")
     zstd -d -f -q "$WORK/out.zst" -o "$WORK/dec.bin" || {
         log_fail "$TEST_NAME — decompression failed"
         exit 1
@@ -465,7 +465,7 @@ trailing_junk_tar)
 
     # stdin path: must not crash (exit non-zero is expected)
     RC=0
-    "$T2SZ" -o "$WORK/out_stdin.zst" -f - < "$WORK/junk.tar" 2>/dev/null || RC=$?
+    "$T2SZ" -o "$WORK/out_stdin.zst" -f - < <(cat "$WORK/junk.tar") 2>/dev/null || RC=$?
     if [ "$RC" -gt 128 ]; then
         log_fail "$TEST_NAME — stdin path killed by signal $(( RC - 128 ))"
         exit 1
@@ -532,7 +532,7 @@ stdin_explicit_stdout_raw)
     # Exercises the stdoutMode path when both input is stdin and output is explicit stdout.
     make_small_dat "$WORK/input.dat"
     sha_before=$(sha256_file "$WORK/input.dat")
-    "$T2SZ" -r -o - -f - < "$WORK/input.dat" > "$WORK/out.zst" 2>/dev/null || {
+    "$T2SZ" -r -o - -f - < <(cat "$WORK/input.dat") > "$WORK/out.zst" 2>/dev/null || {
         log_fail "$TEST_NAME — t2sz exited non-zero"
         exit 1
     }
@@ -551,7 +551,7 @@ stdin_explicit_stdout_raw)
 stdin_explicit_stdout_tar)
     # stdin tar mode with explicit -o - (not relying on default stdout).
     make_small_tar "$WORK/input.tar"
-    "$T2SZ" -o - -f - < "$WORK/input.tar" > "$WORK/out.zst" 2>/dev/null || {
+    "$T2SZ" -o - -f - < <(cat "$WORK/input.tar") > "$WORK/out.zst" 2>/dev/null || {
         log_fail "$TEST_NAME — t2sz exited non-zero"
         exit 1
     }
@@ -675,7 +675,7 @@ stdin_overwrite_no_force)
     make_small_dat "$WORK/input.dat"
     printf 'SENTINEL' > "$WORK/existing.zst"
     RC=0
-    "$T2SZ" -r -o "$WORK/existing.zst" - < "$WORK/input.dat" 2>"$WORK/stderr.txt" || RC=$?
+    "$T2SZ" -r -o "$WORK/existing.zst" - < <(cat "$WORK/input.dat") 2>"$WORK/stderr.txt" || RC=$?
     [ "$RC" -eq 1 ] || {
         log_fail "$TEST_NAME — expected exit 1, got $RC"
         exit 1
@@ -700,7 +700,7 @@ stdin_overwrite_force)
     # Must succeed, overwriting the file without prompting.
     make_small_dat "$WORK/input.dat"
     printf 'x' > "$WORK/existing.zst"
-    assert_exit 0  "$T2SZ" -r -f -o "$WORK/existing.zst" - < "$WORK/input.dat"
+    assert_exit 0  "$T2SZ" -r -f -o "$WORK/existing.zst" - < <(cat "$WORK/input.dat")
     # Verify a valid zstd file was written (larger than 1-byte placeholder).
     bytes=$(wc -c < "$WORK/existing.zst")
     [ $((bytes + 0)) -gt 1 ] || {
@@ -775,6 +775,1111 @@ garbage_suffix)
     log_pass "$TEST_NAME"
     ;;
 
+# ── Frame-parallel compression (-T) ─────────────────────────────────────────
+
+frame_pool_matches_serial)
+    # A tar with 200 small members and one 40 MB member, compressed with
+    # -T 4: the small frames go through the FramePool workers, the big one
+    # (> POOL_MAX_FRAME_SIZE) is compressed inline by the writer. The frame
+    # boundaries must be identical to a serial run and the output must
+    # round-trip.
+    mkdir -p "$WORK/content"
+    for i in $(seq 1 200); do
+        printf 'member %d of the frame pool test\n' "$i" > "$WORK/content/small_$i.txt"
+    done
+    head -c 41943040 /dev/urandom > "$WORK/content/big.bin"
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    assert_exit 0  "$T2SZ" -o "$WORK/serial.zst" -f "$WORK/archive.tar"
+    assert_exit 0  "$T2SZ" -T 4 -o "$WORK/pool.zst" -f "$WORK/archive.tar"
+    if [ "$(seek_table_dsizes "$WORK/serial.zst")" != "$(seek_table_dsizes "$WORK/pool.zst")" ]; then
+        log_fail "$TEST_NAME — frame boundaries differ between -T 4 and serial"
+        exit 1
+    fi
+    zstd -d -f -q "$WORK/pool.zst" -o "$WORK/dec.tar" || {
+        log_fail "$TEST_NAME — decompression failed"
+        exit 1
+    }
+    cmp -s "$WORK/archive.tar" "$WORK/dec.tar" || {
+        log_fail "$TEST_NAME — decompressed tar differs from the input"
+        exit 1
+    }
+    log_pass "$TEST_NAME"
+    ;;
+
+stdin_pipeline_matches_serial)
+    # Same archive shape as frame_pool_matches_serial, piped through stdin
+    # with -T 4: a reader thread assembles frames for the pool, and the
+    # 40 MB member is streamed to the writer in inline chunks. Frame
+    # boundaries must match the serial stdin path.
+    mkdir -p "$WORK/content"
+    for i in $(seq 1 200); do
+        printf 'member %d of the stdin pipeline test\n' "$i" > "$WORK/content/small_$i.txt"
+    done
+    head -c 41943040 /dev/urandom > "$WORK/content/big.bin"
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    assert_exit 0  "$T2SZ" -o "$WORK/serial.zst" -f - < <(cat "$WORK/archive.tar")
+    assert_exit 0  "$T2SZ" -T 4 -o "$WORK/pipe.zst" -f - < <(cat "$WORK/archive.tar")
+    if [ "$(seek_table_dsizes "$WORK/serial.zst")" != "$(seek_table_dsizes "$WORK/pipe.zst")" ]; then
+        log_fail "$TEST_NAME — frame boundaries differ between -T 4 and serial"
+        exit 1
+    fi
+    zstd -d -f -q "$WORK/pipe.zst" -o "$WORK/dec.tar" || {
+        log_fail "$TEST_NAME — decompression failed"
+        exit 1
+    }
+    cmp -s "$WORK/archive.tar" "$WORK/dec.tar" || {
+        log_fail "$TEST_NAME — decompressed tar differs from the input"
+        exit 1
+    }
+    log_pass "$TEST_NAME"
+    ;;
+
+noseek_tar)
+    # -j in tar mode: no seek table is written, but the frames are still
+    # counted, so the "No tar entries found" check must not fire.
+    make_small_tar "$WORK/input.tar"
+    assert_exit 0  "$T2SZ" -j -o "$WORK/out.zst" -f "$WORK/input.tar"
+    verify_no_seek_table "$WORK/out.zst" || exit 1
+    assert_exit 0  "$T2SZ" -j -o "$WORK/out_stdin.zst" -f - < <(cat "$WORK/input.tar")
+    verify_no_seek_table "$WORK/out_stdin.zst" || exit 1
+    zstd -t -q "$WORK/out.zst" "$WORK/out_stdin.zst" 2>/dev/null || {
+        log_fail "$TEST_NAME — output is not valid zstd"
+        exit 1
+    }
+    log_pass "$TEST_NAME"
+    ;;
+
+plan_matches_output)
+    # --plan must describe exactly the frames the compressor produces, in
+    # tar mode with -s/-S and in raw mode, without creating any output.
+    mkdir -p "$WORK/content"
+    for i in $(seq 1 30); do
+        head -c $(( i * 3000 )) /dev/urandom > "$WORK/content/file_$i.bin"
+    done
+    head -c 3000000 /dev/urandom > "$WORK/content/big.bin"
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+
+    for args in "-s 64k -S 1M" "-S 256k" "-r -s 100k"; do
+        # shellcheck disable=SC2086
+        "$T2SZ" --plan $args -o "$WORK/plan_only.zst" "$WORK/archive.tar" > "$WORK/plan.txt" || {
+            log_fail "$TEST_NAME — --plan $args failed"
+            exit 1
+        }
+        if [ -e "$WORK/plan_only.zst" ]; then
+            log_fail "$TEST_NAME — --plan $args created an output file"
+            exit 1
+        fi
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $args -o "$WORK/out.zst" -f "$WORK/archive.tar"
+        if [ "$(grep -v '^#' "$WORK/plan.txt" | cut -f3)" != "$(seek_table_dsizes "$WORK/out.zst")" ]; then
+            log_fail "$TEST_NAME — plan for '$args' differs from the compressed frames"
+            exit 1
+        fi
+        log_step "plan for '$args' matches $(grep -vc '^#' "$WORK/plan.txt") frames"
+    done
+
+    # Planning needs a seekable input.
+    assert_exit 1  "$T2SZ" --plan - < <(cat "$WORK/archive.tar")
+    log_pass "$TEST_NAME"
+    ;;
+
+dict_roundtrip)
+    # -D trains a dictionary from many small, similar members, stores it in
+    # a skippable frame at offset 0 (seek table entry with size 0) and
+    # compresses every frame with it. The result must be smaller than the
+    # plain archive, decompress with zstd -D, and not depend on -T.
+    mkdir -p "$WORK/content"
+    for i in $(seq 1 400); do
+        printf '{"id": %d, "name": "user%d", "email": "user%d@example.com", "roles": ["reader", "writer"]}\n' \
+            "$i" "$i" "$i" > "$WORK/content/user_$i.json"
+    done
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    assert_exit 0  "$T2SZ" -o "$WORK/plain.zst" -f "$WORK/archive.tar"
+    assert_exit 0  "$T2SZ" -D 16k -o "$WORK/dict.zst" -f "$WORK/archive.tar"
+    assert_exit 0  "$T2SZ" -D 16k -T 4 -o "$WORK/dict_t4.zst" -f "$WORK/archive.tar"
+
+    extract_dict "$WORK/dict.zst" "$WORK/dict.bin" || {
+        log_fail "$TEST_NAME — no dictionary frame at the head of the archive"
+        exit 1
+    }
+    if [ "$(seek_table_dsizes "$WORK/dict.zst" | head -n 1)" != "0" ]; then
+        log_fail "$TEST_NAME — dictionary frame not recorded first in the seek table"
+        exit 1
+    fi
+    if [ "$(seek_table_dsizes "$WORK/dict.zst" | tail -n +2)" != "$(seek_table_dsizes "$WORK/plain.zst")" ]; then
+        log_fail "$TEST_NAME — frame boundaries changed with -D"
+        exit 1
+    fi
+    PLAIN_SIZE=$(wc -c < "$WORK/plain.zst")
+    DICT_SIZE=$(wc -c < "$WORK/dict.zst")
+    if [ "$DICT_SIZE" -ge "$PLAIN_SIZE" ]; then
+        log_fail "$TEST_NAME — -D output ($DICT_SIZE) not smaller than plain ($PLAIN_SIZE)"
+        exit 1
+    fi
+    log_step "plain $PLAIN_SIZE bytes, with dictionary $DICT_SIZE bytes"
+
+    cmp -s "$WORK/dict.zst" "$WORK/dict_t4.zst" || {
+        log_fail "$TEST_NAME — -T 4 output differs from serial"
+        exit 1
+    }
+    zstd -d -q -D "$WORK/dict.bin" -c "$WORK/dict.zst" > "$WORK/dec.tar" || {
+        log_fail "$TEST_NAME — zstd -D could not decompress"
+        exit 1
+    }
+    cmp -s "$WORK/archive.tar" "$WORK/dec.tar" || {
+        log_fail "$TEST_NAME — decompressed tar differs from the input"
+        exit 1
+    }
+
+    # Training needs the whole input up front, and a sane dictionary size.
+    assert_exit 1  "$T2SZ" -D 16k -o "$WORK/stdin.zst" -f - < <(cat "$WORK/archive.tar")
+    assert_exit 1  "$T2SZ" -D 100 -o "$WORK/small.zst" -f "$WORK/archive.tar"
+    log_pass "$TEST_NAME"
+    ;;
+
+extract_member)
+    # -x decompresses a single member through the seek table. Members must
+    # come out byte-identical whatever the framing (-s aggregation, -S
+    # splitting, -D dictionary, -T), including long names stored in GNU or
+    # PAX extension headers.
+    LONG=$(printf 'd%.0s' $(seq 1 60))
+    mkdir -p "$WORK/content/sub" "$WORK/content/$LONG/$LONG"
+    for i in $(seq 1 50); do
+        printf 'member %d\n' "$i" > "$WORK/content/sub/file_$i.txt"
+    done
+    head -c 3000000 /dev/urandom > "$WORK/content/big.bin"
+    printf 'deep\n' > "$WORK/content/$LONG/$LONG/long_name.txt"
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+
+    for args in "" "-s 64k" "-S 256k" "-s 100k -S 1M -T 4" "-D 4k"; do
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $args -o "$WORK/out.zst" -f "$WORK/archive.tar"
+        for m in sub/file_1.txt ./sub/file_50.txt big.bin "$LONG/$LONG/long_name.txt"; do
+            "$T2SZ" -x "$m" "$WORK/out.zst" > "$WORK/member" || {
+                log_fail "$TEST_NAME — -x $m failed with '$args'"
+                exit 1
+            }
+            cmp -s "$WORK/member" "$WORK/content/${m#./}" || {
+                log_fail "$TEST_NAME — -x $m differs from the original with '$args'"
+                exit 1
+            }
+        done
+        log_step "members extracted from archive built with '$args'"
+    done
+
+    # -o writes to a file instead of stdout.
+    assert_exit 0  "$T2SZ" -x big.bin -o "$WORK/big.out" -f "$WORK/out.zst"
+    cmp -s "$WORK/big.out" "$WORK/content/big.bin" || {
+        log_fail "$TEST_NAME — -x -o output differs"
+        exit 1
+    }
+
+    # Missing members, directories and archives without a seek table fail.
+    assert_exit 1  "$T2SZ" -x missing.txt "$WORK/out.zst"
+    assert_exit 1  "$T2SZ" -x sub "$WORK/out.zst"
+    assert_exit 0  "$T2SZ" -j -o "$WORK/noseek.zst" -f "$WORK/archive.tar"
+    assert_exit 1  "$T2SZ" -x big.bin "$WORK/noseek.zst"
+    assert_exit 1  "$T2SZ" -x big.bin - < <(cat "$WORK/out.zst")
+    log_pass "$TEST_NAME"
+    ;;
+
+member_index)
+    # -i writes a name-sorted member index right before the seek table, on
+    # both the mmap and the stdin path. -x must resolve members through it,
+    # including long names and members split across frames.
+    LONG=$(printf 'd%.0s' $(seq 1 60))
+    mkdir -p "$WORK/content/sub" "$WORK/content/$LONG/$LONG"
+    for i in $(seq 1 50); do
+        printf 'member %d\n' "$i" > "$WORK/content/sub/file_$i.txt"
+    done
+    head -c 3000000 /dev/urandom > "$WORK/content/big.bin"
+    printf 'deep\n' > "$WORK/content/$LONG/$LONG/long_name.txt"
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    MEMBERS=$(tar tf "$WORK/archive.tar" | wc -l | tr -d ' ')
+
+    assert_exit 0  "$T2SZ" -i -o "$WORK/mmap.zst" -f "$WORK/archive.tar"
+    assert_exit 0  "$T2SZ" -i -S 256k -D 4k -o "$WORK/split.zst" -f "$WORK/archive.tar"
+    assert_exit 0  "$T2SZ" -i -s 64k -o "$WORK/stdin.zst" -f - < <(cat "$WORK/archive.tar")
+    assert_exit 0  "$T2SZ" -i -T 4 -o "$WORK/stdin_t4.zst" -f - < <(cat "$WORK/archive.tar")
+
+    for f in mmap split stdin stdin_t4; do
+        N=$(index_members "$WORK/$f.zst") || {
+            log_fail "$TEST_NAME — no member index in $f.zst"
+            exit 1
+        }
+        if [ "$N" -ne "$MEMBERS" ]; then
+            log_fail "$TEST_NAME — $f.zst indexes $N members, expected $MEMBERS"
+            exit 1
+        fi
+        for m in sub/file_1.txt ./sub/file_50.txt big.bin "$LONG/$LONG/long_name.txt"; do
+            "$T2SZ" -x "$m" "$WORK/$f.zst" > "$WORK/member" || {
+                log_fail "$TEST_NAME — -x $m failed on $f.zst"
+                exit 1
+            }
+            cmp -s "$WORK/member" "$WORK/content/${m#./}" || {
+                log_fail "$TEST_NAME — -x $m differs from the original on $f.zst"
+                exit 1
+            }
+        done
+        if [ "$f" != split ]; then
+            zstd -d -q -c "$WORK/$f.zst" | cmp -s - "$WORK/archive.tar" || {
+                log_fail "$TEST_NAME — $f.zst does not decompress to the input with zstd"
+                exit 1
+            }
+        fi
+        log_step "$f.zst: $N members indexed, lookups match"
+    done
+
+    assert_exit 1  "$T2SZ" -x missing.txt "$WORK/mmap.zst"
+    assert_exit 1  "$T2SZ" -x sub "$WORK/mmap.zst"
+    assert_exit 1  "$T2SZ" -i -r -o "$WORK/raw.zst" -f "$WORK/archive.tar"
+    log_pass "$TEST_NAME"
+    ;;
+
+io_uring_output)
+    # The io_uring writer must produce the same bytes as stdio, whether the
+    # output is larger than its buffer pool or not, on the mmap, stdin and
+    # -x paths. On systems without io_uring both runs use stdio. The random
+    # input stays incompressible, so its output outgrows the 8 MiB pool.
+    head -c 700000 /dev/urandom | od -An -tx1 > "$WORK/input.dat"
+    head -c 10000000 /dev/urandom > "$WORK/random.dat"
+    for args in "-r -s 1M -T 4" "-r -l 1" "-r -s 64k -j" "-r -s 1M -T 4 random"; do
+        IN="$WORK/input.dat"
+        case "$args" in *random) IN="$WORK/random.dat"; args="${args% random}" ;; esac
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $args -o "$WORK/uring.zst" -f "$IN"
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $args --no-io-uring -o "$WORK/stdio.zst" -f "$IN"
+        cmp -s "$WORK/uring.zst" "$WORK/stdio.zst" || {
+            log_fail "$TEST_NAME — io_uring and stdio outputs differ ($args, $(basename "$IN"))"
+            exit 1
+        }
+    done
+    [ "$(wc -c < "$WORK/uring.zst")" -gt 8388608 ] || { log_fail "$TEST_NAME — output smaller than the buffer pool"; exit 1; }
+    zstd -d -q -c "$WORK/uring.zst" | cmp -s - "$WORK/random.dat" || {
+        log_fail "$TEST_NAME — io_uring output does not decompress to the input"
+        exit 1
+    }
+    assert_exit 0  "$T2SZ" -r -s 256k -T 2 -o "$WORK/stdin.zst" -f - < <(cat "$WORK/input.dat")
+    zstd -d -q -c "$WORK/stdin.zst" | cmp -s - "$WORK/input.dat" || {
+        log_fail "$TEST_NAME — stdin input through io_uring does not round-trip"
+        exit 1
+    }
+
+    make_small_tar "$WORK/small.tar"
+    assert_exit 0  "$T2SZ" -o "$WORK/small.tar.zst" -f "$WORK/small.tar"
+    assert_exit 0  "$T2SZ" -x hello.txt -o "$WORK/member" -f "$WORK/small.tar.zst"
+    cmp -s "$WORK/member" "$WORK/hello.txt" || {
+        log_fail "$TEST_NAME — -x through io_uring differs from the member"
+        exit 1
+    }
+
+    # Write errors from asynchronous completions must still fail the run.
+    if ( trap '' XFSZ; ulimit -f 1000 ) 2>/dev/null; then
+        RC=0
+        ( trap '' XFSZ; ulimit -f 1000; "$T2SZ" -r -s 1M -o "$WORK/limited.zst" -f "$WORK/random.dat" ) 2>/dev/null || RC=$?
+        if [ "$RC" -ne 1 ]; then
+            log_fail "$TEST_NAME — exit $RC on a write error, expected 1"
+            exit 1
+        fi
+    fi
+    log_pass "$TEST_NAME"
+    ;;
+
+incompressible_fast_path)
+    # Frames of random data are sampled as incompressible and compressed at
+    # level 1; text frames keep the requested level. Both paths, serial and
+    # with the pool, must round-trip, and --compress-all disables the probe.
+    head -c 2097152 /dev/urandom > "$WORK/input.dat"
+    seq 1 400000 | head -c 2097152 >> "$WORK/input.dat"
+    for threads in 1 4; do
+        "$T2SZ" -r -l 9 -s 512k -T "$threads" -v -o "$WORK/fast.zst" -f "$WORK/input.dat" 2> "$WORK/fast.log" || {
+            log_fail "$TEST_NAME — compression failed (-T $threads)"
+            exit 1
+        }
+        grep -q "^# 4 incompressible frames compressed at level 1" "$WORK/fast.log" || {
+            log_fail "$TEST_NAME — expected 4 fast path frames (-T $threads)"
+            exit 1
+        }
+        zstd -d -q -c "$WORK/fast.zst" | cmp -s - "$WORK/input.dat" || {
+            log_fail "$TEST_NAME — fast path output does not round-trip (-T $threads)"
+            exit 1
+        }
+        "$T2SZ" -r -l 9 -s 512k -T "$threads" -v --compress-all -o "$WORK/all.zst" -f "$WORK/input.dat" 2> "$WORK/all.log" || {
+            log_fail "$TEST_NAME — compression failed with --compress-all (-T $threads)"
+            exit 1
+        }
+        if grep -q "incompressible" "$WORK/all.log"; then
+            log_fail "$TEST_NAME — --compress-all still used the fast path (-T $threads)"
+            exit 1
+        fi
+        zstd -d -q -c "$WORK/all.zst" | cmp -s - "$WORK/input.dat" || {
+            log_fail "$TEST_NAME — --compress-all output does not round-trip (-T $threads)"
+            exit 1
+        }
+    done
+    log_pass "$TEST_NAME"
+    ;;
+
+cdc_frames)
+    # --cdc cuts raw input by content: after an insertion at the start only
+    # the first frame changes, frames stay within -s/-S (default AVG/4 and
+    # AVG*4), and stdin finds the same cuts as a mapped file.
+    seq 1 500000 > "$WORK/v1.dat"
+    { echo "inserted line"; cat "$WORK/v1.dat"; } > "$WORK/v2.dat"
+    for v in 1 2; do
+        "$T2SZ" -r --cdc 64k --plan "$WORK/v$v.dat" > "$WORK/p$v" || {
+            log_fail "$TEST_NAME — --plan failed on v$v.dat"
+            exit 1
+        }
+    done
+    FRAMES=$(grep -c -v '^#' "$WORK/p1")
+    if [ "$FRAMES" -lt 10 ]; then
+        log_fail "$TEST_NAME — expected at least 10 frames, got $FRAMES"
+        exit 1
+    fi
+    if ! cmp -s <(awk '!/^#/ && $1 > 0 {print $3}' "$WORK/p1") <(awk '!/^#/ && $1 > 0 {print $3}' "$WORK/p2"); then
+        log_fail "$TEST_NAME — an insertion at the start changed later frames"
+        exit 1
+    fi
+    if awk -v last="$((FRAMES - 1))" '!/^#/ && $1 < last && ($3 < 16384 || $3 > 262144)' "$WORK/p1" | grep -q .; then
+        log_fail "$TEST_NAME — frame size outside [AVG/4, AVG*4]"
+        exit 1
+    fi
+
+    assert_exit 0  "$T2SZ" -r --cdc 64k -o "$WORK/file.zst" -f "$WORK/v1.dat"
+    assert_exit 0  "$T2SZ" -r --cdc 64k -o "$WORK/stdin.zst" -f - < <(cat "$WORK/v1.dat")
+    cmp -s "$WORK/file.zst" "$WORK/stdin.zst" || {
+        log_fail "$TEST_NAME — stdin and file inputs give different frames"
+        exit 1
+    }
+    verify_seek_table "$WORK/file.zst" "$FRAMES" || exit 1
+    assert_exit 0  "$T2SZ" -r --cdc 64k -s 8k -S 1M -T 4 -o "$WORK/mt.zst" -f - < <(cat "$WORK/v2.dat")
+    zstd -d -q -c "$WORK/mt.zst" | cmp -s - "$WORK/v2.dat" || {
+        log_fail "$TEST_NAME — multi-threaded --cdc output does not round-trip"
+        exit 1
+    }
+
+    make_small_tar "$WORK/small.tar"
+    assert_exit 1  "$T2SZ" --cdc 64k -o "$WORK/tar.zst" -f "$WORK/small.tar"
+    assert_exit 1  "$T2SZ" -r --cdc 64k -s 128k -o "$WORK/bad.zst" -f "$WORK/v1.dat"
+    assert_exit 1  "$T2SZ" -r --cdc 100 -o "$WORK/bad.zst" -f "$WORK/v1.dat"
+    log_pass "$TEST_NAME"
+    ;;
+
+append_members)
+    # -a adds the members of a tar to an archive in place: the result lists
+    # old and new members, plain, -i and -D archives keep working with -x,
+    # and a failed append leaves the archive byte for byte as it was.
+    mkdir -p "$WORK/old" "$WORK/new"
+    for i in $(seq 1 40); do
+        echo "old member $i, some shared text to train a dictionary on" > "$WORK/old/o$i.txt"
+        echo "new member $i, some shared text to train a dictionary on" > "$WORK/new/n$i.txt"
+    done
+    tar cf "$WORK/old.tar" -C "$WORK" old
+    tar cf "$WORK/new.tar" -C "$WORK" new
+    tar cf "$WORK/both.tar" -C "$WORK" old new
+    for flags in "" "-s 4k" "-i" "-D 2k" "-i -s 4k -T 4"; do
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/a.tar.zst" -f "$WORK/old.tar"
+        assert_exit 0  "$T2SZ" -a "$WORK/a.tar.zst" "$WORK/new.tar"
+        for m in old/o7.txt new/n40.txt; do
+            "$T2SZ" -x "$m" "$WORK/a.tar.zst" | cmp -s - "$WORK/$m" || {
+                log_fail "$TEST_NAME — '$m' not extracted after append [$flags]"
+                exit 1
+            }
+        done
+        # Appending again, from stdin, adds the members a second time.
+        assert_exit 0  "$T2SZ" -a "$WORK/a.tar.zst" - < <(cat "$WORK/new.tar")
+        if [ -z "$flags" ]; then
+            zstd -d -q -c "$WORK/a.tar.zst" > "$WORK/a.tar"
+            if [ "$(tar tf "$WORK/a.tar" | sort | uniq -c | awk '$1 == 2' | wc -l)" -ne 41 ] ||
+               [ "$(tar tf "$WORK/a.tar" | wc -l)" -ne 123 ]; then
+                log_fail "$TEST_NAME — wrong member list after two appends"
+                exit 1
+            fi
+        fi
+    done
+
+    # Same members as one tar of both (the record padding may differ).
+    assert_exit 0  "$T2SZ" -o "$WORK/a.tar.zst" -f "$WORK/old.tar"
+    assert_exit 0  "$T2SZ" -a "$WORK/a.tar.zst" "$WORK/new.tar"
+    zstd -d -q -c "$WORK/a.tar.zst" | tar tvf - | cmp -s - <(tar tvf "$WORK/both.tar") || {
+        log_fail "$TEST_NAME — appended archive differs from compressing both at once"
+        exit 1
+    }
+
+    cp "$WORK/a.tar.zst" "$WORK/backup.zst"
+    head -c 3000 "$WORK/new.tar" > "$WORK/bad.tar"
+    head -c 2000 /dev/zero | tr '\0' 'x' >> "$WORK/bad.tar"
+    assert_exit 1  "$T2SZ" -a "$WORK/a.tar.zst" "$WORK/bad.tar"
+    cmp -s "$WORK/a.tar.zst" "$WORK/backup.zst" || {
+        log_fail "$TEST_NAME — failed append modified the archive"
+        exit 1
+    }
+    assert_exit 1  "$T2SZ" -a "$WORK/a.tar.zst" -o "$WORK/x.zst" "$WORK/new.tar"
+    assert_exit 1  "$T2SZ" -a "$WORK/a.tar.zst" -i "$WORK/new.tar"
+    assert_exit 1  "$T2SZ" -a "$WORK/a.tar.zst" -r "$WORK/new.tar"
+    assert_exit 1  "$T2SZ" -a "$WORK/old.tar" "$WORK/new.tar"
+    assert_exit 0  "$T2SZ" -j -o "$WORK/noseek.zst" -f "$WORK/old.tar"
+    assert_exit 1  "$T2SZ" -a "$WORK/noseek.zst" "$WORK/new.tar"
+    log_pass "$TEST_NAME"
+    ;;
+
+checkpoint_resume)
+    # A run that dies half way (here: the file size limit makes a write
+    # fail) leaves OUTPUT.ckpt; --resume then cuts the output after the
+    # last saved frame and produces the same bytes as an uninterrupted run.
+    # The checkpoint must match the input and the options.
+    mkdir -p "$WORK/data"
+    for i in $(seq 1 24); do
+        seq $((i * 1000)) $((i * 1000 + 30000)) > "$WORK/data/f$i"
+    done
+    tar cf "$WORK/in.tar" -C "$WORK" data
+    for flags in "-s 16k" "-i -T 4"; do
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/ref.zst" -f "$WORK/in.tar"
+        LIMIT=$(( $(wc -c < "$WORK/ref.zst") / 2048 ))
+        # shellcheck disable=SC2086
+        run bash -c 'ulimit -f "$1"; trap "" XFSZ; shift; exec "$@"' _ "$LIMIT" \
+            "$T2SZ" $flags --no-io-uring --checkpoint 0 -o "$WORK/out.zst" -f "$WORK/in.tar"
+        assert_rc 1
+        if [ ! -s "$WORK/out.zst.ckpt" ]; then
+            log_fail "$TEST_NAME — no checkpoint left by the interrupted run [$flags]"
+            exit 1
+        fi
+        # shellcheck disable=SC2086
+        assert_exit 1  "$T2SZ" $flags -l 9 --resume -o "$WORK/out.zst" "$WORK/in.tar"
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags --resume -o "$WORK/out.zst" "$WORK/in.tar"
+        cmp -s "$WORK/out.zst" "$WORK/ref.zst" || {
+            log_fail "$TEST_NAME — resumed output differs from an uninterrupted run [$flags]"
+            exit 1
+        }
+        if [ -e "$WORK/out.zst.ckpt" ]; then
+            log_fail "$TEST_NAME — checkpoint not removed after success [$flags]"
+            exit 1
+        fi
+    done
+
+    # The same layout with other data in the part already written is
+    # another input (the last line of the first member changes: frames are
+    # sampled at both ends).
+    run bash -c 'ulimit -f "$1"; trap "" XFSZ; shift; exec "$@"' _ "$LIMIT" \
+        "$T2SZ" --no-io-uring --checkpoint 0 -o "$WORK/out.zst" -f "$WORK/in.tar"
+    assert_rc 1
+    FIRST=$(tar tf "$WORK/in.tar" | grep -v '/$' | head -n 1)
+    sed '$ s/^./9/' "$WORK/$FIRST" > "$WORK/edited" && mv "$WORK/edited" "$WORK/$FIRST"
+    tar cf "$WORK/in.tar" -C "$WORK" data
+    assert_exit 1  "$T2SZ" --resume -o "$WORK/out.zst" "$WORK/in.tar"
+
+    # No checkpoint: --resume starts from the beginning.
+    rm -f "$WORK/out.zst.ckpt"
+    assert_exit 0  "$T2SZ" --resume -o "$WORK/out.zst" -f "$WORK/in.tar"
+    zstd -d -q -c "$WORK/out.zst" | cmp -s - "$WORK/in.tar" || {
+        log_fail "$TEST_NAME — --resume without a checkpoint does not round-trip"
+        exit 1
+    }
+    assert_exit 1  "$T2SZ" --checkpoint 0 -o - "$WORK/in.tar"
+    assert_exit 1  "$T2SZ" --checkpoint 0 -o "$WORK/x.zst" - < <(cat "$WORK/in.tar")
+    assert_exit 1  "$T2SZ" --resume -x data/f1 "$WORK/out.zst"
+    assert_exit 1  "$T2SZ" --checkpoint -1 -o "$WORK/x.zst" "$WORK/in.tar"
+    log_pass "$TEST_NAME"
+    ;;
+
+zstd_input)
+    # A .tar.zst input is decompressed in-process and reframed: the output
+    # is seekable, round-trips to the original tar and works with -x, from
+    # a file or stdin, serial or -T 4. Seekable -D archives can be reframed
+    # too; corrupted and truncated inputs fail. More than the 4 MiB decoder
+    # ring is decompressed, so the decoder waits for the reader.
+    mkdir -p "$WORK/data"
+    for i in $(seq 1 24); do
+        head -c 262144 /dev/urandom | base64 > "$WORK/data/f$i"
+        echo "member $i, some shared text to train a dictionary on" > "$WORK/data/s$i.txt"
+    done
+    tar cf "$WORK/in.tar" -C "$WORK" data
+    zstd -q -c "$WORK/in.tar" > "$WORK/in.tar.zst"
+    for flags in "" "-s 64k" "-s 64k -T 4"; do
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/out.tar.zst" -f "$WORK/in.tar.zst"
+        zstd -d -q -c "$WORK/out.tar.zst" | cmp -s - "$WORK/in.tar" || {
+            log_fail "$TEST_NAME — reframed archive does not round-trip [$flags]"
+            exit 1
+        }
+        "$T2SZ" -x data/s7.txt "$WORK/out.tar.zst" | cmp -s - "$WORK/data/s7.txt" || {
+            log_fail "$TEST_NAME — member not extracted from reframed archive [$flags]"
+            exit 1
+        }
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/stdin.tar.zst" -f - < <(cat "$WORK/in.tar.zst")
+        cmp -s "$WORK/stdin.tar.zst" "$WORK/out.tar.zst" || {
+            log_fail "$TEST_NAME — stdin and file inputs give different archives [$flags]"
+            exit 1
+        }
+    done
+
+    # The dictionary frame of a -D archive is loaded, not compressed.
+    assert_exit 0  "$T2SZ" -D 2k -i -s 16k -o "$WORK/dict.tar.zst" -f "$WORK/in.tar"
+    assert_exit 0  "$T2SZ" -o "$WORK/re.tar.zst" -f "$WORK/dict.tar.zst"
+    zstd -d -q -c "$WORK/re.tar.zst" | cmp -s - "$WORK/in.tar" || {
+        log_fail "$TEST_NAME — reframed -D archive does not round-trip"
+        exit 1
+    }
+
+    # Raw mode decompresses too, --no-decompress keeps the old behaviour.
+    assert_exit 0  "$T2SZ" -r -s 1M -o "$WORK/raw.zst" -f "$WORK/in.tar.zst"
+    zstd -d -q -c "$WORK/raw.zst" | cmp -s - "$WORK/in.tar" || {
+        log_fail "$TEST_NAME — raw mode output does not round-trip"
+        exit 1
+    }
+    assert_exit 0  "$T2SZ" --no-decompress -o "$WORK/raw.zst" -f "$WORK/in.tar.zst"
+    zstd -d -q -c "$WORK/raw.zst" | cmp -s - "$WORK/in.tar.zst" || {
+        log_fail "$TEST_NAME — --no-decompress output does not round-trip"
+        exit 1
+    }
+
+    SIZE=$(wc -c < "$WORK/in.tar.zst")
+    head -c $((SIZE / 2)) "$WORK/in.tar.zst" > "$WORK/cut.tar.zst"
+    assert_exit 1  "$T2SZ" -o "$WORK/x.zst" -f "$WORK/cut.tar.zst"
+    assert_exit 1  "$T2SZ" -o "$WORK/x.zst" -f - < <(cat "$WORK/cut.tar.zst")
+    cp "$WORK/in.tar.zst" "$WORK/bad.tar.zst"
+    printf 'corrupted' | dd of="$WORK/bad.tar.zst" bs=1 seek=$((SIZE / 2)) conv=notrunc 2>/dev/null
+    assert_exit 1  "$T2SZ" -o "$WORK/x.zst" -f "$WORK/bad.tar.zst"
+    assert_exit 1  "$T2SZ" -D 2k -o "$WORK/x.zst" -f "$WORK/in.tar.zst"
+    assert_exit 1  "$T2SZ" --plan "$WORK/in.tar.zst"
+    assert_exit 1  "$T2SZ" --checkpoint 0 -o "$WORK/x.zst" -f "$WORK/in.tar.zst"
+    log_pass "$TEST_NAME"
+    ;;
+
+stats_json)
+    # --stats writes one entry per data frame, matching the seek table, whose
+    # input sizes add up to the input; the totals, the histogram and the
+    # memory figures are there, for the mmap and the pipelined stdin paths.
+    # Warnings of the library are listed, and printed once on stderr.
+    head -c 1000000 /dev/urandom > "$WORK/input.bin"
+    for src in file stdin; do
+        if [ "$src" = file ]; then
+            assert_exit 0  "$T2SZ" -r -s 100k --stats "$WORK/stats.json" -o "$WORK/out.zst" -f "$WORK/input.bin"
+        else
+            assert_exit 0  "$T2SZ" -r -s 100k -T 2 --stats="$WORK/stats.json" -o "$WORK/out.zst" -f - < <(cat "$WORK/input.bin")
+        fi
+        SIZE=$(wc -c < "$WORK/out.zst")
+        FRAMES=$(read_le32 "$WORK/out.zst" $(( SIZE - 9 )))
+        if [ "$(grep -c '"compress_seconds"' "$WORK/stats.json")" -ne "$FRAMES" ] ||
+           [ "$(grep -o '"input_bytes": [0-9]*, "output_bytes"' "$WORK/stats.json" |
+                awk '{ s += $2 } END { print s }')" -ne 1000000 ]; then
+            log_fail "$TEST_NAME — frames do not match the seek table [$src]"
+            exit 1
+        fi
+        for key in '"output_bytes": '"$SIZE"',' '"compression": ' '"headers": ' '"zstd_bytes": [1-9]' \
+                   '"ratio_histogram": ' '"warnings": \[\]' '"source": "'"${src/file/mmap}"'"'; do
+            grep -q "$key" "$WORK/stats.json" || {
+                log_fail "$TEST_NAME — missing $key [$src]"
+                exit 1
+            }
+        done
+    done
+    head -c 2048 "$WORK/input.bin" > "$WORK/small.bin"
+    assert_exit 0  "$T2SZ" -r -s 512 -D 4k --stats "$WORK/stats.json" -o "$WORK/out.zst" -f "$WORK/small.bin" 2> "$WORK/err.txt"
+    grep -q '"warnings": \["Unable to train a dictionary' "$WORK/stats.json" &&
+        [ "$(grep -c '^Warning: Unable to train a dictionary' "$WORK/err.txt")" -eq 1 ] || {
+        log_fail "$TEST_NAME — dictionary warning not reported: $(cat "$WORK/err.txt")"
+        exit 1
+    }
+    assert_exit 1  "$T2SZ" --stats "$WORK/stats.json" --plan "$WORK/input.bin"
+    assert_exit 1  "$T2SZ" -r --stats "$WORK/nodir/stats.json" -o "$WORK/out.zst" -f "$WORK/input.bin"
+    log_pass "$TEST_NAME"
+    ;;
+
+progress)
+    # --progress ends with a summary line on stderr, for an input file and
+    # for stdin, and leaves the archive as it is without it.
+    head -c 300000 /dev/urandom > "$WORK/input.bin"
+    assert_exit 0  "$T2SZ" -r -s 64k -o "$WORK/plain.zst" -f "$WORK/input.bin"
+    assert_exit 0  "$T2SZ" -r -s 64k --progress -o "$WORK/out.zst" -f "$WORK/input.bin" 2> "$WORK/err.txt"
+    cmp -s "$WORK/plain.zst" "$WORK/out.zst" || { log_fail "$TEST_NAME — output differs"; exit 1; }
+    grep -q '^293.0 KiB -> .*, ratio .*MB/s, .* s$' "$WORK/err.txt" || {
+        log_fail "$TEST_NAME — no summary line: $(cat "$WORK/err.txt")"
+        exit 1
+    }
+    assert_exit 0  "$T2SZ" -r -s 64k -T 2 --progress -o "$WORK/out.zst" -f - < <(cat "$WORK/input.bin") 2> "$WORK/err.txt"
+    grep -q '^293.0 KiB -> ' "$WORK/err.txt" || { log_fail "$TEST_NAME — no summary line [stdin]"; exit 1; }
+    assert_exit 1  "$T2SZ" --progress --plan "$WORK/input.bin"
+    log_pass "$TEST_NAME"
+    ;;
+
+auto_block)
+    # --auto-block picks the block sizes by trial compression: read=SIZE
+    # bounds every frame, ratio=100 accepts the smallest candidate; the
+    # choice shows in --stats and in --plan. Given with -s, on stdin or
+    # with an invalid goal it is rejected.
+    seq 1 400000 > "$WORK/input.txt"
+    assert_exit 0  "$T2SZ" -r --auto-block read=64k --stats "$WORK/stats.json" -o "$WORK/out.zst" -f "$WORK/input.txt"
+    if [ "$(seek_table_dsizes "$WORK/out.zst" | awk '$1 > 65536' | wc -l)" -ne 0 ]; then
+        log_fail "$TEST_NAME — a frame exceeds read=64k"
+        exit 1
+    fi
+    grep -q '"block_size": {"min": [0-9]*, "max": 0, "auto": {"sample_bytes": [1-9]' "$WORK/stats.json" || {
+        log_fail "$TEST_NAME — no auto block size in the stats"
+        exit 1
+    }
+    assert_exit 0  "$T2SZ" -r --auto-block ratio=100 --stats "$WORK/stats.json" -o "$WORK/out.zst" -f "$WORK/input.txt"
+    grep -q '"block_size": {"min": 16384, ' "$WORK/stats.json" || {
+        log_fail "$TEST_NAME — ratio=100 did not pick the smallest frames"
+        exit 1
+    }
+    assert_exit 0  "$T2SZ" -r --auto-block read=4k,ratio=100 -o "$WORK/out.zst" -f "$WORK/input.txt"
+    if [ "$(seek_table_dsizes "$WORK/out.zst" | sort -u | head -1)" -gt 4096 ]; then
+        log_fail "$TEST_NAME — read=4k not honoured"
+        exit 1
+    fi
+    assert_exit 0  "$T2SZ" -r --auto-block read=64k --plan "$WORK/input.txt"
+    assert_exit 1  "$T2SZ" -r --auto-block read=64k -s 1M -o "$WORK/out.zst" -f "$WORK/input.txt"
+    assert_exit 1  "$T2SZ" -r --auto-block read=64k -o "$WORK/out.zst" -f - < <(cat "$WORK/input.txt")
+    assert_exit 1  "$T2SZ" -r --auto-block size=64k -o "$WORK/out.zst" -f "$WORK/input.txt"
+    assert_exit 1  "$T2SZ" -r --auto-block ratio=0 -o "$WORK/out.zst" -f "$WORK/input.txt"
+    log_pass "$TEST_NAME"
+    ;;
+
+test_archive)
+    # -t checks every frame of the seek table in parallel: a -D -i archive
+    # passes; a corrupted payload byte (checksum), a wrong decompressed size
+    # in the seek table, an archive without seek table, stdin and -o fail.
+    mkdir -p "$WORK/content"
+    for i in $(seq 1 200); do
+        printf '{"id": %d, "name": "user%d"}\n' "$i" "$i" > "$WORK/content/user_$i.json"
+    done
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    assert_exit 0  "$T2SZ" -D 4k -i -o "$WORK/dict.zst" -f "$WORK/archive.tar"
+    assert_exit 0  "$T2SZ" -t -T 4 "$WORK/dict.zst"
+    assert_exit 0  "$T2SZ" --test "$WORK/dict.zst"
+
+    head -c 1000000 /dev/urandom > "$WORK/input.bin"
+    assert_exit 0  "$T2SZ" -r -s 64k -o "$WORK/out.zst" -f "$WORK/input.bin"
+    "$T2SZ" -t -T 3 "$WORK/out.zst" > "$WORK/stdout.txt" || { log_fail "$TEST_NAME — valid archive rejected"; exit 1; }
+    grep -q ": OK, 16 frames, [0-9]* -> 1000000 bytes" "$WORK/stdout.txt" || {
+        log_fail "$TEST_NAME — unexpected summary: $(cat "$WORK/stdout.txt")"
+        exit 1
+    }
+    cp "$WORK/out.zst" "$WORK/bad.zst"
+    printf '\x5a' | dd of="$WORK/bad.zst" bs=1 seek=500000 conv=notrunc 2>/dev/null
+    assert_exit 1  "$T2SZ" -t -T 4 "$WORK/bad.zst"
+    SIZE=$(wc -c < "$WORK/out.zst")
+    cp "$WORK/out.zst" "$WORK/bad.zst"
+    printf '\x01' | dd of="$WORK/bad.zst" bs=1 seek=$(( SIZE - 9 - 16 * 8 + 4 )) conv=notrunc 2>/dev/null
+    RC=0
+    "$T2SZ" -t "$WORK/bad.zst" 2>"$WORK/stderr.txt" || RC=$?
+    assert_rc 1
+    grep -q "Frame 0 at offset 0: 65536 decompressed bytes, the seek table says 65537" "$WORK/stderr.txt" || {
+        log_fail "$TEST_NAME — size mismatch not reported"
+        cat "$WORK/stderr.txt" >&2
+        exit 1
+    }
+
+    assert_exit 0  "$T2SZ" -r -j -s 64k -o "$WORK/noseek.zst" -f "$WORK/input.bin"
+    assert_exit 1  "$T2SZ" -t "$WORK/noseek.zst"
+    assert_exit 1  "$T2SZ" -t - < <(cat "$WORK/out.zst")
+    assert_exit 1  "$T2SZ" -t -o "$WORK/x" "$WORK/out.zst"
+    log_pass "$TEST_NAME"
+    ;;
+
+verify)
+    # --verify leaves the archive byte for byte as it is without it, on the
+    # mmap and stdin paths, serial and pooled, with -D -i and when appending;
+    # -v counts the frames checked and --stats times them; it can't be
+    # combined with -x, -t or --plan.
+    mkdir -p "$WORK/content"
+    for i in $(seq 1 100); do
+        printf '{"id": %d, "name": "user%d"}\n' "$i" "$i" > "$WORK/content/user_$i.json"
+    done
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    for flags in "-s 8k" "-s 8k -T 3" "-D 4k -i" "-D 4k -i -T 2"; do
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/plain.zst" -f "$WORK/archive.tar"
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags --verify -o "$WORK/out.zst" -f "$WORK/archive.tar"
+        cmp -s "$WORK/plain.zst" "$WORK/out.zst" || { log_fail "$TEST_NAME — output differs [$flags]"; exit 1; }
+    done
+    head -c 1000000 /dev/urandom | od -An -tx1 > "$WORK/input.txt"
+    for threads in 1 3; do
+        assert_exit 0  "$T2SZ" -r -s 64k -T $threads -o "$WORK/plain.zst" -f - < <(cat "$WORK/input.txt")
+        assert_exit 0  "$T2SZ" -r -s 64k -T $threads --verify -v -o "$WORK/out.zst" -f - \
+                           < <(cat "$WORK/input.txt") 2> "$WORK/err.txt"
+        cmp -s "$WORK/plain.zst" "$WORK/out.zst" || { log_fail "$TEST_NAME — stdin output differs [-T $threads]"; exit 1; }
+        SIZE=$(wc -c < "$WORK/out.zst")
+        FRAMES=$(read_le32 "$WORK/out.zst" $(( SIZE - 9 )))
+        grep -q "^# $FRAMES frames verified$" "$WORK/err.txt" || {
+            log_fail "$TEST_NAME — expected '# $FRAMES frames verified' [-T $threads]"
+            exit 1
+        }
+    done
+    assert_exit 0  "$T2SZ" -r -s 64k --verify --stats "$WORK/stats.json" -o "$WORK/out.zst" -f "$WORK/input.txt"
+    grep -q '"verify": [0-9.]*[1-9]' "$WORK/stats.json" || { log_fail "$TEST_NAME — no verify time in --stats"; exit 1; }
+
+    head -c 3000 "$WORK/input.txt" > "$WORK/extra.txt"
+    (cd "$WORK" && COPYFILE_DISABLE=1 tar cf "$WORK/extra.tar" extra.txt)
+    assert_exit 0  "$T2SZ" -s 8k -i -o "$WORK/out.tar.zst" -f "$WORK/archive.tar"
+    assert_exit 0  "$T2SZ" --verify -a "$WORK/out.tar.zst" "$WORK/extra.tar"
+    assert_exit 0  "$T2SZ" -t "$WORK/out.tar.zst"
+
+    assert_exit 1  "$T2SZ" --verify -x extra.txt "$WORK/out.tar.zst"
+    assert_exit 1  "$T2SZ" --verify -t "$WORK/out.tar.zst"
+    assert_exit 1  "$T2SZ" --verify --plan "$WORK/archive.tar"
+    log_pass "$TEST_NAME"
+    ;;
+
+extension_headers)
+    # PAX ('x', 'g') and GNU long-name ('L') headers share the frame of the
+    # member they describe: the frames holding members are exactly as many
+    # as the real members and the stdin path cuts the same frames as the
+    # mmap path; with and without -s, long names still round-trip and
+    # resolve with -x.
+    LONG=$(printf 'd%.0s' $(seq 1 120))
+    mkdir -p "$WORK/content/$LONG"
+    for i in $(seq 1 20); do
+        printf 'deep %d\n' "$i" > "$WORK/content/$LONG/file_$i.txt"
+        printf 'short %d\n' "$i" > "$WORK/content/short_$i.txt"
+    done
+    (cd "$WORK/content" && tar --format=gnu -cf "$WORK/gnu.tar" . &&
+        tar --format=pax --pax-option=comment=t2sz -cf "$WORK/pax.tar" .) || {
+        log_skip "$TEST_NAME — tar without --format=gnu/pax"
+        exit 0
+    }
+    for f in gnu pax; do
+        MEMBERS=$(tar tf "$WORK/$f.tar" | wc -l | tr -d ' ')
+        N=$("$T2SZ" --plan "$WORK/$f.tar" | awk '!/^#/ && $5 > 0' | wc -l | tr -d ' ')
+        if [ "$N" -ne "$MEMBERS" ]; then
+            log_fail "$TEST_NAME — $f.tar: $N frames with members, expected $MEMBERS"
+            exit 1
+        fi
+        for flags in "" "-s 2k"; do
+            # shellcheck disable=SC2086
+            assert_exit 0  "$T2SZ" $flags -i -o "$WORK/mmap.zst" -f "$WORK/$f.tar"
+            # shellcheck disable=SC2086
+            assert_exit 0  "$T2SZ" $flags -i -o "$WORK/stdin.zst" -f - < <(cat "$WORK/$f.tar")
+            [ -n "$flags" ] || [ "$(seek_table_dsizes "$WORK/mmap.zst")" = "$(seek_table_dsizes "$WORK/stdin.zst")" ] || {
+                log_fail "$TEST_NAME — $f.tar: stdin and mmap frames differ"
+                exit 1
+            }
+            zstd -d -q -c "$WORK/stdin.zst" | cmp -s - "$WORK/$f.tar" || {
+                log_fail "$TEST_NAME — $f.tar does not round-trip [$flags]"
+                exit 1
+            }
+            "$T2SZ" -x "$LONG/file_7.txt" "$WORK/stdin.zst" | cmp -s - "$WORK/content/$LONG/file_7.txt" || {
+                log_fail "$TEST_NAME — -x of a long name fails on $f.tar [$flags]"
+                exit 1
+            }
+        done
+        log_step "$f.tar: $MEMBERS members in $N frames"
+    done
+    log_pass "$TEST_NAME"
+    ;;
+
+large_sparse_members)
+    # Base-256 sizes (GNU tar writes them from 8 GiB on; here a small one is
+    # recoded by hand) and old GNU sparse members with sparse map extension
+    # blocks are sized right: the archive round-trips on the mmap and stdin
+    # paths, members after them resolve with -x, with and without -i, and
+    # appending finds the end of the archive.
+    mkdir -p "$WORK/content"
+    head -c 3000 /dev/urandom > "$WORK/content/b256.bin"
+    printf 'after\n' > "$WORK/content/z_after.txt"
+    (cd "$WORK/content" && tar --format=gnu -cf "$WORK/b256.tar" b256.bin z_after.txt) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    # size 3000 = 0x0BB8 in base-256, then the checksum of the new header
+    printf '\x80\0\0\0\0\0\0\0\0\0\x0b\xb8' | dd of="$WORK/b256.tar" bs=1 seek=124 conv=notrunc 2>/dev/null
+    printf '        ' | dd of="$WORK/b256.tar" bs=1 seek=148 conv=notrunc 2>/dev/null
+    SUM=$(od -An -tu1 -v -N 512 "$WORK/b256.tar" | tr -s ' ' '\n' | awk '{ s += $1 } END { print s }')
+    printf '%06o\0 ' "$SUM" | dd of="$WORK/b256.tar" bs=1 seek=148 conv=notrunc 2>/dev/null
+    tar tf "$WORK/b256.tar" > /dev/null || { log_fail "$TEST_NAME — tar rejects the base-256 header"; exit 1; }
+
+    # 10 data extents: 4 in the header, 6 in an extension block
+    for i in $(seq 0 9); do
+        head -c 4096 /dev/urandom | dd of="$WORK/content/sparse.img" bs=4096 seek=$(( i * 64 )) conv=notrunc 2>/dev/null
+    done
+    truncate -s 3M "$WORK/content/sparse.img" 2>/dev/null || dd if=/dev/null of="$WORK/content/sparse.img" bs=1 seek=3145728 2>/dev/null
+    (cd "$WORK/content" && tar --format=gnu -S -cf "$WORK/sparse.tar" sparse.img z_after.txt) || {
+        log_skip "$TEST_NAME — tar without --sparse"
+        exit 0
+    }
+
+    for f in b256 sparse; do
+        for flags in "" "-i"; do
+            # shellcheck disable=SC2086
+            assert_exit 0  "$T2SZ" $flags -o "$WORK/mmap.zst" -f "$WORK/$f.tar"
+            # shellcheck disable=SC2086
+            assert_exit 0  "$T2SZ" $flags -o "$WORK/stdin.zst" -f - < <(cat "$WORK/$f.tar")
+            for out in mmap stdin; do
+                zstd -d -q -c "$WORK/$out.zst" | cmp -s - "$WORK/$f.tar" || {
+                    log_fail "$TEST_NAME — $f.tar does not round-trip [$out $flags]"
+                    exit 1
+                }
+                "$T2SZ" -x z_after.txt "$WORK/$out.zst" | cmp -s - "$WORK/content/z_after.txt" || {
+                    log_fail "$TEST_NAME — -x z_after.txt fails on $f.tar [$out $flags]"
+                    exit 1
+                }
+            done
+            if [ "$f" = b256 ]; then
+                "$T2SZ" -x b256.bin "$WORK/stdin.zst" | cmp -s - "$WORK/content/b256.bin" || {
+                    log_fail "$TEST_NAME — -x b256.bin differs from the original [$flags]"
+                    exit 1
+                }
+            else
+                assert_exit 1  "$T2SZ" -x sparse.img "$WORK/stdin.zst"
+            fi
+        done
+        N=$(seek_table_dsizes "$WORK/mmap.zst" | wc -l | tr -d ' ')
+        (cd "$WORK/content" && tar --format=gnu -cf "$WORK/extra.tar" z_after.txt)
+        assert_exit 0  "$T2SZ" -a "$WORK/mmap.zst" "$WORK/extra.tar"
+        "$T2SZ" -x z_after.txt "$WORK/mmap.zst" > /dev/null || { log_fail "$TEST_NAME — append to $f.tar broke it"; exit 1; }
+        log_step "$f.tar: $N frames, round-trips, members after it resolve"
+    done
+    log_pass "$TEST_NAME"
+    ;;
+
+input_window)
+    # --input-window drops the input behind the compressor: the output is
+    # the same as without it on the mmap and stdin paths, serial and pooled,
+    # with -D -i and --verify; on Linux the peak RSS stays well below the
+    # input size; -x, -t and --plan reject it.
+    # 36 MB of text, as four copies: od alone would take seconds.
+    head -c 3000000 /dev/urandom | od -An -tx1 > "$WORK/part.txt"
+    cat "$WORK/part.txt" "$WORK/part.txt" "$WORK/part.txt" "$WORK/part.txt" > "$WORK/input.txt"
+    assert_exit 0  "$T2SZ" -r -s 1M -l 1 --stats "$WORK/plain.json" -o "$WORK/plain.zst" -f "$WORK/input.txt"
+    assert_exit 0  "$T2SZ" -r -s 1M -l 1 --input-window 4M --stats "$WORK/window.json" -o "$WORK/out.zst" -f "$WORK/input.txt"
+    cmp -s "$WORK/plain.zst" "$WORK/out.zst" || { log_fail "$TEST_NAME — raw output differs"; exit 1; }
+    if [ "$(uname -s)" = Linux ]; then
+        SIZE=$(wc -c < "$WORK/input.txt")
+        PLAIN=$(sed -n 's/.*"peak_rss_bytes": \([0-9]*\).*/\1/p' "$WORK/plain.json")
+        WINDOW=$(sed -n 's/.*"peak_rss_bytes": \([0-9]*\).*/\1/p' "$WORK/window.json")
+        if [ "$PLAIN" -lt "$SIZE" ] || [ "$WINDOW" -gt $(( SIZE / 2 )) ]; then
+            log_fail "$TEST_NAME — peak RSS $WINDOW with a 4M window, $PLAIN without, for $SIZE bytes of input"
+            exit 1
+        fi
+        log_step "peak RSS $(( PLAIN >> 20 )) MiB -> $(( WINDOW >> 20 )) MiB"
+    fi
+
+    mkdir -p "$WORK/content"
+    for i in $(seq 1 100); do
+        head -c $(( i * 500 )) "$WORK/input.txt" > "$WORK/content/file_$i.txt"
+    done
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    for flags in "" "-s 64k -T 3" "-D 4k -i" "-s 64k --verify -T 2"; do
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/plain.zst" -f "$WORK/archive.tar"
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags --input-window 64k -o "$WORK/out.zst" -f "$WORK/archive.tar"
+        cmp -s "$WORK/plain.zst" "$WORK/out.zst" || { log_fail "$TEST_NAME — tar output differs [$flags]"; exit 1; }
+        case "$flags" in -D*) continue ;; esac  # -D needs a seekable input
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags --input-window 64k -o "$WORK/stdin.zst" -f - < "$WORK/archive.tar"
+        zstd -d -q -c "$WORK/stdin.zst" | cmp -s - "$WORK/archive.tar" || {
+            log_fail "$TEST_NAME — stdin output does not round-trip [$flags]"
+            exit 1
+        }
+    done
+
+    assert_exit 1  "$T2SZ" --input-window 4M -x file_1.txt "$WORK/out.zst"
+    assert_exit 1  "$T2SZ" --input-window 4M -t "$WORK/out.zst"
+    assert_exit 1  "$T2SZ" --input-window 4M --plan "$WORK/archive.tar"
+    assert_exit 1  "$T2SZ" --input-window 0 -o "$WORK/out.zst" -f "$WORK/archive.tar"
+    log_pass "$TEST_NAME"
+    ;;
+
+input_engine)
+    # --input-engine pread and pread-direct stream the file through the
+    # readahead thread: the output is the same as reading it from stdin, in
+    # raw and tar mode, serial and pooled, with --verify and --input-window;
+    # a FIFO falls back to the stdin path; where direct I/O is unsupported
+    # (tmpfs) a warning is printed and the file is read buffered; features
+    # needing a seekable input and invalid engines are rejected.
+    # 18 MB of text, more than the 16 MiB of readahead buffers, as four
+    # copies: od alone would take seconds.
+    head -c 1500000 /dev/urandom | od -An -tx1 > "$WORK/part.txt"
+    cat "$WORK/part.txt" "$WORK/part.txt" "$WORK/part.txt" "$WORK/part.txt" > "$WORK/input.txt"
+    mkdir -p "$WORK/content"
+    for i in $(seq 1 100); do
+        head -c $(( i * 500 )) "$WORK/input.txt" > "$WORK/content/file_$i.txt"
+    done
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    # Both engines share the reader, pread-direct is only run on two sets.
+    for flags in "-r -s 1M -l 1" "-r -s 256k -l 1 -T 3" "-s 64k -T 3" "-s 64k --verify -T 2" "-s 64k --input-window 1M"; do
+        case "$flags" in -r*) IN="$WORK/input.txt" ;; *) IN="$WORK/archive.tar" ;; esac
+        case "$flags" in *-T\ 3) ENGINES="pread pread-direct" ;; *) ENGINES="pread" ;; esac
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/stdin.zst" -f - < <(cat "$IN")
+        for engine in $ENGINES; do
+            # shellcheck disable=SC2086
+            assert_exit 0  "$T2SZ" $flags --input-engine $engine -o "$WORK/out.zst" -f "$IN"
+            cmp -s "$WORK/stdin.zst" "$WORK/out.zst" || { log_fail "$TEST_NAME — $engine output differs [$flags]"; exit 1; }
+        done
+        zstd -d -q -c "$WORK/out.zst" | cmp -s - "$IN" || { log_fail "$TEST_NAME — no round-trip [$flags]"; exit 1; }
+    done
+
+    assert_exit 0  "$T2SZ" --input-engine pread --stats "$WORK/stats.json" -o "$WORK/out.zst" -f "$WORK/archive.tar"
+    grep -q '"source": "pread"' "$WORK/stats.json" || { log_fail "$TEST_NAME — stats source is not pread"; exit 1; }
+
+    if command -v mkfifo > /dev/null 2>&1 && mkfifo "$WORK/fifo" 2>/dev/null; then
+        cat "$WORK/archive.tar" > "$WORK/fifo" &
+        assert_exit 0  "$T2SZ" --input-engine pread -o "$WORK/out.zst" -f "$WORK/fifo"
+        wait
+        zstd -d -q -c "$WORK/out.zst" | cmp -s - "$WORK/archive.tar" || { log_fail "$TEST_NAME — FIFO output does not round-trip"; exit 1; }
+    fi
+
+    if [ -d /dev/shm ] && [ -w /dev/shm ]; then
+        SHM="/dev/shm/t2sz_${TEST_NAME}_$$.tar"
+        cp "$WORK/archive.tar" "$SHM"
+        "$T2SZ" --input-engine pread-direct -o "$WORK/out.zst" -f "$SHM" 2> "$WORK/err.txt"
+        STATUS=$?
+        rm -f "$SHM"
+        [ "$STATUS" -eq 0 ] || { log_fail "$TEST_NAME — pread-direct on /dev/shm exited $STATUS"; exit 1; }
+        zstd -d -q -c "$WORK/out.zst" | cmp -s - "$WORK/archive.tar" || { log_fail "$TEST_NAME — /dev/shm output does not round-trip"; exit 1; }
+        grep -q 'direct I/O' "$WORK/err.txt" && log_step "direct I/O unsupported on /dev/shm, fell back to pread"
+    fi
+
+    assert_exit 1  "$T2SZ" --input-engine pread -D 4k -o "$WORK/out.zst" -f "$WORK/archive.tar"
+    assert_exit 1  "$T2SZ" --input-engine pread --checkpoint 0 -o "$WORK/out.zst" -f "$WORK/archive.tar"
+    assert_exit 1  "$T2SZ" --input-engine pread --auto-block read=1M -o "$WORK/out.zst" -f "$WORK/archive.tar"
+    assert_exit 1  "$T2SZ" --input-engine pread --plan "$WORK/archive.tar"
+    assert_exit 1  "$T2SZ" --input-engine pread -t "$WORK/stdin.zst"
+    assert_exit 1  "$T2SZ" --input-engine mmap2 -o "$WORK/out.zst" -f "$WORK/archive.tar"
+    assert_exit 1  "$T2SZ" --input-engine pread -o "$WORK/out.zst" -f "$WORK/missing.tar"
+    log_pass "$TEST_NAME"
+    ;;
+
+stdin_regular_file)
+    # A regular file redirected to stdin is mapped: the archive is identical
+    # to the one made from the file name, raw and tar, serial and pooled,
+    # and --stats reports the mmap source; -D, --plan, -x, -t and
+    # --auto-block accept it. A pipe, and a file already read from (stdin
+    # not at offset 0), are still streamed.
+    head -c 3000000 /dev/urandom | od -An -tx1 > "$WORK/input.txt"
+    mkdir -p "$WORK/content"
+    for i in $(seq 1 100); do
+        head -c $(( i * 700 )) "$WORK/input.txt" > "$WORK/content/file_$i.txt"
+    done
+    (cd "$WORK/content" && COPYFILE_DISABLE=1 tar cf "$WORK/archive.tar" .) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    cp "$WORK/input.txt" "$WORK/input.bin"
+    for flags in "-r -s 256k" "-r -s 256k -T 3" "" "-s 64k -T 3" "-D 4k -i"; do
+        case "$flags" in -r*) IN="$WORK/input.bin" ;; *) IN="$WORK/archive.tar" ;; esac
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/file.zst" -f "$IN"
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/stdin.zst" -f - < "$IN"
+        cmp -s "$WORK/file.zst" "$WORK/stdin.zst" || { log_fail "$TEST_NAME — output differs [$flags]"; exit 1; }
+    done
+
+    assert_exit 0  "$T2SZ" --stats "$WORK/stats.json" -o "$WORK/stdin.zst" -f - < "$WORK/archive.tar"
+    grep -q '"source": "mmap"' "$WORK/stats.json" || { log_fail "$TEST_NAME — stats source is not mmap"; exit 1; }
+    assert_exit 0  "$T2SZ" --plan - < "$WORK/archive.tar"
+    assert_exit 0  "$T2SZ" -r --auto-block read=64k -o "$WORK/auto.zst" -f - < "$WORK/input.bin"
+    assert_exit 0  "$T2SZ" -t - < "$WORK/stdin.zst"
+    "$T2SZ" -x ./file_7.txt - < "$WORK/stdin.zst" > "$WORK/file_7.txt" || { log_fail "$TEST_NAME — -x failed"; exit 1; }
+    cmp -s "$WORK/file_7.txt" "$WORK/content/file_7.txt" || { log_fail "$TEST_NAME — -x output differs"; exit 1; }
+
+    assert_exit 1  "$T2SZ" --plan - < <(cat "$WORK/archive.tar")
+    assert_exit 0  "$T2SZ" --stats "$WORK/stats.json" -o "$WORK/pipe.zst" -f - < <(cat "$WORK/archive.tar")
+    grep -q '"source": "stdin"' "$WORK/stats.json" || { log_fail "$TEST_NAME — piped stats source is not stdin"; exit 1; }
+
+    # dd reads exactly 1000 bytes, leaving stdin at that offset.
+    RC=0
+    (dd bs=1000 count=1 of=/dev/null 2>/dev/null && "$T2SZ" -r -o "$WORK/tail.zst" -f -) < "$WORK/input.bin" || RC=$?
+    assert_rc 0
+    tail -c +1001 "$WORK/input.bin" > "$WORK/tail.bin"
+    zstd -d -q -c "$WORK/tail.zst" | cmp -s - "$WORK/tail.bin" || { log_fail "$TEST_NAME — offset stdin does not round-trip"; exit 1; }
+    log_pass "$TEST_NAME"
+    ;;
+
+pax_digits)
+    # PAX ('x') payloads are not NUL-terminated: one that ends in digits
+    # ("1234567", then a whole archive ending in a payload of digits, with
+    # nothing mapped after it) is parsed within its size on the mmap and
+    # stdin paths, with -i, and the member after it keeps its own name.
+    mkdir -p "$WORK/content"
+    printf '1234567' > "$WORK/content/pax.txt"
+    printf 'after\n' > "$WORK/content/z_after.txt"
+    head -c 3584 /dev/zero | tr '\0' '1' > "$WORK/content/digits.txt"
+    (cd "$WORK/content" && tar --format=ustar -cf "$WORK/short.tar" pax.txt z_after.txt &&
+        tar --format=ustar -cf "$WORK/end.tar" digits.txt) || {
+        log_fail "$TEST_NAME — tar creation failed"
+        exit 1
+    }
+    for f in short end; do
+        # typeflag 'x', then the checksum of the new header
+        printf 'x' | dd of="$WORK/$f.tar" bs=1 seek=156 conv=notrunc 2>/dev/null
+        printf '        ' | dd of="$WORK/$f.tar" bs=1 seek=148 conv=notrunc 2>/dev/null
+        SUM=$(od -An -tu1 -v -N 512 "$WORK/$f.tar" | tr -s ' ' '\n' | awk '{ s += $1 } END { print s }')
+        printf '%06o\0 ' "$SUM" | dd of="$WORK/$f.tar" bs=1 seek=148 conv=notrunc 2>/dev/null
+    done
+    head -c 4096 "$WORK/end.tar" > "$WORK/end4k.tar"
+
+    for flags in "" "-i"; do
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/mmap.zst" -f "$WORK/short.tar"
+        # shellcheck disable=SC2086
+        assert_exit 0  "$T2SZ" $flags -o "$WORK/stdin.zst" -f - < <(cat "$WORK/short.tar")
+        for out in mmap stdin; do
+            zstd -d -q -c "$WORK/$out.zst" | cmp -s - "$WORK/short.tar" || {
+                log_fail "$TEST_NAME — short.tar does not round-trip [$out $flags]"
+                exit 1
+            }
+            "$T2SZ" -x z_after.txt "$WORK/$out.zst" | cmp -s - "$WORK/content/z_after.txt" || {
+                log_fail "$TEST_NAME — -x z_after.txt fails [$out $flags]"
+                exit 1
+            }
+        done
+        # The archive ends in the payload: any clean exit, no crash.
+        for src in mmap stdin; do
+            RC=0
+            if [ "$src" = mmap ]; then
+                # shellcheck disable=SC2086
+                "$T2SZ" $flags -o "$WORK/end.zst" -f "$WORK/end4k.tar" 2>/dev/null || RC=$?
+            else
+                # shellcheck disable=SC2086
+                "$T2SZ" $flags -o "$WORK/end.zst" -f - < <(cat "$WORK/end4k.tar") 2>/dev/null || RC=$?
+            fi
+            [ "$RC" -le 1 ] || { log_fail "$TEST_NAME — exit $RC on an archive ending in digits [$src $flags]"; exit 1; }
+        done
+    done
+    log_pass "$TEST_NAME"
+    ;;
+
 *)
     log_fail "unknown test name '$TEST_NAME'"
     exit 1
@@ -0,0 +1,608 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * test_libt2sz.c — API test for libt2sz (src/t2sz.h)
+ *
+ * Usage: test_libt2sz
+ *
+ * Builds small tar archives in memory and drives the library through its
+ * callbacks only: buffer and stream compression (decompressed back and
+ * compared), extraction, appending, checkpoints, verification, statistics
+ * and progress counters, option validation, error codes for invalid input and failing
+ * sinks, warnings, reuse of one context across many archives, and contexts
+ * used on concurrent threads.
+ *
+ * Exit 0 on success, 1 on the first failed check.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+
+#include "t2sz.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "test_libt2sz:%d: check failed: %s\n", __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+/* ── Growable output buffer, used as the write callback ───────────────────── */
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    size_t failAfter;   /* fail once this many bytes were accepted, 0 = never */
+} Sink;
+
+static int sinkWrite(void *opaque, const void *buf, size_t len) {
+    Sink *s = opaque;
+    if (s->failAfter && s->len + len > s->failAfter) {
+        return -1;
+    }
+    if (s->len + len > s->cap) {
+        s->cap = (s->len + len) * 2;
+        s->data = realloc(s->data, s->cap);
+        CHECK(s->data != NULL);
+    }
+    memcpy(s->data + s->len, buf, len);
+    s->len += len;
+    return 0;
+}
+
+/* ── Read callback over a memory buffer, with short reads ─────────────────── */
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    size_t chunk;       /* maximum bytes returned per call */
+} Source;
+
+static ptrdiff_t sourceRead(void *opaque, void *buf, size_t len) {
+    Source *s = opaque;
+    size_t n = s->len - s->pos;
+    if (n > len) n = len;
+    if (n > s->chunk) n = s->chunk;
+    memcpy(buf, s->data + s->pos, n);
+    s->pos += n;
+    return (ptrdiff_t)n;
+}
+
+/* Write callback that changes a byte of the input once the first output
+ * is written, like a file modified while it is being compressed */
+typedef struct {
+    Sink out;
+    uint8_t *input;
+} ChangingSink;
+
+static int sinkChangeInput(void *opaque, const void *buf, size_t len) {
+    ChangingSink *s = opaque;
+    if (s->out.len == 0) {
+        s->input[0] ^= 0x01;
+    }
+    return sinkWrite(&s->out, buf, len);
+}
+
+/* Release callback checking that each pass over the input hands it back
+ * in consecutive ranges, and counting the passes that reached the end */
+typedef struct {
+    uint64_t size;      /* input size */
+    uint64_t next;      /* offset the next range must start at */
+    unsigned passes;
+    bool ok;
+} Released;
+
+static void countRelease(void *opaque, uint64_t offset, uint64_t size) {
+    Released *r = opaque;
+    if (offset != r->next || size == 0 || offset + size > r->size) r->ok = false;
+    r->next = offset + size;
+    if (r->next == r->size) {
+        r->passes++;
+        r->next = 0;
+    }
+}
+
+/* Checkpoint callback keeping the last state */
+static int keepState(void *opaque, const void *state, size_t len) {
+    Sink *s = opaque;
+    s->len = 0;
+    return sinkWrite(s, state, len);
+}
+
+/* ── In-memory tar writer ─────────────────────────────────────────────────── */
+
+static uint64_t rngState = 0x9E3779B97F4A7C15ull;
+
+static uint8_t nextByte(void) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return (uint8_t)(rngState % 16); /* compressible */
+}
+
+/* Append a regular file member of @p size bytes named "file<i>.bin". */
+static void tarAdd(Sink *tar, const unsigned i, const size_t size) {
+    uint8_t h[512] = {0};
+    snprintf((char *)h, 100, "file%u.bin", i);
+    snprintf((char *)h + 100, 8, "0000644");
+    snprintf((char *)h + 108, 8, "0000000");
+    snprintf((char *)h + 116, 8, "0000000");
+    snprintf((char *)h + 124, 12, "%011zo", size);
+    snprintf((char *)h + 136, 12, "%011o", 0);
+    memset(h + 148, ' ', 8);
+    h[156] = '0';
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    unsigned sum = 0;
+    for (int k = 0; k < 512; k++) sum += h[k];
+    snprintf((char *)h + 148, 8, "%06o", sum);
+    sinkWrite(tar, h, sizeof(h));
+
+    uint8_t block[512];
+    for (size_t done = 0; done < size; done += 512) {
+        memset(block, 0, sizeof(block));
+        const size_t n = size - done < 512 ? size - done : 512;
+        for (size_t k = 0; k < n; k++) block[k] = nextByte();
+        sinkWrite(tar, block, sizeof(block));
+    }
+}
+
+static Sink makeTar(const unsigned members) {
+    Sink tar = {0};
+    for (unsigned i = 0; i < members; i++) {
+        tarAdd(&tar, i, 1000 + i * 3000);
+    }
+    const uint8_t zero[1024] = {0};
+    sinkWrite(&tar, zero, sizeof(zero));
+    return tar;
+}
+
+/* Decompress every frame of @p z (skippable ones are ignored) and compare. */
+static void checkRoundTrip(const Sink *z, const Sink *expected) {
+    uint8_t *out = malloc(expected->len + 1);
+    CHECK(out != NULL);
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    ZSTD_inBuffer in = { z->data, z->len, 0 };
+    ZSTD_outBuffer o = { out, expected->len + 1, 0 };
+    while (in.pos < in.size) {
+        const size_t ret = ZSTD_decompressStream(dctx, &o, &in);
+        CHECK(!ZSTD_isError(ret));
+    }
+    CHECK(o.pos == expected->len);
+    CHECK(memcmp(out, expected->data, expected->len) == 0);
+    ZSTD_freeDCtx(dctx);
+    free(out);
+}
+
+/* ── One context per thread, compressing with -i concurrently ─────────────── */
+
+typedef struct {
+    const Sink *tar;
+    const Sink *expected;   /* output of the same options on the main thread */
+} Concurrent;
+
+static void *concurrentCompress(void *arg) {
+    const Concurrent *c = arg;
+    T2szOptions opts;
+    t2szInitOptions(&opts);
+    opts.buildIndex = true;
+    T2szContext *ctx = t2szCreate();
+    CHECK(ctx != NULL);
+    CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+    Sink z = {0};
+    for (int i = 0; i < 200; i++) {
+        z.len = 0;
+        CHECK(t2szCompressBuffer(ctx, c->tar->data, c->tar->len, sinkWrite, &z) == T2SZ_OK);
+        CHECK(z.len == c->expected->len && memcmp(z.data, c->expected->data, z.len) == 0);
+    }
+    free(z.data);
+    t2szFree(ctx);
+    return NULL;
+}
+
+int main(void) {
+    const Sink tar = makeTar(12);
+    T2szOptions opts;
+    T2szContext *ctx = t2szCreate();
+    CHECK(ctx != NULL);
+
+    /* Option validation */
+    t2szInitOptions(&opts);
+    opts.level = 23;
+    CHECK(t2szSetOptions(ctx, &opts) == T2SZ_ERROR_PARAMETER);
+    CHECK(strlen(t2szErrorMessage(ctx)) > 0);
+    t2szInitOptions(&opts);
+    opts.rawMode = true;
+    opts.buildIndex = true;
+    CHECK(t2szSetOptions(ctx, &opts) == T2SZ_ERROR_PARAMETER);
+    t2szInitOptions(&opts);
+    opts.cdcAverage = 65536;
+    CHECK(t2szSetOptions(ctx, &opts) == T2SZ_ERROR_PARAMETER);  /* tar mode */
+    opts.rawMode = true;
+    opts.minBlockSize = 131072;
+    CHECK(t2szSetOptions(ctx, &opts) == T2SZ_ERROR_PARAMETER);  /* min > average */
+
+    /* Buffer and stream compression, serial and with the frame pool */
+    for (uint32_t workers = 0; workers <= 4; workers += 4) {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 8192;
+        opts.workers = workers;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        checkRoundTrip(&z, &tar);
+        z.len = 0;
+
+        Source src = { tar.data, tar.len, 0, 777 };
+        CHECK(t2szCompressStream(ctx, sourceRead, &src, sinkWrite, &z) == T2SZ_OK);
+        checkRoundTrip(&z, &tar);
+        free(z.data);
+    }
+
+    /* Invalid tar: a format error, and nothing reaches the sink */
+    {
+        t2szInitOptions(&opts);
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        uint8_t junk[4096];
+        memset(junk, 'x', sizeof(junk));
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, junk, sizeof(junk), sinkWrite, &z) == T2SZ_ERROR_FORMAT);
+        CHECK(z.len == 0);
+        Source src = { junk, sizeof(junk), 0, sizeof(junk) };
+        CHECK(t2szCompressStream(ctx, sourceRead, &src, sinkWrite, &z) == T2SZ_ERROR_FORMAT);
+        free(z.data);
+    }
+
+    /* A failing sink aborts the call, including with pool and reader threads */
+    for (uint32_t workers = 0; workers <= 4; workers += 2) {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 4096;
+        opts.workers = workers;
+        opts.level = 1;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = { .failAfter = 100 };
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_ERROR_WRITE);
+        Source src = { tar.data, tar.len, 0, 1000 };
+        z.len = 0;
+        CHECK(t2szCompressStream(ctx, sourceRead, &src, sinkWrite, &z) == T2SZ_ERROR_WRITE);
+        free(z.data);
+    }
+
+    /* Extraction, with and without the member index */
+    for (int index = 0; index <= 1; index++) {
+        t2szInitOptions(&opts);
+        opts.buildIndex = index;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+
+        Sink member = {0};
+        CHECK(t2szExtract(ctx, z.data, z.len, "file3.bin", sinkWrite, &member) == T2SZ_OK);
+        size_t offset = 512;
+        for (unsigned i = 0; i < 3; i++) {
+            offset += (1000 + i * 3000 + 511) / 512 * 512 + 512;
+        }
+        CHECK(member.len == 1000 + 3 * 3000);
+        CHECK(memcmp(member.data, tar.data + offset, member.len) == 0);
+        CHECK(t2szExtract(ctx, z.data, z.len, "missing.bin", sinkWrite, &member) == T2SZ_ERROR_NOT_FOUND);
+        CHECK(t2szExtract(ctx, tar.data, tar.len, "file3.bin", sinkWrite, &member) == T2SZ_ERROR_FORMAT);
+        free(member.data);
+        free(z.data);
+    }
+
+    /* Append: keep the head of the archive, write the rest after it */
+    for (int index = 0; index <= 1; index++) {
+        t2szInitOptions(&opts);
+        opts.buildIndex = index;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        uint64_t keep = 0;
+        CHECK(t2szAppendTo(ctx, z.data, z.len, &keep) == T2SZ_OK);
+        CHECK(keep > 0 && keep < z.len);
+        z.len = (size_t)keep;
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+
+        Sink twice = {0};
+        sinkWrite(&twice, tar.data, tar.len - 1024);
+        sinkWrite(&twice, tar.data, tar.len);
+        checkRoundTrip(&z, &twice);
+        Sink member = {0};
+        CHECK(t2szExtract(ctx, z.data, z.len, "file11.bin", sinkWrite, &member) == T2SZ_OK);
+        CHECK(member.len == 1000 + 11 * 3000);
+        CHECK(t2szAppendTo(ctx, tar.data, tar.len, &keep) == T2SZ_ERROR_FORMAT);
+        free(member.data);
+        free(twice.data);
+        free(z.data);
+    }
+
+    /* Checkpoint and resume: same output as an uninterrupted call */
+    for (uint32_t workers = 0; workers <= 4; workers += 4) {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 8192;
+        opts.workers = workers;
+        opts.buildIndex = true;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink full = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &full) == T2SZ_OK);
+
+        Sink state = {0};
+        opts.checkpointFn = keepState;
+        opts.checkpointOpaque = &state;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = { .failAfter = full.len / 2 };
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_ERROR_WRITE);
+        CHECK(state.len > 0);
+
+        uint64_t keep = 0;
+        CHECK(t2szResume(ctx, state.data, state.len, &keep) == T2SZ_OK);
+        CHECK(keep > 0 && keep <= z.len);
+        z.len = (size_t)keep;
+        z.failAfter = 0;
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        CHECK(z.len == full.len && memcmp(z.data, full.data, z.len) == 0);
+
+        /* Another input, a corrupted state, a stream input */
+        CHECK(t2szResume(ctx, state.data, state.len, &keep) == T2SZ_OK);
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len - 512, sinkWrite, &z) == T2SZ_ERROR_PARAMETER);
+        state.data[state.len / 2] ^= 1;
+        CHECK(t2szResume(ctx, state.data, state.len, &keep) == T2SZ_ERROR_FORMAT);
+        Source src = { tar.data, tar.len, 0, 777 };
+        CHECK(t2szCompressStream(ctx, sourceRead, &src, sinkWrite, &z) == T2SZ_ERROR_PARAMETER);
+        free(state.data);
+        free(full.data);
+        free(z.data);
+    }
+
+    /* A zstd-compressed input is decompressed and streamed */
+    for (uint32_t workers = 0; workers <= 4; workers += 4) {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 8192;
+        opts.workers = workers;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink expected = {0};
+        Source in = { tar.data, tar.len, 0, 777 };
+        CHECK(t2szCompressStream(ctx, sourceRead, &in, sinkWrite, &expected) == T2SZ_OK);
+        Sink plain = {0};
+        opts.minBlockSize = 0;
+        opts.level = 9;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &plain) == T2SZ_OK);
+
+        opts.minBlockSize = 8192;
+        opts.level = 3;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, plain.data, plain.len, sinkWrite, &z) == T2SZ_OK);
+        CHECK(z.len == expected.len && memcmp(z.data, expected.data, z.len) == 0);
+        z.len = 0;
+        Source src = { plain.data, plain.len, 0, 777 };
+        CHECK(t2szCompressStream(ctx, sourceRead, &src, sinkWrite, &z) == T2SZ_OK);
+        CHECK(z.len == expected.len && memcmp(z.data, expected.data, z.len) == 0);
+
+        /* Truncated, planned, or kept compressed */
+        CHECK(t2szCompressBuffer(ctx, plain.data, plain.len / 2, sinkWrite, &z) == T2SZ_ERROR_FORMAT);
+        const T2szFrame *frames;
+        size_t nbFrames;
+        uint64_t nbMembers;
+        CHECK(t2szPlan(ctx, plain.data, plain.len, &frames, &nbFrames, &nbMembers) == T2SZ_ERROR_PARAMETER);
+        opts.noDecompress = true;
+        opts.rawMode = true;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        z.len = 0;
+        CHECK(t2szCompressBuffer(ctx, plain.data, plain.len, sinkWrite, &z) == T2SZ_OK);
+        checkRoundTrip(&z, &plain);
+        free(expected.data);
+        free(plain.data);
+        free(z.data);
+    }
+
+    /* Statistics: one entry per data frame, covering the whole input */
+    for (uint32_t workers = 0; workers <= 4; workers += 4) {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 8192;
+        opts.workers = workers;
+        opts.collectStats = true;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        const T2szStats *stats = t2szGetStats(ctx);
+        CHECK(stats->nbFrames > 1 && stats->inputBytes == tar.len && stats->outputBytes == z.len);
+        uint64_t in = 0;
+        for (size_t i = 0; i < stats->nbFrames; i++)
+            in += stats->frames[i].inputSize;
+        CHECK(in == tar.len && stats->zstdMemory > 0 && stats->wallNs > 0);
+        opts.collectStats = false;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        z.len = 0;
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        CHECK(t2szGetStats(ctx)->nbFrames == 0);
+        free(z.data);
+    }
+
+    /* Progress counters: known total on buffers, resumed part excluded from the rate */
+    {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 8192;
+        opts.workers = 4;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        T2szProgress p;
+        t2szGetProgress(ctx, &p);
+        CHECK(p.inputBytes == tar.len && p.totalBytes == tar.len && p.outputBytes == z.len && p.resumedBytes == 0);
+        z.len = 0;
+        Source src = { tar.data, tar.len, 0, 777 };
+        CHECK(t2szCompressStream(ctx, sourceRead, &src, sinkWrite, &z) == T2SZ_OK);
+        t2szGetProgress(ctx, &p);
+        CHECK(p.inputBytes == tar.len && p.totalBytes == 0 && p.outputBytes == z.len);
+        free(z.data);
+    }
+
+    /* Automatic block sizes: bounded frames, rejected with -s and on streams */
+    {
+        t2szInitOptions(&opts);
+        opts.autoMaxRead = 20000;
+        opts.collectStats = true;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        checkRoundTrip(&z, &tar);
+        const T2szStats *stats = t2szGetStats(ctx);
+        CHECK(stats->minBlockSize > 0 && stats->maxBlockSize == 20000 && stats->autoSolidRatio > 0);
+        for (size_t i = 0; i < stats->nbFrames; i++)
+            CHECK(stats->frames[i].inputSize <= 20000);
+        Source src = { tar.data, tar.len, 0, 777 };
+        CHECK(t2szCompressStream(ctx, sourceRead, &src, sinkWrite, &z) == T2SZ_ERROR_PARAMETER);
+        opts.minBlockSize = 4096;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_ERROR_PARAMETER);
+        free(z.data);
+    }
+
+    /* Integrity test: every frame checked, on one thread or several */
+    for (uint32_t workers = 0; workers <= 4; workers += 4) {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 8192;
+        opts.workers = workers;
+        opts.collectStats = true;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        size_t nbFrames = t2szGetStats(ctx)->nbFrames;
+        uint64_t frameSize = t2szGetStats(ctx)->frames[0].outputSize;
+        T2szTestResult result;
+        CHECK(t2szTest(ctx, z.data, z.len, &result) == T2SZ_OK);
+        CHECK(result.dataFrames == nbFrames && result.noChecksumFrames == 0);
+        CHECK(result.compressedBytes == z.len && result.decompressedBytes == tar.len);
+        z.data[frameSize / 2] ^= 0x20;
+        CHECK(t2szTest(ctx, z.data, z.len, &result) == T2SZ_ERROR_FORMAT);
+        CHECK(t2szTest(ctx, tar.data, tar.len, &result) == T2SZ_ERROR_FORMAT);
+        free(z.data);
+    }
+
+    /* Verification: same output, and a change of the mapped input is caught */
+    for (uint32_t workers = 0; workers <= 4; workers += 4) {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 8192;
+        opts.workers = workers;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink expected = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &expected) == T2SZ_OK);
+        opts.verify = true;
+        opts.collectStats = true;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        CHECK(z.len == expected.len && memcmp(z.data, expected.data, z.len) == 0);
+        CHECK(t2szGetStats(ctx)->verifyNs > 0);
+        z.len = 0;
+        Source src = { tar.data, tar.len, 0, 777 };
+        CHECK(t2szCompressStream(ctx, sourceRead, &src, sinkWrite, &z) == T2SZ_OK);
+        checkRoundTrip(&z, &tar);
+
+        ChangingSink changing = { {0}, malloc(tar.len) };
+        CHECK(changing.input != NULL);
+        memcpy(changing.input, tar.data, tar.len);
+        CHECK(t2szCompressBuffer(ctx, changing.input, tar.len, sinkChangeInput, &changing) == T2SZ_ERROR_VERIFY);
+        CHECK(strstr(t2szErrorMessage(ctx), "frame 0 at offset 0") != NULL);
+        memcpy(changing.input, tar.data, tar.len);
+        changing.out.len = 0;
+        Source copied = { changing.input, tar.len, 0, 777 };
+        CHECK(t2szCompressStream(ctx, sourceRead, &copied, sinkChangeInput, &changing) == T2SZ_OK);
+        free(changing.input);
+        free(changing.out.data);
+        free(expected.data);
+        free(z.data);
+    }
+
+    /* Input window: same output, every pass releases the whole input in order */
+    for (uint32_t workers = 0; workers <= 4; workers += 4) {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 8192;
+        opts.dictCapacity = 4096;
+        opts.workers = workers;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink expected = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &expected) == T2SZ_OK);
+        Released released = { tar.len, 0, 0, true };
+        opts.inputWindow = 16384;
+        opts.releaseFn = countRelease;
+        opts.releaseOpaque = &released;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+        CHECK(z.len == expected.len && memcmp(z.data, expected.data, z.len) == 0);
+        CHECK(released.ok && released.passes == 3);  /* planning, dictionary, compression */
+        free(expected.data);
+        free(z.data);
+    }
+
+    /* One context, many archives: results stay identical */
+    {
+        t2szInitOptions(&opts);
+        opts.minBlockSize = 16384;
+        opts.level = 1;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink first = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &first) == T2SZ_OK);
+        Sink z = {0};
+        for (int i = 0; i < 1000; i++) {
+            z.len = 0;
+            CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &z) == T2SZ_OK);
+            CHECK(z.len == first.len && memcmp(z.data, first.data, z.len) == 0);
+        }
+        free(first.data);
+        free(z.data);
+    }
+
+    /* Warnings: raised instead of printed, cleared by the next call */
+    {
+        t2szInitOptions(&opts);
+        opts.rawMode = true;
+        opts.minBlockSize = 512;
+        opts.dictCapacity = 4096;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink z = {0};
+        CHECK(t2szCompressBuffer(ctx, tar.data, 2048, sinkWrite, &z) == T2SZ_OK);
+        CHECK(t2szGetWarnings(ctx) == T2SZ_WARNING_DICTIONARY);
+        CHECK(strstr(t2szWarningMessage(ctx, T2SZ_WARNING_DICTIONARY), "dictionary") != NULL);
+        CHECK(t2szWarningMessage(ctx, T2SZ_WARNING_INDEX)[0] == '\0');
+        opts.dictCapacity = 0;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        z.len = 0;
+        CHECK(t2szCompressBuffer(ctx, tar.data, 2048, sinkWrite, &z) == T2SZ_OK);
+        CHECK(t2szGetWarnings(ctx) == 0);
+        CHECK(t2szWarningMessage(ctx, T2SZ_WARNING_DICTIONARY)[0] == '\0');
+        free(z.data);
+    }
+
+    /* Concurrent contexts: each index is sorted against its own names */
+    {
+        const Sink other = makeTar(40);
+        t2szInitOptions(&opts);
+        opts.buildIndex = true;
+        CHECK(t2szSetOptions(ctx, &opts) == T2SZ_OK);
+        Sink expected[2] = {{0}, {0}};
+        CHECK(t2szCompressBuffer(ctx, tar.data, tar.len, sinkWrite, &expected[0]) == T2SZ_OK);
+        CHECK(t2szCompressBuffer(ctx, other.data, other.len, sinkWrite, &expected[1]) == T2SZ_OK);
+        Concurrent c[2] = {{&tar, &expected[0]}, {&other, &expected[1]}};
+        pthread_t threads[2];
+        for (int i = 0; i < 2; i++) CHECK(pthread_create(&threads[i], NULL, concurrentCompress, &c[i]) == 0);
+        for (int i = 0; i < 2; i++) pthread_join(threads[i], NULL);
+        free(expected[0].data);
+        free(expected[1].data);
+        free(other.data);
+    }
+
+    t2szFree(ctx);
+    free(tar.data);
+    printf("test_libt2sz: OK\n");
+    return 0;
+}
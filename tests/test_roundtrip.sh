@@ -303,7 +303,7 @@ test_stdin() {
     raw_to_file)
         # Pipe the blob through stdin; t2sz writes the compressed output to a file.
         log_step "Compressing stdin to file (raw mode)"
-        "$T2SZ" -r -o "$compressed" -f "$@" - < "$input" \
+        cat "$input" | "$T2SZ" -r -o "$compressed" -f "$@" - \
             || die "t2sz stdin->file failed"
         zstd -d -f -q "$compressed" -o "$decompressed" || die "zstd decomp failed"
         local sha_after
@@ -321,7 +321,7 @@ test_stdin() {
         (cd "$WORK" && cp input.bin blob.bin && COPYFILE_DISABLE=1 tar cf archive.tar blob.bin) \
             || die "tar creation failed"
         log_step "Compressing tar from stdin to file"
-        "$T2SZ" -o "$compressed" -f "$@" - < "$WORK/archive.tar" \
+        cat "$WORK/archive.tar" | "$T2SZ" -o "$compressed" -f "$@" - \
             || die "t2sz stdin-tar->file failed"
         zstd -d -f -q "$compressed" -o "$WORK/dec.tar" || die "zstd decomp failed"
         mkdir -p "$WORK/extracted"
@@ -339,7 +339,7 @@ test_stdin() {
     raw_to_stdout)
         # Pipe the blob through stdin; no -o so t2sz defaults output to stdout.
         log_step "Compressing stdin to stdout (raw mode, no -o)"
-        "$T2SZ" -r "$@" - < "$input" > "$compressed" \
+        cat "$input" | "$T2SZ" -r "$@" - > "$compressed" \
             || die "t2sz stdin->stdout failed"
         zstd -d -f -q "$compressed" -o "$decompressed" || die "zstd decomp failed"
         local sha_after
@@ -368,7 +368,7 @@ test_stdin() {
         (cd "$WORK" && COPYFILE_DISABLE=1 tar cf archive.tar "${blob_list[@]}") \
             || die "tar creation failed"
         log_step "Compressing multi-file tar from stdin to file"
-        "$T2SZ" -o "$compressed" -f "$@" - < "$WORK/archive.tar" \
+        cat "$WORK/archive.tar" | "$T2SZ" -o "$compressed" -f "$@" - \
             || die "t2sz stdin-tar-multi->file failed"
         zstd -d -f -q "$compressed" -o "$WORK/dec.tar" || die "zstd decomp failed"
         mkdir -p "$WORK/extracted"
@@ -395,7 +395,7 @@ test_stdin() {
         (cd "$WORK" && cp input.bin blob.bin && COPYFILE_DISABLE=1 tar cf archive.tar blob.bin) \
             || die "tar creation failed"
         log_step "Compressing tar from stdin to stdout"
-        "$T2SZ" "$@" - < "$WORK/archive.tar" > "$compressed" \
+        cat "$WORK/archive.tar" | "$T2SZ" "$@" - > "$compressed" \
             || die "t2sz stdin-tar->stdout failed"
         zstd -d -f -q "$compressed" -o "$WORK/dec.tar" || die "zstd decomp failed"
         mkdir -p "$WORK/extracted"